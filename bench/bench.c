@@ -0,0 +1,896 @@
+#define _GNU_SOURCE
+/*
+ * Benchmark suite for fileManager
+ * 
+ * Builds the trees, files and logs each scenario needs, starts a fresh
+ * "fileManager serve" for the scenario and sends it the commands over
+ * its socket, timing each one from request to exit status. Command
+ * output goes to /dev/null, so only the tool's own work is measured.
+ * 
+ * Every scenario prints one JSON object per line on standard output:
+ * 
+ *   {"scenario":"readFile","param":1048576,"writers":1,"ops":5,...}
+ * 
+ * param is the entry count for listDir and listFilesByExtension, the file
+ * size for readFile, the log size for showLogs and the number of commands
+ * otherwise. Times are microseconds; peak_rss_kb is the server's maximum
+ * resident set over the scenario.
+ * 
+ * Usage: bench [--binary path] [--dir path] [--scale small|full]
+ *              [--only scenario] [--repeat N] [--writers K] [--depth N]
+ *              [--keep] [-- fileManager options]
+ * 
+ * Options after "--" go to the server, such as --jobs 4 or --durability
+ * fdatasync, so runs with and without them can be compared.
+ */
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <signal.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Socket and configuration the server is started with, in the work directory
+#define BENCH_SOCKET "bench.sock"
+#define BENCH_CONFIG "fileManager.conf"
+
+// How long the server may take to start listening
+#define BENCH_START_TIMEOUT_MS 10000
+
+// Most requests a connection keeps in flight
+#define BENCH_MAX_DEPTH 64
+
+// Most concurrent writers
+#define BENCH_MAX_WRITERS 256
+
+// Largest framed request
+#define BENCH_REQUEST_SIZE 4096
+
+// Most server options after "--"
+#define BENCH_MAX_SERVER_ARGS 32
+
+// Bytes written at a time when generating files and logs
+#define BENCH_CHUNK_SIZE (1024 * 1024)
+
+// Sizes of one run; lists end with 0
+struct bench_scale {
+    const char *name;
+    long files;             // createFile, deleteFile
+    long dirs;              // createDir, deleteDir
+    long list_sizes[3];     // listDir, listFilesByExtension
+    long read_sizes[6];     // readFile
+    long appends;           // appendToFile, over all writers
+    long log_size;          // showLogs
+};
+
+static const struct bench_scale g_scales[] = {
+    { "small", 2000, 2000, { 10000, 0 },
+      { 1024, 1024L * 1024, 64L * 1024 * 1024, 0 }, 4000, 16L * 1024 * 1024 },
+    { "full", 100000, 100000, { 10000, 1000000, 0 },
+      { 1024, 1024L * 1024, 64L * 1024 * 1024, 1024L * 1024 * 1024, 4096L * 1024 * 1024, 0 },
+      100000, 1024L * 1024 * 1024 },
+};
+
+struct bench_options {
+    char binary[PATH_MAX];
+    const char *dir;
+    const struct bench_scale *scale;
+    const char *only;
+    long repeat;
+    long writers;
+    long depth;
+    int keep;
+    char *server_args[BENCH_MAX_SERVER_ARGS];
+    int server_arg_count;
+};
+
+// One kind of command a scenario sends
+struct bench_request {
+    const char *command;
+    const char *path;       // Path, prefix numbered per request, or NULL
+    int numbered;
+    const char *extra[3];   // More arguments, NULL-terminated
+};
+
+// Commands one connection sends, and where their results go
+struct bench_job {
+    const struct bench_request *request;
+    long first;             // Number of the first request
+    long count;
+    long depth;
+    long *latency_ns;       // count slots
+    long failed;
+    int error;
+};
+
+// Socket connection to the server
+struct bench_client {
+    int fd;
+    int passed[4];          // Output, errors, working directory and input of requests
+    char reply[256];
+    size_t reply_len;
+};
+
+static struct bench_options g_options;
+static int g_null_fd = -1;
+static int g_work_fd = -1;
+
+/**
+ * Get the time of the monotonic clock
+ * 
+ * @return Nanoseconds
+ */
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Write all of a buffer to a descriptor
+ * 
+ * @param fd Descriptor to write to
+ * @param data Bytes to write
+ * @param len Number of bytes
+ * @return 0 on success, -1 on failure
+ */
+static int write_all_fd(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * Report a failed call with its errno
+ * 
+ * @param what What was being done
+ * @param path Path it was done to
+ */
+static void report_error(const char *what, const char *path) {
+    char error_msg[PATH_MAX + 128];
+    int len = string_format(error_msg, sizeof(error_msg), 
+                      "bench: %s \"%s\": %s\n", what, path, strerror(errno));
+    err_write(error_msg, len);
+}
+
+/**
+ * Create a directory unless it is already there
+ * 
+ * @param path Directory to create
+ * @return 0 on success, -1 on failure
+ */
+static int make_directory(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        report_error("Could not create directory", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Create numbered empty files, prefix0 to prefix(count - 1), with a suffix
+ * Files that exist are left alone, so this only fills in what is missing.
+ * 
+ * @param dir Directory to create them in
+ * @param prefix Start of each name
+ * @param count Number of files
+ * @param mixed Alternate ".txt" and ".log" suffixes instead of none
+ * @return 0 on success, -1 on failure
+ */
+static int make_files(const char *dir, const char *prefix, long count, int mixed) {
+    if (make_directory(dir) == -1) {
+        return -1;
+    }
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        report_error("Could not open directory", dir);
+        return -1;
+    }
+    
+    for (long i = 0; i < count; i++) {
+        char name[NAME_MAX + 1];
+        string_format(name, sizeof(name), "%s%ld%s", prefix, i, 
+                      mixed ? ((i % 2) ? ".log" : ".txt") : "");
+        int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            report_error("Could not create file", name);
+            close(dir_fd);
+            return -1;
+        }
+        close(fd);
+    }
+    close(dir_fd);
+    return 0;
+}
+
+/**
+ * Create numbered empty directories, dir/prefix0 onwards
+ * 
+ * @param dir Directory to create them in
+ * @param prefix Start of each name
+ * @param count Number of directories
+ * @return 0 on success, -1 on failure
+ */
+static int make_directories(const char *dir, const char *prefix, long count) {
+    if (make_directory(dir) == -1) {
+        return -1;
+    }
+    for (long i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        string_format(path, sizeof(path), "%s/%s%ld", dir, prefix, i);
+        if (make_directory(path) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write a file of numbered text lines, unless one of that size exists
+ * 
+ * @param path File to write
+ * @param size Size in bytes
+ * @param log Write operation log entries instead of plain lines
+ * @return 0 on success, -1 on failure
+ */
+static int make_text_file(const char *path, long size, int log) {
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == size) {
+        return 0;
+    }
+    
+    char *chunk = malloc(BENCH_CHUNK_SIZE);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (!chunk || fd == -1) {
+        report_error("Could not create file", path);
+        free(chunk);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    
+    long written = 0;
+    long line = 0;
+    int result = 0;
+    while (written < size && result == 0) {
+        size_t len = 0;
+        while (len < BENCH_CHUNK_SIZE - 128) {
+            len += string_format(chunk + len, BENCH_CHUNK_SIZE - len, log ?
+                                 "[2026-01-01 00:00:00] File \"bench/file_%ld.txt\" created successfully.\n" :
+                                 "Line %ld of a generated benchmark file, padded to look like text.\n", 
+                                 line);
+            line++;
+        }
+        if ((long)len > size - written) {
+            len = size - written;
+        }
+        if (write_all_fd(fd, chunk, len) == -1) {
+            report_error("Could not write file", path);
+            result = -1;
+        }
+        written += len;
+    }
+    
+    close(fd);
+    free(chunk);
+    return result;
+}
+
+/**
+ * Connect to the server
+ * 
+ * @param client Client to set up
+ * @return 0 on success, -1 on failure
+ */
+static int client_connect(struct bench_client *client) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, BENCH_SOCKET, sizeof(BENCH_SOCKET));
+    
+    client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->fd == -1) {
+        return -1;
+    }
+    if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(client->fd);
+        client->fd = -1;
+        return -1;
+    }
+    client->passed[0] = g_null_fd;
+    client->passed[1] = g_null_fd;
+    client->passed[2] = g_work_fd;
+    client->passed[3] = g_null_fd;
+    client->reply_len = 0;
+    return 0;
+}
+
+/**
+ * Send one command as a framed request, with the descriptors to use
+ * 
+ * @param client Connected client
+ * @param args Arguments of the command
+ * @param count Number of arguments
+ * @return 0 on success, -1 on failure
+ */
+static int client_send(struct bench_client *client, char *const args[], int count) {
+    char request[BENCH_REQUEST_SIZE];
+    size_t request_len = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(args[i]) + 1;
+        if (request_len + len > sizeof(request) - 32) {
+            return -1;
+        }
+        memcpy(request + request_len, args[i], len);
+        request_len += len;
+    }
+    
+    char header[32];
+    int header_len = string_format(header, sizeof(header), ":%ld\n", (long)request_len);
+    struct iovec iov[2] = { { header, header_len }, { request, request_len } };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(client->passed))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(client->passed));
+    memcpy(CMSG_DATA(cmsg), client->passed, sizeof(client->passed));
+    
+    ssize_t sent;
+    do {
+        sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    if (sent == -1) {
+        return -1;
+    }
+    
+    // Requests are small; the rest of one cut short goes without descriptors
+    size_t total = header_len + request_len;
+    while ((size_t)sent < total) {
+        size_t offset = sent;
+        const char *rest = (offset < (size_t)header_len) ? header + offset : request + (offset - header_len);
+        size_t len = (offset < (size_t)header_len) ? header_len - offset : total - offset;
+        ssize_t more = send(client->fd, rest, len, MSG_NOSIGNAL);
+        if (more == -1 && errno != EINTR) {
+            return -1;
+        }
+        sent += (more > 0) ? more : 0;
+    }
+    return 0;
+}
+
+/**
+ * Wait for the exit status of the oldest request in flight
+ * 
+ * @param client Connected client
+ * @param status Receives the exit status
+ * @return 0 on success, -1 if the connection failed
+ */
+static int client_receive(struct bench_client *client, int *status) {
+    while (1) {
+        char *newline = memchr(client->reply, '\n', client->reply_len);
+        if (newline) {
+            *newline = '\0';
+            const char *text = strstr(client->reply, "] exit status ");
+            *status = (client->reply[0] == '[' && text) ? atoi(text + 14) : -1;
+            
+            size_t used = newline - client->reply + 1;
+            memmove(client->reply, newline + 1, client->reply_len - used);
+            client->reply_len -= used;
+            return (*status == -1) ? -1 : 0;
+        }
+        if (client->reply_len == sizeof(client->reply)) {
+            return -1;
+        }
+        
+        ssize_t received = recv(client->fd, client->reply + client->reply_len,
+                                sizeof(client->reply) - client->reply_len, 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        client->reply_len += received;
+    }
+}
+
+/**
+ * Build the arguments of one request
+ * 
+ * @param request Kind of command
+ * @param number Number of the request
+ * @param args Receives the arguments
+ * @param path Buffer for a numbered path
+ * @param size Size of the buffer
+ * @return Number of arguments
+ */
+static int build_request(const struct bench_request *request, long number, char *args[],
+                         char *path, size_t size) {
+    int count = 0;
+    args[count++] = (char *)request->command;
+    if (request->path && request->numbered) {
+        string_format(path, size, "%s%ld", request->path, number);
+        args[count++] = path;
+    } else if (request->path) {
+        args[count++] = (char *)request->path;
+    }
+    for (int i = 0; request->extra[i]; i++) {
+        args[count++] = (char *)request->extra[i];
+    }
+    return count;
+}
+
+/**
+ * Send a job's commands on a connection of its own, keeping up to depth
+ * of them in flight
+ * 
+ * @param arg Pointer to the struct bench_job
+ * @return NULL
+ */
+static void *run_job(void *arg) {
+    struct bench_job *job = (struct bench_job *)arg;
+    struct bench_client client;
+    if (client_connect(&client) == -1) {
+        job->error = 1;
+        return NULL;
+    }
+    
+    long sent_at[BENCH_MAX_DEPTH];
+    long sent = 0;
+    long done = 0;
+    while (done < job->count) {
+        while (sent < job->count && sent - done < job->depth) {
+            char *args[8];
+            char path[PATH_MAX];
+            int count = build_request(job->request, job->first + sent, args, path, sizeof(path));
+            sent_at[sent % job->depth] = now_ns();
+            if (client_send(&client, args, count) == -1) {
+                job->error = 1;
+                close(client.fd);
+                return NULL;
+            }
+            sent++;
+        }
+        
+        int status;
+        if (client_receive(&client, &status) == -1) {
+            job->error = 1;
+            break;
+        }
+        job->latency_ns[done] = now_ns() - sent_at[done % job->depth];
+        if (status != 0) {
+            job->failed++;
+        }
+        done++;
+    }
+    close(client.fd);
+    return NULL;
+}
+
+/**
+ * Start a server in the work directory and wait until it accepts
+ * 
+ * @return Its process ID, or -1 on failure
+ */
+static pid_t start_server(void) {
+    char *argv[BENCH_MAX_SERVER_ARGS + 5];
+    int argc = 0;
+    argv[argc++] = g_options.binary;
+    for (int i = 0; i < g_options.server_arg_count; i++) {
+        argv[argc++] = g_options.server_args[i];
+    }
+    argv[argc++] = "serve";
+    argv[argc++] = "--socket";
+    argv[argc++] = BENCH_SOCKET;
+    argv[argc] = NULL;
+    
+    pid_t pid = fork();
+    if (pid == -1) {
+        report_error("Could not start", g_options.binary);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(g_null_fd, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    
+    for (long waited = 0; waited < BENCH_START_TIMEOUT_MS; waited += 10) {
+        struct bench_client client;
+        if (client_connect(&client) == 0) {
+            close(client.fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            break;
+        }
+        struct timespec delay = { 0, 10 * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+    
+    err_write("bench: The server did not start\n", 32);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * Stop a server and collect its peak memory use
+ * 
+ * @param pid Server to stop
+ * @return Maximum resident set size in kilobytes
+ */
+static long stop_server(pid_t pid) {
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    kill(pid, SIGTERM);
+    while (wait4(pid, NULL, 0, &usage) == -1 && errno == EINTR) {
+    }
+    return usage.ru_maxrss;
+}
+
+/**
+ * Compare two latencies for qsort()
+ * 
+ * @param a First latency
+ * @param b Second latency
+ * @return Negative, zero or positive as a is less than, equal to or greater than b
+ */
+static int compare_latency(const void *a, const void *b) {
+    long left = *(const long *)a;
+    long right = *(const long *)b;
+    return (left > right) - (left < right);
+}
+
+/**
+ * Get a percentile of sorted latencies, by nearest rank
+ * 
+ * @param sorted Latencies in ascending order
+ * @param count Number of latencies
+ * @param percent Percentile wanted
+ * @return Latency in microseconds
+ */
+static long percentile_us(const long *sorted, long count, long percent) {
+    if (count == 0) {
+        return 0;
+    }
+    long rank = (count * percent + 99) / 100;
+    return sorted[(rank > 0) ? rank - 1 : 0] / 1000;
+}
+
+/**
+ * Check whether a scenario was selected with --only
+ * 
+ * @param name Name of the scenario
+ * @return 1 if it should run
+ */
+static int selected(const char *name) {
+    return !g_options.only || strncmp(name, g_options.only, strlen(g_options.only)) == 0;
+}
+
+/**
+ * Run a scenario on a fresh server and print its result line
+ * 
+ * @param name Name of the scenario
+ * @param param What the scenario was sized by
+ * @param request Command to send
+ * @param count Number of commands, split between the writers
+ * @param writers Number of connections sending at once
+ * @param depth Commands each connection keeps in flight
+ * @return 0 on success, -1 on failure
+ */
+static int measure(const char *name, long param, const struct bench_request *request,
+                   long count, long writers, long depth) {
+    if (writers > count) {
+        writers = count;
+    }
+    long *latency_ns = malloc((count > 0 ? count : 1) * sizeof(long));
+    struct bench_job *jobs = calloc(writers, sizeof(*jobs));
+    pthread_t *threads = calloc(writers, sizeof(*threads));
+    pid_t server = (latency_ns && jobs && threads) ? start_server() : -1;
+    if (server == -1) {
+        free(latency_ns);
+        free(jobs);
+        free(threads);
+        return -1;
+    }
+    
+    long first = 0;
+    for (long i = 0; i < writers; i++) {
+        jobs[i].request = request;
+        jobs[i].first = first;
+        jobs[i].count = count / writers + (i < count % writers);
+        jobs[i].depth = depth;
+        jobs[i].latency_ns = latency_ns + first;
+        first += jobs[i].count;
+    }
+    
+    long start = now_ns();
+    long started = 0;
+    for (; started < writers; started++) {
+        if (pthread_create(&threads[started], NULL, run_job, &jobs[started]) != 0) {
+            break;
+        }
+    }
+    long failed = 0;
+    int error = (started < writers);
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        failed += jobs[i].failed;
+        error |= jobs[i].error;
+    }
+    long elapsed = now_ns() - start;
+    long peak_rss = stop_server(server);
+    
+    if (error) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "bench: Lost the connection to the server in %s\n", name);
+        err_write(error_msg, len);
+    } else {
+        qsort(latency_ns, count, sizeof(long), compare_latency);
+        char line[512];
+        int len = string_format(line, sizeof(line), 
+                                "{\"scenario\":\"%s\",\"param\":%ld,\"writers\":%ld,\"ops\":%ld,"
+                                "\"failed\":%ld,\"elapsed_us\":%ld,\"ops_per_sec\":%ld,"
+                                "\"p50_us\":%ld,\"p99_us\":%ld,\"max_us\":%ld,\"peak_rss_kb\":%ld}\n", 
+                                name, param, writers, count, failed, elapsed / 1000,
+                                (elapsed > 0) ? (long)(count * 1000000000.0 / elapsed) : 0,
+                                percentile_us(latency_ns, count, 50),
+                                percentile_us(latency_ns, count, 99),
+                                (count > 0) ? latency_ns[count - 1] / 1000 : 0, peak_rss);
+        out_write(line, len);
+        out_flush();
+    }
+    
+    free(latency_ns);
+    free(jobs);
+    free(threads);
+    return error ? -1 : 0;
+}
+
+/**
+ * Run every selected scenario at the chosen scale
+ * 
+ * @return Number of scenarios that failed
+ */
+static int run_scenarios(void) {
+    const struct bench_scale *scale = g_options.scale;
+    long repeat = g_options.repeat;
+    long depth = g_options.depth;
+    int failures = 0;
+    
+    if (selected("createFile")) {
+        struct bench_request request = { "createFile", "bulk/file_", 1, { NULL } };
+        failures += make_directory("bulk") == -1 ||
+                    measure("createFile", scale->files, &request, scale->files, 1, depth) == -1;
+    }
+    if (selected("deleteFile")) {
+        struct bench_request request = { "deleteFile", "bulk/file_", 1, { NULL } };
+        failures += make_files("bulk", "file_", scale->files, 0) == -1 ||
+                    measure("deleteFile", scale->files, &request, scale->files, 1, depth) == -1;
+    }
+    if (selected("createDir")) {
+        struct bench_request request = { "createDir", "dirs/dir_", 1, { NULL } };
+        failures += make_directory("dirs") == -1 ||
+                    measure("createDir", scale->dirs, &request, scale->dirs, 1, depth) == -1;
+    }
+    if (selected("deleteDir")) {
+        struct bench_request request = { "deleteDir", "dirs/dir_", 1, { NULL } };
+        failures += make_directories("dirs", "dir_", scale->dirs) == -1 ||
+                    measure("deleteDir", scale->dirs, &request, scale->dirs, 1, depth) == -1;
+    }
+    
+    for (int i = 0; scale->list_sizes[i]; i++) {
+        long entries = scale->list_sizes[i];
+        char dir[64];
+        string_format(dir, sizeof(dir), "list_%ld", entries);
+        if (!selected("listDir") && !selected("listFilesByExtension")) {
+            continue;
+        }
+        if (make_files(dir, "entry_", entries, 1) == -1) {
+            failures++;
+            continue;
+        }
+        struct bench_request list = { "listDir", dir, 0, { NULL } };
+        struct bench_request by_extension = { "listFilesByExtension", dir, 0, { ".log", NULL } };
+        if (selected("listDir")) {
+            failures += measure("listDir", entries, &list, repeat, 1, 1) == -1;
+        }
+        if (selected("listFilesByExtension")) {
+            failures += measure("listFilesByExtension", entries, &by_extension, repeat, 1, 1) == -1;
+        }
+    }
+    
+    for (int i = 0; scale->read_sizes[i] && selected("readFile"); i++) {
+        long size = scale->read_sizes[i];
+        char path[64];
+        string_format(path, sizeof(path), "read_%ld.txt", size);
+        struct bench_request request = { "readFile", path, 0, { NULL } };
+        failures += make_text_file(path, size, 0) == -1 ||
+                    measure("readFile", size, &request, repeat, 1, 1) == -1;
+    }
+    
+    if (selected("appendToFile")) {
+        struct bench_request request = { "appendToFile", "appends.txt", 0,
+                                         { "A line appended by one of the benchmark writers", NULL } };
+        unlink("appends.txt");
+        failures += make_text_file("appends.txt", 0, 0) == -1 ||
+                    measure("appendToFile", scale->appends, &request, scale->appends,
+                            g_options.writers, depth) == -1;
+    }
+    
+    if (selected("showLogs")) {
+        struct bench_request all = { "showLogs", NULL, 0, { NULL } };
+        struct bench_request last = { "showLogs", NULL, 0, { "--last", "1000", NULL } };
+        struct bench_request grep = { "showLogs", NULL, 0, { "--grep", "file_4242.", NULL } };
+        if (make_text_file("log.txt", scale->log_size, 1) == -1) {
+            failures++;
+        } else {
+            failures += measure("showLogs", scale->log_size, &all, repeat, 1, 1) == -1;
+            failures += measure("showLogs/last", scale->log_size, &last, repeat, 1, 1) == -1;
+            failures += measure("showLogs/grep", scale->log_size, &grep, repeat, 1, 1) == -1;
+        }
+    }
+    
+    return failures;
+}
+
+/**
+ * Write the usage message
+ */
+static void usage(void) {
+    const char *text =
+        "Usage: bench [--binary path] [--dir path] [--scale small|full] [--only scenario]\n"
+        "             [--repeat N] [--writers K] [--depth N] [--keep] [-- fileManager options]\n";
+    err_write(text, strlen(text));
+}
+
+/**
+ * Read the command line into g_options
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return 0 on success, -1 on bad arguments
+ */
+static int parse_options(int argc, char *argv[]) {
+    const char *binary = "./fileManager";
+    g_options.dir = "bench.tmp";
+    g_options.scale = &g_scales[0];
+    g_options.repeat = 5;
+    g_options.writers = 8;
+    g_options.depth = 1;
+    
+    for (int i = 1; i < argc; i++) {
+        long value = 0;
+        int has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--") == 0) {
+            for (i++; i < argc && g_options.server_arg_count < BENCH_MAX_SERVER_ARGS; i++) {
+                g_options.server_args[g_options.server_arg_count++] = argv[i];
+            }
+            if (i < argc) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            g_options.keep = 1;
+        } else if (strcmp(argv[i], "--binary") == 0 && has_value) {
+            binary = argv[++i];
+        } else if (strcmp(argv[i], "--dir") == 0 && has_value) {
+            g_options.dir = argv[++i];
+        } else if (strcmp(argv[i], "--only") == 0 && has_value) {
+            g_options.only = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0 && has_value) {
+            i++;
+            g_options.scale = NULL;
+            for (size_t j = 0; j < sizeof(g_scales) / sizeof(g_scales[0]); j++) {
+                if (strcmp(argv[i], g_scales[j].name) == 0) {
+                    g_options.scale = &g_scales[j];
+                }
+            }
+            if (!g_options.scale) {
+                return -1;
+            }
+        } else if ((strcmp(argv[i], "--repeat") == 0 || strcmp(argv[i], "--writers") == 0 ||
+                    strcmp(argv[i], "--depth") == 0) && has_value &&
+                   parse_number(argv[i + 1], &value) == 0 && value > 0) {
+            if (strcmp(argv[i], "--repeat") == 0) {
+                g_options.repeat = value;
+            } else if (strcmp(argv[i], "--writers") == 0) {
+                g_options.writers = (value < BENCH_MAX_WRITERS) ? value : BENCH_MAX_WRITERS;
+            } else {
+                g_options.depth = (value < BENCH_MAX_DEPTH) ? value : BENCH_MAX_DEPTH;
+            }
+            i++;
+        } else {
+            return -1;
+        }
+    }
+    
+    // The server runs in the work directory
+    if (!realpath(binary, g_options.binary)) {
+        report_error("Could not find", binary);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Remove the work directory and everything in it
+ * 
+ * @param dir Work directory
+ */
+static void remove_work_dir(const char *dir) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("rm", "rm", "-rf", "--", dir, (char *)NULL);
+        _exit(127);
+    }
+    if (pid != -1) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_options(argc, argv) == -1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    
+    g_null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    int home_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (g_null_fd == -1 || home_fd == -1 || make_directory(g_options.dir) == -1) {
+        return EXIT_FAILURE;
+    }
+    g_work_fd = open(g_options.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (g_work_fd == -1 || fchdir(g_work_fd) == -1) {
+        report_error("Could not enter", g_options.dir);
+        return EXIT_FAILURE;
+    }
+    
+    // Keep the generated log whole however large it is
+    const char *config = "log_max_size=0\n";
+    int config_fd = open(BENCH_CONFIG, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (config_fd == -1 || write_all_fd(config_fd, config, strlen(config)) == -1) {
+        report_error("Could not write", BENCH_CONFIG);
+        return EXIT_FAILURE;
+    }
+    close(config_fd);
+    
+    int failures = run_scenarios();
+    
+    if (fchdir(home_fd) == 0 && !g_options.keep) {
+        remove_work_dir(g_options.dir);
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
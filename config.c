@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#define MAX_SETTINGS 64
+#define MAX_KEY_SIZE 64
+#define MAX_VALUE_SIZE 256
+#define MAX_CONFIG_SIZE 65536
+
+// A single "key = value" setting
+struct setting {
+    char key[MAX_KEY_SIZE];
+    char value[MAX_VALUE_SIZE];
+    int warned;     // Value reported as invalid; accessed atomically
+};
+
+static struct setting g_settings[MAX_SETTINGS];
+static int g_setting_count = 0;
+
+/**
+ * Copy a string into a fixed-size buffer, trimming surrounding blanks
+ * 
+ * @param dest Destination buffer
+ * @param size Size of the destination buffer
+ * @param start Start of the string
+ * @param end One past the end of the string
+ * @return 0 on success, -1 if the trimmed string is empty or too long
+ */
+static int copy_trimmed(char *dest, size_t size, const char *start, const char *end) {
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        end--;
+    }
+    
+    size_t len = end - start;
+    if (len == 0 || len >= size) {
+        return -1;
+    }
+    
+    memcpy(dest, start, len);
+    dest[len] = '\0';
+    return 0;
+}
+
+/**
+ * Set a single setting, overriding the configuration file
+ * 
+ * @param key Setting name
+ * @param value Setting value
+ * @return 0 on success, -1 on failure
+ */
+int config_set(const char *key, const char *value) {
+    if (!key || !value || strlen(key) >= MAX_KEY_SIZE || strlen(value) >= MAX_VALUE_SIZE) {
+        return -1;
+    }
+    
+    // Replace an existing setting
+    for (int i = 0; i < g_setting_count; i++) {
+        if (strcmp(g_settings[i].key, key) == 0) {
+            strcpy(g_settings[i].value, value);
+            g_settings[i].warned = 0;
+            return 0;
+        }
+    }
+    
+    if (g_setting_count >= MAX_SETTINGS) {
+        return -1;
+    }
+    
+    strcpy(g_settings[g_setting_count].key, key);
+    strcpy(g_settings[g_setting_count].value, value);
+    g_settings[g_setting_count].warned = 0;
+    g_setting_count++;
+    
+    return 0;
+}
+
+/**
+ * Load settings from a configuration file
+ * A missing default file is not an error.
+ * 
+ * @param path Path of the file, or NULL for CONFIG_FILE
+ * @return 0 on success, -1 on failure
+ */
+int load_config(const char *path) {
+    const char *filename = path ? path : CONFIG_FILE;
+    
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        if (!path && errno == ENOENT) {
+            return 0;
+        }
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open config file \"%s\": %s\n", 
+                          filename, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    char *buffer = malloc(MAX_CONFIG_SIZE);
+    if (!buffer) {
+        write_error("Error: Memory allocation failed\n");
+        close(fd);
+        return -1;
+    }
+    
+    // Read the whole file; configuration files are small
+    size_t total = 0;
+    while (total < MAX_CONFIG_SIZE - 1) {
+        ssize_t bytes_read = read(fd, buffer + total, MAX_CONFIG_SIZE - 1 - total);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            break;
+        }
+        total += bytes_read;
+    }
+    buffer[total] = '\0';
+    close(fd);
+    
+    int result = 0;
+    int line_number = 0;
+    char *line = buffer;
+    
+    while (line < buffer + total) {
+        char *end = strchr(line, '\n');
+        if (!end) {
+            end = buffer + total;
+        }
+        line_number++;
+        
+        // Drop comments
+        char *comment = memchr(line, '#', end - line);
+        char *content_end = comment ? comment : end;
+        
+        // Skip lines that are blank once the comment is gone
+        char *p = line;
+        while (p < content_end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        
+        if (p < content_end) {
+            char key[MAX_KEY_SIZE];
+            char value[MAX_VALUE_SIZE];
+            char *equals = memchr(p, '=', content_end - p);
+            
+            if (!equals || 
+                copy_trimmed(key, sizeof(key), p, equals) == -1 || 
+                copy_trimmed(value, sizeof(value), equals + 1, content_end) == -1 || 
+                config_set(key, value) == -1) {
+                char error_msg[256];
+                int len = string_format(error_msg, sizeof(error_msg), 
+                                  "Error: Invalid setting on line %d of \"%s\"\n", 
+                                  line_number, filename);
+                err_write(error_msg, len);
+                result = -1;
+            }
+        }
+        
+        line = end + 1;
+    }
+    
+    free(buffer);
+    return result;
+}
+
+/**
+ * Find a setting by name
+ * 
+ * @param key Setting name
+ * @return The setting, or NULL if it isn't set
+ */
+static struct setting *find_setting(const char *key) {
+    for (int i = 0; i < g_setting_count; i++) {
+        if (strcmp(g_settings[i].key, key) == 0) {
+            return &g_settings[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get a setting as a string
+ * 
+ * @param key Setting name
+ * @param default_value Value returned if the setting isn't set
+ * @return Setting value, or default_value
+ */
+const char *config_get_string(const char *key, const char *default_value) {
+    struct setting *setting = find_setting(key);
+    return setting ? setting->value : default_value;
+}
+
+/**
+ * Get a setting as a non-negative number
+ * Sizes accept a K, M or G suffix. Invalid values fall back to the
+ * default; each is reported once, however often it is read.
+ * 
+ * @param key Setting name
+ * @param default_value Value returned if the setting isn't set or invalid
+ * @return Setting value, or default_value
+ */
+long config_get_number(const char *key, long default_value) {
+    struct setting *setting = find_setting(key);
+    if (!setting) {
+        return default_value;
+    }
+    const char *text = setting->value;
+    
+    char digits[MAX_VALUE_SIZE];
+    size_t len = strlen(text);
+    long multiplier = 1;
+    
+    switch (len > 0 ? text[len - 1] : '\0') {
+        case 'K': case 'k': multiplier = 1024L; len--; break;
+        case 'M': case 'm': multiplier = 1024L * 1024; len--; break;
+        case 'G': case 'g': multiplier = 1024L * 1024 * 1024; len--; break;
+        default: break;
+    }
+    
+    memcpy(digits, text, len);
+    digits[len] = '\0';
+    
+    long value;
+    if (parse_number(digits, &value) == -1 || value > LONG_MAX / multiplier) {
+        if (__atomic_exchange_n(&setting->warned, 1, __ATOMIC_RELAXED)) {
+            return default_value;
+        }
+        char error_msg[256];
+        int err_len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Invalid value \"%s\" for setting \"%s\"\n", 
+                              text, key);
+        err_write(error_msg, err_len);
+        return default_value;
+    }
+    
+    return value * multiplier;
+}
@@ -0,0 +1,21 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Default configuration file, read from the working directory if present
+#define CONFIG_FILE "fileManager.conf"
+
+// Load settings from a configuration file
+// Lines have the form "key = value"; '#' starts a comment
+int load_config(const char *path);
+
+// Set a single setting, overriding the configuration file
+int config_set(const char *key, const char *value);
+
+// Get a setting as a string, or the default if it isn't set
+const char *config_get_string(const char *key, const char *default_value);
+
+// Get a setting as a non-negative number, or the default if it isn't set
+// Sizes accept a K, M or G suffix
+long config_get_number(const char *key, long default_value);
+
+#endif // CONFIG_H
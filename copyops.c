@@ -0,0 +1,992 @@
+#define _GNU_SOURCE
+#include "copyops.h"
+#include "logging.h"
+#include "utils.h"
+#include "threadpool.h"
+#include "dirscan.h"
+#include "durability.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdio.h>  // renameat2()
+
+// Buffer size of the read/write fallback
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+// How a file's contents were copied, from cheapest to most expensive
+enum copy_method {
+    COPY_REFLINK,
+    COPY_RANGE,
+    COPY_BUFFERED
+};
+
+// Names of the copy methods, for messages
+static const char *const g_method_names[] = { "reflink", "copy_file_range", "buffered" };
+
+/**
+ * Copy a byte range with read() and write()
+ * 
+ * @param in Source file
+ * @param out Destination file
+ * @param offset Start of the range in both files
+ * @param len Length of the range
+ * @return 0 on success, -1 on failure
+ */
+static int copy_buffered(int in, int out, off_t offset, off_t len) {
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    
+    int result = 0;
+    while (len > 0) {
+        size_t want = (len < COPY_BUFFER_SIZE) ? (size_t)len : COPY_BUFFER_SIZE;
+        ssize_t got = pread(in, buffer, want, offset);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            result = (got == -1) ? -1 : 0; // 0: the source shrank
+            break;
+        }
+        
+        for (ssize_t done = 0; done < got; ) {
+            ssize_t written = pwrite(out, buffer + done, got - done, offset + done);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written == -1) {
+                result = -1;
+                break;
+            }
+            done += written;
+        }
+        if (result == -1) {
+            break;
+        }
+        offset += got;
+        len -= got;
+    }
+    
+    int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Copy a byte range inside the kernel, falling back to read() and write()
+ * copy_file_range() fails at once across some filesystems and on old
+ * kernels; the rest of the range is then copied through a buffer.
+ * 
+ * @param in Source file
+ * @param out Destination file
+ * @param offset Start of the range in both files
+ * @param len Length of the range
+ * @param method Set to COPY_BUFFERED if the fallback was used
+ * @return 0 on success, -1 on failure
+ */
+static int copy_range(int in, int out, off_t offset, off_t len, int *method) {
+    loff_t in_off = offset;
+    loff_t out_off = offset;
+    
+    while (len > 0) {
+        size_t want = (len < 0x40000000) ? (size_t)len : 0x40000000;
+        ssize_t copied = copy_file_range(in, &in_off, out, &out_off, want, 0);
+        if (copied > 0) {
+            len -= copied;
+            continue;
+        }
+        if (copied == 0) {
+            break; // The source shrank
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+            errno == EOPNOTSUPP || errno == ETXTBSY) {
+            __atomic_store_n(method, COPY_BUFFERED, __ATOMIC_RELAXED);
+            return copy_buffered(in, out, in_off, len);
+        }
+        return -1;
+    }
+    
+    return 0;
+}
+
+// One chunk of a large file
+struct copy_chunk {
+    off_t offset;
+    off_t len;
+};
+
+// Large file being copied by several workers
+struct chunked_copy {
+    int in;
+    int out;
+    int method;
+    int error;      // First errno, accessed atomically
+};
+
+/**
+ * Copy one chunk of a large file (thread pool task)
+ * 
+ * @param task Chunk to copy, as a struct copy_chunk
+ * @param worker Index of the calling worker
+ * @param context Pointer to struct chunked_copy
+ */
+static void copy_chunk_task(void *task, int worker, void *context) {
+    const struct copy_chunk *chunk = (const struct copy_chunk *)task;
+    struct chunked_copy *copy = (struct chunked_copy *)context;
+    (void)worker;
+    
+    if (copy_range(copy->in, copy->out, chunk->offset, chunk->len, &copy->method) == -1) {
+        int expected = 0;
+        __atomic_compare_exchange_n(&copy->error, &expected, errno, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Copy a whole file's contents
+ * A reflink shares the source's blocks and is tried first. Otherwise
+ * the kernel copies the data, split into chunks copied in parallel
+ * when the file is large.
+ * 
+ * @param in Source file
+ * @param out Empty destination file
+ * @param size Size of the source
+ * @param jobs Number of worker threads, or 0 for one per CPU
+ * @param method Set to the method used
+ * @return 0 on success, -1 on failure
+ */
+static int copy_contents(int in, int out, off_t size, int jobs, int *method) {
+    if (ioctl(out, FICLONE, in) == 0) {
+        *method = COPY_REFLINK;
+        return 0;
+    }
+    *method = COPY_RANGE;
+    
+    if (jobs <= 0) {
+        jobs = pool_default_workers();
+    }
+    if (jobs == 1 || size < COPY_PARALLEL_MIN) {
+        return copy_range(in, out, 0, size, method);
+    }
+    
+    off_t chunk_len = (size / jobs + COPY_CHUNK_ALIGN - 1) / COPY_CHUNK_ALIGN * COPY_CHUNK_ALIGN;
+    int count = (size + chunk_len - 1) / chunk_len;
+    struct copy_chunk *chunks = malloc(count * sizeof(*chunks));
+    struct chunked_copy copy = { in, out, COPY_RANGE, 0 };
+    struct thread_pool *pool = chunks ? pool_create(count, copy_chunk_task, &copy) : NULL;
+    if (!pool) {
+        free(chunks);
+        return copy_range(in, out, 0, size, method);
+    }
+    
+    // Sizing the file first lets every chunk be written in place
+    int result = ftruncate(out, size);
+    for (int i = 0; i < count && result == 0; i++) {
+        chunks[i].offset = i * chunk_len;
+        chunks[i].len = (i == count - 1) ? size - chunks[i].offset : chunk_len;
+        if (pool_submit(pool, -1, &chunks[i]) == -1) {
+            result = -1;
+        }
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+    free(chunks);
+    
+    *method = copy.method;
+    if (result == 0 && copy.error) {
+        errno = copy.error;
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * Report a failed copy
+ * 
+ * @param source Path of the source
+ * @param dest Path of the destination
+ * @param error errno value
+ */
+static void copy_error(const char *source, const char *dest, int error) {
+    char error_msg[512];
+    int len;
+    if (error == EEXIST) {
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: File \"%s\" already exists.\n", dest);
+    } else {
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not copy \"%s\" to \"%s\": %s\n", 
+                      source, dest, strerror(error));
+    }
+    err_write(error_msg, len);
+}
+
+/**
+ * Copy a regular file to a new file with the same permissions
+ * A partly written destination is removed again. Nothing is reported,
+ * so workers of a directory copy can call it too.
+ * 
+ * @param source Path of the source
+ * @param dest Path of the destination, which must not exist
+ * @param jobs Number of worker threads for a large file, or 0 for one per CPU
+ * @param method Set to the method used
+ * @return 0 on success, -1 on failure with errno set
+ */
+static int copy_regular(const char *source, const char *dest, int jobs, int *method) {
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in == -1 || fstat(in, &st) == -1) {
+        int open_errno = errno;
+        if (in != -1) {
+            close(in);
+        }
+        errno = open_errno;
+        return -1;
+    }
+    
+    // Set-user-ID and set-group-ID bits are not carried over
+    int out = open(dest, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+    if (out == -1) {
+        int open_errno = errno;
+        close(in);
+        errno = open_errno;
+        return -1;
+    }
+    
+    int result = copy_contents(in, out, st.st_size, jobs, method);
+    if (result == 0) {
+        result = durability_sync(out);
+    }
+    int copy_errno = errno;
+    if (close(out) == -1 && result == 0) {
+        result = -1;
+        copy_errno = errno;
+    }
+    close(in);
+    
+    if (result == -1) {
+        unlink(dest);
+        errno = copy_errno;
+    }
+    return result;
+}
+
+/**
+ * Work out the destination path of a copy or move
+ * An existing directory receives the source under its own name.
+ * 
+ * @param source Path of the source
+ * @param dest Destination as given
+ * @return Destination path to free, or NULL if memory allocation failed
+ */
+static char *target_path(const char *source, const char *dest) {
+    if (!directory_exists(dest)) {
+        return strdup(dest);
+    }
+    
+    size_t source_len = strlen(source);
+    while (source_len > 1 && source[source_len - 1] == '/') {
+        source_len--;
+    }
+    const char *base = source;
+    for (size_t i = 0; i + 1 < source_len; i++) {
+        if (source[i] == '/') {
+            base = source + i + 1;
+        }
+    }
+    size_t base_len = source + source_len - base;
+    size_t dest_len = strlen(dest);
+    
+    char *target = malloc(dest_len + base_len + 2);
+    if (target) {
+        memcpy(target, dest, dest_len);
+        target[dest_len] = '/';
+        memcpy(target + dest_len + 1, base, base_len);
+        target[dest_len + 1 + base_len] = '\0';
+    }
+    return target;
+}
+
+// Arguments for the copy and move operations
+struct copy_args {
+    const char *source;
+    const char *dest;       // Resolved destination path
+    int jobs;
+};
+
+/**
+ * Copy a file once its destination is known
+ * 
+ * @param arg Pointer to struct copy_args
+ * @return 0 on success, -1 on failure
+ */
+static int copy_file_operation(void *arg) {
+    const struct copy_args *copy = (const struct copy_args *)arg;
+    
+    int method;
+    if (copy_regular(copy->source, copy->dest, copy->jobs, &method) == -1) {
+        copy_error(copy->source, copy->dest, errno);
+        
+        // Log the error
+        char log_error[512];
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Could not copy file \"%s\" to \"%s\"", copy->source, copy->dest);
+        log_operation(log_error);
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[512];
+    string_format(log_msg, sizeof(log_msg), "File \"%s\" copied to \"%s\" (%s).", 
+            copy->source, copy->dest, g_method_names[method]);
+    log_operation(log_msg);
+    
+    // Print success message
+    char success_msg[512];
+    int len = string_format(success_msg, sizeof(success_msg), 
+                      "File \"%s\" copied to \"%s\" successfully.\n", copy->source, copy->dest);
+    out_write(success_msg, len);
+    
+    return 0;
+}
+
+/**
+ * Run a copy or move operation and report a failure to start it
+ * 
+ * @param operation Operation to run
+ * @param copy Its arguments
+ * @return 0 on success, -1 on failure
+ */
+static int run_copy(int (*operation)(void *), struct copy_args *copy) {
+    int result = run_operation(operation, copy);
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    return (result != 0) ? -1 : 0;
+}
+
+/**
+ * Copy a file
+ * Runs in-process, or in a child process when isolation is enabled
+ * 
+ * @param source Path of the file to copy
+ * @param dest Path of the new file, or an existing directory to copy into
+ * @param jobs Number of worker threads for a large file, or 0 for one per CPU
+ * @return 0 on success, -1 on failure
+ */
+int copy_file(const char *source, const char *dest, int jobs) {
+    // Check if file exists
+    if (!file_exists(source)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: File \"%s\" not found.\n", source);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    char *target = target_path(source, dest);
+    if (!target) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    
+    struct copy_args copy = { source, target, jobs };
+    int result = run_copy(copy_file_operation, &copy);
+    free(target);
+    return result;
+}
+
+/**
+ * Get the device holding the directory of a path
+ * 
+ * @param path Path of a file that may not exist yet
+ * @param dev Set to the device
+ * @return 0 on success, -1 on failure
+ */
+static int parent_device(const char *path, dev_t *dev) {
+    const char *slash = strrchr(path, '/');
+    char *parent = slash ? strndup(path, (slash == path) ? 1 : (size_t)(slash - path)) : strdup(".");
+    if (!parent) {
+        return -1;
+    }
+    
+    struct stat st;
+    int result = stat(parent, &st);
+    free(parent);
+    if (result == 0) {
+        *dev = st.st_dev;
+    }
+    return result;
+}
+
+/**
+ * Move a file once its destination is known
+ * 
+ * @param arg Pointer to struct copy_args
+ * @return 0 on success, -1 on failure
+ */
+static int move_file_operation(void *arg) {
+    const struct copy_args *move = (const struct copy_args *)arg;
+    
+    // A rename is only possible within one device
+    struct stat st;
+    dev_t dest_dev;
+    int same_device = stat(move->source, &st) == 0 &&
+                      parent_device(move->dest, &dest_dev) == 0 && st.st_dev == dest_dev;
+    
+    int renamed = 0;
+    if (same_device) {
+        int result = renameat2(AT_FDCWD, move->source, AT_FDCWD, move->dest, RENAME_NOREPLACE);
+        if (result == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            // No RENAME_NOREPLACE on this filesystem
+            struct stat existing;
+            if (lstat(move->dest, &existing) == 0) {
+                errno = EEXIST;
+            } else {
+                result = rename(move->source, move->dest);
+            }
+        }
+        renamed = (result == 0);
+        if (!renamed && errno != EXDEV) {
+            copy_error(move->source, move->dest, errno);
+            
+            // Log the error
+            char log_error[512];
+            string_format(log_error, sizeof(log_error), 
+                         "ERROR: Could not move file \"%s\" to \"%s\": %s", 
+                         move->source, move->dest, strerror(errno));
+            log_operation(log_error);
+            return -1;
+        }
+    }
+    
+    // Across devices, copy and then remove the source
+    if (!renamed) {
+        int method;
+        if (copy_regular(move->source, move->dest, 0, &method) == -1) {
+            copy_error(move->source, move->dest, errno);
+            
+            char log_error[512];
+            string_format(log_error, sizeof(log_error), 
+                         "ERROR: Could not move file \"%s\" to \"%s\"", move->source, move->dest);
+            log_operation(log_error);
+            return -1;
+        }
+        if (unlink(move->source) == -1) {
+            char error_msg[512];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Copied \"%s\" to \"%s\" but could not delete it: %s\n", 
+                              move->source, move->dest, strerror(errno));
+            err_write(error_msg, len);
+            return -1;
+        }
+    }
+    
+    // Log the operation
+    char log_msg[512];
+    string_format(log_msg, sizeof(log_msg), "File \"%s\" moved to \"%s\"%s.", 
+            move->source, move->dest, renamed ? "" : " (copied across devices)");
+    log_operation(log_msg);
+    
+    // Print success message
+    char success_msg[512];
+    int len = string_format(success_msg, sizeof(success_msg), 
+                      "File \"%s\" moved to \"%s\" successfully.\n", move->source, move->dest);
+    out_write(success_msg, len);
+    
+    return 0;
+}
+
+/**
+ * Move a file
+ * Runs in-process, or in a child process when isolation is enabled
+ * 
+ * @param source Path of the file to move
+ * @param dest New path, or an existing directory to move into
+ * @return 0 on success, -1 on failure
+ */
+int move_file(const char *source, const char *dest) {
+    // Check if file exists
+    if (!file_exists(source)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: File \"%s\" not found.\n", source);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    char *target = target_path(source, dest);
+    if (!target) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    
+    struct copy_args move = { source, target, 0 };
+    int result = run_copy(move_file_operation, &move);
+    free(target);
+    return result;
+}
+
+// File queued for a worker by a directory copy
+struct copy_task {
+    char *source;
+    char *dest;
+    int error;                  // errno value once the copy failed
+    struct copy_task *next;     // Next failed copy
+};
+
+// Directory whose final permissions are set once everything is copied
+struct copied_dir {
+    char *path;
+    mode_t mode;
+};
+
+// State of a directory copy
+struct tree_copy {
+    struct thread_pool *pool;
+    struct copied_dir *dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+    long files;         // Accessed atomically
+    int failed;         // Accessed atomically
+    pthread_mutex_t failed_lock;
+    struct copy_task *failures;  // Failed copies, newest first, for the calling thread to report
+};
+
+// Entries collected while scanning a source directory
+struct copy_scan {
+    int fd;
+    char *names;        // Type byte, then the NUL-terminated name
+    size_t len;
+    size_t capacity;
+};
+
+/**
+ * Copy one file of a directory copy (thread pool task)
+ * 
+ * @param task File to copy, as a struct copy_task
+ * @param worker Index of the calling worker
+ * @param context Pointer to struct tree_copy
+ */
+static void copy_tree_task(void *task, int worker, void *context) {
+    struct copy_task *copy = (struct copy_task *)task;
+    struct tree_copy *tree = (struct tree_copy *)context;
+    (void)worker;
+    
+    // Files are copied side by side, so each one uses a single thread
+    int method;
+    if (copy_regular(copy->source, copy->dest, 1, &method) == -1) {
+        // Output belongs to the command's thread, so the failure is kept
+        copy->error = errno;
+        __atomic_store_n(&tree->failed, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&tree->failed_lock);
+        copy->next = tree->failures;
+        tree->failures = copy;
+        pthread_mutex_unlock(&tree->failed_lock);
+        return;
+    }
+    
+    __atomic_add_fetch(&tree->files, 1, __ATOMIC_RELAXED);
+    free(copy->source);
+    free(copy->dest);
+    free(copy);
+}
+
+/**
+ * Report the files a directory copy could not copy, oldest first
+ * 
+ * @param tree Copy state, with every worker finished
+ */
+static void report_copy_failures(struct tree_copy *tree) {
+    struct copy_task *reversed = NULL;
+    while (tree->failures) {
+        struct copy_task *copy = tree->failures;
+        tree->failures = copy->next;
+        copy->next = reversed;
+        reversed = copy;
+    }
+    
+    while (reversed) {
+        struct copy_task *copy = reversed;
+        reversed = copy->next;
+        copy_error(copy->source, copy->dest, copy->error);
+        free(copy->source);
+        free(copy->dest);
+        free(copy);
+    }
+}
+
+/**
+ * Collect the entries of a source directory with their types
+ * 
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Pointer to struct copy_scan
+ * @return 0 to keep scanning, -1 if memory allocation failed
+ */
+static int copy_scan_batch(const struct dir_entry *entries, size_t count, void *context) {
+    struct copy_scan *scan = (struct copy_scan *)context;
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
+        unsigned char type = entry->type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(scan->fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG :
+                   S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+        
+        if (scan->len + entry->name_len + 2 > scan->capacity) {
+            size_t capacity = scan->capacity ? scan->capacity * 2 : 4096;
+            while (capacity < scan->len + entry->name_len + 2) {
+                capacity *= 2;
+            }
+            char *names = realloc(scan->names, capacity);
+            if (!names) {
+                return -1;
+            }
+            scan->names = names;
+            scan->capacity = capacity;
+        }
+        scan->names[scan->len] = (char)type;
+        memcpy(scan->names + scan->len + 1, entry->name, entry->name_len + 1);
+        scan->len += entry->name_len + 2;
+    }
+    
+    return 0;
+}
+
+/**
+ * Report a failure while copying a tree
+ * 
+ * @param tree Copy state
+ * @param what What failed, e.g. "create directory"
+ * @param path Path involved
+ * @param error errno value
+ */
+static void tree_error(struct tree_copy *tree, const char *what, const char *path, int error) {
+    char error_msg[1024];
+    int len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not %s \"%s\": %s\n", what, path, strerror(error));
+    err_write(error_msg, len);
+    __atomic_store_n(&tree->failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Join a directory path and a name
+ * 
+ * @param dir Directory path
+ * @param name Entry name
+ * @return Joined path to free, or NULL if memory allocation failed
+ */
+static char *join_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char *path = malloc(dir_len + name_len + 2);
+    if (path) {
+        memcpy(path, dir, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, name, name_len + 1);
+    }
+    return path;
+}
+
+/**
+ * Create a directory's copy and queue the files below it
+ * Directories are created by the calling thread, in order, so a file's
+ * directory always exists before a worker copies it. New directories
+ * stay writable until the copy finishes.
+ * 
+ * @param tree Copy state
+ * @param source Source directory
+ * @param dest Directory to create
+ */
+static void copy_tree(struct tree_copy *tree, const char *source, const char *dest) {
+    struct copy_scan scan = { -1, NULL, 0, 0 };
+    scan.fd = open(source, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (scan.fd == -1 || fstat(scan.fd, &st) == -1) {
+        tree_error(tree, "open directory", source, errno);
+        if (scan.fd != -1) {
+            close(scan.fd);
+        }
+        return;
+    }
+    
+    if (mkdir(dest, 0700) == -1) {
+        tree_error(tree, "create directory", dest, errno);
+        close(scan.fd);
+        return;
+    }
+    
+    if (tree->dir_count == tree->dir_capacity) {
+        size_t capacity = tree->dir_capacity ? tree->dir_capacity * 2 : 64;
+        struct copied_dir *dirs = realloc(tree->dirs, capacity * sizeof(*dirs));
+        if (dirs) {
+            tree->dirs = dirs;
+            tree->dir_capacity = capacity;
+        }
+    }
+    char *dest_copy = strdup(dest);
+    if (tree->dir_count < tree->dir_capacity && dest_copy) {
+        tree->dirs[tree->dir_count].path = dest_copy;
+        tree->dirs[tree->dir_count].mode = st.st_mode & 0777;
+        tree->dir_count++;
+    } else {
+        free(dest_copy);
+        tree_error(tree, "record directory", dest, ENOMEM);
+    }
+    
+    if (dir_scan(scan.fd, copy_scan_batch, &scan) == -1) {
+        tree_error(tree, "read directory", source, errno);
+    }
+    close(scan.fd);
+    
+    for (size_t pos = 0; pos < scan.len; ) {
+        unsigned char type = (unsigned char)scan.names[pos];
+        const char *name = scan.names + pos + 1;
+        pos += strlen(name) + 2;
+        
+        char *child_source = join_path(source, name);
+        char *child_dest = join_path(dest, name);
+        if (!child_source || !child_dest) {
+            free(child_source);
+            free(child_dest);
+            tree_error(tree, "copy", source, ENOMEM);
+            break;
+        }
+        
+        if (type == DT_DIR) {
+            copy_tree(tree, child_source, child_dest);
+        } else if (type == DT_REG) {
+            struct copy_task *task = malloc(sizeof(*task));
+            if (task) {
+                task->source = child_source;
+                task->dest = child_dest;
+                task->error = 0;
+                task->next = NULL;
+            }
+            if (task && pool_submit(tree->pool, -1, task) == 0) {
+                continue; // The task owns the paths now
+            }
+            free(task);
+            tree_error(tree, "copy", child_source, ENOMEM);
+        } else if (type == DT_LNK) {
+            // Links are copied as links, never followed
+            char target[4096];
+            ssize_t len = readlink(child_source, target, sizeof(target) - 1);
+            if (len >= 0) {
+                target[len] = '\0';
+            }
+            if (len == -1 || symlink(target, child_dest) == -1) {
+                tree_error(tree, "copy link", child_source, errno);
+            } else {
+                __atomic_add_fetch(&tree->files, 1, __ATOMIC_RELAXED);
+            }
+        } else {
+            tree_error(tree, "copy special file", child_source, EOPNOTSUPP);
+        }
+        
+        free(child_source);
+        free(child_dest);
+    }
+    
+    free(scan.names);
+}
+
+/**
+ * Check whether a copy's destination lies inside its source
+ * The destination does not exist yet, so its parent and that parent's
+ * ancestors are compared with the source by device and inode, which
+ * also catches paths that reach the source through links.
+ * 
+ * @param source Source directory
+ * @param dest Destination path
+ * @return 1 if inside, 0 if not, -1 on failure with errno set
+ */
+static int dest_inside_source(const char *source, const char *dest) {
+    struct stat source_st;
+    if (stat(source, &source_st) == -1) {
+        return -1;
+    }
+    
+    const char *slash = strrchr(dest, '/');
+    char *parent = slash ? strndup(dest, (slash == dest) ? 1 : (size_t)(slash - dest)) : strdup(".");
+    if (!parent) {
+        return -1;
+    }
+    int fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(parent);
+    if (fd == -1) {
+        return (errno == ENOENT) ? 0 : -1; // Left for mkdir() to report
+    }
+    
+    int result = 0;
+    for (;;) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            result = -1;
+            break;
+        }
+        if (st.st_dev == source_st.st_dev && st.st_ino == source_st.st_ino) {
+            result = 1;
+            break;
+        }
+        
+        int up = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct stat up_st;
+        if (up == -1 || fstat(up, &up_st) == -1) {
+            if (up != -1) {
+                close(up);
+            }
+            result = -1;
+            break;
+        }
+        close(fd);
+        fd = up;
+        
+        // The root is its own parent
+        if (up_st.st_dev == st.st_dev && up_st.st_ino == st.st_ino) {
+            break;
+        }
+    }
+    
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Copy a directory tree once its destination is known
+ * 
+ * @param arg Pointer to struct copy_args
+ * @return 0 on success, -1 if anything could not be copied
+ */
+static int copy_directory_operation(void *arg) {
+    const struct copy_args *copy = (const struct copy_args *)arg;
+    
+    // Copying into its own subtree would never finish
+    int inside = dest_inside_source(copy->source, copy->dest);
+    if (inside != 0) {
+        char error_msg[512];
+        int len;
+        if (inside == 1) {
+            len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Cannot copy directory \"%s\" into itself (\"%s\").\n", 
+                          copy->source, copy->dest);
+        } else {
+            len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not copy \"%s\" to \"%s\": %s\n", 
+                          copy->source, copy->dest, strerror(errno));
+        }
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    struct tree_copy tree;
+    memset(&tree, 0, sizeof(tree));
+    int jobs = (copy->jobs > 0) ? copy->jobs : pool_default_workers();
+    tree.pool = pool_create(jobs, copy_tree_task, &tree);
+    if (!tree.pool) {
+        err_write("Error: Could not start worker threads\n", 38);
+        return -1;
+    }
+    pthread_mutex_init(&tree.failed_lock, NULL);
+    
+    copy_tree(&tree, copy->source, copy->dest);
+    pool_wait(tree.pool);
+    pool_destroy(tree.pool);
+    report_copy_failures(&tree);
+    pthread_mutex_destroy(&tree.failed_lock);
+    
+    // Deepest directories last in the list, so restore from the end
+    for (size_t i = tree.dir_count; i-- > 0; ) {
+        if (chmod(tree.dirs[i].path, tree.dirs[i].mode) == -1) {
+            tree_error(&tree, "set permissions of", tree.dirs[i].path, errno);
+        }
+        free(tree.dirs[i].path);
+    }
+    free(tree.dirs);
+    
+    // One record for the whole tree rather than one per file
+    char log_msg[512];
+    if (tree.failed) {
+        string_format(log_msg, sizeof(log_msg), 
+                "ERROR: Could not copy all of directory \"%s\" to \"%s\" "
+                "(%ld files copied).", copy->source, copy->dest, tree.files);
+        log_operation(log_msg);
+        return -1;
+    }
+    
+    string_format(log_msg, sizeof(log_msg), 
+            "Directory \"%s\" copied to \"%s\" (%ld files, %ld directories).", 
+            copy->source, copy->dest, tree.files, (long)tree.dir_count);
+    log_operation(log_msg);
+    
+    // Print success message
+    char success_msg[512];
+    int len = string_format(success_msg, sizeof(success_msg), 
+                      "Directory \"%s\" copied to \"%s\" successfully "
+                      "(%ld files, %ld directories).\n", 
+                      copy->source, copy->dest, tree.files, (long)tree.dir_count);
+    out_write(success_msg, len);
+    
+    return 0;
+}
+
+/**
+ * Copy a directory and everything below it
+ * Directories are recreated in order while a pool of worker threads
+ * copies the files. Symbolic links are copied as links.
+ * 
+ * @param source Directory to copy
+ * @param dest Path of the copy, or an existing directory to copy into
+ * @param jobs Number of worker threads, or 0 for one per CPU
+ * @return 0 on success, -1 on failure
+ */
+int copy_directory(const char *source, const char *dest, int jobs) {
+    // Check if directory exists
+    if (!directory_exists(source)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", source);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    char *target = target_path(source, dest);
+    if (!target) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    
+    struct copy_args copy = { source, target, jobs };
+    int result = run_copy(copy_directory_operation, &copy);
+    free(target);
+    return result;
+}
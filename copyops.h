@@ -0,0 +1,19 @@
+#ifndef COPYOPS_H
+#define COPYOPS_H
+
+// Files at least this large are copied in parallel chunks
+#define COPY_PARALLEL_MIN (64L * 1024 * 1024)
+
+// Granularity of the chunks a large file is split into
+#define COPY_CHUNK_ALIGN (1L * 1024 * 1024)
+
+// Copy a file; dest may be an existing directory to copy into
+int copy_file(const char *source, const char *dest, int jobs);
+
+// Move a file, renaming it when source and destination share a device
+int move_file(const char *source, const char *dest);
+
+// Copy a directory and everything below it using worker threads
+int copy_directory(const char *source, const char *dest, int jobs);
+
+#endif // COPYOPS_H
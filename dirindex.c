@@ -0,0 +1,853 @@
+#define _GNU_SOURCE
+#include "dirindex.h"
+#include "dirscan.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>  // renameat()
+#include <time.h>
+
+// Index being built in memory before it is written out
+struct index_builder {
+    struct dir_index_dir *dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+    struct dir_index_entry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+    const struct dir_index_hash *hashes;  // Content hashes to write, sorted by device and inode
+    size_t hash_count;
+    const struct dir_index *old;  // Previous index, or NULL
+    int root_fd;
+    dir_index_dirty_fn is_dirty;  // Directories to read again, or NULL to compare mtimes
+    void *dirty_context;
+};
+
+// Mapped index kept open between commands
+struct warm_index {
+    dev_t dev;
+    ino_t ino;
+    struct dir_index index;    // index.map is NULL for an empty slot
+    int users;
+};
+
+// Indexes kept mapped while a long-running server keeps them warm
+// An index file is only ever replaced, never rewritten in place, so the
+// same inode always holds the same contents.
+static struct warm_index g_warm_indexes[DIR_INDEX_WARM_SLOTS];
+static int g_warm_next = 0;
+static int g_keep_warm = 0;
+
+// Directory being scanned into a builder
+struct index_scan {
+    struct index_builder *builder;
+    int fd;
+    int is_root;
+};
+
+/**
+ * Grow a builder array to hold at least one more element
+ * 
+ * @param array Array to grow
+ * @param capacity Capacity in elements, updated
+ * @param count Elements in use
+ * @param size Size of an element
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int reserve(void **array, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+    void *grown = realloc(*array, new_capacity * size);
+    if (!grown) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Copy a name into the builder's name area
+ * 
+ * @param builder Index being built
+ * @param name Name to add
+ * @param len Length of the name
+ * @param offset Set to the offset of the copy
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int add_name(struct index_builder *builder, const char *name, size_t len, uint64_t *offset) {
+    while (builder->names_len + len + 1 > builder->names_capacity) {
+        size_t capacity = builder->names_capacity ? builder->names_capacity * 2 : 65536;
+        char *grown = realloc(builder->names, capacity);
+        if (!grown) {
+            return -1;
+        }
+        builder->names = grown;
+        builder->names_capacity = capacity;
+    }
+    *offset = builder->names_len;
+    memcpy(builder->names + builder->names_len, name, len);
+    builder->names[builder->names_len + len] = '\0';
+    builder->names_len += len + 1;
+    return 0;
+}
+
+/**
+ * Find the extension of a name
+ * 
+ * @param name Name to examine
+ * @param len Length of the name
+ * @return Offset of the last '.', or len if the name has no extension
+ */
+static uint16_t extension_offset(const char *name, size_t len) {
+    const char *dot = memrchr(name, '.', len);
+    return (dot && dot != name) ? (uint16_t)(dot - name) : (uint16_t)len;
+}
+
+/**
+ * Convert a file mode to a directory entry type
+ * 
+ * @param mode Mode from stat()
+ * @return DT_ value
+ */
+static uint8_t mode_type(mode_t mode) {
+    return S_ISDIR(mode) ? DT_DIR : S_ISREG(mode) ? DT_REG : S_ISLNK(mode) ? DT_LNK :
+           S_ISFIFO(mode) ? DT_FIFO : S_ISSOCK(mode) ? DT_SOCK :
+           S_ISCHR(mode) ? DT_CHR : S_ISBLK(mode) ? DT_BLK : DT_UNKNOWN;
+}
+
+/**
+ * Add a batch of scanned entries with their metadata
+ * 
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Pointer to struct index_scan
+ * @return 0 to keep scanning, -1 on failure
+ */
+static int index_batch(const struct dir_entry *entries, size_t count, void *context) {
+    struct index_scan *scan = (struct index_scan *)context;
+    struct index_builder *builder = scan->builder;
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
+        if (scan->is_root && dir_index_own_file(entry->name)) {
+            continue;
+        }
+        
+        struct stat st;
+        if (fstatat(scan->fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            continue; // Removed since it was read
+        }
+        
+        if (reserve((void **)&builder->entries, &builder->entry_capacity,
+                    builder->entry_count, sizeof(*builder->entries)) == -1) {
+            return -1;
+        }
+        struct dir_index_entry *record = &builder->entries[builder->entry_count];
+        memset(record, 0, sizeof(*record));
+        if (add_name(builder, entry->name, entry->name_len, &record->name) == -1) {
+            return -1;
+        }
+        record->name_len = entry->name_len;
+        record->ext = extension_offset(entry->name, entry->name_len);
+        record->size = st.st_size;
+        record->mtime_sec = st.st_mtime;
+        record->ino = st.st_ino;
+        record->type = mode_type(st.st_mode);
+        record->target_type = record->type;
+        
+        if (record->type == DT_LNK) {
+            struct stat target;
+            record->target_type = (fstatat(scan->fd, entry->name, &target, 0) == 0) ?
+                                  mode_type(target.st_mode) : DT_UNKNOWN;
+        }
+        
+        builder->entry_count++;
+    }
+    
+    return 0;
+}
+
+/**
+ * Order entries by name
+ * 
+ * @param a First entry
+ * @param b Second entry
+ * @param names Name area of the builder
+ * @return Comparison of the names
+ */
+static int compare_entries(const void *a, const void *b, void *names) {
+    const struct dir_index_entry *x = (const struct dir_index_entry *)a;
+    const struct dir_index_entry *y = (const struct dir_index_entry *)b;
+    return strcmp((const char *)names + x->name, (const char *)names + y->name);
+}
+
+/**
+ * Order directories by path
+ * 
+ * @param a First directory
+ * @param b Second directory
+ * @param names Name area of the builder
+ * @return Comparison of the paths
+ */
+static int compare_dirs(const void *a, const void *b, void *names) {
+    const struct dir_index_dir *x = (const struct dir_index_dir *)a;
+    const struct dir_index_dir *y = (const struct dir_index_dir *)b;
+    return strcmp((const char *)names + x->path, (const char *)names + y->path);
+}
+
+/**
+ * Order content hashes by device and inode
+ * 
+ * @param a First hash
+ * @param b Second hash
+ * @return Comparison of the devices, then the inodes
+ */
+static int compare_hashes(const void *a, const void *b) {
+    const struct dir_index_hash *x = (const struct dir_index_hash *)a;
+    const struct dir_index_hash *y = (const struct dir_index_hash *)b;
+    if (x->dev != y->dev) {
+        return (x->dev > y->dev) ? 1 : -1;
+    }
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+/**
+ * Order an entry's inode and size against a content hash's
+ * 
+ * @param key Hash being looked up
+ * @param member Entry of the sorted table
+ * @return Comparison of inode, then size, then mtime
+ */
+static int compare_entry_keys(const void *key, const void *member) {
+    const struct dir_index_hash *x = (const struct dir_index_hash *)key;
+    const struct dir_index_entry *y = *(const struct dir_index_entry *const *)member;
+    if (x->ino != y->ino) {
+        return (x->ino > y->ino) ? 1 : -1;
+    }
+    if (x->size != y->size) {
+        return (x->size > y->size) ? 1 : -1;
+    }
+    return (x->mtime_sec > y->mtime_sec) - (x->mtime_sec < y->mtime_sec);
+}
+
+/**
+ * Order entry pointers by inode, size and mtime
+ * 
+ * @param a Pointer to the first entry
+ * @param b Pointer to the second entry
+ * @return Comparison of inode, then size, then mtime
+ */
+static int compare_entry_inodes(const void *a, const void *b) {
+    const struct dir_index_entry *x = *(const struct dir_index_entry *const *)a;
+    const struct dir_index_entry *y = *(const struct dir_index_entry *const *)b;
+    if (x->ino != y->ino) {
+        return (x->ino > y->ino) ? 1 : -1;
+    }
+    if (x->size != y->size) {
+        return (x->size > y->size) ? 1 : -1;
+    }
+    return (x->mtime_sec > y->mtime_sec) - (x->mtime_sec < y->mtime_sec);
+}
+
+/**
+ * Combine new content hashes with the previous index's
+ * Old hashes are kept only for files the new index still holds with the
+ * same inode, size and mtime, so hashes of deleted files do not pile up.
+ * 
+ * @param builder Built index; its hash table is set to the result
+ * @param added New hashes
+ * @param count Number of new hashes
+ * @return Merged table to free after writing, or NULL on failure
+ */
+static struct dir_index_hash *merge_hashes(struct index_builder *builder, 
+                                           const struct dir_index_hash *added, size_t count) {
+    size_t old_count = builder->old ? builder->old->header->hash_count : 0;
+    struct dir_index_hash *merged = malloc((old_count + count + 1) * sizeof(*merged));
+    const struct dir_index_entry **files = malloc((builder->entry_count + 1) * sizeof(*files));
+    if (!merged || !files) {
+        free(merged);
+        free(files);
+        return NULL;
+    }
+    
+    size_t file_count = 0;
+    for (size_t i = 0; i < builder->entry_count; i++) {
+        if (builder->entries[i].type == DT_REG) {
+            files[file_count++] = &builder->entries[i];
+        }
+    }
+    qsort(files, file_count, sizeof(*files), compare_entry_inodes);
+    
+    // A new hash replaces any old one of the same device and inode
+    memcpy(merged, added, count * sizeof(*merged));
+    qsort(merged, count, sizeof(*merged), compare_hashes);
+    size_t merged_count = count;
+    for (size_t i = 0; i < old_count; i++) {
+        const struct dir_index_hash *old = &builder->old->hashes[i];
+        if (!bsearch(old, merged, count, sizeof(*merged), compare_hashes) &&
+            bsearch(old, files, file_count, sizeof(*files), compare_entry_keys)) {
+            merged[merged_count++] = *old;
+        }
+    }
+    qsort(merged, merged_count, sizeof(*merged), compare_hashes);
+    free(files);
+    
+    builder->hashes = merged;
+    builder->hash_count = merged_count;
+    return merged;
+}
+
+/**
+ * Copy a directory's entries from the previous index
+ * 
+ * @param builder Index being built
+ * @param old_dir Directory in the previous index
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int copy_old_entries(struct index_builder *builder, const struct dir_index_dir *old_dir) {
+    const struct dir_index *old = builder->old;
+    
+    for (uint32_t i = 0; i < old_dir->entry_count; i++) {
+        const struct dir_index_entry *old_entry = &old->entries[old_dir->first_entry + i];
+        if (reserve((void **)&builder->entries, &builder->entry_capacity,
+                    builder->entry_count, sizeof(*builder->entries)) == -1) {
+            return -1;
+        }
+        struct dir_index_entry *record = &builder->entries[builder->entry_count];
+        *record = *old_entry;
+        if (add_name(builder, old->names + old_entry->name, old_entry->name_len, &record->name) == -1) {
+            return -1;
+        }
+        builder->entry_count++;
+    }
+    return 0;
+}
+
+/**
+ * Index a directory and, recursively, its subdirectories
+ * A directory whose mtime and inode match the previous index keeps its
+ * old entries without being read; its subdirectories are still checked,
+ * since changes inside them do not touch its mtime. When the caller
+ * tracks changes itself, a clean directory is trusted without even
+ * being opened.
+ * 
+ * @param builder Index being built
+ * @param parent_fd Directory holding this one, or -1 to open it from the root
+ * @param path Path relative to the root, "" for the root
+ * @param path_len Length of the path
+ * @return 0 on success, -1 on failure
+ */
+static int index_directory(struct index_builder *builder, int parent_fd, 
+                           const char *path, size_t path_len) {
+    const struct dir_index_dir *old_dir = builder->old ? dir_index_find(builder->old, path) : NULL;
+    int trusted = old_dir && builder->is_dirty && !builder->is_dirty(path, builder->dirty_context);
+    
+    struct dir_index_dir dir;
+    memset(&dir, 0, sizeof(dir));
+    if (add_name(builder, path, path_len, &dir.path) == -1) {
+        return -1;
+    }
+    dir.path_len = path_len;
+    dir.first_entry = builder->entry_count;
+    
+    int fd = -1;
+    if (trusted) {
+        dir.mtime_sec = old_dir->mtime_sec;
+        dir.mtime_nsec = old_dir->mtime_nsec;
+        dir.ino = old_dir->ino;
+    } else {
+        // Open relative to the parent, or from the root below a trusted directory
+        const char *name = path;
+        const char *slash = memrchr(path, '/', path_len);
+        if (path_len == 0) {
+            name = ".";
+        } else if (slash && parent_fd != -1) {
+            name = slash + 1;
+        }
+        fd = openat((parent_fd != -1) ? parent_fd : builder->root_fd, name, 
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            // Unreadable, or removed since its parent was read
+            return (path_len == 0) ? -1 : 0;
+        }
+        
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            return -1;
+        }
+        dir.mtime_sec = st.st_mtim.tv_sec;
+        dir.mtime_nsec = st.st_mtim.tv_nsec;
+        dir.ino = st.st_ino;
+        
+        trusted = !builder->is_dirty && old_dir && old_dir->ino == dir.ino &&
+                  old_dir->mtime_sec == dir.mtime_sec && old_dir->mtime_nsec == dir.mtime_nsec;
+    }
+    
+    int result = 0;
+    if (trusted) {
+        result = copy_old_entries(builder, old_dir);
+    } else {
+        struct index_scan scan = { builder, fd, path_len == 0 };
+        result = dir_scan(fd, index_batch, &scan);
+        qsort_r(builder->entries + dir.first_entry, builder->entry_count - dir.first_entry, 
+                sizeof(*builder->entries), compare_entries, builder->names);
+    }
+    dir.entry_count = builder->entry_count - dir.first_entry;
+    
+    if (result == 0 && reserve((void **)&builder->dirs, &builder->dir_capacity, 
+                               builder->dir_count, sizeof(*builder->dirs)) == -1) {
+        result = -1;
+    }
+    if (result == 0) {
+        builder->dirs[builder->dir_count++] = dir;
+    }
+    
+    // Arrays may move while subdirectories are added, so work by index
+    for (size_t i = dir.first_entry; i < dir.first_entry + dir.entry_count && result == 0; i++) {
+        if (builder->entries[i].type != DT_DIR) {
+            continue;
+        }
+        
+        size_t name_len = builder->entries[i].name_len;
+        char *child_path = malloc(path_len + name_len + 2);
+        if (!child_path) {
+            result = -1;
+            break;
+        }
+        size_t child_len = 0;
+        if (path_len > 0) {
+            memcpy(child_path, path, path_len);
+            child_path[path_len] = '/';
+            child_len = path_len + 1;
+        }
+        memcpy(child_path + child_len, builder->names + builder->entries[i].name, name_len + 1);
+        child_len += name_len;
+        
+        result = index_directory(builder, fd, child_path, child_len);
+        free(child_path);
+    }
+    
+    if (fd != -1) {
+        close(fd);
+    }
+    return result;
+}
+
+/**
+ * Write a built index next to the old one and move it into place
+ * Readers that still map the old file keep a consistent view.
+ * 
+ * @param builder Built index
+ * @param root_fd Root directory of the tree
+ * @return 0 on success, -1 on failure
+ */
+static int write_index(struct index_builder *builder, int root_fd) {
+    qsort_r(builder->dirs, builder->dir_count, sizeof(*builder->dirs), compare_dirs, builder->names);
+    
+    struct dir_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DIR_INDEX_MAGIC, sizeof(DIR_INDEX_MAGIC));
+    header.version = DIR_INDEX_VERSION;
+    header.dir_count = builder->dir_count;
+    header.entry_count = builder->entry_count;
+    header.dirs_offset = sizeof(header);
+    header.entries_offset = header.dirs_offset + builder->dir_count * sizeof(*builder->dirs);
+    header.hashes_offset = header.entries_offset + builder->entry_count * sizeof(*builder->entries);
+    header.hash_count = builder->hash_count;
+    header.names_offset = header.hashes_offset + builder->hash_count * sizeof(*builder->hashes);
+    header.names_size = builder->names_len;
+    header.built_sec = time(NULL);
+    
+    char temp_name[64];
+    string_format(temp_name, sizeof(temp_name), "%s.tmp.%d", DIR_INDEX_FILE, (int)getpid());
+    
+    int fd = openat(root_fd, temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    struct {
+        const void *data;
+        size_t len;
+    } parts[] = {
+        { &header, sizeof(header) },
+        { builder->dirs, builder->dir_count * sizeof(*builder->dirs) },
+        { builder->entries, builder->entry_count * sizeof(*builder->entries) },
+        { builder->hashes, builder->hash_count * sizeof(*builder->hashes) },
+        { builder->names, builder->names_len },
+    };
+    
+    int result = 0;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]) && result == 0; i++) {
+        const char *data = parts[i].data;
+        size_t len = parts[i].len;
+        while (len > 0) {
+            ssize_t written = write(fd, data, len);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written == -1) {
+                result = -1;
+                break;
+            }
+            data += written;
+            len -= written;
+        }
+    }
+    
+    if (close(fd) == -1) {
+        result = -1;
+    }
+    if (result == 0 && renameat(root_fd, temp_name, root_fd, DIR_INDEX_FILE) == -1) {
+        result = -1;
+    }
+    if (result == -1) {
+        int saved_errno = errno;
+        unlinkat(root_fd, temp_name, 0);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+/**
+ * Bring the index of a tree up to date
+ * Only directories whose mtime changed since the last update are read
+ * again, so refreshing a slowly changing tree costs one fstat() per
+ * directory rather than one per entry. File sizes and times are those
+ * seen when their directory was last read.
+ * 
+ * @param root Root directory of the tree
+ * @return 0 on success, -1 on failure with errno set
+ */
+int dir_index_update(const char *root) {
+    return dir_index_refresh(root, NULL, NULL);
+}
+
+/**
+ * Rebuild the index of a tree, optionally adding content hashes
+ * The previous index's hashes are carried over as they are.
+ * 
+ * @param root Root directory of the tree
+ * @param is_dirty Called with each indexed directory's path, or NULL to compare mtimes
+ * @param context Passed to is_dirty
+ * @param added Content hashes to add, or NULL
+ * @param added_count Number of hashes to add
+ * @return 0 on success, -1 on failure with errno set
+ */
+static int rebuild_index(const char *root, dir_index_dirty_fn is_dirty, void *context,
+                         const struct dir_index_hash *added, size_t added_count) {
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        return -1;
+    }
+    
+    struct dir_index old;
+    int have_old = (dir_index_open(root, &old) == 0);
+    
+    struct index_builder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.old = have_old ? &old : NULL;
+    builder.root_fd = root_fd;
+    builder.is_dirty = is_dirty;
+    builder.dirty_context = context;
+    
+    int result = index_directory(&builder, root_fd, "", 0);
+    struct dir_index_hash *merged = NULL;
+    if (result == 0 && added_count > 0) {
+        merged = merge_hashes(&builder, added, added_count);
+        if (!merged) {
+            errno = ENOMEM;
+            result = -1;
+        }
+    } else if (have_old) {
+        builder.hashes = old.hashes;
+        builder.hash_count = old.header->hash_count;
+    }
+    if (result == 0) {
+        result = write_index(&builder, root_fd);
+    }
+    int saved_errno = errno;
+    
+    free(merged);
+    if (have_old) {
+        dir_index_close(&old);
+    }
+    free(builder.dirs);
+    free(builder.entries);
+    free(builder.names);
+    close(root_fd);
+    
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Rebuild the index of a tree, reading again only the given directories
+ * Directories for which is_dirty returns 0 keep their indexed entries
+ * unchecked; directories missing from the old index are always read.
+ * 
+ * @param root Root directory of the tree
+ * @param is_dirty Called with each indexed directory's path, or NULL to compare mtimes
+ * @param context Passed to is_dirty
+ * @return 0 on success, -1 on failure with errno set
+ */
+int dir_index_refresh(const char *root, dir_index_dirty_fn is_dirty, void *context) {
+    return rebuild_index(root, is_dirty, context, NULL, 0);
+}
+
+/**
+ * Refresh the index of a tree and add content hashes to it
+ * A hash replaces any earlier one for the same inode. Like
+ * dir_index_update(), this must not run while a watch process owns the
+ * index.
+ * 
+ * @param root Root directory of the tree
+ * @param hashes Hashes to add
+ * @param count Number of hashes
+ * @return 0 on success, -1 on failure with errno set
+ */
+int dir_index_store_hashes(const char *root, const struct dir_index_hash *hashes, size_t count) {
+    return rebuild_index(root, NULL, NULL, hashes, count);
+}
+
+/**
+ * Map the index of a tree for reading
+ * The tables are checked against the file size, so a damaged or foreign
+ * file is rejected rather than read out of bounds.
+ * 
+ * @param root Root directory of the tree
+ * @param index Set to the mapped index
+ * @return 0 on success, -1 if there is no valid index
+ */
+int dir_index_open(const char *root, struct dir_index *index) {
+    char path[4096];
+    string_format(path, sizeof(path), "%s/%s", root, DIR_INDEX_FILE);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct dir_index_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    
+    for (int i = 0; g_keep_warm && i < DIR_INDEX_WARM_SLOTS; i++) {
+        struct warm_index *warm = &g_warm_indexes[i];
+        if (warm->index.map && warm->dev == st.st_dev && warm->ino == st.st_ino) {
+            close(fd);
+            warm->users++;
+            *index = warm->index;
+            return 0;
+        }
+    }
+    
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    
+    const struct dir_index_header *header = (const struct dir_index_header *)map;
+    uint64_t size = st.st_size;
+    int valid = memcmp(header->magic, DIR_INDEX_MAGIC, sizeof(DIR_INDEX_MAGIC)) == 0 &&
+                header->version == DIR_INDEX_VERSION &&
+                header->dirs_offset == sizeof(*header) &&
+                header->entries_offset == header->dirs_offset +
+                                          (uint64_t)header->dir_count * sizeof(struct dir_index_dir) &&
+                header->hashes_offset == header->entries_offset +
+                                         header->entry_count * sizeof(struct dir_index_entry) &&
+                header->names_offset == header->hashes_offset +
+                                        header->hash_count * sizeof(struct dir_index_hash) &&
+                header->names_offset + header->names_size == size &&
+                header->names_size > 0 &&
+                ((const char *)map)[size - 1] == '\0';
+    
+    if (valid) {
+        index->dirs = (const struct dir_index_dir *)((const char *)map + header->dirs_offset);
+        index->entries = (const struct dir_index_entry *)((const char *)map + header->entries_offset);
+        index->hashes = (const struct dir_index_hash *)((const char *)map + header->hashes_offset);
+        index->names = (const char *)map + header->names_offset;
+        
+        for (uint32_t i = 0; valid && i < header->dir_count; i++) {
+            const struct dir_index_dir *dir = &index->dirs[i];
+            valid = dir->path < header->names_size &&
+                    dir->first_entry + dir->entry_count <= header->entry_count;
+        }
+        for (uint64_t i = 0; valid && i < header->entry_count; i++) {
+            valid = index->entries[i].name + index->entries[i].name_len < header->names_size;
+        }
+    }
+    
+    if (!valid) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    
+    index->map = map;
+    index->size = st.st_size;
+    index->header = header;
+    
+    // Keep it in the next slot nobody is using
+    for (int i = 0; g_keep_warm && i < DIR_INDEX_WARM_SLOTS; i++) {
+        struct warm_index *warm = &g_warm_indexes[(g_warm_next + i) % DIR_INDEX_WARM_SLOTS];
+        if (warm->users == 0) {
+            if (warm->index.map) {
+                munmap(warm->index.map, warm->index.size);
+            }
+            warm->dev = st.st_dev;
+            warm->ino = st.st_ino;
+            warm->index = *index;
+            warm->users = 1;
+            g_warm_next = (g_warm_next + i + 1) % DIR_INDEX_WARM_SLOTS;
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Unmap an index
+ * 
+ * @param index Index opened by dir_index_open()
+ */
+void dir_index_close(struct dir_index *index) {
+    for (int i = 0; i < DIR_INDEX_WARM_SLOTS; i++) {
+        struct warm_index *warm = &g_warm_indexes[i];
+        if (warm->index.map == index->map && index->map) {
+            if (--warm->users == 0 && !g_keep_warm) {
+                munmap(warm->index.map, warm->index.size);
+                warm->index.map = NULL;
+            }
+            index->map = NULL;
+            return;
+        }
+    }
+    munmap(index->map, index->size);
+    index->map = NULL;
+}
+
+/**
+ * Keep indexes mapped between commands
+ * A long-running server turns this on so repeated listings of a tree
+ * reuse its mapping. Turning it off unmaps every index not in use.
+ * 
+ * @param enabled 1 to keep indexes mapped, 0 to unmap them on close
+ */
+void dir_index_keep_warm(int enabled) {
+    g_keep_warm = enabled;
+    for (int i = 0; !enabled && i < DIR_INDEX_WARM_SLOTS; i++) {
+        struct warm_index *warm = &g_warm_indexes[i];
+        if (warm->index.map && warm->users == 0) {
+            munmap(warm->index.map, warm->index.size);
+            warm->index.map = NULL;
+        }
+    }
+}
+
+/**
+ * Find a directory by path with a binary search of the directory table
+ * 
+ * @param index Mapped index
+ * @param path Path relative to the root, "" for the root
+ * @return Directory, or NULL if the path is not an indexed directory
+ */
+const struct dir_index_dir *dir_index_find(const struct dir_index *index, const char *path) {
+    size_t low = 0;
+    size_t high = index->header->dir_count;
+    
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = strcmp(index->names + index->dirs[mid].path, path);
+        if (order == 0) {
+            return &index->dirs[mid];
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Find the cached content hash of a file with a binary search by device
+ * and inode
+ * 
+ * @param index Mapped index
+ * @param dev Device of the file
+ * @param ino Inode of the file
+ * @param size Current size of the file
+ * @param mtime_sec Current mtime of the file, seconds
+ * @param mtime_nsec Current mtime of the file, nanoseconds
+ * @return Hash, or NULL if none is cached or the file changed since
+ */
+const struct dir_index_hash *dir_index_find_hash(const struct dir_index *index, uint64_t dev,
+                                                 uint64_t ino, uint64_t size,
+                                                 int64_t mtime_sec, int64_t mtime_nsec) {
+    struct dir_index_hash key;
+    key.dev = dev;
+    key.ino = ino;
+    const struct dir_index_hash *found = bsearch(&key, index->hashes, index->header->hash_count,
+                                                 sizeof(key), compare_hashes);
+    if (!found || found->size != size || found->mtime_sec != mtime_sec ||
+        found->mtime_nsec != mtime_nsec) {
+        return NULL;
+    }
+    return found;
+}
+
+/**
+ * Check whether a name is one of the index's own files
+ * The index, its temporary copies and related files are never indexed.
+ * 
+ * @param name Name of an entry at the root of the tree
+ * @return 1 for index files, 0 otherwise
+ */
+int dir_index_own_file(const char *name) {
+    return strncmp(name, DIR_INDEX_FILE, sizeof(DIR_INDEX_FILE) - 1) == 0;
+}
+
+/**
+ * Check whether a watch process keeps the index of a tree current
+ * The watcher holds an exclusive lock on the tree's watch file for as
+ * long as it runs, so a lock that cannot be shared means it is alive.
+ * 
+ * @param root Root directory of the tree
+ * @return 1 if a watcher is running, 0 otherwise
+ */
+int dir_index_watched(const char *root) {
+    char path[4096];
+    string_format(path, sizeof(path), "%s/%s", root, DIR_INDEX_WATCH_FILE);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    
+    int watched = (flock(fd, LOCK_SH | LOCK_NB) == -1 && errno == EWOULDBLOCK);
+    close(fd);
+    return watched;
+}
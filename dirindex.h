@@ -0,0 +1,121 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Index file kept at the top of each indexed tree
+#define DIR_INDEX_FILE ".fmindex"
+
+// Lock file held by the watch process of a tree
+#define DIR_INDEX_WATCH_FILE ".fmindex.watch"
+
+// Identifies index files and their layout
+#define DIR_INDEX_MAGIC "FMINDEX"
+#define DIR_INDEX_VERSION 3
+
+// Index mappings kept open between commands while kept warm
+#define DIR_INDEX_WARM_SLOTS 8
+
+// Start of an index file
+// The file holds the header, the directory table sorted by path, the
+// entry table (each directory's entries contiguous and sorted by name),
+// the content hashes sorted by device and inode and the NUL-terminated
+// names the tables point into.
+struct dir_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dir_count;
+    uint64_t entry_count;
+    uint64_t dirs_offset;
+    uint64_t entries_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    int64_t built_sec;
+    uint64_t hashes_offset;
+    uint64_t hash_count;
+};
+
+// One directory of the tree
+struct dir_index_dir {
+    uint64_t path;          // Offset of the path relative to the root, "" for the root
+    uint64_t first_entry;
+    uint32_t entry_count;
+    uint32_t path_len;
+    int64_t mtime_sec;      // Directory mtime when its entries were read
+    int64_t mtime_nsec;
+    uint64_t ino;
+};
+
+// One entry of a directory
+struct dir_index_entry {
+    uint64_t name;          // Offset of the name
+    uint64_t size;
+    int64_t mtime_sec;
+    uint64_t ino;
+    uint16_t name_len;
+    uint16_t ext;           // Offset of the extension in the name, or name_len if none
+    uint8_t type;           // DT_ value, links not followed
+    uint8_t target_type;    // DT_ value, links followed; DT_UNKNOWN if dangling
+    uint8_t reserved[2];
+};
+
+// Content hash of a file, valid while its device, inode, size and mtime
+// are unchanged
+struct dir_index_hash {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash[2];
+};
+
+// An index mapped for reading
+struct dir_index {
+    void *map;
+    size_t size;
+    const struct dir_index_header *header;
+    const struct dir_index_dir *dirs;
+    const struct dir_index_entry *entries;
+    const struct dir_index_hash *hashes;
+    const char *names;
+};
+
+// Bring the index of a tree up to date, rescanning changed directories
+int dir_index_update(const char *root);
+
+// Tells dir_index_refresh() whether a directory must be read again
+typedef int (*dir_index_dirty_fn)(const char *path, void *context);
+
+// Rebuild the index of a tree, reading only directories is_dirty selects
+int dir_index_refresh(const char *root, dir_index_dirty_fn is_dirty, void *context);
+
+// Refresh the index of a tree and add content hashes to it
+int dir_index_store_hashes(const char *root, const struct dir_index_hash *hashes, size_t count);
+
+// Find the cached content hash of a file with the given device, inode,
+// size and mtime
+const struct dir_index_hash *dir_index_find_hash(const struct dir_index *index, uint64_t dev,
+                                                 uint64_t ino, uint64_t size,
+                                                 int64_t mtime_sec, int64_t mtime_nsec);
+
+// Check whether a watch process keeps the index of a tree current
+int dir_index_watched(const char *root);
+
+// Map the index of a tree for reading
+int dir_index_open(const char *root, struct dir_index *index);
+
+// Unmap an index
+void dir_index_close(struct dir_index *index);
+
+// Keep indexes mapped between commands, for a long-running server
+void dir_index_keep_warm(int enabled);
+
+// Find a directory by its path relative to the root, "" for the root
+const struct dir_index_dir *dir_index_find(const struct dir_index *index, const char *path);
+
+// Check whether a name is one of the index's own files
+int dir_index_own_file(const char *name);
+
+#endif // DIRINDEX_H
@@ -2,23 +2,78 @@
 #include "dirops.h"
 #include "logging.h"
 #include "utils.h"
+#include "threadpool.h"
+#include "dirscan.h"
+#include "dirwalk.h"
+#include "match.h"
+#include "dirindex.h"
+#include "fdcache.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <dirent.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+
+// Listing output buffered before it is written
+#define LISTING_BUFFER_SIZE 65536
 
 /**
- * Create a new directory with the given name
+ * Convert a file mode to a directory entry type
  * 
- * @param dirname Name of the directory to create
- * @return 0 on success, -1 on failure
+ * @param mode Mode from stat()
+ * @return DT_DIR, DT_REG, DT_LNK or another DT_ value
+ */
+static int mode_to_type(mode_t mode) {
+    if (S_ISDIR(mode)) {
+        return DT_DIR;
+    }
+    if (S_ISREG(mode)) {
+        return DT_REG;
+    }
+    if (S_ISLNK(mode)) {
+        return DT_LNK;
+    }
+    return S_ISFIFO(mode) ? DT_FIFO : S_ISSOCK(mode) ? DT_SOCK : 
+           S_ISCHR(mode) ? DT_CHR : S_ISBLK(mode) ? DT_BLK : DT_UNKNOWN;
+}
+
+/**
+ * Get the type of a directory entry
+ * Most filesystems report the type in the entry itself, so metadata is
+ * only read for DT_UNKNOWN, or for links when their target matters.
+ * 
+ * @param dir_fd Descriptor of the directory holding the entry
+ * @param name Entry name
+ * @param d_type Type from the directory entry
+ * @param follow Whether to report the type of a symbolic link's target
+ * @return DT_ value, or -1 if the entry could not be examined
  */
+static int entry_type(int dir_fd, const char *name, unsigned char d_type, int follow) {
+    struct stat st;
+    int type = d_type;
+    
+    if (type == DT_UNKNOWN) {
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            return -1;
+        }
+        type = mode_to_type(st.st_mode);
+    }
+    
+    if (type == DT_LNK && follow) {
+        if (fstatat(dir_fd, name, &st, 0) == -1) {
+            return -1; // Dangling link
+        }
+        type = mode_to_type(st.st_mode);
+    }
+    
+    return type;
+}
+
 /**
  * Create a new directory
  * 
@@ -32,8 +87,8 @@ int create_directory(const char *dirname) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Directory \"%s\" already exists.\n", dirname);
-        write(STDERR_FILENO, error_msg, len);
-
+        err_write(error_msg, len);
+        
         // Log the error
         char log_error[256];
         string_format(log_error, sizeof(log_error), 
@@ -49,7 +104,7 @@ int create_directory(const char *dirname) {
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not create directory \"%s\": %s\n", 
                           dirname, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         
         // Log the error
         char log_error[256];
@@ -70,344 +125,1489 @@ int create_directory(const char *dirname) {
     char success_msg[256];
     int len = string_format(success_msg, sizeof(success_msg), 
                       "Directory \"%s\" created successfully.\n", dirname);
-    write(STDOUT_FILENO, success_msg, len);
+    out_write(success_msg, len);
     
     return 0;
 }
 
+// Single-directory listing in progress
+struct listing {
+    int fd;                 // Directory being listed
+    const struct matcher *matcher;  // Names to list, or NULL for everything
+    int count;                      // Entries listed
+    size_t len;                     // Bytes pending in buffer
+    char buffer[LISTING_BUFFER_SIZE];
+};
+
 /**
- * List contents of a directory
- * This operation is performed in a child process
+ * Write a listing's pending output to standard output
  * 
- * @param dirname Name of the directory to list
- * @return 0 on success, -1 on failure
+ * @param listing Listing to flush
  */
-int list_directory(const char *dirname) {
-    // Check if directory exists
-    if (!directory_exists(dirname)) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Directory \"%s\" not found.\n", dirname);
-        write(STDERR_FILENO, error_msg, len);
-        return -1;
+static void listing_flush(struct listing *listing) {
+    if (listing->len > 0) {
+        out_write(listing->buffer, listing->len);
+        listing->len = 0;
     }
+}
+
+/**
+ * Add one "  prefix name" line to a listing
+ * 
+ * @param listing Listing to add to
+ * @param prefix Text before the name
+ * @param name Entry name, or a path relative to the listed directory
+ * @param name_len Length of the name
+ */
+static void listing_add(struct listing *listing, const char *prefix, 
+                        const char *name, size_t name_len) {
+    size_t prefix_len = strlen(prefix);
     
-    // Create a child process to perform the listing
-    pid_t pid = fork();
+    if (listing->len + prefix_len + name_len + 1 > sizeof(listing->buffer)) {
+        listing_flush(listing);
+    }
     
-    if (pid == -1) {
-        // Fork failed
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not create process: %s\n", strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        return -1;
-    } 
-    else if (pid == 0) {
-        // Child process
-        DIR *dir;
-        struct dirent *entry;
-        
-        // Open the directory
-        dir = opendir(dirname);
-        if (!dir) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Could not open directory \"%s\": %s\n", 
-                              dirname, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            _exit(EXIT_FAILURE);
-        }
-        
-        // Print directory contents header
-        char header[256];
-        int header_len = string_format(header, sizeof(header), 
-                                 "Contents of directory \"%s\":\n", dirname);
-        write(STDOUT_FILENO, header, header_len);
+    // Only very deep paths from the index are longer than the buffer
+    if (prefix_len + name_len + 1 > sizeof(listing->buffer)) {
+        out_write(prefix, prefix_len);
+        out_write(name, name_len);
+        out_write("\n", 1);
+        listing->count++;
+        return;
+    }
+    
+    char *p = listing->buffer + listing->len;
+    memcpy(p, prefix, prefix_len);
+    memcpy(p + prefix_len, name, name_len);
+    p[prefix_len + name_len] = '\n';
+    listing->len += prefix_len + name_len + 1;
+    listing->count++;
+}
+
+/**
+ * Add a batch of entries to a listing
+ * 
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Listing being built
+ * @return 0 to keep scanning
+ */
+static int listing_batch(const struct dir_entry *entries, size_t count, void *context) {
+    struct listing *listing = (struct listing *)context;
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
         
-        // Read directory entries
-        int count = 0;
-        while ((entry = readdir(dir)) != NULL) {
-            // Skip "." and ".." entries
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        if (listing->matcher) {
+            // Check the name first; only matching names need their type
+            if (!matcher_match(listing->matcher, entry->name, entry->name_len)) {
                 continue;
             }
             
-            // Determine if entry is a directory
-            char path[512];
-            string_format(path, sizeof(path), "%s/%s", dirname, entry->d_name);
-            
-            struct stat st;
-            if (stat(path, &st) == -1) {
-                continue; // Skip if we can't get information
-            }
-            
-            // Prepare entry string with directory indicator
-            char entry_str[512];
-            int entry_len;
-            if (S_ISDIR(st.st_mode)) {
-                entry_len = string_format(entry_str, sizeof(entry_str), "  [DIR] %s\n", entry->d_name);
-            } else {
-                entry_len = string_format(entry_str, sizeof(entry_str), "  %s\n", entry->d_name);
+            // Only list regular files, not directories
+            if (entry_type(listing->fd, entry->name, entry->type, 1) == DT_REG) {
+                listing_add(listing, "  ", entry->name, entry->name_len);
             }
-            
-            // Write entry to stdout
-            write(STDOUT_FILENO, entry_str, entry_len);
-            count++;
+            continue;
         }
         
-        // Close directory
-        closedir(dir);
-        
-        // If no entries found, print a message
-        if (count == 0) {
-            const char *empty_msg = "  (empty directory)\n";
-            write(STDOUT_FILENO, empty_msg, strlen(empty_msg));
+        // Determine if entry is a directory, following links as stat() would
+        int type = entry_type(listing->fd, entry->name, entry->type, 1);
+        if (type == -1) {
+            continue; // Skip if we can't get information
         }
         
-        // Exit successfully
-        _exit(EXIT_SUCCESS);
-    } 
-    else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
-        
-        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
-            // Log the operation
-            char log_msg[256];
-            string_format(log_msg, sizeof(log_msg), "Listed contents of directory \"%s\".", dirname);
-            log_operation(log_msg);
-            
-            return 0;
-        } else {
-            return -1;
-        }
+        listing_add(listing, (type == DT_DIR) ? "  [DIR] " : "  ", entry->name, entry->name_len);
     }
+    
+    return 0;
 }
 
 /**
- * List files with a specific extension in a directory
- * This operation is performed in a child process
+ * Open a directory for listing and write its header
+ * 
+ * @param dirname Name of the directory
+ * @param extension Patterns as given, for the header
+ * @param matcher Compiled patterns, or NULL to list everything
+ * @return New listing, or NULL on failure
+ */
+static struct listing *open_listing(const char *dirname, const char *extension, 
+                                    const struct matcher *matcher) {
+    struct listing *listing = malloc(sizeof(*listing));
+    if (!listing) {
+        char error_msg[] = "Error: Memory allocation failed\n";
+        err_write(error_msg, strlen(error_msg));
+        return NULL;
+    }
+    
+    // Open the directory
+    listing->fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (listing->fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open directory \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        free(listing);
+        return NULL;
+    }
+    
+    listing->matcher = matcher;
+    listing->count = 0;
+    listing->len = 0;
+    
+    // Print directory contents header
+    if (matcher) {
+        listing->len = string_format(listing->buffer, sizeof(listing->buffer), 
+                               "Files with extension \"%s\" in directory \"%s\":\n", 
+                               extension, dirname);
+    } else {
+        listing->len = string_format(listing->buffer, sizeof(listing->buffer), 
+                               "Contents of directory \"%s\":\n", dirname);
+    }
+    
+    return listing;
+}
+
+/**
+ * Read a listing's directory, write the remaining output and free it
+ * 
+ * @param listing Listing opened by open_listing()
+ * @param dirname Name of the directory, for error messages
+ * @return 0 on success, -1 if the directory could not be read
+ */
+static int finish_listing(struct listing *listing, const char *dirname) {
+    int result = dir_scan(listing->fd, listing_batch, listing);
+    int scan_errno = errno;
+    
+    // Close directory
+    close(listing->fd);
+    listing_flush(listing);
+    
+    if (result == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not read directory \"%s\": %s\n", 
+                          dirname, strerror(scan_errno));
+        err_write(error_msg, len);
+    }
+    
+    int count = listing->count;
+    free(listing);
+    
+    return (result == -1) ? -1 : count;
+}
+
+/**
+ * Write the entries of a directory to standard output
+ * 
+ * @param arg Name of the directory to list
+ * @return 0 on success, -1 on failure
+ */
+static int list_directory_operation(void *arg) {
+    const char *dirname = (const char *)arg;
+    
+    struct listing *listing = open_listing(dirname, NULL, NULL);
+    if (!listing) {
+        return -1;
+    }
+    
+    int count = finish_listing(listing, dirname);
+    if (count == -1) {
+        return -1;
+    }
+    
+    // If no entries found, print a message
+    if (count == 0) {
+        const char *empty_msg = "  (empty directory)\n";
+        out_write(empty_msg, strlen(empty_msg));
+    }
+    
+    return 0;
+}
+
+/**
+ * List contents of a directory
+ * Runs in-process, or in a child process when isolation is enabled
  * 
  * @param dirname Name of the directory to list
- * @param extension File extension to filter by (e.g., ".txt")
  * @return 0 on success, -1 on failure
  */
-int list_files_by_extension(const char *dirname, const char *extension) {
+int list_directory(const char *dirname) {
     // Check if directory exists
     if (!directory_exists(dirname)) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Directory \"%s\" not found.\n", dirname);
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         return -1;
     }
     
-    // Create a child process to perform the listing
-    pid_t pid = fork();
+    int result = run_operation(list_directory_operation, (void *)dirname);
     
-    if (pid == -1) {
+    if (result == RUN_FORK_FAILED) {
         // Fork failed
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not create process: %s\n", strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         return -1;
-    } 
-    else if (pid == 0) {
-        // Child process
-        DIR *dir;
-        struct dirent *entry;
-        
-        // Open the directory
-        dir = opendir(dirname);
-        if (!dir) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Could not open directory \"%s\": %s\n", 
-                              dirname, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            _exit(EXIT_FAILURE);
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "Listed contents of directory \"%s\".", dirname);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+// Entries collected by one walker thread
+struct walk_output {
+    char buffer[LISTING_BUFFER_SIZE];
+    size_t len;
+    char **entries;     // --sorted: 'd' or 'f' followed by the path
+    size_t count;
+    size_t capacity;
+};
+
+// State shared by the walker threads
+struct walk_state {
+    const char *root;
+    const struct matcher *matcher;  // Regular files to list, or NULL for all
+    int sorted;
+    int workers;
+    struct walk_output *outputs;  // One per worker
+    pthread_mutex_t output_lock;  // Keeps flushed buffers from interleaving
+    long entries;                 // Accessed atomically
+    int failed;                   // Accessed atomically
+};
+
+// Arguments for the recursive listing operation
+struct recursive_args {
+    const char *dirname;
+    const char *extension;          // Patterns as given, or NULL
+    const struct matcher *matcher;  // Compiled patterns, or NULL
+    int jobs;
+    int sorted;
+};
+
+/**
+ * Write a walker's buffered output to standard output
+ * 
+ * @param state Walk state
+ * @param output Output to flush
+ */
+static void walk_flush(struct walk_state *state, struct walk_output *output) {
+    if (output->len > 0) {
+        pthread_mutex_lock(&state->output_lock);
+        out_write(output->buffer, output->len);
+        pthread_mutex_unlock(&state->output_lock);
+        output->len = 0;
+    }
+}
+
+/**
+ * Record one entry found by the walk
+ * 
+ * @param state Walk state
+ * @param output Calling worker's output
+ * @param path Path relative to the walk root
+ * @param is_dir Whether the entry is a directory
+ */
+static void walk_emit(struct walk_state *state, struct walk_output *output, 
+                      const char *path, int is_dir) {
+    size_t path_len = strlen(path);
+    __atomic_add_fetch(&state->entries, 1, __ATOMIC_RELAXED);
+    
+    if (state->sorted) {
+        if (output->count == output->capacity) {
+            size_t capacity = output->capacity ? output->capacity * 2 : 1024;
+            char **entries = realloc(output->entries, capacity * sizeof(*entries));
+            if (!entries) {
+                __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            output->entries = entries;
+            output->capacity = capacity;
         }
+        char *entry = malloc(path_len + 2);
+        if (!entry) {
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        entry[0] = is_dir ? 'd' : 'f';
+        memcpy(entry + 1, path, path_len + 1);
+        output->entries[output->count++] = entry;
+        return;
+    }
+    
+    // "  [DIR] path\n" or "  path\n"
+    const char *prefix = is_dir ? "  [DIR] " : "  ";
+    size_t prefix_len = strlen(prefix);
+    size_t line_len = prefix_len + path_len + 1;
+    
+    if (output->len + line_len > sizeof(output->buffer)) {
+        walk_flush(state, output);
+    }
+    if (line_len > sizeof(output->buffer)) {
+        pthread_mutex_lock(&state->output_lock);
+        out_write(prefix, prefix_len);
+        out_write(path, path_len);
+        out_write("\n", 1);
+        pthread_mutex_unlock(&state->output_lock);
+        return;
+    }
+    
+    memcpy(output->buffer + output->len, prefix, prefix_len);
+    memcpy(output->buffer + output->len + prefix_len, path, path_len);
+    output->buffer[output->len + line_len - 1] = '\n';
+    output->len += line_len;
+}
+
+/**
+ * Report a directory the walk could not read
+ * 
+ * @param state Walk state
+ * @param path Path relative to the walk root
+ * @param error errno value
+ */
+static void walk_error(struct walk_state *state, const char *path, int error) {
+    char error_msg[512];
+    int len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not open directory \"%s/%s\": %s\n", 
+                      state->root, path, strerror(error));
+    err_write(error_msg, len);
+    __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Report a directory the walk could not read
+ * 
+ * @param path Path relative to the walk root
+ * @param error errno value
+ * @param context Walk state
+ */
+static void walk_dir_error(const char *path, int error, void *context) {
+    walk_error((struct walk_state *)context, path, error);
+}
+
+/**
+ * Record a batch of entries and enter the subdirectories among them
+ * 
+ * @param scan Directory being read
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Walk state
+ * @return 0 to keep scanning, 1 to stop after a memory allocation failure
+ */
+static int walk_batch(struct dir_walk_scan *scan, const struct dir_entry *entries, 
+                      size_t count, void *context) {
+    struct walk_state *state = (struct walk_state *)context;
+    struct walk_output *output = &state->outputs[scan->worker];
+    size_t path_len = scan->path_len;
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
         
-        // Print directory contents header
-        char header[256];
-        int header_len = string_format(header, sizeof(header), 
-                                 "Files with extension \"%s\" in directory \"%s\":\n", 
-                                 extension, dirname);
-        write(STDOUT_FILENO, header, header_len);
-        
-        // Read directory entries
-        int count = 0;
-        size_t ext_len = strlen(extension);
+        int type = entry_type(scan->fd, entry->name, entry->type, 0);
+        if (type == -1) {
+            continue; // Skip if we can't get information
+        }
+        int is_dir = (type == DT_DIR);
         
-        while ((entry = readdir(dir)) != NULL) {
-            // Skip "." and ".." entries
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        // With patterns, only matching regular files are listed
+        int listed = 1;
+        if (state->matcher) {
+            listed = !is_dir && matcher_match(state->matcher, entry->name, entry->name_len) && 
+                     (type == DT_REG || 
+                      (type == DT_LNK && entry_type(scan->fd, entry->name, type, 1) == DT_REG));
+            if (!listed && !is_dir) {
                 continue;
             }
-            
-            // Get filename length
-            size_t name_len = strlen(entry->d_name);
-            
-            // Check if file has the specified extension
-            if (name_len > ext_len && 
-                strcmp(entry->d_name + name_len - ext_len, extension) == 0) {
-                    
-                // Prepare full path for stat
-                char path[512];
-                string_format(path, sizeof(path), "%s/%s", dirname, entry->d_name);
-                
-                struct stat st;
-                if (stat(path, &st) == -1) {
-                    continue; // Skip if we can't get information
-                }
-                
-                // Only list regular files, not directories
-                if (S_ISREG(st.st_mode)) {
-                    // Prepare entry string
-                    char entry_str[512];
-                    int entry_len = string_format(entry_str, sizeof(entry_str), 
-                                            "  %s\n", entry->d_name);
-                    
-                    // Write entry to stdout
-                    write(STDOUT_FILENO, entry_str, entry_len);
-                    count++;
-                }
-            }
         }
         
-        // Close directory
-        closedir(dir);
-        
-        // If no matching files found, print a message
-        if (count == 0) {
-            char no_files_msg[256];
-            int msg_len = string_format(no_files_msg, sizeof(no_files_msg), 
-                                  "No files with extension \"%s\" found in \"%s\".\n", 
-                                  extension, dirname);
-            write(STDOUT_FILENO, no_files_msg, msg_len);
+        if (listed) {
+            char *path = malloc(path_len + entry->name_len + 2);
+            if (!path) {
+                __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+            if (path_len > 0) {
+                memcpy(path, scan->path, path_len);
+                path[path_len] = '/';
+                memcpy(path + path_len + 1, entry->name, entry->name_len + 1);
+            } else {
+                memcpy(path, entry->name, entry->name_len + 1);
+            }
+            walk_emit(state, output, path, is_dir);
+            free(path);
         }
         
-        // Exit successfully
-        _exit(EXIT_SUCCESS);
-    } 
-    else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
-        
-        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
-            // Log the operation
-            char log_msg[256];
-            string_format(log_msg, sizeof(log_msg), 
-                    "Listed files with extension \"%s\" in directory \"%s\".", 
-                    extension, dirname);
-            log_operation(log_msg);
-            
-            return 0;
-        } else {
-            return -1;
+        if (is_dir && dir_walk_enter(scan, entry->name, entry->name_len) == -1) {
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+            return 1;
         }
     }
+    
+    return 0;
 }
 
 /**
- * Delete an empty directory
+ * Order collected entries by path
  * 
- * @param dirname Name of the directory to delete
+ * @param a Pointer to the first entry
+ * @param b Pointer to the second entry
+ * @return Comparison of the paths
+ */
+static int compare_walk_entries(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a + 1, *(const char *const *)b + 1);
+}
+
+/**
+ * Write collected entries to standard output in path order
+ * 
+ * @param state Walk state
+ */
+static void write_sorted_entries(struct walk_state *state) {
+    int workers = state->workers;
+    size_t total = 0;
+    for (int i = 0; i < workers; i++) {
+        total += state->outputs[i].count;
+    }
+    
+    char **entries = malloc((total ? total : 1) * sizeof(*entries));
+    if (!entries) {
+        err_write("Error: Memory allocation failed\n", 32);
+        __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    size_t count = 0;
+    for (int i = 0; i < workers; i++) {
+        memcpy(entries + count, state->outputs[i].entries, 
+               state->outputs[i].count * sizeof(*entries));
+        count += state->outputs[i].count;
+    }
+    qsort(entries, count, sizeof(*entries), compare_walk_entries);
+    
+    // All workers have finished, so the first output buffer is free to use
+    state->sorted = 0;
+    for (size_t i = 0; i < count; i++) {
+        walk_emit(state, &state->outputs[0], entries[i] + 1, entries[i][0] == 'd');
+    }
+    walk_flush(state, &state->outputs[0]);
+    free(entries);
+}
+
+/**
+ * Write the whole tree below a directory to standard output
+ * 
+ * @param arg Pointer to struct recursive_args
+ * @return 0 on success, -1 if any part of the tree could not be listed
+ */
+static int list_recursive_operation(void *arg) {
+    const struct recursive_args *list = (const struct recursive_args *)arg;
+    const char *dirname = list->dirname;
+    
+    // Open the directory
+    int root_fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open directory \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    struct walk_state state;
+    state.root = dirname;
+    state.matcher = list->matcher;
+    state.sorted = list->sorted;
+    state.entries = 0;
+    state.failed = 0;
+    state.workers = (list->jobs > 0) ? list->jobs : pool_default_workers();
+    state.outputs = calloc(state.workers, sizeof(*state.outputs));
+    if (!state.outputs) {
+        close(root_fd);
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    pthread_mutex_init(&state.output_lock, NULL);
+    
+    // Print directory contents header
+    char header[512];
+    int header_len;
+    if (list->matcher) {
+        header_len = string_format(header, sizeof(header), 
+                             "Files with extension \"%s\" in directory \"%s\" (recursive):\n", 
+                             list->extension, dirname);
+    } else {
+        header_len = string_format(header, sizeof(header), 
+                             "Contents of directory \"%s\" (recursive):\n", dirname);
+    }
+    out_write(header, header_len);
+    
+    if (dir_walk(root_fd, state.workers, walk_batch, walk_dir_error, &state) == -1) {
+        err_write("Error: Could not start worker threads\n", 38);
+        state.failed = 1;
+    }
+    
+    int workers = state.workers;
+    if (state.sorted) {
+        write_sorted_entries(&state);
+    } else {
+        for (int i = 0; i < workers; i++) {
+            walk_flush(&state, &state.outputs[i]);
+        }
+    }
+    
+    // If no entries found, print a message
+    if (state.entries == 0 && list->matcher) {
+        char no_files_msg[512];
+        int msg_len = string_format(no_files_msg, sizeof(no_files_msg), 
+                              "No files with extension \"%s\" found in \"%s\".\n", 
+                              list->extension, dirname);
+        out_write(no_files_msg, msg_len);
+    } else if (state.entries == 0) {
+        const char *empty_msg = "  (empty directory)\n";
+        out_write(empty_msg, strlen(empty_msg));
+    }
+    
+    for (int i = 0; i < workers; i++) {
+        for (size_t j = 0; j < state.outputs[i].count; j++) {
+            free(state.outputs[i].entries[j]);
+        }
+        free(state.outputs[i].entries);
+    }
+    free(state.outputs);
+    pthread_mutex_destroy(&state.output_lock);
+    
+    return state.failed ? -1 : 0;
+}
+
+/**
+ * List a directory and all of its subdirectories
+ * Directories are read in parallel by a pool of worker threads, each
+ * opening subdirectories relative to their parent's descriptor.
+ * Symbolic links to directories are listed but not followed.
+ * 
+ * @param dirname Name of the directory to list
+ * @param jobs Number of worker threads, or 0 for one per CPU
+ * @param sorted Whether to print the entries in path order
  * @return 0 on success, -1 on failure
  */
-int delete_directory(const char *dirname) {
+int list_directory_recursive(const char *dirname, int jobs, int sorted) {
     // Check if directory exists
     if (!directory_exists(dirname)) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Directory \"%s\" not found.\n", dirname);
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         return -1;
     }
     
-    // Create a child process to perform the deletion
-    pid_t pid = fork();
+    struct recursive_args list = { dirname, NULL, NULL, jobs, sorted };
+    int result = run_operation(list_recursive_operation, &list);
     
-    if (pid == -1) {
+    if (result == RUN_FORK_FAILED) {
         // Fork failed
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not create process: %s\n", strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         return -1;
-    } 
-    else if (pid == 0) {
-        // Child process
-        
-        // Check if directory is empty
-        DIR *dir = opendir(dirname);
-        if (!dir) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Could not open directory \"%s\": %s\n", 
-                              dirname, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            _exit(EXIT_FAILURE);
-        }
-        
-        struct dirent *entry;
-        int is_empty = 1;
-        
-        while ((entry = readdir(dir)) != NULL) {
-            // Skip "." and ".." entries
-            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-                is_empty = 0;
-                break;
-            }
-        }
-        
-        closedir(dir);
-        
-        if (!is_empty) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Directory \"%s\" is not empty.\n", dirname);
-            write(STDERR_FILENO, error_msg, len);
-            _exit(EXIT_FAILURE);
-        }
-        
-        // Delete the directory
-        if (rmdir(dirname) == -1) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Could not delete directory \"%s\": %s\n", 
-                              dirname, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            _exit(EXIT_FAILURE);
-        }
-        
-        // Exit successfully
-        _exit(EXIT_SUCCESS);
-    } 
-    else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), 
+            "Listed contents of directory \"%s\" recursively.", dirname);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+// Arguments for the extension listing operation
+struct extension_args {
+    const char *dirname;
+    const char *extension;
+    const struct matcher *matcher;
+};
+
+/**
+ * Write the regular files with a given extension to standard output
+ * 
+ * @param arg Pointer to struct extension_args
+ * @return 0 on success, -1 on failure
+ */
+static int list_extension_operation(void *arg) {
+    const struct extension_args *list = (const struct extension_args *)arg;
+    const char *dirname = list->dirname;
+    const char *extension = list->extension;
+    
+    struct listing *listing = open_listing(dirname, extension, list->matcher);
+    if (!listing) {
+        return -1;
+    }
+    
+    int count = finish_listing(listing, dirname);
+    if (count == -1) {
+        return -1;
+    }
+    
+    // If no matching files found, print a message
+    if (count == 0) {
+        char no_files_msg[256];
+        int msg_len = string_format(no_files_msg, sizeof(no_files_msg), 
+                              "No files with extension \"%s\" found in \"%s\".\n", 
+                              extension, dirname);
+        out_write(no_files_msg, msg_len);
+    }
+    
+    return 0;
+}
+
+/**
+ * Compile the patterns of a listFilesByExtension command
+ * 
+ * @param extension Comma-separated suffixes and globs
+ * @return Compiled matcher, or NULL after reporting an invalid pattern
+ */
+static struct matcher *compile_extension(const char *extension) {
+    struct matcher *matcher = matcher_compile(extension);
+    if (!matcher) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Invalid pattern \"%s\"\n", extension);
+        err_write(error_msg, len);
+    }
+    return matcher;
+}
+
+/**
+ * List files with a specific extension in a directory
+ * The extension may be a comma-separated list of suffixes and globs,
+ * e.g. ".log,.gz" or "*.2026-*.log".
+ * Runs in-process, or in a child process when isolation is enabled
+ * 
+ * @param dirname Name of the directory to list
+ * @param extension File extension to filter by (e.g., ".txt")
+ * @return 0 on success, -1 on failure
+ */
+int list_files_by_extension(const char *dirname, const char *extension) {
+    // Check if directory exists
+    if (!directory_exists(dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    struct matcher *matcher = compile_extension(extension);
+    if (!matcher) {
+        return -1;
+    }
+    
+    struct extension_args list = { dirname, extension, matcher };
+    int result = run_operation(list_extension_operation, &list);
+    matcher_free(matcher);
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), 
+            "Listed files with extension \"%s\" in directory \"%s\".", 
+            extension, dirname);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+/**
+ * Remove the directory after checking that it is empty
+ * 
+ * @param arg Name of the directory to delete
+ * @return 0 on success, -1 on failure
+ */
+static int remove_directory_operation(void *arg) {
+    const char *dirname = (const char *)arg;
+    
+    // Check if directory is empty
+    int fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open directory \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    int is_empty = dir_is_empty(fd);
+    int scan_errno = errno;
+    close(fd);
+    
+    if (is_empty == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not read directory \"%s\": %s\n", 
+                          dirname, strerror(scan_errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    if (!is_empty) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" is not empty.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    // Delete the directory
+    if (rmdir(dirname) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not delete directory \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Delete an empty directory
+ * Runs in-process, or in a child process when isolation is enabled
+ * 
+ * @param dirname Name of the directory to delete
+ * @return 0 on success, -1 on failure
+ */
+int delete_directory(const char *dirname) {
+    // Check if directory exists
+    if (!directory_exists(dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    int result = run_operation(remove_directory_operation, (void *)dirname);
+    fd_cache_invalidate(); // Cached descriptors may be of removed directories
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "Directory \"%s\" deleted successfully.", dirname);
+    log_operation(log_msg);
+    
+    // Print success message
+    char success_msg[256];
+    int len = string_format(success_msg, sizeof(success_msg), 
+                      "Directory \"%s\" deleted successfully.\n", dirname);
+    out_write(success_msg, len);
+    
+    return 0;
+}
+
+/**
+ * List files with a specific extension in a directory tree
+ * Uses the same parallel walk as list_directory_recursive().
+ * 
+ * @param dirname Name of the directory to list
+ * @param extension Comma-separated suffixes and globs
+ * @param jobs Number of worker threads, or 0 for one per CPU
+ * @param sorted Whether to print the files in path order
+ * @return 0 on success, -1 on failure
+ */
+int list_files_by_extension_recursive(const char *dirname, const char *extension, 
+                                      int jobs, int sorted) {
+    // Check if directory exists
+    if (!directory_exists(dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    struct matcher *matcher = compile_extension(extension);
+    if (!matcher) {
+        return -1;
+    }
+    
+    struct recursive_args list = { dirname, extension, matcher, jobs, sorted };
+    int result = run_operation(list_recursive_operation, &list);
+    matcher_free(matcher);
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), 
+            "Listed files with extension \"%s\" in directory \"%s\" recursively.", 
+            extension, dirname);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+// Arguments for the indexed listing operation
+struct indexed_args {
+    const char *dirname;
+    const char *extension;          // Patterns as given, or NULL
+    const struct matcher *matcher;  // Compiled patterns, or NULL
+    int recursive;
+    int sorted;
+};
+
+/**
+ * Refresh and map the index of a tree, reporting failures
+ * The refresh is skipped while a watch process keeps the index current.
+ * 
+ * @param dirname Root directory of the tree
+ * @param index Set to the mapped index
+ * @return 0 on success, -1 on failure
+ */
+static int open_fresh_index(const char *dirname, struct dir_index *index) {
+    if ((!dir_index_watched(dirname) && dir_index_update(dirname) == -1) || 
+        dir_index_open(dirname, index) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not update index for \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Write collected "d/f + path" entries in path order and free them
+ * 
+ * @param listing Listing to add the entries to
+ * @param entries Collected entries
+ * @param count Number of entries
+ */
+static void listing_add_sorted(struct listing *listing, char **entries, size_t count) {
+    qsort(entries, count, sizeof(*entries), compare_walk_entries);
+    for (size_t i = 0; i < count; i++) {
+        listing_add(listing, (entries[i][0] == 'd') ? "  [DIR] " : "  ", 
+                    entries[i] + 1, strlen(entries[i] + 1));
+        free(entries[i]);
+    }
+}
+
+/**
+ * Write a directory or tree to standard output from its index
+ * Entries are listed under the same rules as the scanning listings:
+ * links are followed for a single directory and not for a tree, and
+ * only regular files are listed when patterns are given.
+ * 
+ * @param arg Pointer to struct indexed_args
+ * @return 0 on success, -1 on failure
+ */
+static int list_indexed_operation(void *arg) {
+    const struct indexed_args *list = (const struct indexed_args *)arg;
+    const char *dirname = list->dirname;
+    
+    struct dir_index index;
+    if (open_fresh_index(dirname, &index) == -1) {
+        return -1;
+    }
+    
+    struct listing *listing = malloc(sizeof(*listing));
+    char *path = malloc(PATH_MAX);
+    size_t path_capacity = PATH_MAX;
+    if (!listing || !path) {
+        free(listing);
+        free(path);
+        dir_index_close(&index);
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    listing->fd = -1;
+    listing->matcher = list->matcher;
+    listing->count = 0;
+    
+    // Print directory contents header
+    const char *suffix = list->recursive ? " (recursive)" : "";
+    if (list->matcher) {
+        listing->len = string_format(listing->buffer, sizeof(listing->buffer), 
+                               "Files with extension \"%s\" in directory \"%s\"%s:\n", 
+                               list->extension, dirname, suffix);
+    } else {
+        listing->len = string_format(listing->buffer, sizeof(listing->buffer), 
+                               "Contents of directory \"%s\"%s:\n", dirname, suffix);
+    }
+    
+    // The root sorts first, so a single directory is just dirs[0]
+    size_t dir_count = list->recursive ? index.header->dir_count : 1;
+    char **sorted = NULL;
+    size_t sorted_count = 0;
+    size_t sorted_capacity = 0;
+    int failed = 0;
+    
+    for (size_t d = 0; d < dir_count && !failed; d++) {
+        const struct dir_index_dir *dir = &index.dirs[d];
+        const char *dir_path = index.names + dir->path;
         
-        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
-            // Log the operation
-            char log_msg[256];
-            string_format(log_msg, sizeof(log_msg), "Directory \"%s\" deleted successfully.", dirname);
-            log_operation(log_msg);
+        for (uint32_t e = 0; e < dir->entry_count && !failed; e++) {
+            const struct dir_index_entry *entry = &index.entries[dir->first_entry + e];
+            const char *name = index.names + entry->name;
+            
+            // Follow links for a single directory, as stat() would
+            int type = list->recursive ? entry->type : entry->target_type;
+            if (type == DT_UNKNOWN) {
+                continue; // Dangling link
+            }
+            int is_dir = (type == DT_DIR);
+            
+            if (list->matcher && (is_dir || entry->target_type != DT_REG || 
+                                  !matcher_match(list->matcher, name, entry->name_len))) {
+                continue;
+            }
             
-            // Print success message
-            char success_msg[256];
-            int len = string_format(success_msg, sizeof(success_msg), 
-                              "Directory \"%s\" deleted successfully.\n", dirname);
-            write(STDOUT_FILENO, success_msg, len);
+            // Recursive listings name entries by their path below the root
+            size_t len = entry->name_len;
+            if (list->recursive && dir->path_len > 0) {
+                len += dir->path_len + 1;
+                if (len + 2 > path_capacity) {
+                    char *grown = realloc(path, len + 2);
+                    if (!grown) {
+                        failed = 1;
+                        break;
+                    }
+                    path = grown;
+                    path_capacity = len + 2;
+                }
+                memcpy(path + 1, dir_path, dir->path_len);
+                path[dir->path_len + 1] = '/';
+                memcpy(path + dir->path_len + 2, name, entry->name_len + 1);
+            } else {
+                memcpy(path + 1, name, entry->name_len + 1);
+            }
+            
+            if (!list->sorted) {
+                listing_add(listing, is_dir ? "  [DIR] " : "  ", path + 1, len);
+                continue;
+            }
             
-            return 0;
+            if (sorted_count == sorted_capacity) {
+                size_t capacity = sorted_capacity ? sorted_capacity * 2 : 1024;
+                char **grown = realloc(sorted, capacity * sizeof(*sorted));
+                if (!grown) {
+                    failed = 1;
+                    break;
+                }
+                sorted = grown;
+                sorted_capacity = capacity;
+            }
+            path[0] = is_dir ? 'd' : 'f';
+            sorted[sorted_count] = malloc(len + 2);
+            if (!sorted[sorted_count]) {
+                failed = 1;
+                break;
+            }
+            memcpy(sorted[sorted_count++], path, len + 2);
+        }
+    }
+    
+    if (failed) {
+        for (size_t i = 0; i < sorted_count; i++) {
+            free(sorted[i]);
+        }
+        sorted_count = 0;
+    }
+    listing_add_sorted(listing, sorted, sorted_count);
+    listing_flush(listing);
+    
+    // If no entries found, print a message
+    if (!failed && listing->count == 0 && list->matcher) {
+        char no_files_msg[512];
+        int msg_len = string_format(no_files_msg, sizeof(no_files_msg), 
+                              "No files with extension \"%s\" found in \"%s\".\n", 
+                              list->extension, dirname);
+        out_write(no_files_msg, msg_len);
+    } else if (!failed && listing->count == 0) {
+        const char *empty_msg = "  (empty directory)\n";
+        out_write(empty_msg, strlen(empty_msg));
+    }
+    
+    free(sorted);
+    free(path);
+    free(listing);
+    dir_index_close(&index);
+    
+    if (failed) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Run an indexed listing and report its outcome
+ * 
+ * @param list Listing to run
+ * @return 0 on success, -1 on failure
+ */
+static int run_indexed_listing(const struct indexed_args *list) {
+    // Check if directory exists
+    if (!directory_exists(list->dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", list->dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    int result = run_operation(list_indexed_operation, (void *)list);
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    return (result != 0) ? -1 : 0;
+}
+
+/**
+ * List a directory from the index kept in its .fmindex file
+ * The index is refreshed first, which reads again only the directories
+ * whose mtime changed since the last refresh.
+ * 
+ * @param dirname Name of the directory to list
+ * @param recursive Whether to list the whole tree
+ * @param sorted Whether to print a recursive listing in path order
+ * @return 0 on success, -1 on failure
+ */
+int list_directory_indexed(const char *dirname, int recursive, int sorted) {
+    struct indexed_args list = { dirname, NULL, NULL, recursive, sorted };
+    if (run_indexed_listing(&list) == -1) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), 
+            recursive ? "Listed contents of directory \"%s\" recursively from index." : 
+                        "Listed contents of directory \"%s\" from index.", dirname);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+/**
+ * List files with a specific extension from the index of a tree
+ * 
+ * @param dirname Name of the directory to list
+ * @param extension Comma-separated suffixes and globs
+ * @param recursive Whether to list the whole tree
+ * @param sorted Whether to print a recursive listing in path order
+ * @return 0 on success, -1 on failure
+ */
+int list_files_by_extension_indexed(const char *dirname, const char *extension, 
+                                    int recursive, int sorted) {
+    struct matcher *matcher = compile_extension(extension);
+    if (!matcher) {
+        return -1;
+    }
+    
+    struct indexed_args list = { dirname, extension, matcher, recursive, sorted };
+    int result = run_indexed_listing(&list);
+    matcher_free(matcher);
+    
+    if (result == -1) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), 
+            recursive ? "Listed files with extension \"%s\" in directory \"%s\" recursively from index." : 
+                        "Listed files with extension \"%s\" in directory \"%s\" from index.", 
+            extension, dirname);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+// Directory being removed by a recursive delete
+// A directory is removed by whichever task drops its last reference:
+// its own scan, or the removal of its last subdirectory.
+struct delete_dir {
+    struct delete_dir *parent;  // NULL for the root
+    int fd;                     // Open directory, or -1 until opened
+    int refs;                   // Scan in progress plus subdirectories not yet removed
+    int failed;                 // Something below could not be removed; accessed atomically
+    char *path;                 // Path relative to the root, "" for the root
+    const char *name;           // Last component of path
+};
+
+// State shared by the delete threads
+struct delete_state {
+    struct thread_pool *pool;
+    const char *root;
+    long files;                 // Accessed atomically
+    long dirs;                  // Accessed atomically
+    int failed;                 // Accessed atomically
+};
+
+// Arguments for the recursive delete operation
+struct delete_args {
+    const char *dirname;
+    int jobs;
+};
+
+/**
+ * Report an entry the delete could not remove
+ * 
+ * @param state Delete state
+ * @param path Directory path relative to the root
+ * @param name Entry name, or NULL for the directory itself
+ * @param what What failed, e.g. "delete"
+ * @param error errno value
+ */
+static void delete_error(struct delete_state *state, const char *path, const char *name, 
+                         const char *what, int error) {
+    char error_msg[1024];
+    int len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not %s \"%s%s%s%s%s\": %s\n", what, state->root, 
+                      (path[0] || name) ? "/" : "", path, (path[0] && name) ? "/" : "", 
+                      name ? name : "", strerror(error));
+    err_write(error_msg, len);
+    __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Drop a reference to a directory, removing it with the last one
+ * Removing a directory drops its reference on the parent, so the tree
+ * is removed bottom-up as its leaves finish.
+ * 
+ * @param state Delete state
+ * @param dir Directory to release
+ */
+static void delete_release(struct delete_state *state, struct delete_dir *dir) {
+    while (dir && __atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        struct delete_dir *parent = dir->parent;
+        int failed = __atomic_load_n(&dir->failed, __ATOMIC_RELAXED);
+        
+        if (dir->fd != -1) {
+            close(dir->fd);
+        }
+        
+        // The root is removed by the caller once the pool is idle
+        if (parent && !failed) {
+            if (unlinkat(parent->fd, dir->name, AT_REMOVEDIR) == 0) {
+                __atomic_add_fetch(&state->dirs, 1, __ATOMIC_RELAXED);
+            } else {
+                delete_error(state, dir->path, NULL, "delete directory", errno);
+                failed = 1;
+            }
+        }
+        if (parent && failed) {
+            __atomic_store_n(&parent->failed, 1, __ATOMIC_RELAXED);
+        }
+        
+        free(dir->path);
+        free(dir);
+        dir = parent;
+    }
+}
+
+// One directory being emptied by a delete thread
+struct delete_scan {
+    struct delete_state *state;
+    struct delete_dir *dir;
+    int worker;
+    size_t path_len;
+};
+
+/**
+ * Remove the entries of a batch and queue its subdirectories
+ * 
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Pointer to struct delete_scan
+ * @return 0 to keep scanning, 1 to stop after a memory allocation failure
+ */
+static int delete_batch(const struct dir_entry *entries, size_t count, void *context) {
+    struct delete_scan *scan = (struct delete_scan *)context;
+    struct delete_state *state = scan->state;
+    struct delete_dir *dir = scan->dir;
+    size_t path_len = scan->path_len;
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
+        
+        int type = entry_type(dir->fd, entry->name, entry->type, 0);
+        if (type == -1) {
+            continue; // Already gone
+        }
+        
+        if (type != DT_DIR) {
+            if (unlinkat(dir->fd, entry->name, 0) == 0) {
+                __atomic_add_fetch(&state->files, 1, __ATOMIC_RELAXED);
+            } else if (errno != ENOENT) {
+                delete_error(state, dir->path, entry->name, "delete", errno);
+                __atomic_store_n(&dir->failed, 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+        
+        struct delete_dir *child = malloc(sizeof(*child));
+        char *path = malloc(path_len + entry->name_len + 2);
+        if (!child || !path) {
+            free(child);
+            free(path);
+            __atomic_store_n(&dir->failed, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        if (path_len > 0) {
+            memcpy(path, dir->path, path_len);
+            path[path_len] = '/';
+            memcpy(path + path_len + 1, entry->name, entry->name_len + 1);
         } else {
-            return -1;
+            memcpy(path, entry->name, entry->name_len + 1);
+        }
+        child->parent = dir;
+        child->fd = -1;
+        child->refs = 1;
+        child->failed = 0;
+        child->path = path;
+        child->name = path + (path_len > 0 ? path_len + 1 : 0);
+        
+        __atomic_add_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL);
+        if (pool_submit(state->pool, scan->worker, child) == -1) {
+            __atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL);
+            free(child->path);
+            free(child);
+            __atomic_store_n(&dir->failed, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Empty one directory of a recursive delete (thread pool task)
+ * 
+ * @param task Directory to empty, as a struct delete_dir
+ * @param worker Index of the calling worker
+ * @param context Delete state
+ */
+static void delete_directory_task(void *task, int worker, void *context) {
+    struct delete_dir *dir = (struct delete_dir *)task;
+    struct delete_state *state = (struct delete_state *)context;
+    
+    // The parent stays open until all of its subdirectories are removed
+    if (dir->fd == -1) {
+        dir->fd = openat(dir->parent->fd, dir->name, 
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dir->fd == -1) {
+            delete_error(state, dir->path, NULL, "open directory", errno);
+            __atomic_store_n(&dir->failed, 1, __ATOMIC_RELAXED);
+            delete_release(state, dir);
+            return;
+        }
+    }
+    
+    struct delete_scan scan = { state, dir, worker, strlen(dir->path) };
+    if (dir_scan(dir->fd, delete_batch, &scan) == -1) {
+        delete_error(state, dir->path, NULL, "read directory", errno);
+        __atomic_store_n(&dir->failed, 1, __ATOMIC_RELAXED);
+    }
+    
+    delete_release(state, dir);
+}
+
+/**
+ * Remove a directory and everything below it
+ * 
+ * @param arg Pointer to struct delete_args
+ * @return 0 on success, -1 if anything could not be removed
+ */
+static int remove_tree_operation(void *arg) {
+    const struct delete_args *remove = (const struct delete_args *)arg;
+    const char *dirname = remove->dirname;
+    
+    struct delete_dir *root = calloc(1, sizeof(*root));
+    if (root) {
+        root->path = calloc(1, 1);
+    }
+    if (!root || !root->path) {
+        free(root);
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    root->refs = 1;
+    
+    // Never follow a link given as the directory itself
+    root->fd = open(dirname, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (root->fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open directory \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        free(root->path);
+        free(root);
+        return -1;
+    }
+    
+    struct delete_state state = { NULL, dirname, 0, 0, 0 };
+    int jobs = (remove->jobs > 0) ? remove->jobs : pool_default_workers();
+    state.pool = pool_create(jobs, delete_directory_task, &state);
+    if (!state.pool) {
+        close(root->fd);
+        free(root->path);
+        free(root);
+        err_write("Error: Could not start worker threads\n", 38);
+        return -1;
+    }
+    
+    // Keep the root until the pool is idle, then remove it here
+    root->refs = 2;
+    int root_failed = 0;
+    if (pool_submit(state.pool, -1, root) == -1) {
+        root->refs = 1;
+        root_failed = 1;
+    }
+    pool_wait(state.pool);
+    pool_destroy(state.pool);
+    
+    root_failed |= __atomic_load_n(&root->failed, __ATOMIC_RELAXED);
+    delete_release(&state, root);
+    
+    if (!root_failed) {
+        if (rmdir(dirname) == 0) {
+            state.dirs++;
+        } else {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not delete directory \"%s\": %s\n", 
+                              dirname, strerror(errno));
+            err_write(error_msg, len);
+            root_failed = 1;
         }
     }
+    
+    // One record for the whole tree rather than one per entry
+    char log_msg[512];
+    if (root_failed || state.failed) {
+        string_format(log_msg, sizeof(log_msg), 
+                "ERROR: Could not delete all of directory \"%s\" "
+                "(%ld files and %ld directories deleted).", 
+                dirname, state.files, state.dirs);
+        log_operation(log_msg);
+        return -1;
+    }
+    
+    string_format(log_msg, sizeof(log_msg), 
+            "Directory \"%s\" deleted recursively (%ld files, %ld directories).", 
+            dirname, state.files, state.dirs);
+    log_operation(log_msg);
+    
+    // Print success message
+    char success_msg[512];
+    int len = string_format(success_msg, sizeof(success_msg), 
+                      "Directory \"%s\" and its contents deleted successfully "
+                      "(%ld files, %ld directories).\n", 
+                      dirname, state.files, state.dirs);
+    out_write(success_msg, len);
+    
+    return 0;
+}
+
+/**
+ * Delete a directory and everything below it
+ * Directories are emptied in parallel by a pool of worker threads,
+ * with every entry removed relative to its parent's descriptor, and
+ * each directory is removed as soon as its last subdirectory is gone.
+ * Symbolic links are removed, never followed.
+ * 
+ * @param dirname Name of the directory to delete
+ * @param jobs Number of worker threads, or 0 for one per CPU
+ * @return 0 on success, -1 on failure
+ */
+int delete_directory_recursive(const char *dirname, int jobs) {
+    // Check if directory exists
+    if (!directory_exists(dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    struct delete_args remove = { dirname, jobs };
+    int result = run_operation(remove_tree_operation, &remove);
+    fd_cache_invalidate(); // Cached descriptors may be of removed directories
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    return (result != 0) ? -1 : 0;
 }
\ No newline at end of file
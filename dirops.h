@@ -7,10 +7,27 @@ int create_directory(const char *dirname);
 // List contents of a directory
 int list_directory(const char *dirname);
 
+// List a directory and all of its subdirectories using worker threads
+int list_directory_recursive(const char *dirname, int jobs, int sorted);
+
 // List files with a specific extension in a directory
 int list_files_by_extension(const char *dirname, const char *extension);
 
+// List files with a specific extension in a directory tree using worker threads
+int list_files_by_extension_recursive(const char *dirname, const char *extension, 
+                                      int jobs, int sorted);
+
+// List a directory, or with recursive its whole tree, from the tree's index
+int list_directory_indexed(const char *dirname, int recursive, int sorted);
+
+// List files with a specific extension from the tree's index
+int list_files_by_extension_indexed(const char *dirname, const char *extension, 
+                                    int recursive, int sorted);
+
 // Delete an empty directory
 int delete_directory(const char *dirname);
 
+// Delete a directory and everything below it using worker threads
+int delete_directory_recursive(const char *dirname, int jobs);
+
 #endif // DIROPS_H
\ No newline at end of file
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include "dirscan.h"
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Record layout returned by getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Largest record getdents64 returns: the header and a NAME_MAX name, aligned
+#define RECORD_MAX 288
+
+// Scan buffer and the batch being built from it
+struct dir_scanner {
+    struct dir_entry batch[DIRSCAN_BATCH];
+    size_t size;
+    char buffer[];
+};
+
+/**
+ * Fill a buffer with the next directory entries
+ * 
+ * @param fd Open directory
+ * @param buffer Buffer to fill
+ * @param size Size of the buffer
+ * @return Bytes filled, 0 at the end, -1 on failure
+ */
+static long read_entries(int fd, char *buffer, size_t size) {
+    long bytes_read;
+    do {
+        bytes_read = syscall(SYS_getdents64, fd, buffer, size);
+    } while (bytes_read == -1 && errno == EINTR);
+    return bytes_read;
+}
+
+/**
+ * Check for the "." and ".." entries
+ * 
+ * @param name Entry name
+ * @return 1 for "." or "..", 0 otherwise
+ */
+static int is_dot_entry(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/**
+ * Read every entry of a directory in batches
+ * Entries are parsed in place from a getdents64 buffer. The buffer starts
+ * small, since most directories fit in it, and grows while the kernel
+ * keeps filling it, so a directory of millions of entries still costs a
+ * few hundred system calls instead of one library call per entry.
+ * 
+ * @param fd Open directory, read from its current position
+ * @param handle Called with each batch of entries
+ * @param context Passed to handle
+ * @return 0 when done or stopped by handle, -1 on failure
+ */
+int dir_scan(int fd, dir_batch_fn handle, void *context) {
+    struct dir_scanner *scanner = malloc(sizeof(*scanner) + DIRSCAN_BUFFER_MIN);
+    if (!scanner) {
+        return -1;
+    }
+    scanner->size = DIRSCAN_BUFFER_MIN;
+    
+    int result = 0;
+    long filled;
+    
+    while (result == 0 && (filled = read_entries(fd, scanner->buffer, scanner->size)) > 0) {
+        size_t count = 0;
+        
+        for (long pos = 0; pos < filled && result == 0; ) {
+            struct linux_dirent64 *record = (struct linux_dirent64 *)(scanner->buffer + pos);
+            pos += record->d_reclen;
+            
+            if (is_dot_entry(record->d_name)) {
+                continue;
+            }
+            
+            struct dir_entry *entry = &scanner->batch[count++];
+            entry->name = record->d_name;
+            entry->name_len = strlen(record->d_name);
+            entry->ino = record->d_ino;
+            entry->type = record->d_type;
+            
+            if (count == DIRSCAN_BATCH) {
+                result = handle(scanner->batch, count, context);
+                count = 0;
+            }
+        }
+        
+        if (result == 0 && count > 0) {
+            result = handle(scanner->batch, count, context);
+        }
+        
+        // A full buffer means more entries are waiting; a failed
+        // reallocation just keeps the current size
+        if (result == 0 && (size_t)filled + RECORD_MAX > scanner->size &&
+            scanner->size < DIRSCAN_BUFFER_MAX) {
+            struct dir_scanner *grown = realloc(scanner, sizeof(*scanner) + scanner->size * 2);
+            if (grown) {
+                scanner = grown;
+                scanner->size *= 2;
+            }
+        }
+    }
+    
+    if (result == 0 && filled == -1) {
+        result = -1;
+    }
+    
+    free(scanner);
+    return (result == -1) ? -1 : 0;
+}
+
+/**
+ * Check whether a directory is empty
+ * Reads a single small block, which is enough to find a first entry.
+ * 
+ * @param fd Open directory, read from its current position
+ * @return 1 if empty, 0 if not, -1 on failure
+ */
+int dir_is_empty(int fd) {
+    // Aligned for the 64-bit fields of the records
+    uint64_t buffer[512];
+    long filled;
+    
+    while ((filled = read_entries(fd, (char *)buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < filled; ) {
+            struct linux_dirent64 *record = (struct linux_dirent64 *)((char *)buffer + pos);
+            pos += record->d_reclen;
+            
+            if (!is_dot_entry(record->d_name)) {
+                return 0;
+            }
+        }
+    }
+    
+    return (filled == -1) ? -1 : 1;
+}
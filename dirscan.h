@@ -0,0 +1,33 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes of directory entries requested from the kernel per call: the
+// first call of a scan asks for DIRSCAN_BUFFER_MIN, and each call that
+// fills the buffer doubles it, up to DIRSCAN_BUFFER_MAX
+#define DIRSCAN_BUFFER_MIN (64 * 1024)
+#define DIRSCAN_BUFFER_MAX (1024 * 1024)
+
+// Most entries handed to the callback at once
+#define DIRSCAN_BATCH 1024
+
+// One directory entry; name points into the scan buffer
+struct dir_entry {
+    const char *name;
+    size_t name_len;
+    uint64_t ino;
+    unsigned char type;  // DT_ value, possibly DT_UNKNOWN
+};
+
+// Handle a batch of entries; return 0 to continue, 1 to stop, -1 to fail
+typedef int (*dir_batch_fn)(const struct dir_entry *entries, size_t count, void *context);
+
+// Read every entry of an open directory except "." and "..", in batches
+int dir_scan(int fd, dir_batch_fn handle, void *context);
+
+// Check whether an open directory has no entries besides "." and ".."
+int dir_is_empty(int fd);
+
+#endif // DIRSCAN_H
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include "dirwalk.h"
+#include "threadpool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Directory found by a walk
+// A directory stays open while its subdirectories are waiting to be
+// opened relative to it, so no full path is ever looked up again.
+struct walk_dir {
+    struct walk_dir *parent;  // Directory holding this one, until it is opened
+    int fd;                   // Open directory, or -1 until opened
+    int refs;                 // Scan in progress plus unopened subdirectories
+    char *path;               // Path relative to the walk root, "" for the root
+    const char *name;         // Last component of path
+};
+
+struct dir_walk {
+    struct thread_pool *pool;
+    dir_walk_fn handle;
+    dir_walk_error_fn error;
+    void *context;
+};
+
+/**
+ * Drop a reference to a walked directory, closing it with the last one
+ * 
+ * @param dir Directory to release
+ */
+static void walk_release(struct walk_dir *dir) {
+    if (__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (dir->fd != -1) {
+            close(dir->fd);
+        }
+        free(dir->path);
+        free(dir);
+    }
+}
+
+/**
+ * Pass a batch of entries to the walk's handler
+ * 
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Pointer to struct dir_walk_scan
+ * @return Result of the handler
+ */
+static int walk_batch(const struct dir_entry *entries, size_t count, void *context) {
+    struct dir_walk_scan *scan = (struct dir_walk_scan *)context;
+    struct dir_walk *walk = scan->walk;
+    return walk->handle(scan, entries, count, walk->context);
+}
+
+/**
+ * Read one directory of a walk (thread pool task)
+ * Subdirectories are queued on the calling worker's deque; idle workers
+ * steal them from there.
+ * 
+ * @param task Directory to read, as a struct walk_dir
+ * @param worker Index of the calling worker
+ * @param context Pointer to struct dir_walk
+ */
+static void walk_directory(void *task, int worker, void *context) {
+    struct walk_dir *dir = (struct walk_dir *)task;
+    struct dir_walk *walk = (struct dir_walk *)context;
+    
+    // Open relative to the parent, then let the parent go
+    if (dir->fd == -1) {
+        dir->fd = openat(dir->parent->fd, dir->name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int open_errno = errno;
+        walk_release(dir->parent);
+        dir->parent = NULL;
+        
+        if (dir->fd == -1) {
+            walk->error(dir->path, open_errno, walk->context);
+            walk_release(dir);
+            return;
+        }
+    }
+    
+    struct dir_walk_scan scan = { walk, dir->fd, dir->path, strlen(dir->path), worker, dir };
+    if (dir_scan(dir->fd, walk_batch, &scan) == -1) {
+        walk->error(dir->path, errno, walk->context);
+    }
+    
+    walk_release(dir);
+}
+
+/**
+ * Queue a subdirectory of the directory being read
+ * 
+ * @param scan Directory being read
+ * @param name Name of the subdirectory
+ * @param name_len Length of the name
+ * @return 0 on success, -1 if memory allocation failed
+ */
+int dir_walk_enter(struct dir_walk_scan *scan, const char *name, size_t name_len) {
+    struct walk_dir *dir = (struct walk_dir *)scan->dir;
+    size_t path_len = scan->path_len;
+    
+    struct walk_dir *child = malloc(sizeof(*child));
+    char *path = malloc(path_len + name_len + 2);
+    if (!child || !path) {
+        free(child);
+        free(path);
+        return -1;
+    }
+    if (path_len > 0) {
+        memcpy(path, scan->path, path_len);
+        path[path_len] = '/';
+        memcpy(path + path_len + 1, name, name_len + 1);
+    } else {
+        memcpy(path, name, name_len + 1);
+    }
+    child->parent = dir;
+    child->fd = -1;
+    child->refs = 1;
+    child->path = path;
+    child->name = path + (path_len > 0 ? path_len + 1 : 0);
+    
+    __atomic_add_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL);
+    if (pool_submit(scan->walk->pool, scan->worker, child) == -1) {
+        __atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL);
+        free(child->path);
+        free(child);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Walk a directory tree in parallel
+ * The handler sees each directory's entries and calls dir_walk_enter()
+ * for the subdirectories to descend into. It runs on the worker
+ * threads, so whatever it collects should be kept per worker.
+ * 
+ * @param root_fd Open root directory; closed by the walk
+ * @param jobs Number of worker threads, at least 1
+ * @param handle Called with each batch of entries
+ * @param error Called for each directory that could not be read
+ * @param context Passed to handle and error
+ * @return 0 when the walk finished, -1 if it could not be started
+ */
+int dir_walk(int root_fd, int jobs, dir_walk_fn handle, dir_walk_error_fn error, void *context) {
+    struct walk_dir *root = calloc(1, sizeof(*root));
+    if (root) {
+        root->path = calloc(1, 1);
+    }
+    if (!root || !root->path) {
+        free(root);
+        close(root_fd);
+        return -1;
+    }
+    root->fd = root_fd;
+    root->refs = 1;
+    
+    struct dir_walk walk = { NULL, handle, error, context };
+    walk.pool = pool_create(jobs, walk_directory, &walk);
+    if (!walk.pool || pool_submit(walk.pool, -1, root) == -1) {
+        if (walk.pool) {
+            pool_destroy(walk.pool);
+        }
+        walk_release(root);
+        return -1;
+    }
+    
+    pool_wait(walk.pool);
+    pool_destroy(walk.pool);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef DIRWALK_H
+#define DIRWALK_H
+
+#include "dirscan.h"
+
+// Walk of a directory tree by a pool of worker threads
+// Each directory is opened relative to its parent's descriptor, which
+// stays open until all of its subdirectories have been opened.
+struct dir_walk;
+
+// One directory being read by a walk
+struct dir_walk_scan {
+    struct dir_walk *walk;
+    int fd;             // Open directory
+    const char *path;   // Relative to the walk root, "" for the root
+    size_t path_len;
+    int worker;         // Index of the worker reading it
+    void *dir;          // Walk's own record of the directory
+};
+
+// Handle a batch of one directory's entries; return 0 to continue,
+// 1 to stop reading this directory
+typedef int (*dir_walk_fn)(struct dir_walk_scan *scan, const struct dir_entry *entries,
+                           size_t count, void *context);
+
+// Report a directory that could not be opened or read
+typedef void (*dir_walk_error_fn)(const char *path, int error, void *context);
+
+// Walk the tree below an open directory, which the walk closes; returns
+// 0 when done, -1 if the walk could not be started
+int dir_walk(int root_fd, int jobs, dir_walk_fn handle, dir_walk_error_fn error, void *context);
+
+// Queue a subdirectory of the directory being read; -1 if out of memory
+int dir_walk_enter(struct dir_walk_scan *scan, const char *name, size_t name_len);
+
+#endif // DIRWALK_H
@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+#include "durability.h"
+#include "config.h"
+#include "logging.h"
+#include "utils.h"
+#include "stats.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+// Bytes staged in an aligned buffer per O_DIRECT write
+#define DIRECT_CHUNK_SIZE (1024 * 1024)
+
+// Level names, indexed by enum durability
+static const char *const g_level_names[] = { "none", "fdatasync", "group", "direct" };
+
+// Files written since the last group sync, as duplicated descriptors
+static pthread_mutex_t g_group_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_group_fds[DURABILITY_GROUP_MAX];
+static int g_group_count = 0;
+static long long g_group_started = 0;   // Milliseconds, when the first was held
+
+/**
+ * Parse a durability level name
+ * 
+ * @param text Level name
+ * @param level Set to the level
+ * @return 0 on success, -1 if the name is unknown
+ */
+int durability_parse(const char *text, enum durability *level) {
+    for (int i = DURABILITY_NONE; i <= DURABILITY_DIRECT; i++) {
+        if (strcmp(text, g_level_names[i]) == 0) {
+            *level = (enum durability)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Get the level from the durability setting
+ * --durability on the command line overrides the configuration file.
+ * 
+ * @return Configured level, DURABILITY_NONE if unset or unknown
+ */
+enum durability durability_level(void) {
+    enum durability level;
+    if (durability_parse(config_get_string("durability", "none"), &level) == -1) {
+        return DURABILITY_NONE;
+    }
+    return level;
+}
+
+/**
+ * fdatasync() a file, retrying when interrupted
+ * 
+ * @param fd Descriptor of the file
+ * @return 0 on success, -1 on failure
+ */
+static int sync_data(int fd) {
+    long long wait_start = stats_now();
+    int result;
+    while ((result = fdatasync(fd)) == -1 && errno == EINTR) {
+    }
+    stats_wait(STATS_SYNC, wait_start);
+    return result;
+}
+
+/**
+ * Get the monotonic time in milliseconds
+ * 
+ * @return Current time
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Make a file's written data durable as the level asks
+ * Called after writing and before closing the file. At the group level
+ * the file is kept open and synced with the others written around the
+ * same time; an isolated child syncs at once, as it will not be there
+ * for the group.
+ * 
+ * @param fd Descriptor of the written file
+ * @return 0 on success, -1 on failure with errno set
+ */
+int durability_sync(int fd) {
+    enum durability level = durability_level();
+    if (level == DURABILITY_NONE) {
+        return 0;
+    }
+    if (level != DURABILITY_GROUP || process_isolation_enabled()) {
+        return sync_data(fd);
+    }
+    
+    int held = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (held == -1) {
+        return sync_data(fd); // Out of descriptors: no group for this one
+    }
+    
+    pthread_mutex_lock(&g_group_mutex);
+    if (g_group_count == 0) {
+        g_group_started = now_ms();
+    }
+    g_group_fds[g_group_count++] = held;
+    int due = g_group_count == DURABILITY_GROUP_MAX ||
+              now_ms() - g_group_started >=
+              config_get_number("durability_interval", DURABILITY_DEFAULT_INTERVAL);
+    pthread_mutex_unlock(&g_group_mutex);
+    
+    return due ? durability_commit() : 0;
+}
+
+/**
+ * fdatasync() and release every file held for the group sync
+ * A failure is reported here, since the operations that wrote the
+ * files have already reported success.
+ * 
+ * @return 0 on success, -1 if any file could not be synced
+ */
+int durability_commit(void) {
+    int fds[DURABILITY_GROUP_MAX];
+    
+    pthread_mutex_lock(&g_group_mutex);
+    int count = g_group_count;
+    memcpy(fds, g_group_fds, count * sizeof(*fds));
+    g_group_count = 0;
+    pthread_mutex_unlock(&g_group_mutex);
+    
+    int sync_errno = 0;
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (sync_data(fds[i]) == -1) {
+            sync_errno = errno;
+            failed++;
+        }
+        close(fds[i]);
+    }
+    
+    if (failed) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not sync %d written files: %s\n", 
+                          failed, strerror(sync_errno));
+        err_write(error_msg, len);
+        
+        // Log the error
+        char log_error[256];
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Group sync failed for %d of %d files: %s", 
+                     failed, count, strerror(sync_errno));
+        log_operation(log_error);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Write a whole buffer at the end of a file, retrying on short writes
+ * 
+ * @param fd Descriptor of the file, open with O_APPEND
+ * @param data Data to write
+ * @param len Number of bytes to write
+ * @return 0 on success, -1 on failure
+ */
+static int append_fully(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * Append a large buffer with O_DIRECT where possible, then fdatasync()
+ * The bytes up to the next aligned offset and the unaligned tail go
+ * through the page cache; the aligned middle is staged in an aligned
+ * buffer and written around it. Filesystems without O_DIRECT get a
+ * buffered write, which the final fdatasync() makes durable all the same.
+ * 
+ * @param fd Descriptor of the file, open with O_APPEND and locked
+ * @param dir_fd Directory path is relative to, or AT_FDCWD
+ * @param path Path of the same file, to open it for O_DIRECT
+ * @param data Data to append
+ * @param len Number of bytes to append
+ * @return 0 on success, -1 on failure with errno set
+ */
+int durability_append_direct(int fd, int dir_fd, const char *path,
+                             const char *data, size_t len) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    
+    size_t head = (DURABILITY_DIRECT_ALIGN - st.st_size % DURABILITY_DIRECT_ALIGN) %
+                  DURABILITY_DIRECT_ALIGN;
+    if (head > len) {
+        head = len;
+    }
+    size_t middle = (len - head) / DURABILITY_DIRECT_ALIGN * DURABILITY_DIRECT_ALIGN;
+    
+    if (append_fully(fd, data, head) == -1) {
+        return -1;
+    }
+    
+    size_t done = 0;
+    char *buffer = NULL;
+    int direct_fd = -1;
+    if (middle > 0 && posix_memalign((void **)&buffer, DURABILITY_DIRECT_ALIGN,
+                                     DIRECT_CHUNK_SIZE) == 0) {
+        direct_fd = openat(dir_fd, path, O_WRONLY | O_DIRECT | O_CLOEXEC);
+    }
+    
+    off_t offset = st.st_size + head;
+    while (direct_fd != -1 && done < middle) {
+        size_t chunk = (middle - done < DIRECT_CHUNK_SIZE) ? middle - done : DIRECT_CHUNK_SIZE;
+        memcpy(buffer, data + head + done, chunk);
+        ssize_t written = pwrite(direct_fd, buffer, chunk, offset + done);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break; // Alignment refused: finish through the page cache
+        }
+        done += written;
+        if (written % DURABILITY_DIRECT_ALIGN != 0) {
+            break; // A short write leaves the rest unaligned
+        }
+    }
+    if (direct_fd != -1) {
+        close(direct_fd);
+    }
+    free(buffer);
+    
+    if (append_fully(fd, data + head + done, len - head - done) == -1) {
+        return -1;
+    }
+    return sync_data(fd);
+}
@@ -0,0 +1,41 @@
+#ifndef DURABILITY_H
+#define DURABILITY_H
+
+#include <stddef.h>
+
+// How far written data is pushed towards stable storage
+enum durability {
+    DURABILITY_NONE,       // Leave it to the kernel's writeback (default)
+    DURABILITY_FDATASYNC,  // fdatasync() every file before reporting success
+    DURABILITY_GROUP,      // fdatasync() written files together, periodically
+    DURABILITY_DIRECT      // Large appends bypass the page cache, then fdatasync()
+};
+
+// Written files held for one group sync, whichever limit is reached first
+#define DURABILITY_GROUP_MAX 256
+#define DURABILITY_DEFAULT_INTERVAL 100   // Milliseconds
+
+// Appends at least this large are written with O_DIRECT at the direct level
+#define DURABILITY_DIRECT_MIN (64 * 1024)
+
+// Alignment of O_DIRECT offsets, lengths and buffers
+#define DURABILITY_DIRECT_ALIGN 4096
+
+// Parse a durability level name: none, fdatasync, group or direct
+int durability_parse(const char *text, enum durability *level);
+
+// Get the level from the durability setting
+enum durability durability_level(void);
+
+// Make a file's written data durable as the level asks, before it is closed
+int durability_sync(int fd);
+
+// Append a large buffer with O_DIRECT where possible, then fdatasync();
+// fd must be open with O_APPEND and locked, path names the same file
+int durability_append_direct(int fd, int dir_fd, const char *path,
+                             const char *data, size_t len);
+
+// fdatasync() and release every file held for the group sync
+int durability_commit(void);
+
+#endif // DURABILITY_H
@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include "fdcache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// One open directory
+struct fd_cache_entry {
+    char *dir;                      // Normalized path
+    size_t len;
+    int fd;
+    dev_t dev;                      // Identity when opened, for validating hits
+    ino_t ino;
+    struct fd_cache_entry *next;    // Next in the same bucket
+    struct fd_cache_entry *newer;   // Recency list, newest first
+    struct fd_cache_entry *older;
+};
+
+// Directories indexed by a hash of their path, in order of last use
+struct fd_cache {
+    struct fd_cache_entry *buckets[FD_CACHE_BUCKETS];
+    struct fd_cache_entry *newest;
+    struct fd_cache_entry *oldest;
+    int count;
+    int validate;                   // Check hits against the path, for a cache kept warm
+    unsigned long generation;       // g_generation the entries were opened under
+};
+
+// Directories open in every cache, against the descriptor budget
+static int g_open_count = 0;
+static int g_budget = 0;
+
+// Bumped to drop every cached directory
+static unsigned long g_generation = 0;
+
+// Each thread's warm cache, freed when the thread exits
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_warm_key;
+static int g_keep_warm = 0;
+static int g_validate = 0;
+
+/**
+ * Hash a directory path (FNV-1a)
+ * 
+ * @param dir Path to hash
+ * @param len Length of the path
+ * @return Hash value
+ */
+static uint32_t hash_dir(const char *dir, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)dir[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Get how many directories all caches may keep open
+ * A quarter of the descriptor limit leaves the rest to the files the
+ * operations open, the log and the thread pool.
+ * 
+ * @return Number of directories
+ */
+static int cache_budget(void) {
+    int budget = __atomic_load_n(&g_budget, __ATOMIC_RELAXED);
+    if (budget == 0) {
+        struct rlimit limit;
+        budget = FD_CACHE_MAX;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && 
+            limit.rlim_cur / 4 < FD_CACHE_MAX) {
+            budget = (int)(limit.rlim_cur / 4);
+        }
+        if (budget < FD_CACHE_MIN) {
+            budget = FD_CACHE_MIN;
+        }
+        __atomic_store_n(&g_budget, budget, __ATOMIC_RELAXED);
+    }
+    return budget;
+}
+
+/**
+ * Normalize the directory part of a path
+ * Empty and "." components are dropped, so "a//b/./" and "a/b" share an
+ * entry. ".." is kept as it is, since it depends on symbolic links.
+ * 
+ * @param dir Directory part of a path
+ * @param len Length of the directory part
+ * @param out Buffer of at least len + 1 bytes
+ * @return Length of the normalized path; 0 for the working directory
+ */
+static size_t normalize_dir(const char *dir, size_t len, char *out) {
+    size_t out_len = 0;
+    if (len > 0 && dir[0] == '/') {
+        out[out_len++] = '/';
+    }
+    
+    for (size_t pos = 0; pos < len; ) {
+        size_t end = pos;
+        while (end < len && dir[end] != '/') {
+            end++;
+        }
+        size_t part = end - pos;
+        if (part > 0 && !(part == 1 && dir[pos] == '.')) {
+            if (out_len > 0 && out[out_len - 1] != '/') {
+                out[out_len++] = '/';
+            }
+            memcpy(out + out_len, dir + pos, part);
+            out_len += part;
+        }
+        pos = end + 1;
+    }
+    
+    out[out_len] = '\0';
+    return out_len;
+}
+
+/**
+ * Unlink an entry from the recency list
+ * 
+ * @param cache Cache holding the entry
+ * @param entry Entry to unlink
+ */
+static void unlink_recent(struct fd_cache *cache, struct fd_cache_entry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+/**
+ * Put an entry at the front of the recency list
+ * 
+ * @param cache Cache holding the entry
+ * @param entry Entry to move
+ */
+static void push_recent(struct fd_cache *cache, struct fd_cache_entry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+/**
+ * Close and free a cached directory
+ * 
+ * @param cache Cache holding the entry
+ * @param entry Entry to remove
+ */
+static void remove_entry(struct fd_cache *cache, struct fd_cache_entry *entry) {
+    struct fd_cache_entry **link = &cache->buckets[hash_dir(entry->dir, entry->len) % FD_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    unlink_recent(cache, entry);
+    
+    close(entry->fd);
+    free(entry->dir);
+    free(entry);
+    cache->count--;
+    __atomic_sub_fetch(&g_open_count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Close every directory of a cache, keeping the cache
+ * 
+ * @param cache Cache to empty
+ */
+static void clear_cache(struct fd_cache *cache) {
+    while (cache->oldest) {
+        remove_entry(cache, cache->oldest);
+    }
+}
+
+/**
+ * Create an empty cache
+ * 
+ * @return New cache, or NULL if memory allocation failed
+ */
+struct fd_cache *fd_cache_create(void) {
+    struct fd_cache *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->generation = __atomic_load_n(&g_generation, __ATOMIC_ACQUIRE);
+    return cache;
+}
+
+/**
+ * Get a descriptor for the directory holding a path
+ * A path with no directory part, or only "." components, is relative to
+ * the working directory and needs no descriptor of its own. A directory
+ * that is not cached is opened, and once every cache together holds the
+ * budget, this cache's least recently used directory is closed for it.
+ * 
+ * @param cache Cache to use
+ * @param path Path of a file
+ * @param name Set to the last component of path
+ * @return Directory descriptor or AT_FDCWD, -1 on failure with errno set
+ */
+int fd_cache_dir(struct fd_cache *cache, const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        *name = path;
+        return AT_FDCWD;
+    }
+    *name = slash + 1;
+    
+    // Too long to copy: let the kernel resolve the whole path
+    size_t raw_len = slash - path;
+    if (raw_len >= PATH_MAX) {
+        *name = path;
+        return AT_FDCWD;
+    }
+    char dir[PATH_MAX];
+    size_t len = normalize_dir(path, (slash == path) ? 1 : raw_len, dir);
+    if (len == 0) {
+        return AT_FDCWD;
+    }
+    
+    if (cache->generation != __atomic_load_n(&g_generation, __ATOMIC_ACQUIRE)) {
+        clear_cache(cache);
+        cache->generation = __atomic_load_n(&g_generation, __ATOMIC_ACQUIRE);
+    }
+    
+    uint32_t bucket = hash_dir(dir, len) % FD_CACHE_BUCKETS;
+    for (struct fd_cache_entry *entry = cache->buckets[bucket]; entry; entry = entry->next) {
+        if (entry->len != len || memcmp(entry->dir, dir, len) != 0) {
+            continue;
+        }
+        
+        // Between commands the directory may have been replaced or the
+        // working directory changed; a stat is still cheaper than reopening
+        struct stat st;
+        if (cache->validate && 
+            (stat(entry->dir, &st) == -1 || st.st_dev != entry->dev || st.st_ino != entry->ino)) {
+            remove_entry(cache, entry);
+            break;
+        }
+        unlink_recent(cache, entry);
+        push_recent(cache, entry);
+        return entry->fd;
+    }
+    
+    struct fd_cache_entry *entry = malloc(sizeof(*entry));
+    char *copy = entry ? strndup(dir, len) : NULL;
+    if (!copy) {
+        free(entry);
+        errno = ENOMEM;
+        return -1;
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        int open_errno = errno;
+        if (fd != -1) {
+            close(fd);
+        }
+        free(copy);
+        free(entry);
+        errno = open_errno;
+        return -1;
+    }
+    
+    if (__atomic_load_n(&g_open_count, __ATOMIC_RELAXED) >= cache_budget() && cache->oldest) {
+        remove_entry(cache, cache->oldest);
+    }
+    entry->dir = copy;
+    entry->len = len;
+    entry->fd = fd;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    push_recent(cache, entry);
+    cache->count++;
+    __atomic_add_fetch(&g_open_count, 1, __ATOMIC_RELAXED);
+    return fd;
+}
+
+/**
+ * Free a thread's warm cache when the thread exits
+ * 
+ * @param cache The thread's cache
+ */
+static void destroy_warm(void *cache) {
+    fd_cache_destroy((struct fd_cache *)cache);
+}
+
+/**
+ * Create the key for the threads' warm caches
+ */
+static void create_warm_key(void) {
+    pthread_key_create(&g_warm_key, destroy_warm);
+}
+
+/**
+ * Get the calling thread's warm cache, creating it if needed
+ * 
+ * @return The warm cache, or NULL if memory allocation failed
+ */
+static struct fd_cache *warm_cache(void) {
+    pthread_once(&g_key_once, create_warm_key);
+    struct fd_cache *cache = pthread_getspecific(g_warm_key);
+    if (!cache) {
+        cache = fd_cache_create();
+        if (cache) {
+            cache->validate = g_validate;
+            pthread_setspecific(g_warm_key, cache);
+        }
+    }
+    return cache;
+}
+
+/**
+ * Keep a cache per thread open across commands
+ * Batch runs and the server turn this on so repeated commands find
+ * their directories already open. Each thread has its own cache, so
+ * lanes never share one; turning it off frees the calling thread's.
+ * 
+ * @param enabled 1 to keep caches warm, 0 to create one per command
+ * @param validate 1 to check every hit against its path
+ */
+void fd_cache_keep_warm(int enabled, int validate) {
+    g_keep_warm = enabled;
+    g_validate = validate;
+    
+    pthread_once(&g_key_once, create_warm_key);
+    struct fd_cache *cache = pthread_getspecific(g_warm_key);
+    if (cache && !enabled) {
+        fd_cache_destroy(cache);
+        pthread_setspecific(g_warm_key, NULL);
+    } else if (cache) {
+        cache->validate = validate;
+    }
+}
+
+/**
+ * Get the directory holding a path for a single-file operation
+ * Without a warm cache a directory would be opened for one use, which
+ * costs more than letting the kernel resolve the whole path.
+ * 
+ * @param path Path of a file
+ * @param name Set to the name to use relative to the returned directory
+ * @return Directory descriptor or AT_FDCWD, -1 on failure with errno set
+ */
+int fd_cache_lookup(const char *path, const char **name) {
+    struct fd_cache *cache = g_keep_warm ? warm_cache() : NULL;
+    if (!cache) {
+        *name = path;
+        return AT_FDCWD;
+    }
+    return fd_cache_dir(cache, path, name);
+}
+
+/**
+ * Forget every cached directory
+ * Called after this process removes directories, so a path that is
+ * created again is not served the descriptor of the removed one. Each
+ * cache drops its entries on its next lookup.
+ */
+void fd_cache_invalidate(void) {
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get a cache for one command
+ * 
+ * @return The warm cache, a new cache, or NULL if memory allocation failed
+ */
+struct fd_cache *fd_cache_acquire(void) {
+    return g_keep_warm ? warm_cache() : fd_cache_create();
+}
+
+/**
+ * Finish with a cache from fd_cache_acquire()
+ * 
+ * @param cache Cache to release, or NULL
+ */
+void fd_cache_release(struct fd_cache *cache) {
+    if (!g_keep_warm || cache != pthread_getspecific(g_warm_key)) {
+        fd_cache_destroy(cache);
+    }
+}
+
+/**
+ * Close every cached directory and free the cache
+ * 
+ * @param cache Cache to destroy, or NULL
+ */
+void fd_cache_destroy(struct fd_cache *cache) {
+    if (!cache) {
+        return;
+    }
+    clear_cache(cache);
+    free(cache);
+}
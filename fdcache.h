@@ -0,0 +1,43 @@
+#ifndef FDCACHE_H
+#define FDCACHE_H
+
+// Directories kept open by all caches together: a quarter of the
+// RLIMIT_NOFILE soft limit, within these bounds
+#define FD_CACHE_MIN 8
+#define FD_CACHE_MAX 1024
+
+// Hash buckets of one cache
+#define FD_CACHE_BUCKETS 256
+
+// Open directories, least recently used evicted first
+// Paths are resolved relative to the descriptor of their directory, so
+// many files in the same directory cost one directory lookup.
+struct fd_cache;
+
+// Create an empty cache
+struct fd_cache *fd_cache_create(void);
+
+// Get a descriptor for the directory holding path and the name within it
+int fd_cache_dir(struct fd_cache *cache, const char *path, const char **name);
+
+// Close every cached directory and free the cache
+void fd_cache_destroy(struct fd_cache *cache);
+
+// Keep a cache per thread open across commands; validate checks every
+// hit against its path, for directories changed by other processes
+void fd_cache_keep_warm(int enabled, int validate);
+
+// Get the directory holding path from the warm cache, or AT_FDCWD and
+// the path itself; valid until the thread's next lookup
+int fd_cache_lookup(const char *path, const char **name);
+
+// Forget every cached directory, after this process removed directories
+void fd_cache_invalidate(void);
+
+// Get the warm cache, or a new one when it is not kept
+struct fd_cache *fd_cache_acquire(void);
+
+// Finish with a cache from fd_cache_acquire()
+void fd_cache_release(struct fd_cache *cache);
+
+#endif // FDCACHE_H
@@ -4,52 +4,214 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <dirent.h>
 #include <signal.h>
+#include <poll.h>
 
 #include "fileops.h"
 #include "dirops.h"
+#include "copyops.h"
+#include "hashops.h"
+#include "durability.h"
+#include "serve.h"
+#include "scheduler.h"
+#include "fdcache.h"
+#include "stats.h"
+#include "watch.h"
 #include "logging.h"
+#include "config.h"
 #include "utils.h"
 
-#define MAX_INPUT_SIZE 1024
-#define MAX_ARGS 4
-#define MAX_ARG_SIZE 256
+#define READ_BUFFER_SIZE 65536
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define LINE_INITIAL_SIZE 256
 
-// Global arguments array for signal handler access
-static char *g_args[MAX_ARGS] = {NULL};
+// Bound on the argument count of one command, on a batch line or in a
+// request; arguments are otherwise counted and allocated as parsed
+#define ARG_COUNT_LIMIT SERVE_MAX_ARGS
+
+// dispatch_command() result for a command name it does not know
+#define COMMAND_UNKNOWN -4
+
+// Block of arena memory, mapped directly so large lines go back to the system
+struct arena_chunk {
+    struct arena_chunk *next;   // Older chunk
+    size_t size;                // Bytes mapped, this header included
+    size_t used;
+};
+
+// Memory for one command: its line, its arguments and their array
+// Everything is released at once when the next command starts.
+struct arena {
+    struct arena_chunk *chunks; // Newest first
+};
+
+// Arena of the command being run, released by the exit handler
+static struct arena g_arena = { NULL };
+
+// Set while batch commands are read from standard input
+static int g_stdin_commands = 0;
+
+// Worker threads for --batch and serve; 1 runs commands one by one
+static int g_jobs = 1;
+
+// Set by --stats to write the batch's stats at the end
+static int g_show_stats = 0;
+
+// How serve runs requests; defined with the batch loop
+static const struct serve_commands g_serve_commands;
 
 /**
- * Ensures all resources are freed at program exit
+ * Allocate from an arena
+ * Blocks are aligned for pointers. A block larger than a chunk gets a
+ * chunk of its own.
+ * 
+ * @param arena Arena to allocate from
+ * @param size Number of bytes
+ * @return The block, or NULL if no memory could be mapped
  */
-void exit_handler(void) {
-    // Free any allocated global arguments
-    for (int i = 0; i < MAX_ARGS; i++) {
-        if (g_args[i]) {
-            free(g_args[i]);
-            g_args[i] = NULL;
+static void *arena_alloc(struct arena *arena, size_t size) {
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    
+    struct arena_chunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = ARENA_CHUNK_SIZE;
+        while (chunk_size - sizeof(*chunk) < size) {
+            chunk_size *= 2;
+        }
+        chunk = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE, 
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) {
+            return NULL;
         }
+        chunk->next = arena->chunks;
+        chunk->size = chunk_size;
+        chunk->used = sizeof(*chunk);
+        arena->chunks = chunk;
+    }
+    
+    void *block = (char *)chunk + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+/**
+ * Grow the newest block of an arena, moving it if it does not fit
+ * 
+ * @param arena Arena holding the block
+ * @param block Block returned by the last arena_alloc()
+ * @param old_size Size the block was allocated with
+ * @param new_size Size it needs
+ * @return The grown block, or NULL if no memory could be mapped
+ */
+static void *arena_grow(struct arena *arena, void *block, size_t old_size, size_t new_size) {
+    struct arena_chunk *chunk = arena->chunks;
+    size_t offset = (char *)block - (char *)chunk;
+    if (offset + new_size <= chunk->size) {
+        chunk->used = offset;
+        return arena_alloc(arena, new_size);
+    }
+    
+    void *grown = arena_alloc(arena, new_size);
+    if (grown) {
+        memcpy(grown, block, old_size);
     }
+    return grown;
 }
 
 /**
- * Signal handler to ensure proper cleanup on exit
+ * Release everything allocated from an arena, keeping its newest chunk
+ * Called before each command, so a batch maps memory only when a line
+ * needs more than the largest chunk so far.
+ * 
+ * @param arena Arena to reset
  */
-void cleanup_handler(int signum) {
-    // Free any allocated arguments
-    for (int i = 0; i < MAX_ARGS; i++) {
-        if (g_args[i]) {
-            free(g_args[i]);
-            g_args[i] = NULL;
-        }
+static void arena_reset(struct arena *arena) {
+    struct arena_chunk *chunk = arena->chunks;
+    if (!chunk) {
+        return;
+    }
+    
+    struct arena_chunk *older = chunk->next;
+    chunk->next = NULL;
+    chunk->used = sizeof(*chunk);
+    while (older) {
+        struct arena_chunk *next = older->next;
+        munmap(older, older->size);
+        older = next;
+    }
+}
+
+/**
+ * Unmap every chunk of an arena
+ * 
+ * @param arena Arena to release
+ */
+static void arena_release(struct arena *arena) {
+    struct arena_chunk *chunk = arena->chunks;
+    arena->chunks = NULL;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+}
+
+/**
+ * Copy arguments into a single allocation, for commands that outlive
+ * the arena they were parsed into
+ * 
+ * @param args Arguments to copy
+ * @param arg_count Number of arguments
+ * @return NULL-terminated copy, released with one free(), or NULL
+ */
+static char **copy_args(char *const args[], int arg_count) {
+    size_t size = (arg_count + 1) * sizeof(char *);
+    for (int i = 0; i < arg_count; i++) {
+        size += strlen(args[i]) + 1;
+    }
+    
+    char **copy = malloc(size);
+    if (!copy) {
+        return NULL;
+    }
+    char *text = (char *)(copy + arg_count + 1);
+    for (int i = 0; i < arg_count; i++) {
+        size_t len = strlen(args[i]) + 1;
+        memcpy(text, args[i], len);
+        copy[i] = text;
+        text += len;
     }
+    copy[arg_count] = NULL;
+    return copy;
+}
+
+/**
+ * Ensures all resources are freed at program exit
+ */
+void exit_handler(void) {
+    // Write out any buffered output and log entries
+    out_flush();
+    shutdown_logging();
     
-    // Exit with the signal number
-    _exit(signum);
+    // Release the current command's arguments
+    arena_release(&g_arena);
+}
+
+/**
+ * Signal handler asking for a clean exit
+ * Only the request is recorded: the batch, serve and watch loops return
+ * when they see it, and a single command finishes, so output and log
+ * entries are written by exit_handler() on the normal exit path. The
+ * handler is reset, so a second signal ends the process at once.
+ */
+void cleanup_handler(int signum) {
+    exit_request(signum);
 }
 
 /**
@@ -57,190 +219,629 @@ void cleanup_handler(int signum) {
  */
 void display_help(void) {
     const char *help_text = 
-        "Usage: fileManager <command> [arguments]\n\n"
+        "Usage: fileManager [options] <command> [arguments]\n\n"
         "Commands:\n\n"
         "  createDir \"folderName\" - Create a new directory\n\n"
         "  createFile \"fileName\" - Create a new file\n\n"
+        "  createFile \"file1\" \"file2\" ... | --from-file list.txt | -0\n"
+        "  - Create many files; -0 reads NUL-separated paths from standard input\n\n"
         "  listDir \"folderName\" - List all files in a directory\n\n"
+        "  listDir \"folderName\" --recursive [--jobs N] [--sorted]\n"
+        "  - List the whole tree using N threads (default: one per CPU)\n\n"
+        "  listDir \"folderName\" --indexed [--recursive] [--sorted]\n"
+        "  - Answer from the tree's .fmindex file, refreshing changed directories\n\n"
         "  listFilesByExtension \"folderName\" \".txt\" - List files with specific extension\n\n"
+        "  listFilesByExtension \"folderName\" \".log,.gz,*.2026-*.log\" [--recursive ...]\n"
+        "  [--indexed] - List files matching any of several suffixes or glob patterns\n\n"
         "  readFile \"fileName\" - Read a file's content\n\n"
+        "  readFile \"fileName\" --offset N --length M - Read a byte range\n\n"
+        "  readFile \"fileName\" --tail N - Read the last N lines\n\n"
         "  appendToFile \"fileName\" \"new content\" - Append content to a file\n\n"
+        "  appendToFile \"file1\" \"file2\" ... | --from-file list.txt | -0 \"new content\"\n"
+        "  - Append the same content to many files\n\n"
         "  deleteFile \"fileName\" - Delete a file\n\n"
+        "  deleteFile \"file1\" \"file2\" ... | --from-file list.txt | -0 - Delete many files\n\n"
         "  deleteDir \"folderName\" - Delete an empty directory\n\n"
-        "  showLogs - Display operation logs\n\n";
+        "  deleteDir \"folderName\" --recursive [--jobs N] - Delete a directory and its contents\n\n"
+        "  copyFile \"source\" \"dest\" [--jobs N] - Copy a file, reflinking it when possible\n\n"
+        "  moveFile \"source\" \"dest\" - Move a file, renaming it within a filesystem\n\n"
+        "  copyDir \"source\" \"dest\" --recursive [--jobs N] - Copy a directory and its contents\n\n"
+        "  hashFile \"fileName\" - Print a 128-bit hash of a file's content\n\n"
+        "  findDuplicates \"folderName\" [--recursive] [--indexed] [--jobs N] - List files\n"
+        "  with identical content; --indexed caches their hashes in the tree's index\n\n"
+        "  watch \"folderName\" - Keep the tree's index current for --indexed listings\n\n"
+        "  serve --socket \"path\" [--metrics \"path\"] - Run commands sent to a UNIX socket in\n"
+        "  one resident process; --metrics answers HTTP requests there with its stats\n\n"
+        "  stats [--format text|prometheus] - Show counts, latency percentiles, kernel time\n"
+        "  and lock, fork and sync waits of the commands run by this process\n\n"
+        "  showLogs - Display operation logs\n\n"
+        "  showLogs [--last N] [--since \"YYYY-MM-DD HH:MM:SS\"] [--grep \"text\"]\n"
+        "  [--format text|json] - Display selected operation logs\n\n"
+        "Options:\n\n"
+        "  --batch [scriptFile] - Run commands line by line from scriptFile\n"
+        "  (or standard input) in a single process\n\n"
+        "  --isolate - Run file and directory operations in a child process\n\n"
+        "  --config \"file\" - Read settings from file instead of fileManager.conf\n\n"
+        "  --durability none|fdatasync|group|direct - Override the durability setting\n\n"
+        "  --connect \"path\" - Send the command to a server started with serve\n\n"
+        "  --stats - Write the stats of a --batch run to standard error at the end\n\n"
+        "  --jobs N - Let --batch and serve run single-file createFile, appendToFile and\n"
+        "  deleteFile commands on N threads, keeping each path's commands in order\n\n"
+        "Settings:\n\n"
+        "  log_max_size - Rotate log.txt at this size (default 64M, 0 = never)\n\n"
+        "  log_max_age - Rotate log.txt after this many seconds (default 0 = never)\n\n"
+        "  log_retain - Number of compressed log segments to keep (default 8)\n\n"
+        "  log_format - text (log.txt, default) or binary (log.bin, faster to write)\n\n"
+        "  watch_delay - Milliseconds watch collects changes before updating the index (default 100)\n\n"
+        "  append_mode - direct (default) writes each append at once; group lets --batch\n"
+        "  and serve commit runs of appends with one lock and one write per file\n\n"
+        "  durability - none (default), fdatasync after every write, group to fdatasync\n"
+        "  written files together, or direct for O_DIRECT large appends plus fdatasync\n\n"
+        "  durability_interval - Milliseconds a group sync may wait (default 100)\n\n"
+        "  io_backend - auto (default) runs bulk createFile/deleteFile through io_uring\n"
+        "  when the kernel supports it; sync always uses plain system calls\n\n";
     
-    write(STDOUT_FILENO, help_text, strlen(help_text));
+    out_write(help_text, strlen(help_text));
 }
 
 /**
- * Free the memory allocated for arguments
+ * Parse a command line into tokens
+ * Tokens are split on spaces outside double quotes, which are removed.
+ * They are unquoted in place, so each argument is a view into input,
+ * and only the argument array comes from the arena.
  * 
- * @param args Array of argument pointers
+ * @param input Input string to parse, modified
+ * @param arena Arena for the argument array
+ * @param args Set to the NULL-terminated arguments
+ * @return Number of arguments parsed, -1 if memory allocation failed, or
+ *         SERVE_TOO_MANY_ARGS for more than ARG_COUNT_LIMIT
  */
-void free_args(char *args[MAX_ARGS]) {
-    if (!args) return;
+int parse_command(char *input, struct arena *arena, char ***args) {
+    int arg_count = 0;
+    int in_quotes = 0;
+    size_t out = 0;
+    size_t token_len = 0;
     
-    for (int i = 0; i < MAX_ARGS; i++) {
-        if (args[i]) {
-            free(args[i]);
-            args[i] = NULL;
+    // Unquote in place: tokens end up NUL-separated at the start of input
+    for (size_t i = 0; input[i] != '\0' && input[i] != '\n'; i++) {
+        if (input[i] == '"') {
+            in_quotes = !in_quotes;
+        } else if (input[i] == ' ' && !in_quotes) {
+            if (token_len > 0) {
+                input[out++] = '\0';
+                arg_count++;
+                token_len = 0;
+            }
+        } else {
+            input[out++] = input[i];
+            token_len++;
         }
     }
+    if (token_len > 0) {
+        input[out++] = '\0';
+        arg_count++;
+    }
+    if (arg_count > ARG_COUNT_LIMIT) {
+        return SERVE_TOO_MANY_ARGS;
+    }
+    
+    *args = arena_alloc(arena, (arg_count + 1) * sizeof(char *));
+    if (!*args) {
+        return -1; // Memory allocation failed
+    }
+    char *token = input;
+    for (int i = 0; i < arg_count; i++) {
+        (*args)[i] = token;
+        token += strlen(token) + 1;
+    }
+    (*args)[arg_count] = NULL;
+    
+    return arg_count;
 }
 
+// Options of the commands that walk a directory tree
+struct walk_options {
+    int jobs;     // Worker threads, or 0 for one per CPU
+    int sorted;
+    int recursive;
+    int indexed;  // Answer from the tree's index
+};
+
 /**
- * Sync global args array with local args array
- * Note: This makes g_args point to the same memory as args
+ * Parse --recursive, --indexed, --jobs N and --sorted after a command's arguments
+ * 
+ * @param args Array of command arguments
+ * @param arg_count Number of arguments
+ * @param first Index of the first option
+ * @param options Set to the parsed options
+ * @return 0 on success, -1 if the options are invalid or lack --recursive
  */
-void sync_args(char *args[MAX_ARGS]) {
-    for (int i = 0; i < MAX_ARGS; i++) {
-        g_args[i] = args[i]; // No deep copy - just pointer assignment
+static int parse_walk_options(char *args[], int arg_count, int first, 
+                              struct walk_options *options) {
+    long jobs = 0;
+    
+    options->jobs = 0;
+    options->sorted = 0;
+    options->recursive = 0;
+    options->indexed = 0;
+    
+    for (int i = first; i < arg_count; i++) {
+        int valid = 1;
+        if (strcmp(args[i], "--recursive") == 0) {
+            options->recursive = 1;
+        } else if (strcmp(args[i], "--indexed") == 0) {
+            options->indexed = 1;
+        } else if (strcmp(args[i], "--sorted") == 0) {
+            options->sorted = 1;
+        } else if (strcmp(args[i], "--jobs") == 0 && i + 1 < arg_count) {
+            i++;
+            valid = (parse_number(args[i], &jobs) == 0 && jobs > 0 && jobs <= 256);
+        } else {
+            valid = 0;
+        }
+        
+        if (!valid) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Invalid %s option '%s'\n", args[0], args[i]);
+            err_write(error_msg, len);
+            return -1;
+        }
+    }
+    
+    if (!options->recursive && (jobs > 0 || options->sorted)) {
+        err_write("Error: --jobs and --sorted require --recursive\n", 47);
+        return -1;
     }
+    
+    options->jobs = (int)jobs;
+    return 0;
 }
 
+// Target paths of a bulk command
+struct path_list {
+    char **paths;
+    int count;
+    char *data;     // Storage for paths read from a list, or NULL
+};
+
 /**
- * Parse a command line into tokens
+ * Read a list of paths, one per separator-terminated record
+ * Empty records are skipped, and so is the '\r' of CRLF lines.
  * 
- * @param input Input string to parse
- * @param args Array to store parsed arguments
- * @return Number of arguments parsed, or -1 on error
+ * @param source Path of the list, or NULL for standard input, which is
+ *        the client's when serving a request
+ * @param separator '\n' for a list file, '\0' for -0 input
+ * @param list Set to the paths read
+ * @return 0 on success, -1 on failure
  */
-int parse_command(char *input, char *args[MAX_ARGS]) {
-    int arg_count = 0;
-    int in_quotes = 0;
-    int i, j = 0;
+static int read_path_list(const char *source, char separator, struct path_list *list) {
+    int fd = source ? open(source, O_RDONLY | O_CLOEXEC) : in_descriptor();
+    if (fd == -1 && !source) {
+        err_write("Error: -0 has no standard input to read paths from\n", 51);
+        return -1;
+    }
+    if (fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open path list \"%s\": %s\n", 
+                          source, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
     
-    // Free any existing allocations in args
-    free_args(args);
+    size_t len = 0;
+    size_t capacity = READ_BUFFER_SIZE;
+    char *data = malloc(capacity + 1);
+    ssize_t bytes_read = 0;
     
-    // Allocate memory for the first argument
-    args[0] = (char *)malloc(MAX_ARG_SIZE);
-    if (!args[0]) {
-        return -1; // Memory allocation failed
+    while (data) {
+        if (len == capacity) {
+            char *grown = realloc(data, capacity * 2 + 1);
+            if (!grown) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        bytes_read = read(fd, data + len, capacity - len);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            break;
+        }
+        len += bytes_read;
     }
+    int read_errno = errno;
     
-    // Update global args for signal handler
-    sync_args(args);
+    if (source) {
+        close(fd);
+    }
+    if (!data) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    if (bytes_read == -1) {
+        char error_msg[256];
+        int msg_len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not read path list: %s\n", strerror(read_errno));
+        err_write(error_msg, msg_len);
+        free(data);
+        return -1;
+    }
+    data[len] = separator; // Terminate the last record
     
-    // Parse input string
-    for (i = 0; input[i] != '\0' && input[i] != '\n'; i++) {
-        if (input[i] == '"') {
-            in_quotes = !in_quotes;
+    // Count the records, then split them in place
+    int count = 0;
+    for (size_t i = 0; i <= len; i++) {
+        count += (data[i] == separator);
+    }
+    list->paths = malloc((count ? count : 1) * sizeof(*list->paths));
+    if (!list->paths) {
+        free(data);
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    
+    list->count = 0;
+    char *start = data;
+    for (size_t i = 0; i <= len; i++) {
+        if (data[i] != separator) {
             continue;
         }
-        
-        if (input[i] == ' ' && !in_quotes) {
-            if (j > 0) { // If we have collected characters
-                args[arg_count][j] = '\0';
-                arg_count++;
-                
-                if (arg_count >= MAX_ARGS) {
-                    break; // Too many arguments
-                }
-                
-                // Allocate memory for the next argument
-                args[arg_count] = (char *)malloc(MAX_ARG_SIZE);
-                if (!args[arg_count]) {
-                    // Free previously allocated memory
-                    free_args(args);
-                    return -1; // Memory allocation failed
-                }
-                
-                // Update global args for signal handler
-                sync_args(args);
-                
-                j = 0;
-            }
-        } else {
-            args[arg_count][j++] = input[i];
+        data[i] = '\0';
+        char *end = data + i;
+        if (separator == '\n' && end > start && end[-1] == '\r') {
+            *--end = '\0';
+        }
+        if (end > start) {
+            list->paths[list->count++] = start;
         }
+        start = data + i + 1;
     }
+    list->data = data;
     
-    // Set the last argument if there are characters
-    if (j > 0) {
-        args[arg_count][j] = '\0';
-        arg_count++;
-    } else if (arg_count > 0 && j == 0) {
-        // Free the last allocated but unused memory
-        free(args[arg_count]);
-        args[arg_count] = NULL;
-        g_args[arg_count] = NULL;
+    if (list->count == 0) {
+        err_write("Error: The path list is empty\n", 30);
+        free(list->paths);
+        free(data);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Get the targets of a bulk command
+ * The targets are the given arguments, or "--from-file list" for a file
+ * with one path per line, or "-0" for NUL-separated paths on standard
+ * input.
+ * 
+ * @param args Target arguments
+ * @param count Number of target arguments
+ * @param list Set to the targets; free list->paths and list->data when data is set
+ * @return 0 on success, -1 on failure
+ */
+static int collect_paths(char *args[], int count, struct path_list *list) {
+    list->data = NULL;
+    
+    if (count == 2 && strcmp(args[0], "--from-file") == 0) {
+        return read_path_list(args[1], '\n', list);
+    }
+    if (count == 1 && strcmp(args[0], "-0") == 0) {
+        if (g_stdin_commands) {
+            err_write("Error: -0 cannot read paths while commands come from standard input\n", 68);
+            return -1;
+        }
+        return read_path_list(NULL, '\0', list);
     }
     
-    return arg_count;
+    list->paths = args;
+    list->count = count;
+    return 0;
 }
 
 /**
- * Execute a command with the given arguments
+ * Run a bulk command over its targets
+ * 
+ * @param op 'c' to create, 'a' to append, 'd' to delete
+ * @param args Target arguments
+ * @param count Number of target arguments
+ * @param content Content to append, or NULL
+ * @return 0 if every target succeeded, -1 otherwise
+ */
+static int run_bulk_command(char op, char *args[], int count, const char *content) {
+    struct path_list list;
+    if (collect_paths(args, count, &list) == -1) {
+        return -1;
+    }
+    
+    int result;
+    if (op == 'c') {
+        result = create_files(list.paths, list.count);
+    } else if (op == 'a') {
+        result = append_to_files(list.paths, list.count, content);
+    } else {
+        result = delete_files(list.paths, list.count);
+    }
+    
+    if (list.data) {
+        free(list.paths);
+        free(list.data);
+    }
+    return result;
+}
+
+/**
+ * Run a command with the given arguments
  * 
  * @param args Array of command arguments
  * @param arg_count Number of arguments
- * @return 0 on success, 1 to exit program, -1 on error
+ * @return 0 on success, 1 to exit program, -1 on error, COMMAND_UNKNOWN
+ *         if there is no such command
  */
-int execute_command(char *args[], int arg_count) {
-    if (arg_count == 0) {
-        return 0;
-    }
+static int dispatch_command(char *args[], int arg_count) {
+    // Tag this command's log records with its operation
+    log_set_operation(args[0]);
     
     // Check the command
     if (strcmp(args[0], "createDir") == 0) {
         if (arg_count != 2) {
-            write(STDERR_FILENO, "Error: createDir requires one argument\n", 39);
+            err_write("Error: createDir requires one argument\n", 39);
             return -1;
         }
         return create_directory(args[1]);
     } 
     else if (strcmp(args[0], "createFile") == 0) {
-        if (arg_count != 2) {
-            write(STDERR_FILENO, "Error: createFile requires one argument\n", 40);
+        if (arg_count < 2) {
+            err_write("Error: createFile requires one argument\n", 40);
             return -1;
         }
-        return create_file(args[1]);
+        if (arg_count == 2 && strcmp(args[1], "-0") != 0) {
+            return create_file(args[1]);
+        }
+        return run_bulk_command('c', args + 1, arg_count - 1, NULL);
     } 
     else if (strcmp(args[0], "listDir") == 0) {
-        if (arg_count != 2) {
-            write(STDERR_FILENO, "Error: listDir requires one argument\n", 37);
+        if (arg_count < 2) {
+            err_write("Error: listDir requires one argument\n", 37);
             return -1;
         }
-        return list_directory(args[1]);
+        if (arg_count == 2) {
+            return list_directory(args[1]);
+        }
+        
+        struct walk_options options;
+        if (parse_walk_options(args, arg_count, 2, &options) == -1) {
+            return -1;
+        }
+        if (options.indexed) {
+            return list_directory_indexed(args[1], options.recursive, options.sorted);
+        }
+        return list_directory_recursive(args[1], options.jobs, options.sorted);
     } 
     else if (strcmp(args[0], "listFilesByExtension") == 0) {
-        if (arg_count != 3) {
-            write(STDERR_FILENO, "Error: listFilesByExtension requires two arguments\n", 51);
+        if (arg_count < 3) {
+            err_write("Error: listFilesByExtension requires two arguments\n", 51);
             return -1;
         }
-        return list_files_by_extension(args[1], args[2]);
+        if (arg_count == 3) {
+            return list_files_by_extension(args[1], args[2]);
+        }
+        
+        struct walk_options options;
+        if (parse_walk_options(args, arg_count, 3, &options) == -1) {
+            return -1;
+        }
+        if (options.indexed) {
+            return list_files_by_extension_indexed(args[1], args[2], 
+                                                   options.recursive, options.sorted);
+        }
+        return list_files_by_extension_recursive(args[1], args[2], options.jobs, options.sorted);
     } 
     else if (strcmp(args[0], "readFile") == 0) {
-        if (arg_count != 2) {
-            write(STDERR_FILENO, "Error: readFile requires one argument\n", 38);
+        if (arg_count < 2 || arg_count % 2 != 0) {
+            err_write("Error: readFile requires one argument\n", 38);
             return -1;
         }
-        return read_file(args[1]);
+        if (arg_count == 2) {
+            return read_file(args[1]);
+        }
+        
+        // Options: --offset N, --length M, or --tail N
+        long offset = 0, length = -1, tail = -1;
+        for (int i = 2; i < arg_count; i += 2) {
+            long *target = NULL;
+            if (strcmp(args[i], "--offset") == 0) {
+                target = &offset;
+            } else if (strcmp(args[i], "--length") == 0) {
+                target = &length;
+            } else if (strcmp(args[i], "--tail") == 0) {
+                target = &tail;
+            }
+            
+            if (!target || parse_number(args[i + 1], target) == -1) {
+                char error_msg[256];
+                int len = string_format(error_msg, sizeof(error_msg), 
+                                  "Error: Invalid readFile option '%s %s'\n", 
+                                  args[i], args[i + 1]);
+                err_write(error_msg, len);
+                return -1;
+            }
+        }
+        
+        if (tail >= 0) {
+            if (offset != 0 || length != -1) {
+                write_error("Error: --tail cannot be combined with --offset or --length\n");
+                return -1;
+            }
+            return read_file_tail(args[1], tail);
+        }
+        return read_file_range(args[1], offset, length);
     } 
     else if (strcmp(args[0], "appendToFile") == 0) {
-        if (arg_count != 3) {
-            write(STDERR_FILENO, "Error: appendToFile requires two arguments\n", 43);
+        if (arg_count < 3) {
+            err_write("Error: appendToFile requires two arguments\n", 43);
             return -1;
         }
-        return append_to_file(args[1], args[2]);
+        if (arg_count == 3 && strcmp(args[1], "-0") != 0) {
+            return append_to_file(args[1], args[2]);
+        }
+        
+        // The content comes last, after every target
+        return run_bulk_command('a', args + 1, arg_count - 2, args[arg_count - 1]);
     } 
     else if (strcmp(args[0], "deleteFile") == 0) {
-        if (arg_count != 2) {
-            write(STDERR_FILENO, "Error: deleteFile requires one argument\n", 40);
+        if (arg_count < 2) {
+            err_write("Error: deleteFile requires one argument\n", 40);
             return -1;
         }
-        return delete_file(args[1]);
+        if (arg_count == 2 && strcmp(args[1], "-0") != 0) {
+            return delete_file(args[1]);
+        }
+        return run_bulk_command('d', args + 1, arg_count - 1, NULL);
     } 
     else if (strcmp(args[0], "deleteDir") == 0) {
+        if (arg_count < 2) {
+            err_write("Error: deleteDir requires one argument\n", 39);
+            return -1;
+        }
+        if (arg_count == 2) {
+            return delete_directory(args[1]);
+        }
+        
+        struct walk_options options;
+        if (parse_walk_options(args, arg_count, 2, &options) == -1) {
+            return -1;
+        }
+        if (!options.recursive || options.sorted || options.indexed) {
+            err_write("Error: deleteDir only accepts --recursive [--jobs N]\n", 53);
+            return -1;
+        }
+        return delete_directory_recursive(args[1], options.jobs);
+    } 
+    else if (strcmp(args[0], "copyFile") == 0) {
+        long jobs = 0;
+        if (arg_count == 5 && strcmp(args[3], "--jobs") == 0) {
+            if (parse_number(args[4], &jobs) == -1 || jobs <= 0 || jobs > 256) {
+                err_write("Error: Invalid copyFile --jobs value\n", 37);
+                return -1;
+            }
+        } else if (arg_count != 3) {
+            err_write("Error: copyFile requires two arguments\n", 39);
+            return -1;
+        }
+        return copy_file(args[1], args[2], (int)jobs);
+    } 
+    else if (strcmp(args[0], "moveFile") == 0) {
+        if (arg_count != 3) {
+            err_write("Error: moveFile requires two arguments\n", 39);
+            return -1;
+        }
+        return move_file(args[1], args[2]);
+    } 
+    else if (strcmp(args[0], "copyDir") == 0) {
+        if (arg_count < 3) {
+            err_write("Error: copyDir requires two arguments\n", 38);
+            return -1;
+        }
+        
+        struct walk_options options;
+        if (parse_walk_options(args, arg_count, 3, &options) == -1) {
+            return -1;
+        }
+        if (!options.recursive || options.sorted || options.indexed) {
+            err_write("Error: copyDir only accepts --recursive [--jobs N]\n", 51);
+            return -1;
+        }
+        return copy_directory(args[1], args[2], options.jobs);
+    } 
+    else if (strcmp(args[0], "hashFile") == 0) {
         if (arg_count != 2) {
-            write(STDERR_FILENO, "Error: deleteDir requires one argument\n", 39);
+            err_write("Error: hashFile requires one argument\n", 38);
             return -1;
         }
-        return delete_directory(args[1]);
+        return hash_file(args[1]);
+    } 
+    else if (strcmp(args[0], "findDuplicates") == 0) {
+        if (arg_count < 2) {
+            err_write("Error: findDuplicates requires one argument\n", 44);
+            return -1;
+        }
+        
+        struct walk_options options;
+        if (parse_walk_options(args, arg_count, 2, &options) == -1) {
+            return -1;
+        }
+        if (options.sorted) {
+            err_write("Error: findDuplicates only accepts --recursive, --indexed and --jobs N\n", 71);
+            return -1;
+        }
+        return find_duplicates(args[1], options.recursive, options.indexed, options.jobs);
+    } 
+    else if (strcmp(args[0], "serve") == 0) {
+        int metrics = (arg_count == 5 && strcmp(args[3], "--metrics") == 0);
+        if ((arg_count != 3 && !metrics) || strcmp(args[1], "--socket") != 0) {
+            err_write("Error: serve requires --socket \"path\" [--metrics \"path\"]\n", 57);
+            return -1;
+        }
+        return serve_socket(args[2], metrics ? args[4] : NULL, &g_serve_commands, g_jobs);
+    } 
+    else if (strcmp(args[0], "watch") == 0) {
+        if (arg_count != 2) {
+            err_write("Error: watch requires one argument\n", 35);
+            return -1;
+        }
+        return watch_directory(args[1]);
     } 
     else if (strcmp(args[0], "showLogs") == 0) {
-        return show_logs();
+        if (arg_count == 1) {
+            return show_logs();
+        }
+        
+        // Options: --last N, --since TIMESTAMP, --grep PATTERN, --format text|json
+        struct log_query query = { -1, NULL, NULL, 0 };
+        for (int i = 1; i < arg_count; i += 2) {
+            int valid = (i + 1 < arg_count);
+            if (valid && strcmp(args[i], "--last") == 0) {
+                valid = (parse_number(args[i + 1], &query.last) == 0);
+            } else if (valid && strcmp(args[i], "--since") == 0) {
+                query.since = args[i + 1];
+            } else if (valid && strcmp(args[i], "--grep") == 0) {
+                query.grep = args[i + 1];
+            } else if (valid && strcmp(args[i], "--format") == 0) {
+                if (strcmp(args[i + 1], "json") == 0) {
+                    query.json = 1;
+                } else {
+                    valid = (strcmp(args[i + 1], "text") == 0);
+                }
+            } else {
+                valid = 0;
+            }
+            
+            if (!valid) {
+                char error_msg[256];
+                int len = string_format(error_msg, sizeof(error_msg), 
+                                  "Error: Invalid showLogs option '%s'\n", args[i]);
+                err_write(error_msg, len);
+                return -1;
+            }
+        }
+        return show_logs_query(&query);
+    } 
+    else if (strcmp(args[0], "stats") == 0) {
+        enum stats_format format = STATS_TEXT;
+        if (arg_count == 3 && strcmp(args[1], "--format") == 0 && 
+            strcmp(args[2], "prometheus") == 0) {
+            format = STATS_PROMETHEUS;
+        } else if (arg_count != 1 && !(arg_count == 3 && strcmp(args[1], "--format") == 0 && 
+                                       strcmp(args[2], "text") == 0)) {
+            err_write("Error: stats only accepts --format text|prometheus\n", 51);
+            return -1;
+        }
+        return stats_write(out_write, format);
     } 
     else if (strcmp(args[0], "exit") == 0 || strcmp(args[0], "quit") == 0) {
         return 1; // Special return value for exit command
@@ -253,9 +854,500 @@ int execute_command(char *args[], int arg_count) {
         char error_msg[100];
         int len = string_format(error_msg, sizeof(error_msg), 
                                "Error: Unknown command '%s'\n", args[0]);
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
+        return COMMAND_UNKNOWN;
+    }
+}
+
+/**
+ * Execute a command with the given arguments
+ * Each known command is timed, and its latency, kernel time and waits
+ * are recorded for the stats command.
+ * 
+ * @param args Array of command arguments
+ * @param arg_count Number of arguments
+ * @return 0 on success, 1 to exit program, -1 on error
+ */
+int execute_command(char *args[], int arg_count) {
+    if (arg_count == 0) {
+        return 0;
+    }
+    
+    struct stats_timer timer;
+    stats_command_begin(&timer);
+    int result = dispatch_command(args, arg_count);
+    if (result == COMMAND_UNKNOWN) {
         return -1;
     }
+    stats_command_end(&timer, args[0], result < 0);
+    return result;
+}
+
+/**
+ * Wait until a descriptor has input or an exit is requested
+ * 
+ * @param fd Descriptor to wait on
+ * @return 1 once input (or end of input) is ready, 0 on an exit request
+ */
+static int wait_for_input(int fd) {
+    struct pollfd fds[2] = { { fd, POLLIN, 0 }, { exit_request_fd(), POLLIN, 0 } };
+    
+    while (!exit_requested()) {
+        int ready = poll(fds, 2, -1);
+        if ((ready > 0 && fds[0].revents != 0) || (ready == -1 && errno != EINTR)) {
+            return 1; // read() reports any error
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read one line from a file descriptor into an arena
+ * Input is buffered internally so only one read() is needed per block
+ * of input, not per character. Lines may be of any length. Buffered log
+ * entries are flushed before blocking for more input, and an exit
+ * request ends the input.
+ * 
+ * @param fd File descriptor to read from
+ * @param arena Arena to store the line in (without the trailing newline)
+ * @return The line, or NULL on end of input, exit request, error or
+ *         allocation failure
+ */
+static char *read_line(int fd, struct arena *arena) {
+    static char buffer[READ_BUFFER_SIZE];
+    static size_t buf_pos = 0;
+    static size_t buf_len = 0;
+    
+    size_t size = LINE_INITIAL_SIZE;
+    char *line = arena_alloc(arena, size);
+    size_t line_len = 0;
+    int got_input = 0;
+    if (!line) {
+        return NULL;
+    }
+    
+    while (1) {
+        // Refill the buffer when it has been consumed
+        if (buf_pos >= buf_len) {
+            // Show everything so far, including the prompt, before blocking
+            out_flush();
+            flush_logs();
+            if (!wait_for_input(fd)) {
+                return NULL;
+            }
+            ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+            if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_read <= 0) {
+                // End of input: return the last unterminated line if any
+                if (!got_input) {
+                    return NULL;
+                }
+                break;
+            }
+            buf_pos = 0;
+            buf_len = bytes_read;
+        }
+        
+        got_input = 1;
+        char c = buffer[buf_pos++];
+        if (c == '\n') {
+            break;
+        }
+        if (line_len == size - 1) {
+            line = arena_grow(arena, line, size, size * 2);
+            size *= 2;
+            if (!line) {
+                return NULL;
+            }
+        }
+        line[line_len++] = c;
+    }
+    
+    // Strip a trailing carriage return from CRLF scripts
+    if (line_len > 0 && line[line_len - 1] == '\r') {
+        line_len--;
+    }
+    line[line_len] = '\0';
+    
+    return line;
+}
+
+/**
+ * Report a batch command's exit status
+ * 
+ * @param line_number Script line of the command
+ * @param result Command result, negative on failure
+ * @param failed Set to 1 on failure
+ */
+static void report_batch_status(long line_number, int result, void *failed) {
+    int status = (result < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (status != EXIT_SUCCESS) {
+        *(int *)failed = 1;
+    }
+    
+    char status_msg[64];
+    int len = string_format(status_msg, sizeof(status_msg), 
+                      "[%ld] exit status %d\n", line_number, status);
+    out_write(status_msg, len);
+}
+
+/**
+ * Check whether a batch command is a single append that can be queued
+ * 
+ * @param args Array of command arguments
+ * @param arg_count Number of arguments
+ * @return 1 if the command can join a group commit, 0 otherwise
+ */
+static int is_group_append(char *args[], int arg_count) {
+    return arg_count == 3 && strcmp(args[0], "appendToFile") == 0 && 
+           strcmp(args[1], "-0") != 0;
+}
+
+/**
+ * Split a request received by serve into arguments
+ * 
+ * @param request Command line, or NUL-terminated arguments
+ * @param len Length of the request
+ * @param is_line 1 for a command line, 0 for arguments
+ * @param args Set to the NULL-terminated arguments, released with one free()
+ * @return Number of arguments, -1 if memory allocation failed, or
+ *         SERVE_TOO_MANY_ARGS for more than ARG_COUNT_LIMIT
+ */
+static int parse_request(char *request, size_t len, int is_line, char ***args) {
+    char **parsed;
+    int arg_count = 0;
+    
+    arena_reset(&g_arena);
+    if (is_line) {
+        arg_count = parse_command(request, &g_arena, &parsed);
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            arg_count += (request[i] == '\0');
+        }
+        if (arg_count > ARG_COUNT_LIMIT) {
+            return SERVE_TOO_MANY_ARGS;
+        }
+        parsed = arena_alloc(&g_arena, (arg_count + 1) * sizeof(*parsed));
+        char *arg = request;
+        for (int i = 0; parsed && i < arg_count; i++) {
+            parsed[i] = arg;
+            arg += strlen(arg) + 1;
+        }
+    }
+    if (arg_count < 0) {
+        return arg_count;
+    }
+    if (!parsed) {
+        return -1;
+    }
+    
+    // Requests on a lane outlive the next request's arena
+    *args = copy_args(parsed, arg_count);
+    return *args ? arg_count : -1;
+}
+
+/**
+ * Run one command received by serve
+ * Commands that never return, like watch, would stall every client and
+ * are refused.
+ * 
+ * @param args Array of command arguments
+ * @param arg_count Number of arguments
+ * @return Command result: 0 on success, 1 to close the connection, -1 on error
+ */
+static int run_server_command(char *args[], int arg_count) {
+    if (strcmp(args[0], "serve") == 0 || strcmp(args[0], "watch") == 0) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: %s cannot run inside the server\n", args[0]);
+        err_write(error_msg, len);
+        return -1;
+    }
+    return execute_command(args, arg_count);
+}
+
+/**
+ * Get the path a command works on, if it may run beside other commands
+ * Single-file creates, appends and deletes only ever touch their own
+ * file, so they run on that path's lane. Everything else runs alone,
+ * after every command before it.
+ * 
+ * @param args Array of command arguments
+ * @param arg_count Number of arguments
+ * @return Target path, or NULL if the command must run alone
+ */
+static const char *lane_path(char *args[], int arg_count) {
+    int single = (arg_count == 2 && (strcmp(args[0], "createFile") == 0 || 
+                                     strcmp(args[0], "deleteFile") == 0)) || 
+                 (arg_count == 3 && strcmp(args[0], "appendToFile") == 0);
+    return (single && strcmp(args[1], "-0") != 0) ? args[1] : NULL;
+}
+
+/**
+ * Queue a command received by serve for the next group commit
+ * With append_mode = group, single appends wait so that the appends of
+ * every client arriving together are written with one lock and one
+ * write per file.
+ * 
+ * @param args Array of command arguments
+ * @param arg_count Number of arguments
+ * @param tag Passed back to the commit's callbacks
+ * @return 0 if queued, 1 if queued and the group is full, -1 if the
+ *         command must run on its own
+ */
+static int queue_server_command(char *args[], int arg_count, long tag) {
+    if (!is_group_append(args, arg_count) || !append_group_enabled() || 
+        process_isolation_enabled()) {
+        return -1;
+    }
+    return append_group_add(args[1], args[2], tag);
+}
+
+static const struct serve_commands g_serve_commands = {
+    parse_request,
+    lane_path,
+    run_server_command,
+    queue_server_command,
+    append_group_commit
+};
+
+// Batch command running on a scheduler lane
+struct batch_command {
+    char **args;
+    int arg_count;
+    long line_number;
+    struct out_capture capture;
+};
+
+/**
+ * Run a batch command on a lane, capturing its output
+ * 
+ * @param task Pointer to struct batch_command
+ * @param context Unused
+ * @return Command result
+ */
+static int run_batch_command(void *task, void *context) {
+    struct batch_command *command = (struct batch_command *)task;
+    (void)context;
+    
+    out_capture(&command->capture);
+    int result = execute_command(command->args, command->arg_count);
+    out_capture(NULL);
+    return result;
+}
+
+/**
+ * Write a finished batch command's output and status, in script order
+ * 
+ * @param task Pointer to struct batch_command
+ * @param result Command result
+ * @param failed Set to 1 on failure
+ */
+static void finish_batch_command(void *task, int result, void *failed) {
+    struct batch_command *command = (struct batch_command *)task;
+    
+    out_replay(&command->capture);
+    report_batch_status(command->line_number, result, failed);
+    free(command->args);
+    free(command);
+}
+
+/**
+ * Queue a batch command on its path's lane
+ * The command gets its own copy of the arguments, as the arena they
+ * were parsed into is reused for the next line.
+ * 
+ * @param sched Scheduler of the batch
+ * @param args Parsed arguments
+ * @param arg_count Number of arguments
+ * @param line_number Script line of the command
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int schedule_batch_command(struct scheduler *sched, char *const args[], 
+                                  int arg_count, long line_number) {
+    struct batch_command *command = calloc(1, sizeof(*command));
+    char **owned = copy_args(args, arg_count);
+    if (!command || !owned) {
+        free(command);
+        free(owned);
+        return -1;
+    }
+    
+    command->args = owned;
+    command->arg_count = arg_count;
+    command->line_number = line_number;
+    return sched_submit(sched, lane_path(owned, arg_count), command);
+}
+
+/**
+ * Commit a batch's queued appends, after the lane commands before them
+ * 
+ * @param sched Scheduler of the batch, or NULL
+ * @param failed Set to 1 if an append failed
+ */
+static void commit_batch_appends(struct scheduler *sched, int *failed) {
+    if (append_group_pending() == 0) {
+        return;
+    }
+    if (sched) {
+        sched_drain(sched);
+    }
+    append_group_commit(NULL, report_batch_status, failed);
+}
+
+/**
+ * Run commands line by line in a single long-lived process
+ * Blank lines and lines starting with '#' are ignored. After each
+ * command its exit status (0 on success, 1 on failure) is reported.
+ * SIGINT or SIGTERM ends the batch after the running command.
+ * With append_mode = group, runs of appends are queued and committed
+ * together before the next other command, and their messages and
+ * statuses follow in script order once written. With --jobs, the other
+ * single-file commands still run on lanes; a commit first waits for
+ * those before it.
+ * 
+ * @param script Path of the script file, or NULL to read standard input
+ * @return EXIT_SUCCESS if every command succeeded, EXIT_FAILURE otherwise
+ */
+int run_batch(const char *script) {
+    int fd = STDIN_FILENO;
+    
+    if (script) {
+        fd = open(script, O_RDONLY);
+        if (fd == -1) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not open script \"%s\": %s\n", 
+                              script, strerror(errno));
+            err_write(error_msg, len);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    // A long-lived process writes its log from a background thread
+    start_log_flusher();
+    
+    // Only prompt when a person is typing the commands
+    int interactive = !script && isatty(STDIN_FILENO);
+    
+    // Directories stay open from one command to the next; a person may
+    // change them in between, so their hits are checked
+    fd_cache_keep_warm(1, interactive);
+    g_stdin_commands = !script;
+    
+    int line_number = 0;
+    int failed = 0;
+    
+    // Isolated or interactive runs see each append finish before the next
+    int group_appends = append_group_enabled() && !interactive && 
+                        !process_isolation_enabled();
+    
+    // With --jobs, independent file commands run side by side
+    struct scheduler *sched = NULL;
+    if (g_jobs > 1 && !interactive && !process_isolation_enabled()) {
+        sched = sched_create(g_jobs, run_batch_command, finish_batch_command, &failed);
+    }
+    
+    while (!exit_requested()) {
+        if (interactive) {
+            out_write("fileManager> ", 13);
+        }
+        
+        // The previous command's line and arguments are done with
+        arena_reset(&g_arena);
+        char *line = read_line(fd, &g_arena);
+        if (!line) {
+            break;
+        }
+        line_number++;
+        
+        // Skip leading whitespace, blank lines and comments
+        char *command = line;
+        while (*command == ' ' || *command == '\t') {
+            command++;
+        }
+        if (*command == '\0' || *command == '#') {
+            continue;
+        }
+        
+        char **args;
+        int arg_count = parse_command(command, &g_arena, &args);
+        if (arg_count == SERVE_TOO_MANY_ARGS) {
+            commit_batch_appends(sched, &failed);
+            if (sched) {
+                sched_drain(sched);
+            }
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Too many arguments (at most %d)\n", ARG_COUNT_LIMIT);
+            err_write(error_msg, len);
+            report_batch_status(line_number, -1, &failed);
+            continue;
+        }
+        if (arg_count < 0) {
+            err_write("Error: Memory allocation failed\n", 32);
+            failed = 1;
+            break;
+        }
+        
+        if (group_appends && is_group_append(args, arg_count)) {
+            int queued = append_group_add(args[1], args[2], line_number);
+            if (queued == -1) {
+                commit_batch_appends(sched, &failed);
+                err_write("Error: Memory allocation failed\n", 32);
+                report_batch_status(line_number, -1, &failed);
+            } else if (queued == 1) {
+                commit_batch_appends(sched, &failed);
+            }
+            continue;
+        }
+        
+        // Everything else sees the queued appends already written
+        commit_batch_appends(sched, &failed);
+        
+        if (sched && lane_path(args, arg_count)) {
+            if (schedule_batch_command(sched, args, arg_count, line_number) == -1) {
+                err_write("Error: Memory allocation failed\n", 32);
+                report_batch_status(line_number, -1, &failed);
+            }
+            continue;
+        }
+        if (sched) {
+            sched_drain(sched);
+        }
+        
+        int result = execute_command(args, arg_count);
+        
+        // exit/quit ends the batch like end of input
+        if (result == 1) {
+            break;
+        }
+        
+        report_batch_status(line_number, result, &failed);
+    }
+    
+    commit_batch_appends(sched, &failed);
+    sched_destroy(sched);
+    if (durability_commit() == -1) {
+        failed = 1;
+    }
+    arena_release(&g_arena);
+    
+    if (g_show_stats) {
+        stats_write(err_write, STATS_TEXT);
+    }
+    
+    if (interactive) {
+        out_write("\n", 1);
+    }
+    
+    if (script) {
+        close(fd);
+    }
+    
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /**
@@ -263,55 +1355,113 @@ int execute_command(char *args[], int arg_count) {
  */
 int main(int argc, char *argv[]) {
     // Set up signal handlers for clean exit
-    signal(SIGINT, cleanup_handler);
-    signal(SIGTERM, cleanup_handler);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = cleanup_handler;
+    action.sa_flags = SA_RESTART | SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    if (exit_request_init() == 0) {
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
     
     // Register exit handler to clean up resources
     atexit(exit_handler);
     
-    // Initialize logging
-    init_logging();
+    // Global options come before the command
+    int first_arg = 1;
+    int batch_mode = 0;
+    const char *config_path = NULL;
+    const char *durability = NULL;
+    const char *connect_path = NULL;
     
-    // If no arguments are provided, just show help and exit
-    if (argc == 1) {
-        display_help();
-        return EXIT_SUCCESS;
-    } 
-    
-    // Command-line mode
-    char *args[MAX_ARGS] = {NULL}; // Initialize to NULL
-    sync_args(args);  // Update global args
+    while (first_arg < argc && strncmp(argv[first_arg], "--", 2) == 0) {
+        if (strcmp(argv[first_arg], "--batch") == 0) {
+            batch_mode = 1;
+        } else if (strcmp(argv[first_arg], "--isolate") == 0) {
+            set_process_isolation(1);
+        } else if (strcmp(argv[first_arg], "--config") == 0 && first_arg + 1 < argc) {
+            config_path = argv[++first_arg];
+        } else if (strcmp(argv[first_arg], "--stats") == 0) {
+            g_show_stats = 1;
+        } else if (strcmp(argv[first_arg], "--jobs") == 0 && first_arg + 1 < argc) {
+            long jobs;
+            if (parse_number(argv[++first_arg], &jobs) == -1 || jobs < 1 || jobs > 256) {
+                err_write("Error: --jobs needs a number from 1 to 256\n", 43);
+                return EXIT_FAILURE;
+            }
+            g_jobs = (int)jobs;
+        } else if (strcmp(argv[first_arg], "--connect") == 0 && first_arg + 1 < argc) {
+            connect_path = argv[++first_arg];
+        } else if (strcmp(argv[first_arg], "--durability") == 0 && first_arg + 1 < argc) {
+            enum durability level;
+            durability = argv[++first_arg];
+            if (durability_parse(durability, &level) == -1) {
+                char error_msg[256];
+                int len = string_format(error_msg, sizeof(error_msg), 
+                                  "Error: Unknown durability level '%s'\n", durability);
+                err_write(error_msg, len);
+                return EXIT_FAILURE;
+            }
+        } else {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Unknown option '%s'\n", argv[first_arg]);
+            err_write(error_msg, len);
+            return EXIT_FAILURE;
+        }
+        first_arg++;
+    }
     
-    int arg_count = argc - 1;
+    // A thin client: the server runs the command, logs it and writes our output
+    if (connect_path) {
+        if (batch_mode || first_arg == argc) {
+            err_write("Error: --connect requires a command and no --batch\n", 51);
+            return EXIT_FAILURE;
+        }
+        return serve_forward(connect_path, argv + first_arg, argc - first_arg);
+    }
     
-    // Check if we have too many arguments
-    if (arg_count > MAX_ARGS) {
-        write(STDERR_FILENO, "Error: Too many arguments\n", 26);
+    // Settings must be known before logging starts
+    if (load_config(config_path) == -1 && config_path) {
         return EXIT_FAILURE;
     }
+    if (durability) {
+        config_set("durability", durability);
+    }
     
-    // Copy arguments from argv
-    for (int i = 0; i < arg_count; i++) {
-        args[i] = strdup(argv[i + 1]);
-        if (!args[i]) {
-            write(STDERR_FILENO, "Error: Memory allocation failed\n", 32);
-            
-            // Free already allocated memory
-            free_args(args);
-            sync_args(args);
+    // Initialize logging
+    init_logging();
+    
+    // Batch mode: many commands in one process
+    if (batch_mode) {
+        if (argc - first_arg > 1) {
+            err_write("Error: --batch takes at most one script file\n", 45);
             return EXIT_FAILURE;
         }
+        int status = run_batch(first_arg < argc ? argv[first_arg] : NULL);
+        return exit_requested() ? exit_requested() : status;
     }
     
-    // Update global args for signal handler
-    sync_args(args);
+    if (first_arg == argc) {
+        display_help();
+        return EXIT_SUCCESS;
+    }
+    
+    // Command-line mode
+    int arg_count = argc - first_arg;
     
-    // Execute the command
-    int result = execute_command(args, arg_count);
+    // argv is already NULL-terminated and outlives the command
+    int result = execute_command(argv + first_arg, arg_count);
     
-    // Free allocated memory
-    free_args(args);
-    sync_args(args);
+    // Sync whatever the group level still holds
+    if (durability_commit() == -1) {
+        result = -1;
+    }
     
+    // A signal still exits with its number, once everything is written
+    if (exit_requested()) {
+        return exit_requested();
+    }
     return (result < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -2,364 +2,554 @@
 #include "fileops.h"
 #include "logging.h"
 #include "utils.h"
+#include "fdcache.h"
+#include "uring.h"
+#include "config.h"
+#include "durability.h"
+#include "stats.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
-#include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <limits.h>
+
+// Bytes copied per sendfile() or read() when streaming a file
+#define READ_CHUNK_SIZE 65536
+
+// Targets of a bulk command submitted to io_uring at a time
+#define BULK_CHUNK 1024
+
+// Steps of creating a file, for reporting where it failed
+enum create_step {
+    CREATE_OPEN,
+    CREATE_WRITE,
+    CREATE_SYNC,
+    CREATE_CLOSE,
+    CREATE_DONE
+};
 
 /**
- * Create a new file with the given name
+ * Report the outcome of creating a file
  * 
- * @param filename Name of the file to create
+ * @param filename Path of the file
+ * @param step Step that failed, or CREATE_DONE on success
+ * @param error errno value of the failure
  * @return 0 on success, -1 on failure
  */
-int create_file(const char *filename) {
-    // Check if file already exists
-    if (file_exists(filename)) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: File \"%s\" already exists.\n", filename);
-        write(STDERR_FILENO, error_msg, len);
+static int report_create(const char *filename, enum create_step step, int error) {
+    if (step == CREATE_DONE) {
+        // Log the operation
+        char log_msg[256];
+        string_format(log_msg, sizeof(log_msg), "File \"%s\" created successfully.", filename);
+        log_operation(log_msg);
         
-        // Log the error
-        char log_error[256];
+        // Print success message
+        char success_msg[256];
+        int len = string_format(success_msg, sizeof(success_msg), 
+                          "File \"%s\" created successfully.\n", filename);
+        out_write(success_msg, len);
+        return 0;
+    }
+    
+    char error_msg[256];
+    char log_error[256];
+    int len;
+    if (step == CREATE_OPEN && error == EEXIST) {
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: File \"%s\" already exists.\n", filename);
         string_format(log_error, sizeof(log_error), 
                      "ERROR: File \"%s\" already exists.", filename);
-        log_operation(log_error);
-        
-        return -1;
+    } else {
+        const char *action = (step == CREATE_OPEN) ? "create" : 
+                             (step == CREATE_WRITE) ? "write to" : 
+                             (step == CREATE_SYNC) ? "sync" : "close";
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not %s file \"%s\": %s\n", 
+                      action, filename, strerror(error));
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Could not %s file \"%s\": %s", 
+                     action, filename, strerror(error));
     }
+    err_write(error_msg, len);
     
+    // Log the error
+    log_operation(log_error);
+    
+    return -1;
+}
+
+/**
+ * Get the text written into every new file
+ * 
+ * @param len Set to the length of the text
+ * @return Current timestamp, or "" if the time is unavailable
+ */
+static const char *new_file_content(size_t *len) {
+    const char *timestamp = cached_timestamp(len);
+    if (!timestamp) {
+        *len = 0;
+        return "";
+    }
+    return timestamp;
+}
+
+/**
+ * Create a new file relative to a directory descriptor
+ * 
+ * @param dir_fd Directory holding the file, or AT_FDCWD
+ * @param name Name of the file within the directory
+ * @param filename Path of the file, for messages
+ * @return 0 on success, -1 on failure
+ */
+int create_file_at(int dir_fd, const char *name, const char *filename) {
     // Create the file with read/write permissions for owner, read for group and others
-    int fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return report_create(filename, CREATE_OPEN, errno);
+    }
+    
+    // Write timestamp to the file
+    size_t timestamp_len;
+    const char *timestamp = new_file_content(&timestamp_len);
+    if (write(fd, timestamp, timestamp_len) == -1) {
+        int write_errno = errno;
+        close(fd);
+        return report_create(filename, CREATE_WRITE, write_errno);
+    }
+    
+    // Push it to storage as far as the durability level asks
+    if (durability_sync(fd) == -1) {
+        int sync_errno = errno;
+        close(fd);
+        return report_create(filename, CREATE_SYNC, sync_errno);
+    }
+    
+    // Close the file
+    if (close(fd) == -1) {
+        return report_create(filename, CREATE_CLOSE, errno);
+    }
+    
+    return report_create(filename, CREATE_DONE, 0);
+}
+
+/**
+ * Create a new file with the given name
+ * 
+ * @param filename Name of the file to create
+ * @return 0 on success, -1 on failure
+ */
+int create_file(const char *filename) {
+    const char *name;
+    int dir_fd = fd_cache_lookup(filename, &name);
+    if (dir_fd == -1) {
+        return report_create(filename, CREATE_OPEN, errno);
+    }
+    return create_file_at(dir_fd, name, filename);
+}
+
+/**
+ * Write a whole buffer, retrying on short writes and EINTR
+ * 
+ * @param fd Descriptor to write to
+ * @param buffer Data to write
+ * @param len Number of bytes to write
+ * @return 0 on success, -1 on failure
+ */
+static int write_fully(int fd, const char *buffer, size_t len) {
+    size_t total_written = 0;
+    
+    while (total_written < len) {
+        ssize_t bytes_written = write(fd, buffer + total_written, len - total_written);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total_written += bytes_written;
+    }
+    
+    return 0;
+}
+
+/**
+ * Copy a file's remaining content to standard output with bounded memory
+ * The kernel copies directly with sendfile() when standard output allows
+ * it; otherwise a fixed-size buffer is reused for every chunk.
+ * 
+ * @param fd Descriptor of the file, positioned at the start of the content
+ * @param copied Set to the number of bytes copied
+ * @return 0 on success, -1 on read failure, -2 on write failure
+ */
+static int stream_to_stdout(int fd, off_t *copied) {
+    *copied = 0;
+    
+    // The header and anything before it must come out first
+    if (out_flush() == -1) {
+        return -2;
+    }
+    
+    // Zero-copy path: works for regular files, pipes and sockets
+    struct stat out_st;
+    if (fstat(out_descriptor(), &out_st) == 0 && !S_ISCHR(out_st.st_mode)) {
+        while (1) {
+            ssize_t sent = sendfile(out_descriptor(), fd, NULL, READ_CHUNK_SIZE);
+            if (sent > 0) {
+                *copied += sent;
+                continue;
+            }
+            if (sent == 0) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nothing copied yet and not supported here: use the buffer
+            if (*copied == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                break;
+            }
+            return -2;
+        }
+    }
+    
+    // Buffered path
+    char buffer[READ_CHUNK_SIZE];
+    while (1) {
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            return 0;
+        }
+        if (write_fully(out_descriptor(), buffer, bytes_read) == -1) {
+            return -2;
+        }
+        *copied += bytes_read;
+    }
+}
+
+/**
+ * Open a regular file for reading, reporting why it could not be
+ * 
+ * @param filename Name of the file
+ * @return File descriptor on success, -1 on failure
+ */
+static int open_for_read(const char *filename) {
+    const char *name;
+    int dir_fd = fd_cache_lookup(filename, &name);
+    int fd = (dir_fd == -1) ? -1 : open_regular_at(dir_fd, name, O_RDONLY);
     if (fd == -1) {
         char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not create file \"%s\": %s\n", 
+        int len = (errno == ENOENT) ? 
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: File \"%s\" not found.\n", filename) : 
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open file \"%s\": %s\n", 
                           filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        
-        // Log the error
-        char log_error[256];
-        string_format(log_error, sizeof(log_error), 
-                     "ERROR: Could not create file \"%s\": %s", 
-                     filename, strerror(errno));
-        log_operation(log_error);
-        
+        err_write(error_msg, len);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Read contents of a file
+ * The content is streamed, so memory use doesn't depend on file size
+ * 
+ * @param filename Name of the file to read
+ * @return 0 on success, -1 on failure
+ */
+int read_file(const char *filename) {
+    // Open the file for reading; a missing file fails the open itself
+    int fd = open_for_read(filename);
+    if (fd == -1) {
         return -1;
     }
     
-    // Get current timestamp
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
+    // Hint that the file is read once from start to end
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
     
-    // Write timestamp to the file
-    if (write(fd, timestamp, strlen(timestamp)) == -1) {
+    // Print file contents
+    char header[256];
+    int len = string_format(header, sizeof(header), "Contents of \"%s\":\n", filename);
+    out_write(header, len);
+    
+    off_t copied;
+    int result = stream_to_stdout(fd, &copied);
+    if (result < 0) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not write to file \"%s\": %s\n", 
+                          result == -1 ? "Error: Could not read file \"%s\": %s\n" 
+                                       : "Error: Could not write contents of \"%s\": %s\n", 
                           filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        
-        // Log the error
-        char log_error[256];
-        string_format(log_error, sizeof(log_error), 
-                     "ERROR: Could not write to file \"%s\": %s", 
-                     filename, strerror(errno));
-        log_operation(log_error);
-        
+        err_write(error_msg, len);
         close(fd);
         return -1;
     }
     
+    // Add a newline if the file doesn't end with one
+    char last_char;
+    if (copied > 0 && pread(fd, &last_char, 1, copied - 1) == 1 && last_char != '\n') {
+        out_write("\n", 1);
+    }
+    
     // Close the file
     if (close(fd) == -1) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not close file \"%s\": %s\n", 
                           filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        
-        // Log the error
-        char log_error[256];
-        string_format(log_error, sizeof(log_error), 
-                     "ERROR: Could not close file \"%s\": %s", 
-                     filename, strerror(errno));
-        log_operation(log_error);
-        
+        err_write(error_msg, len);
         return -1;
     }
     
     // Log the operation
     char log_msg[256];
-    string_format(log_msg, sizeof(log_msg), "File \"%s\" created successfully.", filename);
+    string_format(log_msg, sizeof(log_msg), "File \"%s\" read successfully.", filename);
     log_operation(log_msg);
     
-    // Print success message
-    char success_msg[256];
-    int len = string_format(success_msg, sizeof(success_msg), 
-                      "File \"%s\" created successfully.\n", filename);
-    write(STDOUT_FILENO, success_msg, len);
-    
     return 0;
 }
 
 /**
- * Read contents of a file
+ * Open a file for a partial read and get its size
  * 
- * @param filename Name of the file to read
- * @return 0 on success, -1 on failure
+ * @param filename Name of the file
+ * @param size Set to the file size
+ * @return File descriptor on success, -1 on failure
  */
-int read_file(const char *filename) {
-    // Check if file exists
-    if (!file_exists(filename)) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: File \"%s\" not found.\n", filename);
-        write(STDERR_FILENO, error_msg, len);
-        return -1;
-    }
-    
-    // Open the file for reading
-    int fd = open(filename, O_RDONLY);
+static int open_for_partial_read(const char *filename, off_t *size) {
+    int fd = open_for_read(filename);
     if (fd == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not open file \"%s\": %s\n", 
-                          filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
         return -1;
     }
     
-    // Get file size
     struct stat st;
     if (fstat(fd, &st) == -1) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not get file size for \"%s\": %s\n", 
                           filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         close(fd);
         return -1;
     }
     
-    // Allocate buffer for file contents
-    char *buffer = (char *)malloc(st.st_size + 1);
-    if (!buffer) {
-        char error_msg[] = "Error: Memory allocation failed\n";
-        write(STDERR_FILENO, error_msg, strlen(error_msg));
-        close(fd);
-        return -1;
+    *size = st.st_size;
+    return fd;
+}
+
+/**
+ * Map a byte range of a file and write it to standard output
+ * Only the pages covering the range are mapped and touched.
+ * 
+ * @param fd Descriptor of the file
+ * @param filename Name of the file, for error messages
+ * @param start First byte of the range
+ * @param end One past the last byte of the range
+ * @return 0 on success, -1 on failure
+ */
+static int write_mapped_range(int fd, const char *filename, off_t start, off_t end) {
+    if (start >= end) {
+        return 0;
     }
     
-    // Read file contents
-    ssize_t bytes_read = read(fd, buffer, st.st_size);
-    if (bytes_read == -1) {
+    // mmap() offsets must be page aligned
+    off_t page_size = sysconf(_SC_PAGESIZE);
+    off_t map_start = start - (start % page_size);
+    size_t map_len = end - map_start;
+    
+    char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_start);
+    if (map == MAP_FAILED) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not read file \"%s\": %s\n", 
+                          "Error: Could not map file \"%s\": %s\n", 
                           filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        free(buffer);
-        close(fd);
+        err_write(error_msg, len);
         return -1;
     }
+    madvise(map, map_len, MADV_SEQUENTIAL);
     
-    // Null-terminate the buffer
-    buffer[bytes_read] = '\0';
+    const char *data = map + (start - map_start);
+    size_t data_len = end - start;
+    int result = out_flush();
+    if (result == 0) {
+        result = write_fully(out_descriptor(), data, data_len);
+    }
     
-    // Close the file
-    if (close(fd) == -1) {
+    // Add a newline if the range doesn't end with one
+    if (result == 0 && data[data_len - 1] != '\n') {
+        result = write_fully(out_descriptor(), "\n", 1);
+    }
+    
+    munmap(map, map_len);
+    
+    if (result == -1) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not close file \"%s\": %s\n", 
+                          "Error: Could not write contents of \"%s\": %s\n", 
                           filename, strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        free(buffer);
+        err_write(error_msg, len);
+    }
+    return result;
+}
+
+/**
+ * Read a byte range of a file
+ * 
+ * @param filename Name of the file to read
+ * @param offset First byte to read
+ * @param length Number of bytes to read, or -1 to read to the end
+ * @return 0 on success, -1 on failure
+ */
+int read_file_range(const char *filename, long offset, long length) {
+    off_t size;
+    int fd = open_for_partial_read(filename, &size);
+    if (fd == -1) {
         return -1;
     }
     
-    // Log the operation
-    char log_msg[256];
-    string_format(log_msg, sizeof(log_msg), "File \"%s\" read successfully.", filename);
-    log_operation(log_msg);
+    // Clamp the range to the file
+    off_t start = (offset < size) ? offset : size;
+    off_t end = size;
+    if (length >= 0 && length < end - start) {
+        end = start + length;
+    }
     
-    // Print file contents
     char header[256];
-    int len = string_format(header, sizeof(header), "Contents of \"%s\":\n", filename);
-    write(STDOUT_FILENO, header, len);
-    write(STDOUT_FILENO, buffer, bytes_read);
+    int len = string_format(header, sizeof(header), 
+                      "Contents of \"%s\" (bytes %ld-%ld):\n", 
+                      filename, (long)start, (long)end);
+    out_write(header, len);
     
-    // Add a newline if the file doesn't end with one
-    if (bytes_read > 0 && buffer[bytes_read - 1] != '\n') {
-        write(STDOUT_FILENO, "\n", 1);
-    }
+    int result = write_mapped_range(fd, filename, start, end);
+    close(fd);
     
-    // Free allocated memory
-    free(buffer);
+    if (result == 0) {
+        char log_msg[256];
+        string_format(log_msg, sizeof(log_msg), 
+                     "File \"%s\" read successfully (bytes %ld-%ld).", 
+                     filename, (long)start, (long)end);
+        log_operation(log_msg);
+    }
     
-    return 0;
+    return result;
 }
 
 /**
- * Append content to a file
+ * Read the last lines of a file
+ * Newlines are found by scanning backwards from the end, so only the
+ * tail of the file is touched.
  * 
- * @param filename The name of the file
- * @param content The content to append
- * @return 0 on success, -1 on error
+ * @param filename Name of the file to read
+ * @param lines Number of lines to read
+ * @return 0 on success, -1 on failure
  */
-int append_to_file(const char *filename, const char *content) {
-    // Check if the file exists
-    if (!file_exists(filename)) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                         "Error: File \"%s\" does not exist\n", filename);
-        write(STDERR_FILENO, error_msg, len);
-        
-        // Log the error
-        char log_error[256];
-        string_format(log_error, sizeof(log_error), 
-                     "ERROR: File \"%s\" does not exist", filename);
-        log_operation(log_error);
-        
+int read_file_tail(const char *filename, long lines) {
+    off_t size;
+    int fd = open_for_partial_read(filename, &size);
+    if (fd == -1) {
         return -1;
     }
     
-    // Fork a child process to perform the operation
-    pid_t pid = fork();
+    char header[256];
+    int len = string_format(header, sizeof(header), 
+                      "Last %ld lines of \"%s\":\n", lines, filename);
+    out_write(header, len);
+    
+    if (size == 0 || lines == 0) {
+        close(fd);
+        return 0;
+    }
     
-    if (pid == -1) {
+    // Mapping the whole file is cheap; pages are only read when touched
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                         "Error: Could not fork process: %s\n", strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        
-        // Log the error
-        char log_error[256];
-        string_format(log_error, sizeof(log_error), 
-                     "ERROR: Could not fork process for appending to \"%s\": %s", 
-                     filename, strerror(errno));
-        log_operation(log_error);
-        
+                          "Error: Could not map file \"%s\": %s\n", 
+                          filename, strerror(errno));
+        err_write(error_msg, len);
+        close(fd);
         return -1;
     }
-    else if (pid == 0) {
-        // Child process
-        
-        // Open file for writing (append mode)
-        int fd = open(filename, O_RDWR | O_APPEND);
-        if (fd == -1) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                             "Error: Could not open file \"%s\": %s\n", 
-                             filename, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            
-            // Log the error from child process
-            char log_error[256];
-            string_format(log_error, sizeof(log_error), 
-                         "ERROR: Could not open file \"%s\" for append: %s", 
-                         filename, strerror(errno));
-            log_operation(log_error);
-            
-            _exit(EXIT_FAILURE);
-        }
-        
-        // Try to acquire an exclusive lock (non-blocking)
-        if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
-            // If we couldn't get the lock because it's already locked
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                char error_msg[256];
-                int len = string_format(error_msg, sizeof(error_msg), 
-                                 "Error: Cannot write to \"%s\". File is locked or read-only.\n", 
-                                 filename);
-                write(STDERR_FILENO, error_msg, len);
-                
-                // Log the error from child process
-                char log_error[256];
-                string_format(log_error, sizeof(log_error), 
-                             "ERROR: Cannot write to \"%s\". File is locked or read-only.", 
-                             filename);
-                log_operation(log_error);
-                
-                close(fd);
-                _exit(EXIT_FAILURE);
-            } else {
-                // Some other error occurred
-                char error_msg[256];
-                int len = string_format(error_msg, sizeof(error_msg), 
-                                 "Error: Could not lock file \"%s\": %s\n", 
-                                 filename, strerror(errno));
-                write(STDERR_FILENO, error_msg, len);
-                
-                // Log the error
-                char log_error[256];
-                string_format(log_error, sizeof(log_error), 
-                             "ERROR: Could not lock file \"%s\": %s", 
-                             filename, strerror(errno));
-                log_operation(log_error);
-                
-                close(fd);
-                _exit(EXIT_FAILURE);
-            }
-        }
-        
-        // Check if file is empty or if the last character is a newline
-        struct stat st;
-        fstat(fd, &st);
-        
-        // If file is not empty, check if we need to add a newline
-        if (st.st_size > 0) {
-            char last_char;
-            if (lseek(fd, -1, SEEK_END) >= 0) {
-                if (read(fd, &last_char, 1) == 1) {
-                    // If the last character is not a newline, add one
-                    if (last_char != '\n') {
-                        const char newline = '\n';
-                        write(fd, &newline, 1);
-                    }
-                }
-            }
-            // Move back to end of file
-            lseek(fd, 0, SEEK_END);
+    madvise(map, size, MADV_RANDOM);
+    
+    // A trailing newline ends the last line rather than starting a new one
+    off_t scan_end = size;
+    if (map[scan_end - 1] == '\n') {
+        scan_end--;
+    }
+    
+    off_t start = 0;
+    long found = 0;
+    while (scan_end > 0) {
+        char *newline = memrchr(map, '\n', scan_end);
+        if (!newline) {
+            break;
         }
-        
-        // Write content to file
-        size_t content_len = strlen(content);
-        ssize_t bytes_written = write(fd, content, content_len);
-        
-        // Release the lock
-        flock(fd, LOCK_UN);
-        
-        // Close the file
-        close(fd);
-        
-        // Check if write was successful
-        if (bytes_written != (ssize_t)content_len) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                             "Error: Could not write to file \"%s\": %s\n", 
-                             filename, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            
-            // Log the error
-            char log_error[256];
-            string_format(log_error, sizeof(log_error), 
-                         "ERROR: Could not write to file \"%s\": %s", 
-                         filename, strerror(errno));
-            log_operation(log_error);
-            
-            _exit(EXIT_FAILURE);
+        if (++found == lines) {
+            start = newline - map + 1;
+            break;
         }
-        
-        // Log the operation
+        scan_end = newline - map;
+    }
+    munmap(map, size);
+    
+    int result = write_mapped_range(fd, filename, start, size);
+    close(fd);
+    
+    if (result == 0) {
+        char log_msg[256];
+        string_format(log_msg, sizeof(log_msg), 
+                     "File \"%s\" read successfully (last %ld lines).", 
+                     filename, lines);
+        log_operation(log_msg);
+    }
+    
+    return result;
+}
+
+// Arguments for the append operation
+struct append_args {
+    const char *filename;
+    const char *content;
+};
+
+// Steps of appending to a file, for reporting where it failed
+enum append_step {
+    APPEND_MISSING,
+    APPEND_OPEN,
+    APPEND_LOCK,
+    APPEND_WRITE,
+    APPEND_SYNC,
+    APPEND_DONE
+};
+
+/**
+ * Report the outcome of appending to a file
+ * 
+ * @param filename Path of the file
+ * @param step Step that failed, or APPEND_DONE on success
+ * @param error errno value of the failure
+ * @return 0 on success, -1 on failure
+ */
+static int report_append(const char *filename, enum append_step step, int error) {
+    if (step == APPEND_DONE) {
+        // Log the operation
         char log_msg[256];
         string_format(log_msg, sizeof(log_msg), "Content appended to file \"%s\".", filename);
         log_operation(log_msg);
@@ -368,95 +558,915 @@ int append_to_file(const char *filename, const char *content) {
         char success_msg[256];
         int len = string_format(success_msg, sizeof(success_msg), 
                           "Content appended to file \"%s\" successfully.\n", filename);
-        write(STDOUT_FILENO, success_msg, len);
+        out_write(success_msg, len);
+        return 0;
+    }
+    
+    char error_msg[256];
+    char log_error[256];
+    int len;
+    if (step == APPEND_MISSING) {
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: File \"%s\" does not exist\n", filename);
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: File \"%s\" does not exist", filename);
+    } else if (step == APPEND_OPEN) {
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not open file \"%s\": %s\n", 
+                      filename, strerror(error));
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Could not open file \"%s\" for append: %s", 
+                     filename, strerror(error));
+    } else {
+        const char *action = (step == APPEND_LOCK) ? "lock" : 
+                             (step == APPEND_WRITE) ? "write to" : "sync";
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not %s file \"%s\": %s\n", 
+                      action, filename, strerror(error));
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Could not %s file \"%s\": %s", 
+                     action, filename, strerror(error));
+    }
+    err_write(error_msg, len);
+    
+    // Log the error
+    log_operation(log_error);
+    
+    return -1;
+}
+
+/**
+ * Lock a file for appending and find out how it ends
+ * The lock is waited for, so concurrent appenders queue up behind each
+ * other instead of failing. The last byte is read once per lock.
+ * 
+ * @param fd Descriptor of the file, open for reading and appending
+ * @param ends_in_newline Set to 1 if the file is empty or ends in '\n'
+ * @return APPEND_DONE on success, or the step that failed with errno set
+ */
+static enum append_step lock_for_append(int fd, int *ends_in_newline) {
+    long long wait_start = stats_now();
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            return APPEND_LOCK;
+        }
+    }
+    stats_wait(STATS_APPEND_LOCK, wait_start);
+    
+    *ends_in_newline = 1;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        char last_char;
+        if (pread(fd, &last_char, 1, st.st_size - 1) == 1) {
+            *ends_in_newline = (last_char == '\n');
+        }
+    }
+    return APPEND_DONE;
+}
+
+/**
+ * Write a list of buffers completely, retrying on short writes and EINTR
+ * 
+ * @param fd Descriptor to write to
+ * @param iov Buffers to write; updated in place on short writes
+ * @param iov_count Number of buffers
+ * @return 0 on success, -1 on failure
+ */
+static int write_vectors(int fd, struct iovec *iov, int iov_count) {
+    while (iov_count > 0) {
+        int batch = (iov_count < IOV_MAX) ? iov_count : IOV_MAX;
+        ssize_t bytes_written = writev(fd, iov, batch);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
         
-        _exit(EXIT_SUCCESS);
+        // Skip whatever a short write already covered
+        size_t done = bytes_written;
+        while (iov_count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Append content to a file relative to a directory descriptor
+ * 
+ * @param dir_fd Directory holding the file, or AT_FDCWD
+ * @param name Name of the file within the directory
+ * @param filename Path of the file, for messages
+ * @param content The content to append
+ * @return 0 on success, -1 on error
+ */
+int append_to_file_at(int dir_fd, const char *name, const char *filename, const char *content) {
+    // Open file for writing (append mode); only existing files are opened
+    int fd = open_regular_at(dir_fd, name, O_RDWR | O_APPEND);
+    if (fd == -1) {
+        return report_append(filename, (errno == ENOENT) ? APPEND_MISSING : APPEND_OPEN, errno);
     }
-    else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+    
+    // Wait for an exclusive lock
+    int ends_in_newline;
+    enum append_step step = lock_for_append(fd, &ends_in_newline);
+    if (step != APPEND_DONE) {
+        int lock_errno = errno;
+        close(fd);
+        return report_append(filename, step, lock_errno);
+    }
+    
+    // A missing trailing newline goes out with the content in one write
+    size_t content_len = strlen(content);
+    int direct = durability_level() == DURABILITY_DIRECT && 
+                 content_len >= DURABILITY_DIRECT_MIN;
+    struct iovec iov[2];
+    int iov_count = 0;
+    if (!ends_in_newline) {
+        iov[iov_count].iov_base = (void *)"\n";
+        iov[iov_count++].iov_len = 1;
+    }
+    if (!direct) {
+        iov[iov_count].iov_base = (void *)content;
+        iov[iov_count++].iov_len = content_len;
+    }
+    
+    int result = write_vectors(fd, iov, iov_count);
+    step = (result == -1) ? APPEND_WRITE : APPEND_SYNC;
+    if (result == 0) {
+        // Large appends at the direct level bypass the page cache
+        result = direct ? durability_append_direct(fd, dir_fd, name, content, content_len) : 
+                          durability_sync(fd);
+    }
+    int write_errno = errno;
+    
+    // Release the lock
+    flock(fd, LOCK_UN);
+    
+    // Close the file
+    close(fd);
+    
+    // Check if write was successful
+    if (result == -1) {
+        return report_append(filename, step, write_errno);
+    }
+    return report_append(filename, APPEND_DONE, 0);
+}
+
+/**
+ * Perform the append
+ * 
+ * @param arg Pointer to struct append_args
+ * @return 0 on success, -1 on error
+ */
+static int append_operation(void *arg) {
+    const struct append_args *append = (const struct append_args *)arg;
+    const char *name;
+    int dir_fd = fd_cache_lookup(append->filename, &name);
+    if (dir_fd == -1) {
+        return report_append(append->filename, 
+                             (errno == ENOENT) ? APPEND_MISSING : APPEND_OPEN, errno);
+    }
+    return append_to_file_at(dir_fd, name, append->filename, append->content);
+}
+
+/**
+ * Append content to a file
+ * Runs in-process, or in a child process when isolation is enabled
+ * 
+ * @param filename The name of the file
+ * @param content The content to append
+ * @return 0 on success, -1 on error
+ */
+int append_to_file(const char *filename, const char *content) {
+    struct append_args append = { filename, content };
+    int result = run_operation(append_operation, &append);
+    
+    if (result == RUN_FORK_FAILED) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                         "Error: Could not fork process: %s\n", strerror(errno));
+        err_write(error_msg, len);
         
-        if (WIFEXITED(status)) {
-            return (WEXITSTATUS(status) == EXIT_SUCCESS) ? 0 : -1;
-        } else {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                             "Error: Child process terminated abnormally\n");
-            write(STDERR_FILENO, error_msg, len);
-            
-            // Log the error
-            char log_error[256];
-            string_format(log_error, sizeof(log_error), 
-                         "ERROR: Child process for appending to \"%s\" terminated abnormally", 
-                         filename);
-            log_operation(log_error);
-            
+        // Log the error
+        char log_error[256];
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Could not fork process for appending to \"%s\": %s", 
+                     filename, strerror(errno));
+        log_operation(log_error);
+        
+        return -1;
+    }
+    else if (result == RUN_ABNORMAL) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                         "Error: Child process terminated abnormally\n");
+        err_write(error_msg, len);
+        
+        // Log the error
+        char log_error[256];
+        string_format(log_error, sizeof(log_error), 
+                     "ERROR: Child process for appending to \"%s\" terminated abnormally", 
+                     filename);
+        log_operation(log_error);
+        
+        return -1;
+    }
+    
+    return (result == 0) ? 0 : -1;
+}
+
+// Append waiting for the next group commit
+struct queued_append {
+    char *filename;
+    char *content;
+    size_t len;
+    long tag;
+    enum append_step step;  // Outcome, set by the commit
+    int error;
+};
+
+// Appends queued since the last group commit, in arrival order
+static struct queued_append *g_appends = NULL;
+static int g_append_count = 0;
+static int g_append_capacity = 0;
+static size_t g_append_bytes = 0;
+
+/**
+ * Check whether the append_mode setting asks for group-committed appends
+ * "direct" (the default) writes every append as it comes; "group"
+ * queues them so each file is locked and written once per commit.
+ * 
+ * @return 1 for group commits, 0 otherwise
+ */
+int append_group_enabled(void) {
+    return strcmp(config_get_string("append_mode", "direct"), "group") == 0;
+}
+
+/**
+ * Queue an append for the next group commit
+ * Nothing is checked or written until append_group_commit().
+ * 
+ * @param filename Path of the file
+ * @param content The content to append
+ * @param tag Passed back to the commit's callback
+ * @return 0 if queued, 1 if queued and the queue should now be committed,
+ *         -1 if memory allocation failed
+ */
+int append_group_add(const char *filename, const char *content, long tag) {
+    if (g_append_count == g_append_capacity) {
+        int capacity = g_append_capacity ? g_append_capacity * 2 : 64;
+        struct queued_append *appends = realloc(g_appends, capacity * sizeof(*appends));
+        if (!appends) {
             return -1;
         }
+        g_appends = appends;
+        g_append_capacity = capacity;
     }
+    
+    struct queued_append *append = &g_appends[g_append_count];
+    append->filename = strdup(filename);
+    append->content = strdup(content);
+    if (!append->filename || !append->content) {
+        free(append->filename);
+        free(append->content);
+        return -1;
+    }
+    append->len = strlen(content);
+    append->tag = tag;
+    g_append_count++;
+    g_append_bytes += append->len;
+    
+    return (g_append_count >= APPEND_GROUP_MAX || g_append_bytes >= APPEND_GROUP_BYTES) ? 1 : 0;
 }
+
 /**
- * Delete a file
+ * Get the number of appends waiting for the next commit
  * 
- * @param filename Name of the file to delete
+ * @return Number of queued appends
+ */
+int append_group_pending(void) {
+    return g_append_count;
+}
+
+/**
+ * Order queued appends by file, keeping arrival order within a file
+ * 
+ * @param a Pointer to an index into g_appends
+ * @param b Pointer to an index into g_appends
+ * @return Comparison result
+ */
+static int compare_appends(const void *a, const void *b) {
+    int left = *(const int *)a;
+    int right = *(const int *)b;
+    int order = strcmp(g_appends[left].filename, g_appends[right].filename);
+    return order ? order : left - right;
+}
+
+/**
+ * Write one file's share of the queue under a single lock
+ * 
+ * @param order Indexes into g_appends of the file's appends, in arrival order
+ * @param count Number of appends
+ */
+static void commit_file(const int *order, int count) {
+    const char *filename = g_appends[order[0]].filename;
+    enum append_step step = APPEND_DONE;
+    int error = 0;
+    
+    const char *name;
+    int dir_fd = fd_cache_lookup(filename, &name);
+    int fd = (dir_fd == -1) ? -1 : open_regular_at(dir_fd, name, O_RDWR | O_APPEND);
+    if (fd == -1) {
+        step = (errno == ENOENT) ? APPEND_MISSING : APPEND_OPEN;
+        error = errno;
+    }
+    
+    int ends_in_newline = 1;
+    if (fd != -1 && (step = lock_for_append(fd, &ends_in_newline)) != APPEND_DONE) {
+        error = errno;
+    }
+    
+    // Every record, with the newlines it needs, goes out in one writev()
+    struct iovec *iov = NULL;
+    if (step == APPEND_DONE) {
+        iov = malloc(2 * count * sizeof(*iov));
+        if (!iov) {
+            step = APPEND_WRITE;
+            error = ENOMEM;
+        }
+    }
+    if (iov) {
+        int iov_count = 0;
+        for (int i = 0; i < count; i++) {
+            const struct queued_append *append = &g_appends[order[i]];
+            if (!ends_in_newline) {
+                iov[iov_count].iov_base = (void *)"\n";
+                iov[iov_count++].iov_len = 1;
+                ends_in_newline = 1;
+            }
+            if (append->len > 0) {
+                iov[iov_count].iov_base = append->content;
+                iov[iov_count++].iov_len = append->len;
+                ends_in_newline = (append->content[append->len - 1] == '\n');
+            }
+        }
+        
+        if (write_vectors(fd, iov, iov_count) == -1) {
+            step = APPEND_WRITE;
+            error = errno;
+        } else if (durability_sync(fd) == -1) {
+            step = APPEND_SYNC;
+            error = errno;
+        }
+        free(iov);
+    }
+    
+    if (fd != -1) {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        g_appends[order[i]].step = step;
+        g_appends[order[i]].error = error;
+    }
+}
+
+/**
+ * Write every queued append and report each one in arrival order
+ * Each file is opened, locked and written once, however many appends it
+ * has queued, and its trailing newline is tracked while the lock is held.
+ * The durability level applies once per file and commit.
+ * 
+ * @param start Called for each append before its messages, or NULL
+ * @param done Called for each append after its messages, or NULL
+ * @param context Passed to start and done
+ * @return 0 if every append succeeded, -1 otherwise
+ */
+int append_group_commit(append_start_fn start, append_done_fn done, void *context) {
+    if (g_append_count == 0) {
+        return 0;
+    }
+    
+    // The queued commands skipped dispatch, which tags their log records
+    log_set_operation("appendToFile");
+    
+    int *order = malloc(g_append_count * sizeof(*order));
+    if (order) {
+        for (int i = 0; i < g_append_count; i++) {
+            order[i] = i;
+        }
+        qsort(order, g_append_count, sizeof(*order), compare_appends);
+        
+        for (int start = 0; start < g_append_count; ) {
+            int end = start + 1;
+            while (end < g_append_count && 
+                   strcmp(g_appends[order[end]].filename, g_appends[order[start]].filename) == 0) {
+                end++;
+            }
+            commit_file(order + start, end - start);
+            start = end;
+        }
+        free(order);
+    } else {
+        for (int i = 0; i < g_append_count; i++) {
+            g_appends[i].step = APPEND_WRITE;
+            g_appends[i].error = ENOMEM;
+        }
+    }
+    
+    int failed = 0;
+    for (int i = 0; i < g_append_count; i++) {
+        struct queued_append *append = &g_appends[i];
+        if (start) {
+            start(append->tag, context);
+        }
+        int result = report_append(append->filename, append->step, append->error);
+        if (result == -1) {
+            failed = 1;
+        }
+        if (done) {
+            done(append->tag, result, context);
+        }
+        free(append->filename);
+        free(append->content);
+    }
+    g_append_count = 0;
+    g_append_bytes = 0;
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * Report the outcome of deleting a file
+ * 
+ * @param filename Path of the file
+ * @param error errno value of the failure, or 0 on success
  * @return 0 on success, -1 on failure
  */
-int delete_file(const char *filename) {
-    // Check if file exists
-    if (!file_exists(filename)) {
+static int report_delete(const char *filename, int error) {
+    if (error) {
         char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: File \"%s\" not found.\n", filename);
-        write(STDERR_FILENO, error_msg, len);
+        int len = (error == ENOENT) ? 
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: File \"%s\" not found.\n", filename) : 
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not delete file \"%s\": %s\n", 
+                          filename, strerror(error));
+        err_write(error_msg, len);
         return -1;
     }
     
-    // Create a child process to perform the deletion
-    pid_t pid = fork();
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "File \"%s\" deleted successfully.", filename);
+    log_operation(log_msg);
+    
+    // Print success message
+    char success_msg[256];
+    int len = string_format(success_msg, sizeof(success_msg), 
+                      "File \"%s\" deleted successfully.\n", filename);
+    out_write(success_msg, len);
+    
+    return 0;
+}
+
+/**
+ * Delete a file relative to a directory descriptor
+ * Only regular files, or links to them, are deleted; anything else is
+ * reported as not found, like a missing file.
+ * 
+ * @param dir_fd Directory holding the file, or AT_FDCWD
+ * @param name Name of the file within the directory
+ * @param filename Path of the file, for messages
+ * @return 0 on success, -1 on failure
+ */
+int delete_file_at(int dir_fd, const char *name, const char *filename) {
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, 0) == -1 || !S_ISREG(st.st_mode)) {
+        return report_delete(filename, ENOENT);
+    }
+    return report_delete(filename, (unlinkat(dir_fd, name, 0) == -1) ? errno : 0);
+}
+
+/**
+ * Remove the file; a missing one fails the check before the unlink
+ * 
+ * @param arg Name of the file to delete
+ * @return 0 on success, -1 on failure
+ */
+static int unlink_operation(void *arg) {
+    const char *filename = (const char *)arg;
+    const char *name;
+    int dir_fd = fd_cache_lookup(filename, &name);
+    if (dir_fd == -1) {
+        return report_delete(filename, errno);
+    }
+    return delete_file_at(dir_fd, name, filename);
+}
+
+/**
+ * Delete a file
+ * Runs in-process, or in a child process when isolation is enabled
+ * 
+ * @param filename Name of the file to delete
+ * @return 0 on success, -1 on failure
+ */
+int delete_file(const char *filename) {
+    int result = run_operation(unlink_operation, (void *)filename);
     
-    if (pid == -1) {
+    if (result == RUN_FORK_FAILED) {
         // Fork failed
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not create process: %s\n", strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+        err_write(error_msg, len);
         return -1;
-    } 
-    else if (pid == 0) {
-        // Child process
-        if (unlink(filename) == -1) {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Could not delete file \"%s\": %s\n", 
-                              filename, strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            _exit(EXIT_FAILURE);
+    }
+    
+    return (result != 0) ? -1 : 0;
+}
+
+// Operations that can be applied to many files at once
+enum bulk_op {
+    BULK_CREATE,
+    BULK_APPEND,
+    BULK_DELETE
+};
+
+// Arguments for a bulk operation
+struct bulk_args {
+    enum bulk_op op;
+    char *const *paths;
+    int count;
+    const char *content;    // BULK_APPEND only
+};
+
+/**
+ * Report a bulk target whose directory could not be opened
+ * 
+ * @param path Path of the target
+ * @param error errno value
+ */
+static void report_missing_dir(const char *path, int error) {
+    char error_msg[256];
+    int len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not open directory of \"%s\": %s\n", 
+                      path, strerror(error));
+    err_write(error_msg, len);
+}
+
+/**
+ * Apply a bulk operation one path at a time
+ * 
+ * @param bulk Operation and targets
+ * @param cache Open directories
+ * @return Number of targets that failed
+ */
+static int bulk_sync(const struct bulk_args *bulk, struct fd_cache *cache) {
+    int failed = 0;
+    for (int i = 0; i < bulk->count; i++) {
+        const char *path = bulk->paths[i];
+        const char *name;
+        int dir_fd = fd_cache_dir(cache, path, &name);
+        
+        if (dir_fd == -1) {
+            report_missing_dir(path, errno);
+            failed++;
+            continue;
         }
         
-        // Exit successfully
-        _exit(EXIT_SUCCESS);
-    } 
-    else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+        int result;
+        if (bulk->op == BULK_CREATE) {
+            result = create_file_at(dir_fd, name, path);
+        } else if (bulk->op == BULK_APPEND) {
+            result = append_to_file_at(dir_fd, name, path, bulk->content);
+        } else {
+            result = delete_file_at(dir_fd, name, path);
+        }
+        if (result == -1) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/**
+ * Run one step for a chunk of targets through io_uring
+ * When the ring fails, the operations it did not run are done with plain
+ * system calls and the ring is not used again, so every file opened by
+ * an earlier step still gets written and closed.
+ * 
+ * @param ring Ring to use, set to NULL once it has failed
+ * @param ops Operations of the step
+ * @param count Number of operations
+ */
+static void run_step(struct uring **ring, struct uring_op *ops, size_t count) {
+    if (!*ring) {
+        uring_run_sync(ops, count);
+        return;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        ops[i].result = -ECANCELED; // Kept if the ring itself fails
+    }
+    if (count > 0 && uring_run(*ring, ops, count) == -1) {
+        for (size_t i = 0; i < count; i++) {
+            if (ops[i].result == -ECANCELED) {
+                uring_run_sync(&ops[i], 1);
+            }
+        }
+        *ring = NULL;
+    }
+}
+
+/**
+ * Create or delete a chunk of targets at a time through io_uring
+ * Each step of a chunk (open, write and close, or statx and unlink) is
+ * submitted as one batch; the targets are then reported in their given order with
+ * the same messages as bulk_sync(). The directory cache still checks
+ * each target's directory, so a missing one is reported the same way,
+ * but the kernel resolves the full paths, since a cached descriptor can
+ * be replaced while the batch is in flight.
+ * 
+ * @param bulk Operation and targets
+ * @param cache Open directories
+ * @param ring Ring to use
+ * @return Number of targets that failed
+ */
+static int bulk_uring(const struct bulk_args *bulk, struct fd_cache *cache, struct uring *ring) {
+    struct uring_op *ops = calloc(BULK_CHUNK * 3, sizeof(*ops));
+    int *index = malloc(BULK_CHUNK * sizeof(*index));
+    struct statx *stats = (bulk->op == BULK_DELETE) ? malloc(BULK_CHUNK * sizeof(*stats)) : NULL;
+    if (!ops || !index || (bulk->op == BULK_DELETE && !stats)) {
+        free(ops);
+        free(index);
+        free(stats);
+        return bulk_sync(bulk, cache);
+    }
+    struct uring_op *writes = ops + BULK_CHUNK;
+    struct uring_op *closes = ops + BULK_CHUNK * 2;
+    struct uring_op *checks = writes;   // Deletes check each target's type instead
+    
+    // Every new file gets the same timestamp within a chunk
+    char content[64];
+    
+    int failed = 0;
+    for (int first = 0; first < bulk->count; first += BULK_CHUNK) {
+        int chunk = bulk->count - first;
+        if (chunk > BULK_CHUNK) {
+            chunk = BULK_CHUNK;
+        }
         
-        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
-            // Log the operation
-            char log_msg[256];
-            string_format(log_msg, sizeof(log_msg), "File \"%s\" deleted successfully.", filename);
-            log_operation(log_msg);
+        // index[i] is the target's first operation, or -errno for its directory
+        size_t count = 0;
+        for (int i = 0; i < chunk; i++) {
+            const char *path = bulk->paths[first + i];
+            const char *name;
+            if (fd_cache_dir(cache, path, &name) == -1) {
+                index[i] = -errno;
+                continue;
+            }
             
-            // Print success message
-            char success_msg[256];
-            int len = string_format(success_msg, sizeof(success_msg), 
-                              "File \"%s\" deleted successfully.\n", filename);
-            write(STDOUT_FILENO, success_msg, len);
+            struct uring_op *op = &ops[count];
+            memset(op, 0, sizeof(*op));
+            op->fd = AT_FDCWD;
+            op->path = path;
+            if (bulk->op == BULK_CREATE) {
+                op->opcode = URING_OPENAT;
+                op->flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+                op->mode = 0644;
+            } else {
+                op->opcode = URING_UNLINKAT;
+                checks[count] = *op;
+                checks[count].opcode = URING_STATX;
+                checks[count].len = STATX_TYPE;
+                checks[count].buffer = &stats[count];
+            }
+            index[i] = count++;
+        }
+        
+        if (bulk->op == BULK_DELETE) {
+            // Only regular files, or links to them, are unlinked
+            run_step(&ring, checks, count);
+            size_t regular = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (checks[i].result >= 0 && S_ISREG(stats[i].stx_mode)) {
+                    ops[regular++] = ops[i];
+                }
+            }
+            run_step(&ring, ops, regular);
             
-            return 0;
+            // Spread the results back out; everything else reads as missing
+            for (size_t i = count; i-- > 0; ) {
+                if (checks[i].result >= 0 && S_ISREG(stats[i].stx_mode)) {
+                    ops[i] = ops[--regular];
+                } else {
+                    ops[i].result = -ENOENT;
+                }
+            }
         } else {
-            return -1;
+            run_step(&ring, ops, count);
+        }
+        
+        if (bulk->op == BULK_CREATE) {
+            size_t content_len;
+            const char *timestamp = new_file_content(&content_len);
+            memcpy(content, timestamp, content_len);
+            
+            for (size_t i = 0; i < count; i++) {
+                memset(&writes[i], 0, sizeof(writes[i]));
+                memset(&closes[i], 0, sizeof(closes[i]));
+                writes[i].opcode = URING_WRITE;
+                writes[i].fd = ops[i].result;
+                writes[i].buffer = content;
+                writes[i].len = content_len;
+                closes[i].opcode = URING_CLOSE;
+                closes[i].fd = ops[i].result;
+            }
+            
+            // Only files that were opened are written and closed
+            size_t opened = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (ops[i].result >= 0) {
+                    writes[opened] = writes[i];
+                    closes[opened] = closes[i];
+                    opened++;
+                }
+            }
+            run_step(&ring, writes, opened);
+            run_step(&ring, closes, opened);
+            
+            // Spread the results back out to each target's slot
+            for (size_t i = count; i-- > 0; ) {
+                if (ops[i].result >= 0) {
+                    writes[i] = writes[--opened];
+                    closes[i] = closes[opened];
+                }
+            }
+        }
+        
+        for (int i = 0; i < chunk; i++) {
+            const char *path = bulk->paths[first + i];
+            if (index[i] < 0) {
+                report_missing_dir(path, -index[i]);
+                failed++;
+                continue;
+            }
+            
+            int result;
+            const struct uring_op *op = &ops[index[i]];
+            if (bulk->op == BULK_DELETE) {
+                result = report_delete(path, (op->result < 0) ? -op->result : 0);
+            } else if (op->result < 0) {
+                result = report_create(path, CREATE_OPEN, -op->result);
+            } else if (writes[index[i]].result < 0) {
+                result = report_create(path, CREATE_WRITE, -writes[index[i]].result);
+            } else if (closes[index[i]].result < 0) {
+                result = report_create(path, CREATE_CLOSE, -closes[index[i]].result);
+            } else {
+                result = report_create(path, CREATE_DONE, 0);
+            }
+            if (result == -1) {
+                failed++;
+            }
+        }
+        
+        // After a ring failure the remaining chunks run one by one
+        if (!ring && first + chunk < bulk->count) {
+            struct bulk_args rest = *bulk;
+            rest.paths += first + chunk;
+            rest.count -= first + chunk;
+            failed += bulk_sync(&rest, cache);
+            break;
         }
     }
+    
+    free(ops);
+    free(index);
+    free(stats);
+    return failed;
+}
+
+/**
+ * Apply one operation to every path of a bulk command
+ * Paths are resolved through a shared cache of open directories, so
+ * each directory is looked up once however many targets it holds.
+ * Creates and deletes go through io_uring when the kernel has it and
+ * io_backend allows it.
+ * 
+ * @param arg Pointer to struct bulk_args
+ * @return 0 if every path succeeded, -1 otherwise
+ */
+static int bulk_operation(void *arg) {
+    struct bulk_args *bulk = (struct bulk_args *)arg;
+    
+    struct fd_cache *cache = fd_cache_acquire();
+    if (!cache) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    
+    struct uring *ring = NULL;
+    // Files to sync are created one by one, so io_uring would not pay off
+    if (bulk->op != BULK_APPEND && uring_enabled() && 
+        (bulk->op == BULK_DELETE || durability_level() == DURABILITY_NONE)) {
+        ring = uring_create(URING_ENTRIES);
+        int usable = ring && ((bulk->op == BULK_DELETE) ? 
+                              uring_supports(ring, URING_STATX) && 
+                              uring_supports(ring, URING_UNLINKAT) : 
+                              uring_supports(ring, URING_OPENAT) && 
+                              uring_supports(ring, URING_WRITE) && 
+                              uring_supports(ring, URING_CLOSE));
+        if (!usable) {
+            uring_destroy(ring);
+            ring = NULL;
+        }
+    }
+    
+    int failed = ring ? bulk_uring(bulk, cache, ring) : bulk_sync(bulk, cache);
+    
+    uring_destroy(ring);
+    fd_cache_release(cache);
+    
+    // One summary record for the whole command
+    static const char *const verbs[] = { "created", "appended to", "deleted" };
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "%d of %d files %s.", 
+            bulk->count - failed, bulk->count, verbs[bulk->op]);
+    log_operation(log_msg);
+    
+    char summary_msg[256];
+    int len = string_format(summary_msg, sizeof(summary_msg), "%s\n", log_msg);
+    out_write(summary_msg, len);
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * Run a bulk operation and report its outcome
+ * 
+ * @param bulk Operation to run
+ * @return 0 if every path succeeded, -1 otherwise
+ */
+static int run_bulk(struct bulk_args *bulk) {
+    int result = run_operation(bulk_operation, bulk);
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    return (result != 0) ? -1 : 0;
+}
+
+/**
+ * Create many files
+ * Each path is reported like a single createFile, followed by a summary.
+ * 
+ * @param paths Paths of the files to create
+ * @param count Number of paths
+ * @return 0 if every file was created, -1 otherwise
+ */
+int create_files(char *const paths[], int count) {
+    struct bulk_args bulk = { BULK_CREATE, paths, count, NULL };
+    return run_bulk(&bulk);
+}
+
+/**
+ * Append the same content to many files
+ * 
+ * @param paths Paths of the files to append to
+ * @param count Number of paths
+ * @param content The content to append
+ * @return 0 if every append succeeded, -1 otherwise
+ */
+int append_to_files(char *const paths[], int count, const char *content) {
+    struct bulk_args bulk = { BULK_APPEND, paths, count, content };
+    return run_bulk(&bulk);
+}
+
+/**
+ * Delete many files
+ * 
+ * @param paths Paths of the files to delete
+ * @param count Number of paths
+ * @return 0 if every file was deleted, -1 otherwise
+ */
+int delete_files(char *const paths[], int count) {
+    struct bulk_args bulk = { BULK_DELETE, paths, count, NULL };
+    return run_bulk(&bulk);
 }
\ No newline at end of file
@@ -7,10 +7,52 @@ int create_file(const char *filename);
 // Read contents of a file
 int read_file(const char *filename);
 
+// Read a byte range of a file; length -1 reads to the end
+int read_file_range(const char *filename, long offset, long length);
+
+// Read the last lines of a file
+int read_file_tail(const char *filename, long lines);
+
 // Append content to a file with proper locking
 int append_to_file(const char *filename, const char *content);
 
 // Delete a file
 int delete_file(const char *filename);
 
+// Create a file relative to a directory descriptor; filename is for messages
+int create_file_at(int dir_fd, const char *name, const char *filename);
+
+// Append to a file relative to a directory descriptor
+int append_to_file_at(int dir_fd, const char *name, const char *filename, const char *content);
+
+// Delete a file relative to a directory descriptor
+int delete_file_at(int dir_fd, const char *name, const char *filename);
+
+// Create, append to or delete many files, reporting each of them
+int create_files(char *const paths[], int count);
+int append_to_files(char *const paths[], int count, const char *content);
+int delete_files(char *const paths[], int count);
+
+// Queued appends committed at once, whichever limit is reached first
+#define APPEND_GROUP_MAX 1024
+#define APPEND_GROUP_BYTES (1024 * 1024)
+
+// Called for each queued append just before it is reported
+typedef void (*append_start_fn)(long tag, void *context);
+
+// Called for each queued append once it has been committed and reported
+typedef void (*append_done_fn)(long tag, int result, void *context);
+
+// Check whether the append_mode setting asks for group-committed appends
+int append_group_enabled(void);
+
+// Queue an append; returns 1 when the queue is full and should be committed
+int append_group_add(const char *filename, const char *content, long tag);
+
+// Get the number of appends waiting for the next commit
+int append_group_pending(void);
+
+// Write every queued append, one lock and one writev() per file
+int append_group_commit(append_start_fn start, append_done_fn done, void *context);
+
 #endif // FILEOPS_H
\ No newline at end of file
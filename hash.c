@@ -0,0 +1,292 @@
+#include "hash.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Stripes in a block, then the accumulators are scrambled
+#define HASH_BLOCK_STRIPES (HASH_BLOCK_SIZE / HASH_STRIPE_SIZE)
+
+#define PRIME32_1 UINT64_C(0x9E3779B1)
+#define PRIME32_2 UINT64_C(0x85EBCA77)
+#define PRIME32_3 UINT64_C(0xC2B2AE3D)
+#define PRIME64_1 UINT64_C(0x9E3779B185EBCA87)
+#define PRIME64_2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 UINT64_C(0x165667B19E3779F9)
+#define PRIME64_4 UINT64_C(0x85EBCA77C2B2AE63)
+#define PRIME64_5 UINT64_C(0x27D4EB2F165667C5)
+
+// Key words mixed into the input; stripe n of a block uses words n to
+// n + 7, and the scramble uses the last eight
+static const uint64_t g_key[HASH_BLOCK_STRIPES + 8] = {
+    UINT64_C(0x2CB0F69F4ABEA221), UINT64_C(0x9417034723148989), UINT64_C(0xDD555950609DFE03),
+    UINT64_C(0xDBAFB150DEB12800), UINT64_C(0x7E789B2E6C442CB6), UINT64_C(0xF41E5636C7E4F8C4),
+    UINT64_C(0x0959D150F8FBA7E4), UINT64_C(0xA97316F13CDB9EEA), UINT64_C(0x74CD8258F9520068),
+    UINT64_C(0x55C74A62E116868B), UINT64_C(0xD2F4C799A2023CBD), UINT64_C(0xDF98CB79A37B51B9),
+    UINT64_C(0x396F5885524F3905), UINT64_C(0xAF1D56386CA3B276), UINT64_C(0xA9FFBE6B5104E85A),
+    UINT64_C(0x6BD0C51B9FD533B3), UINT64_C(0x980CE91C50AB4B56), UINT64_C(0x28AC395780FE62C5),
+    UINT64_C(0x768912E3A6BCEDC7), UINT64_C(0x50B3E8C9332C7C88), UINT64_C(0xCE3BBFE520BD47DA),
+    UINT64_C(0xCBA6C8E8E0BB7C4F), UINT64_C(0xBF194DB8434A346D), UINT64_C(0x7D8F2A7B60416D7F),
+};
+
+#if defined(__SSE2__)
+
+/**
+ * Mix stripes into the accumulators, two lanes per instruction
+ * Each 64-bit lane adds the product of its keyed input's two halves,
+ * plus the neighbouring lane's raw input.
+ * 
+ * @param acc Accumulators
+ * @param data Input, stripes * HASH_STRIPE_SIZE bytes
+ * @param stripes Number of stripes
+ * @param key Key words of the first stripe
+ */
+static void accumulate(uint64_t acc[8], const unsigned char *data, size_t stripes,
+                       const uint64_t *key) {
+    __m128i lanes[4];
+    for (int i = 0; i < 4; i++) {
+        lanes[i] = _mm_loadu_si128((const __m128i *)(acc + 2 * i));
+    }
+    
+    for (size_t s = 0; s < stripes; s++) {
+        const unsigned char *stripe = data + s * HASH_STRIPE_SIZE;
+        for (int i = 0; i < 4; i++) {
+            __m128i input = _mm_loadu_si128((const __m128i *)(stripe + 16 * i));
+            __m128i keyed = _mm_xor_si128(input, _mm_loadu_si128((const __m128i *)(key + s + 2 * i)));
+            __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(input, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+        }
+    }
+    
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(acc + 2 * i), lanes[i]);
+    }
+}
+
+/**
+ * Fold the high bits of the accumulators back in after a block
+ * 
+ * @param acc Accumulators
+ * @param key Key words of the scramble
+ */
+static void scramble(uint64_t acc[8], const uint64_t *key) {
+    const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+    for (int i = 0; i < 4; i++) {
+        __m128i lane = _mm_loadu_si128((const __m128i *)(acc + 2 * i));
+        lane = _mm_xor_si128(lane, _mm_srli_epi64(lane, 47));
+        lane = _mm_xor_si128(lane, _mm_loadu_si128((const __m128i *)(key + 2 * i)));
+        
+        // 64 x 32-bit multiply from two 32 x 32 products
+        __m128i low = _mm_mul_epu32(lane, prime);
+        __m128i high = _mm_mul_epu32(_mm_srli_epi64(lane, 32), prime);
+        lane = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+        _mm_storeu_si128((__m128i *)(acc + 2 * i), lane);
+    }
+}
+
+#else
+
+/**
+ * Read a little-endian 64-bit word
+ * 
+ * @param p Bytes to read
+ * @return The word
+ */
+static uint64_t read64(const unsigned char *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/**
+ * Mix stripes into the accumulators, one lane at a time
+ * 
+ * @param acc Accumulators
+ * @param data Input, stripes * HASH_STRIPE_SIZE bytes
+ * @param stripes Number of stripes
+ * @param key Key words of the first stripe
+ */
+static void accumulate(uint64_t acc[8], const unsigned char *data, size_t stripes,
+                       const uint64_t *key) {
+    for (size_t s = 0; s < stripes; s++) {
+        const unsigned char *stripe = data + s * HASH_STRIPE_SIZE;
+        for (int i = 0; i < 8; i++) {
+            uint64_t input = read64(stripe + 8 * i);
+            uint64_t keyed = input ^ key[s + i];
+            acc[i ^ 1] += input;
+            acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        }
+    }
+}
+
+/**
+ * Fold the high bits of the accumulators back in after a block
+ * 
+ * @param acc Accumulators
+ * @param key Key words of the scramble
+ */
+static void scramble(uint64_t acc[8], const uint64_t *key) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= key[i];
+        acc[i] = lane * PRIME32_1;
+    }
+}
+
+#endif
+
+/**
+ * Multiply two words to 128 bits and fold the halves together
+ * 
+ * @param a First word
+ * @param b Second word
+ * @return Low half XOR high half of the product
+ */
+static uint64_t multiply_fold(uint64_t a, uint64_t b) {
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+}
+
+/**
+ * Spread every input bit over the whole word
+ * 
+ * @param h Word to mix
+ * @return Mixed word
+ */
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Start a hash
+ * 
+ * @param state Hash to start
+ */
+void content_hash_init(struct content_hash *state) {
+    state->acc[0] = PRIME32_3;
+    state->acc[1] = PRIME64_1;
+    state->acc[2] = PRIME64_2;
+    state->acc[3] = PRIME64_3;
+    state->acc[4] = PRIME64_4;
+    state->acc[5] = PRIME32_2;
+    state->acc[6] = PRIME64_5;
+    state->acc[7] = PRIME32_1;
+    state->block_len = 0;
+    state->total_len = 0;
+}
+
+/**
+ * Add data to a hash
+ * Whole blocks are hashed straight from the caller's buffer; only a
+ * block split between calls is copied.
+ * 
+ * @param state Hash to add to
+ * @param data Input
+ * @param len Length of the input
+ */
+void content_hash_update(struct content_hash *state, const void *data, size_t len) {
+    const unsigned char *input = (const unsigned char *)data;
+    state->total_len += len;
+    
+    if (state->block_len > 0) {
+        size_t take = HASH_BLOCK_SIZE - state->block_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(state->block + state->block_len, input, take);
+        state->block_len += take;
+        input += take;
+        len -= take;
+        if (state->block_len < HASH_BLOCK_SIZE) {
+            return;
+        }
+        accumulate(state->acc, state->block, HASH_BLOCK_STRIPES, g_key);
+        scramble(state->acc, g_key + HASH_BLOCK_STRIPES);
+        state->block_len = 0;
+    }
+    
+    while (len >= HASH_BLOCK_SIZE) {
+        accumulate(state->acc, input, HASH_BLOCK_STRIPES, g_key);
+        scramble(state->acc, g_key + HASH_BLOCK_STRIPES);
+        input += HASH_BLOCK_SIZE;
+        len -= HASH_BLOCK_SIZE;
+    }
+    
+    memcpy(state->block, input, len);
+    state->block_len = len;
+}
+
+/**
+ * Get the hash of everything added so far
+ * The unfinished block is hashed stripe by stripe, its last stripe
+ * padded with zeros; the length, mixed in last, keeps padded inputs apart.
+ * 
+ * @param state Hash to finish; it is left unchanged
+ * @param hash Set to the 128-bit hash
+ */
+void content_hash_final(const struct content_hash *state, uint64_t hash[2]) {
+    uint64_t acc[8];
+    memcpy(acc, state->acc, sizeof(acc));
+    
+    size_t stripes = state->block_len / HASH_STRIPE_SIZE;
+    accumulate(acc, state->block, stripes, g_key);
+    size_t rest = state->block_len % HASH_STRIPE_SIZE;
+    if (rest > 0) {
+        unsigned char last[HASH_STRIPE_SIZE];
+        memset(last, 0, sizeof(last));
+        memcpy(last, state->block + stripes * HASH_STRIPE_SIZE, rest);
+        accumulate(acc, last, 1, g_key + stripes);
+    }
+    
+    uint64_t low = state->total_len * PRIME64_1;
+    uint64_t high = ~(state->total_len * PRIME64_2);
+    for (int i = 0; i < 4; i++) {
+        low += multiply_fold(acc[2 * i] ^ g_key[3 + 2 * i], acc[2 * i + 1] ^ g_key[4 + 2 * i]);
+        high += multiply_fold(acc[2 * i] ^ g_key[11 + 2 * i], acc[2 * i + 1] ^ g_key[12 + 2 * i]);
+    }
+    hash[0] = avalanche(high);
+    hash[1] = avalanche(low);
+}
+
+/**
+ * Write a hash as hex digits, most significant first
+ * 
+ * @param hash Hash to write
+ * @param buffer At least HASH_HEX_LEN + 1 bytes
+ */
+void content_hash_format(const uint64_t hash[2], char *buffer) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < HASH_HEX_LEN; i++) {
+        uint64_t word = hash[i / 16];
+        buffer[i] = digits[(word >> (60 - 4 * (i % 16))) & 0xF];
+    }
+    buffer[HASH_HEX_LEN] = '\0';
+}
+
+/**
+ * Name the kernel the hash was built with
+ * 
+ * @return "sse2" or "scalar"
+ */
+const char *content_hash_kernel(void) {
+#if defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
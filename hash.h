@@ -0,0 +1,38 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Input taken per stripe and per block of the content hash
+#define HASH_STRIPE_SIZE 64
+#define HASH_BLOCK_SIZE 1024
+
+// Characters in a formatted hash, without the terminating NUL
+#define HASH_HEX_LEN 32
+
+// Incremental 128-bit content hash
+// Not cryptographic; it tells apart files, not adversaries.
+struct content_hash {
+    uint64_t acc[8];
+    unsigned char block[HASH_BLOCK_SIZE];  // Input of the unfinished block
+    size_t block_len;
+    uint64_t total_len;
+};
+
+// Start a hash
+void content_hash_init(struct content_hash *state);
+
+// Add data to a hash; the result does not depend on how input is split
+void content_hash_update(struct content_hash *state, const void *data, size_t len);
+
+// Get the hash of everything added so far
+void content_hash_final(const struct content_hash *state, uint64_t hash[2]);
+
+// Write a hash as HASH_HEX_LEN hex digits and a NUL
+void content_hash_format(const uint64_t hash[2], char *buffer);
+
+// Name of the kernel the hash was built with, "sse2" or "scalar"
+const char *content_hash_kernel(void);
+
+#endif // HASH_H
@@ -0,0 +1,913 @@
+#define _GNU_SOURCE
+#include "hashops.h"
+#include "hash.h"
+#include "dirindex.h"
+#include "dirscan.h"
+#include "dirwalk.h"
+#include "fdcache.h"
+#include "threadpool.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// A file that may have duplicates
+struct dup_file {
+    char *path;             // Relative to the root
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t edge[2];       // Hash of both ends, or of everything when they overlap
+    uint64_t hash[2];       // Hash of the whole file
+    int have_hash;
+    int hashed_now;         // Hash read by this search, worth caching
+    int dropped;            // No longer a candidate
+};
+
+// Candidates collected from the walk or the index
+struct dup_list {
+    struct dup_file *files;
+    size_t count;
+    size_t capacity;
+};
+
+// Which hash a pass of the search computes
+enum dup_pass {
+    DUP_EDGES,
+    DUP_CONTENTS
+};
+
+// State shared by the hashing threads
+struct dup_state {
+    int root_fd;
+    const char *root;
+    enum dup_pass pass;
+    const struct dir_index *index;  // Cached hashes, or NULL
+    char **buffers;                 // Read buffer of each worker, made on first use
+    int failed;                     // Accessed atomically
+};
+
+// Arguments for the duplicate search operation
+struct duplicate_args {
+    const char *dirname;
+    int recursive;
+    int indexed;
+    int jobs;
+};
+
+// Candidates being collected by a walk of the tree
+struct dup_collect {
+    const char *root;
+    int recursive;
+    struct dup_list *lists;  // One per worker
+    int failed;              // A directory could not be read; accessed atomically
+    int out_of_memory;       // Accessed atomically
+};
+
+/**
+ * Hash an open file from its current offset to the end
+ * 
+ * @param fd File to hash
+ * @param buffer Read buffer of HASH_READ_SIZE bytes
+ * @param hash Set to the hash
+ * @return 0 on success, -1 on failure with errno set
+ */
+static int hash_contents(int fd, char *buffer, uint64_t hash[2]) {
+    struct content_hash state;
+    content_hash_init(&state);
+    
+    while (1) {
+        ssize_t got = read(fd, buffer, HASH_READ_SIZE);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        content_hash_update(&state, buffer, got);
+    }
+    
+    content_hash_final(&state, hash);
+    return 0;
+}
+
+/**
+ * Hash the first and last HASH_EDGE_SIZE bytes of a file
+ * 
+ * @param fd File to hash
+ * @param size Size of the file, more than twice HASH_EDGE_SIZE
+ * @param buffer Read buffer of at least 2 * HASH_EDGE_SIZE bytes
+ * @param hash Set to the hash
+ * @return 0 on success, -1 on failure with errno set
+ */
+static int hash_edges(int fd, uint64_t size, char *buffer, uint64_t hash[2]) {
+    off_t offsets[2] = { 0, (off_t)(size - HASH_EDGE_SIZE) };
+    size_t len = 0;
+    
+    for (int i = 0; i < 2; i++) {
+        size_t done = 0;
+        while (done < HASH_EDGE_SIZE) {
+            ssize_t got = pread(fd, buffer + len + done, HASH_EDGE_SIZE - done, offsets[i] + done);
+            if (got == -1 && errno == EINTR) {
+                continue;
+            }
+            if (got == -1) {
+                return -1;
+            }
+            if (got == 0) {
+                break; // The file shrank; it is dropped once hashed whole
+            }
+            done += got;
+        }
+        len += done;
+    }
+    
+    struct content_hash state;
+    content_hash_init(&state);
+    content_hash_update(&state, buffer, len);
+    content_hash_final(&state, hash);
+    return 0;
+}
+
+/**
+ * Print the content hash of a file
+ * The output has the hash, two spaces and the name, like sha256sum.
+ * 
+ * @param filename Name of the file to hash
+ * @return 0 on success, -1 on failure
+ */
+int hash_file(const char *filename) {
+    const char *name;
+    int dir_fd = fd_cache_lookup(filename, &name);
+    int fd = (dir_fd == -1) ? -1 : open_regular_at(dir_fd, name, O_RDONLY);
+    if (fd == -1) {
+        char error_msg[256];
+        int len = (errno == ENOENT) ?
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: File \"%s\" not found.\n", filename) :
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open file \"%s\": %s\n", 
+                          filename, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    char *buffer = malloc(HASH_READ_SIZE);
+    uint64_t hash[2];
+    if (!buffer || hash_contents(fd, buffer, hash) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not read file \"%s\": %s\n", 
+                          filename, buffer ? strerror(errno) : "Out of memory");
+        err_write(error_msg, len);
+        free(buffer);
+        close(fd);
+        return -1;
+    }
+    free(buffer);
+    close(fd);
+    
+    char hex[HASH_HEX_LEN + 1];
+    content_hash_format(hash, hex);
+    char line[HASH_HEX_LEN + 4096];
+    int len = string_format(line, sizeof(line), "%s  %s\n", hex, filename);
+    out_write(line, len);
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "Hashed file \"%s\".", filename);
+    log_operation(log_msg);
+    
+    return 0;
+}
+
+/**
+ * Add a candidate to the list
+ * 
+ * @param list List to add to
+ * @param dir Directory holding it, relative to the root, "" for the root
+ * @param name Name of the file
+ * @param name_len Length of the name
+ * @return The new candidate, or NULL if memory allocation failed
+ */
+static struct dup_file *add_candidate(struct dup_list *list, const char *dir,
+                                      const char *name, size_t name_len) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        struct dup_file *files = realloc(list->files, capacity * sizeof(*files));
+        if (!files) {
+            return NULL;
+        }
+        list->files = files;
+        list->capacity = capacity;
+    }
+    
+    size_t dir_len = strlen(dir);
+    char *path = malloc(dir_len + name_len + 2);
+    if (!path) {
+        return NULL;
+    }
+    if (dir_len > 0) {
+        memcpy(path, dir, dir_len);
+        path[dir_len++] = '/';
+    }
+    memcpy(path + dir_len, name, name_len);
+    path[dir_len + name_len] = '\0';
+    
+    struct dup_file *file = &list->files[list->count++];
+    memset(file, 0, sizeof(*file));
+    file->path = path;
+    return file;
+}
+
+/**
+ * Record the non-empty regular files of a batch and enter subdirectories
+ * Only regular files, and entries of unknown type, are examined; links
+ * are not followed, so no file is found twice through them.
+ * 
+ * @param scan Directory being read
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Pointer to struct dup_collect
+ * @return 0 to keep scanning, 1 to stop after a memory allocation failure
+ */
+static int collect_batch(struct dir_walk_scan *scan, const struct dir_entry *entries, 
+                         size_t count, void *context) {
+    struct dup_collect *collect = (struct dup_collect *)context;
+    struct dup_list *list = &collect->lists[scan->worker];
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
+        if (scan->path_len == 0 && dir_index_own_file(entry->name)) {
+            continue;
+        }
+        
+        struct stat st;
+        int type = entry->type;
+        if (type == DT_REG || type == DT_UNKNOWN) {
+            if (fstatat(scan->fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                continue; // Removed since it was read
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        
+        if (type == DT_DIR) {
+            if (collect->recursive && dir_walk_enter(scan, entry->name, entry->name_len) == -1) {
+                __atomic_store_n(&collect->out_of_memory, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+            continue;
+        }
+        if (type != DT_REG || st.st_size == 0) {
+            continue;
+        }
+        
+        struct dup_file *file = add_candidate(list, scan->path, entry->name, entry->name_len);
+        if (!file) {
+            __atomic_store_n(&collect->out_of_memory, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        file->size = st.st_size;
+        file->dev = st.st_dev;
+        file->ino = st.st_ino;
+        file->mtime_sec = st.st_mtim.tv_sec;
+        file->mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    return 0;
+}
+
+/**
+ * Report a directory the walk could not read
+ * 
+ * @param path Path relative to the root
+ * @param error errno value
+ * @param context Pointer to struct dup_collect
+ */
+static void collect_error(const char *path, int error, void *context) {
+    struct dup_collect *collect = (struct dup_collect *)context;
+    char error_msg[512];
+    int len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Could not read directory \"%s/%s\": %s\n", 
+                      collect->root, path, strerror(error));
+    err_write(error_msg, len);
+    __atomic_store_n(&collect->failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Collect the candidates of a directory and, with recursive, below it
+ * The tree is read in parallel; each worker collects into a list of its
+ * own, and the lists are joined at the end.
+ * 
+ * @param list List to add to
+ * @param fd Open directory; closed before returning
+ * @param root Directory the search started from, for messages
+ * @param recursive Whether to descend into subdirectories
+ * @param jobs Number of worker threads
+ * @return 0 on success, -1 if anything could not be read
+ */
+static int collect_directory(struct dup_list *list, int fd, const char *root, 
+                             int recursive, int jobs) {
+    struct dup_collect collect = { root, recursive, NULL, 0, 0 };
+    collect.lists = calloc(jobs, sizeof(*collect.lists));
+    if (!collect.lists) {
+        close(fd);
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    
+    if (dir_walk(fd, recursive ? jobs : 1, collect_batch, collect_error, &collect) == -1) {
+        err_write("Error: Could not start worker threads\n", 38);
+        collect.failed = 1;
+    }
+    
+    size_t total = list->count;
+    for (int i = 0; i < jobs; i++) {
+        total += collect.lists[i].count;
+    }
+    struct dup_file *files = realloc(list->files, (total ? total : 1) * sizeof(*files));
+    if (files) {
+        list->files = files;
+        list->capacity = total;
+    }
+    for (int i = 0; i < jobs; i++) {
+        struct dup_list *part = &collect.lists[i];
+        if (files) {
+            memcpy(list->files + list->count, part->files, part->count * sizeof(*files));
+            list->count += part->count;
+        } else {
+            for (size_t j = 0; j < part->count; j++) {
+                free(part->files[j].path);
+            }
+        }
+        free(part->files);
+    }
+    free(collect.lists);
+    
+    if (!files || collect.out_of_memory) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return -1;
+    }
+    return collect.failed ? -1 : 0;
+}
+
+/**
+ * Collect the candidates of a directory or tree from its index
+ * Sizes are those of the index; every candidate is checked again when
+ * it is hashed.
+ * 
+ * @param list List to add to
+ * @param index Mapped index of the tree
+ * @param recursive Whether to take the whole tree or only its root
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int collect_indexed(struct dup_list *list, const struct dir_index *index, int recursive) {
+    const struct dir_index_dir *root = dir_index_find(index, "");
+    if (!root) {
+        return 0;
+    }
+    uint32_t first = recursive ? 0 : (uint32_t)(root - index->dirs);
+    uint32_t last = recursive ? index->header->dir_count : first + 1;
+    
+    for (uint32_t d = first; d < last; d++) {
+        const struct dir_index_dir *dir = &index->dirs[d];
+        for (uint32_t i = 0; i < dir->entry_count; i++) {
+            const struct dir_index_entry *entry = &index->entries[dir->first_entry + i];
+            if (entry->type != DT_REG || entry->size == 0) {
+                continue;
+            }
+            struct dup_file *file = add_candidate(list, index->names + dir->path,
+                                                  index->names + entry->name, entry->name_len);
+            if (!file) {
+                return -1;
+            }
+            file->size = entry->size;
+            file->ino = entry->ino;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Get a worker's read buffer, allocating it on first use
+ * 
+ * @param state Search state
+ * @param worker Index of the worker
+ * @return Buffer of HASH_READ_SIZE bytes, or NULL
+ */
+static char *worker_buffer(struct dup_state *state, int worker) {
+    if (!state->buffers[worker]) {
+        state->buffers[worker] = malloc(HASH_READ_SIZE);
+    }
+    return state->buffers[worker];
+}
+
+/**
+ * Hash one candidate for the current pass (thread pool task)
+ * The file is checked again first, and dropped if it is gone, is no
+ * longer a regular file, or changed size since the last pass.
+ * 
+ * @param task Candidate, as a struct dup_file
+ * @param worker Index of the calling worker
+ * @param context Search state
+ */
+static void hash_candidate(void *task, int worker, void *context) {
+    struct dup_file *file = (struct dup_file *)task;
+    struct dup_state *state = (struct dup_state *)context;
+    
+    char *buffer = worker_buffer(state, worker);
+    int fd = buffer ? open_regular_at(state->root_fd, file->path, O_RDONLY | O_NOFOLLOW) : -1;
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (!buffer || errno != ENOENT) {
+            char error_msg[512];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not open file \"%s/%s\": %s\n", state->root,
+                              file->path, buffer ? strerror(errno) : "Out of memory");
+            err_write(error_msg, len);
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+        file->dropped = 1;
+        return;
+    }
+    
+    if (state->pass == DUP_CONTENTS && (uint64_t)st.st_size != file->size) {
+        close(fd);
+        file->dropped = 1;
+        return;
+    }
+    file->size = st.st_size;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime_sec = st.st_mtim.tv_sec;
+    file->mtime_nsec = st.st_mtim.tv_nsec;
+    
+    int result = 0;
+    if (state->pass == DUP_EDGES && file->size <= 2 * HASH_EDGE_SIZE) {
+        // The ends cover the whole file
+        result = hash_contents(fd, buffer, file->edge);
+        memcpy(file->hash, file->edge, sizeof(file->hash));
+        file->have_hash = 1;
+    } else if (state->pass == DUP_EDGES) {
+        result = hash_edges(fd, file->size, buffer, file->edge);
+    } else {
+        const struct dir_index_hash *cached = state->index ?
+            dir_index_find_hash(state->index, file->dev, file->ino, file->size,
+                                file->mtime_sec, file->mtime_nsec) : NULL;
+        if (cached) {
+            memcpy(file->hash, cached->hash, sizeof(file->hash));
+        } else {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            result = hash_contents(fd, buffer, file->hash);
+            file->hashed_now = 1;
+        }
+        file->have_hash = 1;
+    }
+    
+    if (result == -1) {
+        char error_msg[512];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not read file \"%s/%s\": %s\n", 
+                          state->root, file->path, strerror(errno));
+        err_write(error_msg, len);
+        __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+        file->dropped = 1;
+        file->hashed_now = 0;
+    }
+    close(fd);
+}
+
+/**
+ * Order candidates by size
+ * 
+ * @param a First candidate
+ * @param b Second candidate
+ * @return Comparison of the sizes
+ */
+static int compare_sizes(const void *a, const void *b) {
+    const struct dup_file *x = (const struct dup_file *)a;
+    const struct dup_file *y = (const struct dup_file *)b;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+/**
+ * Order candidates by size and edge hash, hard links of a file together
+ * 
+ * @param a First candidate
+ * @param b Second candidate
+ * @return Comparison of size, edge hash, device, inode, then path
+ */
+static int compare_edges(const void *a, const void *b) {
+    const struct dup_file *x = (const struct dup_file *)a;
+    const struct dup_file *y = (const struct dup_file *)b;
+    uint64_t left[5] = { x->size, x->edge[0], x->edge[1], x->dev, x->ino };
+    uint64_t right[5] = { y->size, y->edge[0], y->edge[1], y->dev, y->ino };
+    for (int i = 0; i < 5; i++) {
+        if (left[i] != right[i]) {
+            return (left[i] > right[i]) ? 1 : -1;
+        }
+    }
+    return strcmp(x->path, y->path);
+}
+
+/**
+ * Order candidates largest first, then by hash and path
+ * 
+ * @param a First candidate
+ * @param b Second candidate
+ * @return Comparison for the report
+ */
+static int compare_hashes(const void *a, const void *b) {
+    const struct dup_file *x = (const struct dup_file *)a;
+    const struct dup_file *y = (const struct dup_file *)b;
+    if (x->size != y->size) {
+        return (x->size < y->size) ? 1 : -1;
+    }
+    if (x->hash[0] != y->hash[0]) {
+        return (x->hash[0] > y->hash[0]) ? 1 : -1;
+    }
+    if (x->hash[1] != y->hash[1]) {
+        return (x->hash[1] > y->hash[1]) ? 1 : -1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+/**
+ * Remove dropped candidates, keeping the order of the rest
+ * 
+ * @param list List to compact
+ */
+static void compact_candidates(struct dup_list *list) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->files[i].dropped) {
+            free(list->files[i].path);
+        } else {
+            list->files[kept++] = list->files[i];
+        }
+    }
+    list->count = kept;
+}
+
+/**
+ * Drop candidates that share their key with no other candidate
+ * The list must be sorted so that equal keys are adjacent.
+ * 
+ * @param list Sorted list
+ * @param same Tells whether two candidates have the same key
+ */
+static void drop_unique(struct dup_list *list,
+                        int (*same)(const struct dup_file *, const struct dup_file *)) {
+    size_t start = 0;
+    while (start < list->count) {
+        size_t end = start + 1;
+        while (end < list->count && same(&list->files[start], &list->files[end])) {
+            end++;
+        }
+        if (end - start == 1) {
+            list->files[start].dropped = 1;
+        }
+        start = end;
+    }
+    compact_candidates(list);
+}
+
+/**
+ * Check whether two candidates have the same size
+ * 
+ * @param a First candidate
+ * @param b Second candidate
+ * @return 1 if they do
+ */
+static int same_size(const struct dup_file *a, const struct dup_file *b) {
+    return a->size == b->size;
+}
+
+/**
+ * Check whether two candidates have the same size and edge hash
+ * 
+ * @param a First candidate
+ * @param b Second candidate
+ * @return 1 if they do
+ */
+static int same_edges(const struct dup_file *a, const struct dup_file *b) {
+    return a->size == b->size && a->edge[0] == b->edge[0] && a->edge[1] == b->edge[1];
+}
+
+/**
+ * Check whether two candidates have the same size and content hash
+ * 
+ * @param a First candidate
+ * @param b Second candidate
+ * @return 1 if they do
+ */
+static int same_contents(const struct dup_file *a, const struct dup_file *b) {
+    return a->size == b->size && a->hash[0] == b->hash[0] && a->hash[1] == b->hash[1];
+}
+
+/**
+ * Run one hashing pass over the candidates that still need it
+ * 
+ * @param state Search state
+ * @param list Candidates
+ * @param jobs Number of worker threads
+ * @return 0 on success, -1 if the workers could not be started
+ */
+static int run_pass(struct dup_state *state, struct dup_list *list, int jobs) {
+    struct thread_pool *pool = pool_create(jobs, hash_candidate, state);
+    if (!pool) {
+        err_write("Error: Could not start worker threads\n", 38);
+        return -1;
+    }
+    
+    for (size_t i = 0; i < list->count; i++) {
+        struct dup_file *file = &list->files[i];
+        if (state->pass == DUP_CONTENTS && file->have_hash) {
+            continue;
+        }
+        if (pool_submit(pool, -1, file) == -1) {
+            file->dropped = 1;
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+    compact_candidates(list);
+    return 0;
+}
+
+/**
+ * Write the groups of duplicates, largest files first
+ * 
+ * @param list Candidates sorted by compare_hashes, every one duplicated
+ * @param dirname Directory searched
+ * @param recursive Whether the search covered the whole tree
+ */
+static void write_duplicates(const struct dup_list *list, const char *dirname, int recursive) {
+    if (list->count == 0) {
+        char msg[512];
+        int len = string_format(msg, sizeof(msg), 
+                          "No duplicate files found in \"%s\".\n", dirname);
+        out_write(msg, len);
+        return;
+    }
+    
+    char header[512];
+    int header_len = string_format(header, sizeof(header), "Duplicate files in directory \"%s\"%s:\n", 
+                             dirname, recursive ? " (recursive)" : "");
+    out_write(header, header_len);
+    
+    long groups = 0;
+    long freeable = 0;
+    size_t start = 0;
+    while (start < list->count) {
+        size_t end = start + 1;
+        while (end < list->count && same_contents(&list->files[start], &list->files[end])) {
+            end++;
+        }
+        
+        char hex[HASH_HEX_LEN + 1];
+        content_hash_format(list->files[start].hash, hex);
+        char line[256];
+        int len = string_format(line, sizeof(line), "  %ld files of %ld bytes (%s):\n", 
+                          (long)(end - start), (long)list->files[start].size, hex);
+        out_write(line, len);
+        for (size_t i = start; i < end; i++) {
+            out_write("    ", 4);
+            out_write(list->files[i].path, strlen(list->files[i].path));
+            out_write("\n", 1);
+        }
+        
+        groups++;
+        freeable += (long)(end - start - 1) * (long)list->files[start].size;
+        start = end;
+    }
+    
+    char summary[256];
+    int summary_len = string_format(summary, sizeof(summary), 
+                              "Found %ld sets of duplicates, %ld files in all; "
+                              "removing the copies would free %ld bytes.\n", 
+                              groups, (long)list->count, freeable);
+    out_write(summary, summary_len);
+}
+
+/**
+ * Cache the hashes this search read in the tree's index
+ * Skipped while a watch process owns the index; the hashes are then
+ * read again next time.
+ * 
+ * @param list Candidates
+ * @param dirname Root of the tree
+ */
+static void store_new_hashes(const struct dup_list *list, const char *dirname) {
+    size_t count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        count += list->files[i].hashed_now;
+    }
+    if (count == 0 || dir_index_watched(dirname)) {
+        return;
+    }
+    
+    struct dir_index_hash *hashes = malloc(count * sizeof(*hashes));
+    if (!hashes) {
+        return;
+    }
+    count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const struct dup_file *file = &list->files[i];
+        if (file->hashed_now) {
+            hashes[count].dev = file->dev;
+            hashes[count].ino = file->ino;
+            hashes[count].size = file->size;
+            hashes[count].mtime_sec = file->mtime_sec;
+            hashes[count].mtime_nsec = file->mtime_nsec;
+            memcpy(hashes[count].hash, file->hash, sizeof(file->hash));
+            count++;
+        }
+    }
+    
+    if (dir_index_store_hashes(dirname, hashes, count) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not update index for \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+    }
+    free(hashes);
+}
+
+/**
+ * Find files with identical contents
+ * Candidates are narrowed step by step: by size, then by a hash of
+ * their first and last HASH_EDGE_SIZE bytes, and only then by a hash of
+ * everything, so most files are never read whole. Both hashing passes
+ * run on a thread pool. Empty files are ignored, and hard links of one
+ * file count once.
+ * 
+ * @param arg Pointer to struct duplicate_args
+ * @return 0 on success, -1 on failure
+ */
+static int find_duplicates_operation(void *arg) {
+    const struct duplicate_args *search = (const struct duplicate_args *)arg;
+    const char *dirname = search->dirname;
+    
+    int root_fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not open directory \"%s\": %s\n", 
+                          dirname, strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    int jobs = (search->jobs > 0) ? search->jobs : pool_default_workers();
+    struct dup_list list = { NULL, 0, 0 };
+    struct dir_index index;
+    int have_index = 0;
+    int result = 0;
+    if (search->indexed) {
+        if ((!dir_index_watched(dirname) && dir_index_update(dirname) == -1) ||
+            dir_index_open(dirname, &index) == -1) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not update index for \"%s\": %s\n", 
+                              dirname, strerror(errno));
+            err_write(error_msg, len);
+            close(root_fd);
+            return -1;
+        }
+        have_index = 1;
+        if (collect_indexed(&list, &index, search->recursive) == -1) {
+            err_write("Error: Memory allocation failed\n", 32);
+            result = -1;
+        }
+    } else {
+        int scan_fd = dup(root_fd);
+        if (scan_fd == -1 || collect_directory(&list, scan_fd, dirname, search->recursive, jobs) == -1) {
+            result = -1;
+        }
+    }
+    
+    struct dup_state state;
+    state.root_fd = root_fd;
+    state.root = dirname;
+    state.index = have_index ? &index : NULL;
+    state.failed = 0;
+    state.buffers = calloc(jobs, sizeof(*state.buffers));
+    if (!state.buffers) {
+        err_write("Error: Memory allocation failed\n", 32);
+        result = -1;
+    }
+    
+    if (state.buffers) {
+        qsort(list.files, list.count, sizeof(*list.files), compare_sizes);
+        drop_unique(&list, same_size);
+        
+        state.pass = DUP_EDGES;
+        if (run_pass(&state, &list, jobs) == -1) {
+            result = -1;
+        }
+        
+        // Hard links share an inode, so only the first of them is kept
+        qsort(list.files, list.count, sizeof(*list.files), compare_edges);
+        for (size_t i = 1; i < list.count; i++) {
+            const struct dup_file *prev = &list.files[i - 1];
+            if (list.files[i].dev == prev->dev && list.files[i].ino == prev->ino) {
+                list.files[i].dropped = 1;
+            }
+        }
+        compact_candidates(&list);
+        drop_unique(&list, same_edges);
+        
+        state.pass = DUP_CONTENTS;
+        if (run_pass(&state, &list, jobs) == -1) {
+            result = -1;
+        }
+        qsort(list.files, list.count, sizeof(*list.files), compare_hashes);
+        
+        // Hashes read now are cached even for files that proved unique
+        if (have_index) {
+            dir_index_close(&index);
+            have_index = 0;
+            store_new_hashes(&list, dirname);
+        }
+        drop_unique(&list, same_contents);
+        write_duplicates(&list, dirname, search->recursive);
+        
+        for (int i = 0; i < jobs; i++) {
+            free(state.buffers[i]);
+        }
+        free(state.buffers);
+    }
+    
+    if (have_index) {
+        dir_index_close(&index);
+    }
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.files[i].path);
+    }
+    free(list.files);
+    close(root_fd);
+    
+    return (result == -1 || state.failed) ? -1 : 0;
+}
+
+/**
+ * Report files with identical contents in a directory or tree
+ * 
+ * @param dirname Directory to search
+ * @param recursive Whether to search its subdirectories too
+ * @param indexed Take candidates from the tree's index and cache hashes there
+ * @param jobs Number of hashing threads, or 0 for one per CPU
+ * @return 0 on success, -1 on failure
+ */
+int find_duplicates(const char *dirname, int recursive, int indexed, int jobs) {
+    // Check if directory exists
+    if (!directory_exists(dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    struct duplicate_args search = { dirname, recursive, indexed, jobs };
+    int result = run_operation(find_duplicates_operation, &search);
+    
+    if (result == RUN_FORK_FAILED) {
+        // Fork failed
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not create process: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    // Log the operation
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "Searched directory \"%s\" for duplicate files%s.", 
+            dirname, recursive ? " recursively" : "");
+    log_operation(log_msg);
+    
+    return 0;
+}
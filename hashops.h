@@ -0,0 +1,17 @@
+#ifndef HASHOPS_H
+#define HASHOPS_H
+
+// Bytes hashed at each end of a file to tell same-sized files apart
+// before reading them whole
+#define HASH_EDGE_SIZE 4096
+
+// Bytes read at a time when hashing a whole file
+#define HASH_READ_SIZE (1024 * 1024)
+
+// Print the content hash of a file
+int hash_file(const char *filename);
+
+// Report files with identical contents in a directory or tree
+int find_duplicates(const char *dirname, int recursive, int indexed, int jobs);
+
+#endif // HASHOPS_H
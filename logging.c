@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 #include "logging.h"
+#include "logqueue.h"
+#include "config.h"
 #include "utils.h"
+#include "stats.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -11,108 +14,453 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 
-#define LOG_FILE "log.txt"
+// Size of the in-memory ring buffer holding pending log entries
+#define LOG_BUFFER_SIZE 65536
+
+// Flush once this many bytes are pending
+#define LOG_FLUSH_THRESHOLD 49152
+
+// Flush once the oldest pending entry is this many seconds old
+#define LOG_FLUSH_INTERVAL 1
+
+// Add an index checkpoint each time the log grows by this many bytes
+#define LOG_INDEX_INTERVAL 65536
+
+// Directory holding the log, opened when logging starts so that a later
+// change of working directory, as a server makes for each client, can't
+// move the log
+static int g_log_dir_fd = -1;
+
+// Log file descriptor, kept open for the life of the process
+static int g_log_fd = -1;
+
+// Checkpoint index descriptor, or -1 if the index is unavailable
+static int g_index_fd = -1;
+
+// Text entries are truncated to this size
+#define TEXT_ENTRY_SIZE 512
+
+// Room for the largest text entry or binary record
+#define LOG_ENTRY_SIZE LOG_RECORD_MAX_SIZE
+
+// Log format from the configuration: -1 until read, then 1 for binary
+static int g_log_binary = -1;
+
+// Operation recorded with the calling thread's log entries
+static __thread int t_log_op = LOG_OP_NONE;
+
+// Command names of the operation codes
+static const char *const g_op_names[LOG_OP_COUNT] = {
+    "", "createDir", "createFile", "listDir", "listFilesByExtension", 
+    "readFile", "appendToFile", "deleteFile", "deleteDir", "showLogs"
+};
+
+// Rotation limits from the configuration; 0 means no limit
+static long g_rotate_max_size = 0;
+static long g_rotate_max_age = 0;
+
+// Ring buffer of formatted entries waiting to be written
+static char g_log_buffer[LOG_BUFFER_SIZE];
+static size_t g_log_head = 0;    // Offset of the oldest pending byte
+static size_t g_log_used = 0;    // Number of pending bytes
+static time_t g_log_oldest = 0;  // Time the oldest pending entry was added
+
+// Wake the flusher thread once this many records are queued
+#define LOG_QUEUE_WAKE 512
+
+// Maximum number of records written by one writev()
+#define LOG_IOV_BATCH (IOV_MAX < 1024 ? IOV_MAX : 1024)
+
+// Preformatted entry handed from a worker to the flusher thread
+struct log_record {
+    struct log_node node;
+    size_t len;
+    char text[];
+};
+
+// Queue of records drained by the flusher thread
+static struct log_queue g_log_queue;
+static long g_log_queued = 0;
+
+// Flusher thread state; the flags are accessed atomically
+static pthread_t g_flusher_thread;
+static sem_t g_flusher_wake;
+static int g_flusher_running = 0;
+static int g_flusher_stop = 0;
+
+// Explicit flush requests and their completion by the flusher thread
+static pthread_mutex_t g_flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_flush_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long g_flush_requested = 0;
+static unsigned long g_flush_completed = 0;
 
 /**
- * Initialize the logging system
- * Creates the log file if it doesn't exist
+ * Record a checkpoint in the index if the log has grown enough
+ * Must be called with the log lock held, just before a batch is written.
+ * Every entry before a checkpoint's offset was written no later than
+ * the checkpoint's time, which lets queries by time skip straight to the
+ * right region of the log.
+ */
+static void update_log_index(void) {
+    if (g_index_fd == -1) {
+        return;
+    }
+    
+    struct stat log_st, index_st;
+    if (fstat(g_log_fd, &log_st) == -1 || fstat(g_index_fd, &index_st) == -1) {
+        return;
+    }
+    
+    // Compare with the newest checkpoint, which any process may have written
+    off_t index_size = index_st.st_size - index_st.st_size % sizeof(struct log_checkpoint);
+    if (index_size > 0) {
+        struct log_checkpoint last;
+        if (pread(g_index_fd, &last, sizeof(last), index_size - sizeof(last)) != sizeof(last)) {
+            return;
+        }
+        if (log_st.st_size < last.offset) {
+            // The log was truncated or replaced; start a fresh index
+            if (ftruncate(g_index_fd, 0) == -1) {
+                return;
+            }
+        } else if (log_st.st_size - last.offset < LOG_INDEX_INTERVAL) {
+            return;
+        }
+    }
+    
+    struct log_checkpoint checkpoint;
+    checkpoint.time = time(NULL);
+    checkpoint.offset = log_st.st_size;
+    write(g_index_fd, &checkpoint, sizeof(checkpoint));
+}
+
+/**
+ * Open the log file and its index, creating them if needed
  * 
  * @return 0 on success, -1 on failure
  */
-int init_logging(void) {
-    // Check if log file exists, if not, create it
-    int fd = open(LOG_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not initialize logging: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+static int open_log_files(void) {
+    if (log_directory() == -1) {
         return -1;
     }
     
-    // Close the file
-    if (close(fd) == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not close log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+    g_log_fd = openat(g_log_dir_fd, log_file_name(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (g_log_fd == -1) {
         return -1;
     }
     
+    if (g_index_fd != -1) {
+        close(g_index_fd);
+    }
+    
+    // The index only speeds up queries, so logging works without it
+    g_index_fd = openat(g_log_dir_fd, log_index_name(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    
     return 0;
 }
 
 /**
- * Log an operation with timestamp
+ * Take the exclusive lock on the file currently named log_file_name()
+ * in the log directory
+ * If another process rotated the log while we held an older descriptor,
+ * the new file is opened and the lock taken on that instead.
  * 
- * @param message Message to log
  * @return 0 on success, -1 on failure
  */
-int log_operation(const char *message) {
-    // Open log file in append mode
-    int fd = open(LOG_FILE, O_WRONLY | O_APPEND);
-    if (fd == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not open log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        return -1;
+static int lock_current_log(void) {
+    while (1) {
+        long long wait_start = stats_now();
+        int locked = flock(g_log_fd, LOCK_EX);
+        stats_wait(STATS_LOG_LOCK, wait_start);
+        if (locked == -1) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not lock log file: %s\n", 
+                              strerror(errno));
+            write(STDERR_FILENO, error_msg, len);
+            return -1;
+        }
+        
+        struct stat fd_st, path_st;
+        if (fstat(g_log_fd, &fd_st) == 0 && fstatat(g_log_dir_fd, log_file_name(), &path_st, 0) == 0 && 
+            fd_st.st_ino == path_st.st_ino && fd_st.st_dev == path_st.st_dev) {
+            return 0;
+        }
+        
+        // Our descriptor refers to an archived segment; reopen
+        flock(g_log_fd, LOCK_UN);
+        close(g_log_fd);
+        g_log_fd = -1;
+        
+        if (open_log_files() == -1) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not open log file: %s\n", 
+                              strerror(errno));
+            write(STDERR_FILENO, error_msg, len);
+            return -1;
+        }
+    }
+}
+
+/**
+ * Check whether the current log has reached its size or age limit
+ * Must be called with the log lock held.
+ * 
+ * @param batch_len Size of the batch about to be written
+ * @return 1 if the log should be rotated first, 0 otherwise
+ */
+static int log_needs_rotation(size_t batch_len) {
+    struct stat st;
+    if (fstat(g_log_fd, &st) == -1 || st.st_size == 0) {
+        return 0;
     }
     
-    // Acquire an exclusive lock
-    if (flock(fd, LOCK_EX) == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not lock log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        close(fd);
+    if (g_rotate_max_size > 0 && st.st_size + (off_t)batch_len > g_rotate_max_size) {
+        return 1;
+    }
+    
+    // The first checkpoint records when the current log was started
+    if (g_rotate_max_age > 0 && g_index_fd != -1) {
+        struct log_checkpoint first;
+        if (pread(g_index_fd, &first, sizeof(first), 0) == sizeof(first) && 
+            time(NULL) - first.time >= g_rotate_max_age) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Write a batch of entries to the log file
+ * The whole batch goes out in a single O_APPEND writev() under an
+ * exclusive lock, so batches from concurrent processes never interleave.
+ * 
+ * @param iov Entries to write; updated in place on short writes
+ * @param iov_count Number of entries
+ * @return 0 on success, -1 on failure
+ */
+static int write_log_batch(struct iovec *iov, int iov_count) {
+    // Acquire an exclusive lock on the current log file
+    if (lock_current_log() == -1) {
         return -1;
     }
     
-    // Get timestamp
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
+    // Start a new segment if this batch would take the log over its limits
+    size_t batch_len = 0;
+    for (int i = 0; i < iov_count; i++) {
+        batch_len += iov[i].iov_len;
+    }
+    if (log_needs_rotation(batch_len)) {
+        int old_fd = g_log_fd;
+        if (rotate_log_segment() == 0) {
+            g_log_fd = -1;
+            if (open_log_files() == -1 || flock(g_log_fd, LOCK_EX) == -1) {
+                flock(old_fd, LOCK_UN);
+                close(old_fd);
+                return -1;
+            }
+            flock(old_fd, LOCK_UN);
+            close(old_fd);
+        }
+    }
     
-    // Format the log entry: [timestamp] message
-    char log_entry[512];
-    int entry_len = string_format(log_entry, sizeof(log_entry), 
-                            "%s %s\n", timestamp, message);
+    // The lock is held, so the end of the file is where this batch lands
+    update_log_index();
     
-    // Write log entry to file
-    if (write(fd, log_entry, entry_len) == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not write to log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+    int result = 0;
+    while (iov_count > 0) {
+        ssize_t bytes_written = writev(g_log_fd, iov, iov_count);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not write to log file: %s\n", 
+                              strerror(errno));
+            write(STDERR_FILENO, error_msg, len);
+            result = -1;
+            break;
+        }
         
-        // Release the lock
-        flock(fd, LOCK_UN);
-        close(fd);
-        return -1;
+        // Skip whatever a short write already covered
+        size_t done = bytes_written;
+        while (iov_count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
     }
     
     // Release the lock
-    if (flock(fd, LOCK_UN) == -1) {
+    if (flock(g_log_fd, LOCK_UN) == -1) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
                           "Error: Could not unlock log file: %s\n", 
                           strerror(errno));
         write(STDERR_FILENO, error_msg, len);
-        close(fd);
-        return -1;
+        result = -1;
+    }
+    
+    return result;
+}
+
+/**
+ * Write the entries pending in the ring buffer to the log file
+ * 
+ * @return 0 on success, -1 on failure
+ */
+static int write_pending_logs(void) {
+    if (g_log_used == 0) {
+        return 0;
+    }
+    
+    // The pending bytes may wrap around the end of the ring
+    struct iovec iov[2];
+    int iov_count = 1;
+    size_t first_len = LOG_BUFFER_SIZE - g_log_head;
+    
+    iov[0].iov_base = g_log_buffer + g_log_head;
+    if (first_len >= g_log_used) {
+        iov[0].iov_len = g_log_used;
+    } else {
+        iov[0].iov_len = first_len;
+        iov[1].iov_base = g_log_buffer;
+        iov[1].iov_len = g_log_used - first_len;
+        iov_count = 2;
+    }
+    
+    int result = write_log_batch(iov, iov_count);
+    
+    // Entries are dropped on failure rather than retried forever
+    g_log_head = 0;
+    g_log_used = 0;
+    
+    return result;
+}
+
+/**
+ * Write every queued record to the log file
+ * Called only from the flusher thread, the queue's single consumer.
+ */
+static void drain_log_queue(void) {
+    struct iovec iov[LOG_IOV_BATCH];
+    struct log_record *records[LOG_IOV_BATCH];
+    
+    while (1) {
+        int count = 0;
+        
+        while (count < LOG_IOV_BATCH) {
+            struct log_node *node = log_queue_pop(&g_log_queue);
+            if (!node) {
+                // A producer may be between claiming and linking its node
+                if (count == 0 && !log_queue_empty(&g_log_queue)) {
+                    sched_yield();
+                    continue;
+                }
+                break;
+            }
+            
+            records[count] = (struct log_record *)node;
+            iov[count].iov_base = records[count]->text;
+            iov[count].iov_len = records[count]->len;
+            count++;
+        }
+        
+        if (count == 0) {
+            break;
+        }
+        
+        write_log_batch(iov, count);
+        
+        for (int i = 0; i < count; i++) {
+            free(records[i]);
+        }
+        __atomic_sub_fetch(&g_log_queued, count, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Flusher thread: writes queued records in batches
+ * Wakes when enough records are queued, when a flush is requested, or
+ * every LOG_FLUSH_INTERVAL seconds.
+ * 
+ * @param arg Unused
+ * @return NULL
+ */
+static void *flusher_main(void *arg) {
+    (void)arg;
+    
+    while (1) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += LOG_FLUSH_INTERVAL;
+        sem_timedwait(&g_flusher_wake, &deadline);
+        
+        int stopping = __atomic_load_n(&g_flusher_stop, __ATOMIC_ACQUIRE);
+        
+        // Every record pushed before this request was made gets written
+        pthread_mutex_lock(&g_flush_mutex);
+        unsigned long requested = g_flush_requested;
+        pthread_mutex_unlock(&g_flush_mutex);
+        
+        drain_log_queue();
+        
+        pthread_mutex_lock(&g_flush_mutex);
+        g_flush_completed = requested;
+        pthread_cond_broadcast(&g_flush_cond);
+        pthread_mutex_unlock(&g_flush_mutex);
+        
+        if (stopping) {
+            break;
+        }
     }
     
-    // Close the file
-    if (close(fd) == -1) {
+    return NULL;
+}
+
+/**
+ * Forget the flusher thread in a forked child, which doesn't inherit it
+ * The child falls back to the ring buffer.
+ */
+static void reset_flusher_in_child(void) {
+    __atomic_store_n(&g_flusher_running, 0, __ATOMIC_RELAXED);
+    log_queue_init(&g_log_queue);
+    g_log_queued = 0;
+}
+
+/**
+ * Initialize the logging system
+ * Creates the log file and its checkpoint index if they don't exist and
+ * keeps them open
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int init_logging(void) {
+    if (g_log_fd != -1) {
+        return 0;
+    }
+    
+    // Read the rotation limits once
+    log_rotation_limits(&g_rotate_max_size, &g_rotate_max_age);
+    
+    // Open the log file, creating it if it doesn't exist
+    if (open_log_files() == -1) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not close log file: %s\n", 
+                          "Error: Could not initialize logging: %s\n", 
                           strerror(errno));
         write(STDERR_FILENO, error_msg, len);
         return -1;
@@ -122,145 +470,326 @@ int log_operation(const char *message) {
 }
 
 /**
- * Display all logs
+ * Get the directory holding the log
+ * It is the working directory at the time logging started, normally
+ * from init_logging() at startup, and stays the same afterwards.
  * 
- * @return 0 on success, -1 on failure
+ * @return Directory descriptor, or -1 if it could not be opened
  */
-int show_logs(void) {
-    // Check if log file exists
-    struct stat st;
-    if (stat(LOG_FILE, &st) == -1) {
-        if (errno == ENOENT) {
-            const char *no_logs_msg = "No logs available.\n";
-            write(STDOUT_FILENO, no_logs_msg, strlen(no_logs_msg));
-            return 0;
-        } else {
-            char error_msg[256];
-            int len = string_format(error_msg, sizeof(error_msg), 
-                              "Error: Could not access log file: %s\n", 
-                              strerror(errno));
-            write(STDERR_FILENO, error_msg, len);
-            return -1;
+int log_directory(void) {
+    if (g_log_dir_fd == -1) {
+        g_log_dir_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+    return g_log_dir_fd;
+}
+
+/**
+ * Check whether the log is written in the binary format
+ * Set with "log_format = binary"; the default is text.
+ * 
+ * @return 1 for binary, 0 for text
+ */
+int log_format_binary(void) {
+    if (g_log_binary == -1) {
+        g_log_binary = (strcmp(config_get_string("log_format", "text"), "binary") == 0);
+    }
+    return g_log_binary;
+}
+
+/**
+ * Get the current log file name for the configured format
+ * 
+ * @return Log file name
+ */
+const char *log_file_name(void) {
+    return log_format_binary() ? LOG_BINARY_FILE : LOG_FILE;
+}
+
+/**
+ * Get the current index file name for the configured format
+ * 
+ * @return Index file name
+ */
+const char *log_index_name(void) {
+    return log_format_binary() ? LOG_BINARY_INDEX_FILE : LOG_INDEX_FILE;
+}
+
+/**
+ * Set the operation recorded with this thread's following log entries
+ * 
+ * @param command Command name, e.g. "createFile"
+ */
+void log_set_operation(const char *command) {
+    t_log_op = LOG_OP_NONE;
+    for (int op = LOG_OP_NONE + 1; op < LOG_OP_COUNT; op++) {
+        if (strcmp(command, g_op_names[op]) == 0) {
+            t_log_op = op;
+            return;
         }
     }
+}
+
+/**
+ * Get the command name of an operation code
+ * 
+ * @param op Operation code
+ * @return Command name, or "" for unknown codes
+ */
+const char *log_operation_name(int op) {
+    return (op > LOG_OP_NONE && op < LOG_OP_COUNT) ? g_op_names[op] : "";
+}
+
+/**
+ * Encode a binary log record
+ * No timestamp formatting is done here: times are stored as integers,
+ * and the path is the first quoted name in the message.
+ * 
+ * @param entry Buffer of LOG_ENTRY_SIZE bytes
+ * @param message Message to log
+ * @return Length of the record
+ */
+static int encode_binary_entry(char *entry, const char *message) {
+    struct log_record_header header;
+    struct timespec mono, wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &wall);
     
-    // Open log file for reading
-    int fd = open(LOG_FILE, O_RDONLY);
-    if (fd == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not open log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        return -1;
+    const char *path = "";
+    size_t path_len = 0;
+    const char *quote = strchr(message, '"');
+    if (quote) {
+        const char *close_quote = strchr(quote + 1, '"');
+        if (close_quote) {
+            path = quote + 1;
+            path_len = close_quote - path;
+        }
+    }
+    if (path_len > LOG_RECORD_MAX_PATH) {
+        path_len = LOG_RECORD_MAX_PATH;
     }
     
-    // Acquire a shared lock for reading
-    if (flock(fd, LOCK_SH) == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not lock log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        close(fd);
+    size_t message_len = strlen(message);
+    if (message_len > LOG_RECORD_MAX_MESSAGE) {
+        message_len = LOG_RECORD_MAX_MESSAGE;
+    }
+    
+    uint32_t length = sizeof(header) + path_len + message_len + sizeof(uint32_t);
+    
+    header.magic = LOG_RECORD_MAGIC;
+    header.length = length;
+    header.mono_ns = (int64_t)mono.tv_sec * 1000000000 + mono.tv_nsec;
+    header.wall_sec = wall.tv_sec;
+    header.wall_nsec = wall.tv_nsec;
+    header.op = t_log_op;
+    header.result = (strncmp(message, "ERROR", 5) == 0) ? -1 : 0;
+    header.pid = getpid();
+    header.path_len = path_len;
+    header.message_len = message_len;
+    
+    char *p = entry;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, path, path_len);
+    p += path_len;
+    memcpy(p, message, message_len);
+    p += message_len;
+    memcpy(p, &length, sizeof(length));
+    
+    return length;
+}
+
+/**
+ * Log an operation with timestamp
+ * The entry is buffered and written with the next batch, by the flusher
+ * thread when it is running
+ * 
+ * @param message Message to log
+ * @return 0 on success, -1 on failure
+ */
+int log_operation(const char *message) {
+    if (g_log_fd == -1 && init_logging() == -1) {
         return -1;
     }
     
-    // Get file size
-    if (fstat(fd, &st) == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not get log file size: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
+    char log_entry[LOG_ENTRY_SIZE];
+    int entry_len;
+    
+    if (log_format_binary()) {
+        entry_len = encode_binary_entry(log_entry, message);
+    } else {
+        // Get timestamp; the cache makes this cheap for bursts of entries
+        const char *timestamp = cached_timestamp(NULL);
         
-        // Release the lock
-        flock(fd, LOCK_UN);
-        close(fd);
-        return -1;
+        // Format the log entry: [timestamp] message
+        entry_len = string_format(log_entry, TEXT_ENTRY_SIZE, 
+                            "%s %s\n", timestamp ? timestamp : "", message);
     }
     
-    // Check if log file is empty
-    if (st.st_size == 0) {
-        const char *empty_log_msg = "Log file is empty.\n";
-        write(STDOUT_FILENO, empty_log_msg, strlen(empty_log_msg));
+    // Hand the entry to the flusher thread without blocking
+    if (__atomic_load_n(&g_flusher_running, __ATOMIC_ACQUIRE)) {
+        struct log_record *record = malloc(sizeof(*record) + entry_len);
+        if (!record) {
+            write_error("Error: Memory allocation failed\n");
+            return -1;
+        }
+        record->len = entry_len;
+        memcpy(record->text, log_entry, entry_len);
+        log_queue_push(&g_log_queue, &record->node);
         
-        // Release the lock
-        flock(fd, LOCK_UN);
-        close(fd);
+        if (__atomic_add_fetch(&g_log_queued, 1, __ATOMIC_RELAXED) == LOG_QUEUE_WAKE) {
+            sem_post(&g_flusher_wake);
+        }
         return 0;
     }
     
-    // Allocate buffer for file contents
-    char *buffer = (char *)malloc(st.st_size + 1);
-    if (!buffer) {
-        char error_msg[] = "Error: Memory allocation failed\n";
-        write(STDERR_FILENO, error_msg, strlen(error_msg));
-        
-        // Release the lock
-        flock(fd, LOCK_UN);
-        close(fd);
-        return -1;
+    int result = 0;
+    
+    // Make room if the entry doesn't fit in the buffer
+    if (g_log_used + entry_len > LOG_BUFFER_SIZE) {
+        result = write_pending_logs();
     }
     
-    // Read file contents
-    ssize_t bytes_read = read(fd, buffer, st.st_size);
-    if (bytes_read == -1) {
-        char error_msg[256];
-        int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not read log file: %s\n", 
-                          strerror(errno));
-        write(STDERR_FILENO, error_msg, len);
-        
-        // Clean up
-        free(buffer);
-        flock(fd, LOCK_UN);
-        close(fd);
+    if (g_log_used == 0) {
+        g_log_oldest = time(NULL);
+    }
+    
+    // Copy the entry into the ring, wrapping around the end if needed
+    size_t tail = (g_log_head + g_log_used) % LOG_BUFFER_SIZE;
+    size_t first_len = LOG_BUFFER_SIZE - tail;
+    if (first_len >= (size_t)entry_len) {
+        memcpy(g_log_buffer + tail, log_entry, entry_len);
+    } else {
+        memcpy(g_log_buffer + tail, log_entry, first_len);
+        memcpy(g_log_buffer, log_entry + first_len, entry_len - first_len);
+    }
+    g_log_used += entry_len;
+    
+    // Flush on size or age
+    if (g_log_used >= LOG_FLUSH_THRESHOLD || 
+        time(NULL) - g_log_oldest >= LOG_FLUSH_INTERVAL) {
+        if (write_pending_logs() == -1) {
+            result = -1;
+        }
+    }
+    
+    return result;
+}
+
+/**
+ * Write all buffered log entries to the log file
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int flush_logs(void) {
+    if (g_log_fd == -1) {
+        return 0;
+    }
+    
+    // Ask the flusher thread to drain the queue and wait for it
+    if (__atomic_load_n(&g_flusher_running, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&g_flush_mutex);
+        unsigned long ticket = ++g_flush_requested;
+        sem_post(&g_flusher_wake);
+        while (g_flush_completed < ticket) {
+            pthread_cond_wait(&g_flush_cond, &g_flush_mutex);
+        }
+        pthread_mutex_unlock(&g_flush_mutex);
+        return 0;
+    }
+    
+    return write_pending_logs();
+}
+
+/**
+ * Start the flusher thread
+ * From then on log_operation() may be called from any thread; records are
+ * queued lock-free and written in batches by the flusher.
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int start_log_flusher(void) {
+    static int atfork_registered = 0;
+    
+    if (__atomic_load_n(&g_flusher_running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    if (g_log_fd == -1 && init_logging() == -1) {
         return -1;
     }
     
-    // Null-terminate the buffer
-    buffer[bytes_read] = '\0';
+    // Entries buffered so far go out before any queued ones
+    flush_logs();
     
-    // Release the lock
-    if (flock(fd, LOCK_UN) == -1) {
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, reset_flusher_in_child);
+        atfork_registered = 1;
+    }
+    
+    log_queue_init(&g_log_queue);
+    g_log_queued = 0;
+    g_flusher_stop = 0;
+    
+    if (sem_init(&g_flusher_wake, 0, 0) == -1) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not unlock log file: %s\n", 
+                          "Error: Could not start log flusher: %s\n", 
                           strerror(errno));
         write(STDERR_FILENO, error_msg, len);
-        
-        // Clean up
-        free(buffer);
-        close(fd);
         return -1;
     }
     
-    // Close the file
-    if (close(fd) == -1) {
+    int err = pthread_create(&g_flusher_thread, NULL, flusher_main, NULL);
+    if (err != 0) {
         char error_msg[256];
         int len = string_format(error_msg, sizeof(error_msg), 
-                          "Error: Could not close log file: %s\n", 
-                          strerror(errno));
+                          "Error: Could not start log flusher: %s\n", 
+                          strerror(err));
         write(STDERR_FILENO, error_msg, len);
-        free(buffer);
+        sem_destroy(&g_flusher_wake);
         return -1;
     }
     
-    // Display logs header
-    const char *logs_header = "Operation Logs:\n";
-    write(STDOUT_FILENO, logs_header, strlen(logs_header));
+    __atomic_store_n(&g_flusher_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Stop the flusher thread after it has written all queued records
+ * Logging falls back to the single-threaded ring buffer.
+ */
+void stop_log_flusher(void) {
+    if (!__atomic_load_n(&g_flusher_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
     
-    // Display log contents
-    write(STDOUT_FILENO, buffer, bytes_read);
+    __atomic_store_n(&g_flusher_stop, 1, __ATOMIC_RELEASE);
+    sem_post(&g_flusher_wake);
+    pthread_join(g_flusher_thread, NULL);
     
-    // Add a newline if the log doesn't end with one
-    if (bytes_read > 0 && buffer[bytes_read - 1] != '\n') {
-        write(STDOUT_FILENO, "\n", 1);
+    __atomic_store_n(&g_flusher_running, 0, __ATOMIC_RELEASE);
+    sem_destroy(&g_flusher_wake);
+}
+
+/**
+ * Flush buffered log entries and close the log file
+ * Called on the normal exit path: the flusher thread, if running, writes
+ * every queued record and is joined first, and a segment the log was
+ * rotated into is compressed before this returns.
+ */
+void shutdown_logging(void) {
+    if (g_log_fd == -1) {
+        return;
     }
     
-    // Free allocated memory
-    free(buffer);
+    stop_log_flusher();
     
-    return 0;
+    write_pending_logs();
+    finish_log_archives();
+    close(g_log_fd);
+    g_log_fd = -1;
+    
+    if (g_index_fd != -1) {
+        close(g_index_fd);
+        g_index_fd = -1;
+    }
 }
\ No newline at end of file
@@ -1,13 +1,134 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Log file and its sidecar index of checkpoints
+#define LOG_FILE "log.txt"
+#define LOG_INDEX_FILE "log.txt.idx"
+
+// Log file and index used when log_format = binary
+#define LOG_BINARY_FILE "log.bin"
+#define LOG_BINARY_INDEX_FILE "log.bin.idx"
+
+// Marks the start of every binary log record
+#define LOG_RECORD_MAGIC 0x524c4d46u  // "FMLR"
+
+// Operation codes stored in binary log records
+enum log_op {
+    LOG_OP_NONE = 0,
+    LOG_OP_CREATE_DIR,
+    LOG_OP_CREATE_FILE,
+    LOG_OP_LIST_DIR,
+    LOG_OP_LIST_BY_EXTENSION,
+    LOG_OP_READ_FILE,
+    LOG_OP_APPEND_TO_FILE,
+    LOG_OP_DELETE_FILE,
+    LOG_OP_DELETE_DIR,
+    LOG_OP_SHOW_LOGS,
+    LOG_OP_COUNT
+};
+
+// Fixed-size header of a binary log record
+// Followed by path_len bytes of path, message_len bytes of message, and
+// a uint32_t copy of length so the log can also be walked backwards.
+struct log_record_header {
+    uint32_t magic;
+    uint32_t length;       // Whole record, header and trailer included
+    int64_t mono_ns;       // CLOCK_MONOTONIC time
+    int64_t wall_sec;      // CLOCK_REALTIME time
+    int32_t wall_nsec;
+    uint16_t op;           // enum log_op
+    int16_t result;        // 0 on success, -1 for errors
+    uint32_t pid;
+    uint16_t path_len;
+    uint16_t message_len;
+};
+
+// Longest path and message kept in a binary record
+#define LOG_RECORD_MAX_PATH 1024
+#define LOG_RECORD_MAX_MESSAGE 1024
+
+// Smallest and largest binary record
+#define LOG_RECORD_MIN_SIZE (sizeof(struct log_record_header) + sizeof(uint32_t))
+#define LOG_RECORD_MAX_SIZE (LOG_RECORD_MIN_SIZE + LOG_RECORD_MAX_PATH + LOG_RECORD_MAX_MESSAGE)
+
+// Index record: entries before offset were all written by time
+struct log_checkpoint {
+    int64_t time;
+    int64_t offset;
+};
+
+// Archived log segment: log.txt.N, or log.txt.N.gz once compressed
+struct log_segment {
+    long seq;
+    int compressed;
+};
+
+// Filters for show_logs_query()
+struct log_query {
+    long last;          // Only the last N lines, or -1 for all lines
+    const char *since;  // Only entries at or after this timestamp, or NULL
+    const char *grep;   // Only lines containing this text, or NULL
+    int json;           // Print entries as JSON objects instead of text
+};
+
 // Initialize the logging system
 int init_logging(void);
 
 // Log an operation with timestamp
 int log_operation(const char *message);
 
+// Set the operation recorded with this thread's following log entries
+void log_set_operation(const char *command);
+
+// Get the command name of an operation code
+const char *log_operation_name(int op);
+
+// Get the directory holding the log and its segments, fixed when logging starts
+int log_directory(void);
+
+// Check whether the log is written in the binary format
+int log_format_binary(void);
+
+// Current log file and index names for the configured format, relative
+// to log_directory()
+const char *log_file_name(void);
+const char *log_index_name(void);
+
+// Write all buffered log entries to the log file
+int flush_logs(void);
+
+// Start a background thread that writes queued entries, making
+// log_operation() safe to call from multiple threads
+int start_log_flusher(void);
+
+// Stop the background thread after it has written everything
+void stop_log_flusher(void);
+
+// Flush buffered log entries and close the log file
+void shutdown_logging(void);
+
+// Find the archived log segments, oldest first
+int list_log_segments(struct log_segment **segments, int *count);
+
+// Build the file name of an archived segment
+void log_segment_name(char *buffer, size_t size, long seq, const char *suffix);
+
+// Get the configured rotation limits (0 means no limit)
+void log_rotation_limits(long *max_size, long *max_age);
+
+// Move the current log aside as an archived segment; log lock must be held
+int rotate_log_segment(void);
+
+// Wait until segments queued for compression are compressed
+void finish_log_archives(void);
+
 // Display all logs
 int show_logs(void);
 
+// Display the logs selected by a query
+int show_logs_query(const struct log_query *query);
+
 #endif // LOGGING_H
\ No newline at end of file
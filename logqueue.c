@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include "logqueue.h"
+
+#include <stdlib.h>
+
+/**
+ * Initialize an empty queue
+ * 
+ * @param queue Queue to initialize
+ */
+void log_queue_init(struct log_queue *queue) {
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+/**
+ * Push a node onto the queue
+ * Producers only contend on a single atomic exchange, never on a lock.
+ * 
+ * @param queue Queue to push onto
+ * @param node Node to push
+ */
+void log_queue_push(struct log_queue *queue, struct log_node *node) {
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    
+    // Claim the head, then link the previous head to the new node
+    struct log_node *prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/**
+ * Pop the oldest node from the queue
+ * A NULL result can also mean a producer is between its exchange and its
+ * link; the node becomes visible on a later call.
+ * 
+ * @param queue Queue to pop from
+ * @return Oldest node, or NULL if none is ready
+ */
+struct log_node *log_queue_pop(struct log_queue *queue) {
+    struct log_node *tail = queue->tail;
+    struct log_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    
+    // Step over the stub node
+    if (tail == &queue->stub) {
+        if (!next) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+    
+    // The tail is the last node unless a push is still in progress
+    struct log_node *head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail != head) {
+        return NULL;
+    }
+    
+    // Re-insert the stub so the last real node can be detached
+    log_queue_push(queue, &queue->stub);
+    
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+    
+    return NULL;
+}
+
+/**
+ * Check whether the queue is empty with no push in progress
+ * 
+ * @param queue Queue to check
+ * @return 1 if empty, 0 otherwise
+ */
+int log_queue_empty(struct log_queue *queue) {
+    return queue->tail == &queue->stub && 
+           __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == &queue->stub;
+}
@@ -0,0 +1,30 @@
+#ifndef LOGQUEUE_H
+#define LOGQUEUE_H
+
+#include <stddef.h>
+
+// Intrusive queue link, embedded as the first member of each record
+struct log_node {
+    struct log_node *next;
+};
+
+// Lock-free multi-producer, single-consumer queue
+struct log_queue {
+    struct log_node *head;  // Most recently pushed node (producers)
+    struct log_node *tail;  // Next node to pop (consumer only)
+    struct log_node stub;   // Placeholder so the queue is never empty
+};
+
+// Initialize an empty queue
+void log_queue_init(struct log_queue *queue);
+
+// Push a node; safe to call from any number of threads concurrently
+void log_queue_push(struct log_queue *queue, struct log_node *node);
+
+// Pop the oldest node, or NULL if none is ready; single consumer only
+struct log_node *log_queue_pop(struct log_queue *queue);
+
+// Check whether the queue is empty with no push in progress
+int log_queue_empty(struct log_queue *queue);
+
+#endif // LOGQUEUE_H
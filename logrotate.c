@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include "logging.h"
+#include "config.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <zlib.h>
+
+// Default rotation settings
+#define DEFAULT_LOG_MAX_SIZE (64L * 1024 * 1024)
+#define DEFAULT_LOG_MAX_AGE 0
+#define DEFAULT_LOG_RETAIN 8
+
+// Bytes compressed per read
+#define COMPRESS_CHUNK_SIZE 65536
+
+// Segments waiting to be compressed; more than this are left plain
+#define ARCHIVE_QUEUE_SIZE 16
+
+// Archiver thread state, guarded by g_archive_mutex
+static pthread_mutex_t g_archive_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_archive_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t g_archiver_thread;
+static long g_archive_queue[ARCHIVE_QUEUE_SIZE];
+static int g_archive_count = 0;
+static int g_archiver_running = 0;
+static int g_archiver_stop = 0;
+
+/**
+ * Build the file name of an archived segment
+ * 
+ * @param buffer Buffer to store the name
+ * @param size Size of the buffer
+ * @param seq Segment sequence number
+ * @param suffix Suffix after the number, e.g. "", ".gz" or ".idx"
+ */
+void log_segment_name(char *buffer, size_t size, long seq, const char *suffix) {
+    string_format(buffer, size, "%s.%ld%s", log_file_name(), seq, suffix);
+}
+
+/**
+ * Compare two segments by sequence number, for qsort()
+ */
+static int compare_segments(const void *a, const void *b) {
+    long seq_a = ((const struct log_segment *)a)->seq;
+    long seq_b = ((const struct log_segment *)b)->seq;
+    return (seq_a > seq_b) - (seq_a < seq_b);
+}
+
+/**
+ * Find the archived log segments, oldest first
+ * Archived segments are named log.txt.N (being compressed) or log.txt.N.gz,
+ * and live in log_directory().
+ * 
+ * @param segments Set to a malloc'd array of segments; free() it when done
+ * @param count Set to the number of segments
+ * @return 0 on success, -1 on failure
+ */
+int list_log_segments(struct log_segment **segments, int *count) {
+    *segments = NULL;
+    *count = 0;
+    
+    int dir_fd = openat(log_directory(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (dir_fd == -1) ? NULL : fdopendir(dir_fd);
+    if (!dir) {
+        if (dir_fd != -1) {
+            close(dir_fd);
+        }
+        return -1;
+    }
+    
+    int capacity = 0;
+    const char *prefix = log_file_name();
+    size_t prefix_len = strlen(prefix);
+    struct dirent *entry;
+    
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strncmp(name, prefix, prefix_len) != 0 || name[prefix_len] != '.') {
+            continue;
+        }
+        
+        // Parse "N" or "N.gz" after the prefix
+        const char *p = name + prefix_len + 1;
+        long seq = 0;
+        int digits = 0;
+        while (*p >= '0' && *p <= '9' && digits < 18) {
+            seq = seq * 10 + (*p - '0');
+            p++;
+            digits++;
+        }
+        
+        int compressed;
+        if (digits == 0) {
+            continue;
+        } else if (*p == '\0') {
+            compressed = 0;
+        } else if (strcmp(p, ".gz") == 0) {
+            compressed = 1;
+        } else {
+            continue;
+        }
+        
+        // A segment caught between compression steps is listed once
+        int duplicate = 0;
+        for (int i = 0; i < *count; i++) {
+            if ((*segments)[i].seq == seq) {
+                (*segments)[i].compressed = 0;
+                duplicate = 1;
+                break;
+            }
+        }
+        if (duplicate) {
+            continue;
+        }
+        
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            struct log_segment *grown = realloc(*segments, capacity * sizeof(**segments));
+            if (!grown) {
+                free(*segments);
+                *segments = NULL;
+                *count = 0;
+                closedir(dir);
+                return -1;
+            }
+            *segments = grown;
+        }
+        
+        (*segments)[*count].seq = seq;
+        (*segments)[*count].compressed = compressed;
+        (*count)++;
+    }
+    
+    closedir(dir);
+    
+    if (*count > 1) {
+        qsort(*segments, *count, sizeof(**segments), compare_segments);
+    }
+    
+    return 0;
+}
+
+/**
+ * Get the configured rotation limits
+ * 
+ * @param max_size Set to the maximum log size in bytes, 0 for no limit
+ * @param max_age Set to the maximum log age in seconds, 0 for no limit
+ */
+void log_rotation_limits(long *max_size, long *max_age) {
+    *max_size = config_get_number("log_max_size", DEFAULT_LOG_MAX_SIZE);
+    *max_age = config_get_number("log_max_age", DEFAULT_LOG_MAX_AGE);
+}
+
+/**
+ * Compress an archived segment to log.txt.N.gz
+ * 
+ * @param seq Segment sequence number
+ * @return 0 on success, -1 on failure
+ */
+static int compress_segment(long seq) {
+    char plain[64], compressed[64], temp[64];
+    log_segment_name(plain, sizeof(plain), seq, "");
+    log_segment_name(compressed, sizeof(compressed), seq, ".gz");
+    log_segment_name(temp, sizeof(temp), seq, ".gz.tmp");
+    
+    int dir_fd = log_directory();
+    int fd = openat(dir_fd, plain, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    int temp_fd = openat(dir_fd, temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    gzFile gz = (temp_fd == -1) ? NULL : gzdopen(temp_fd, "wb6");
+    if (!gz) {
+        if (temp_fd != -1) {
+            close(temp_fd);
+            unlinkat(dir_fd, temp, 0);
+        }
+        close(fd);
+        return -1;
+    }
+    
+    char buffer[COMPRESS_CHUNK_SIZE];
+    int result = 0;
+    while (1) {
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            result = (bytes_read == 0) ? 0 : -1;
+            break;
+        }
+        if (gzwrite(gz, buffer, bytes_read) != bytes_read) {
+            result = -1;
+            break;
+        }
+    }
+    
+    close(fd);
+    if (gzclose(gz) != Z_OK) {
+        result = -1;
+    }
+    
+    // Swap in the compressed copy, or keep the plain one
+    if (result == 0 && renameat(dir_fd, temp, dir_fd, compressed) == 0) {
+        unlinkat(dir_fd, plain, 0);
+    } else {
+        unlinkat(dir_fd, temp, 0);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Remove the oldest archived segments beyond the retention limit
+ */
+static void prune_segments(void) {
+    long retain = config_get_number("log_retain", DEFAULT_LOG_RETAIN);
+    
+    struct log_segment *segments;
+    int count;
+    if (list_log_segments(&segments, &count) == -1) {
+        return;
+    }
+    
+    for (int i = 0; i < count - retain; i++) {
+        char name[64];
+        log_segment_name(name, sizeof(name), segments[i].seq, ".gz");
+        unlinkat(log_directory(), name, 0);
+        log_segment_name(name, sizeof(name), segments[i].seq, "");
+        unlinkat(log_directory(), name, 0);
+    }
+    
+    free(segments);
+}
+
+/**
+ * Forget the archiver thread in a forked child, which doesn't inherit it
+ * Segments the parent queued are left to the parent.
+ */
+static void reset_archiver_in_child(void) {
+    pthread_mutex_init(&g_archive_mutex, NULL);
+    pthread_cond_init(&g_archive_wake, NULL);
+    g_archive_count = 0;
+    g_archiver_running = 0;
+    g_archiver_stop = 0;
+}
+
+/**
+ * Archiver thread: compresses queued segments and prunes old ones
+ * Runs until finish_log_archives() asks it to stop and the queue is empty.
+ * 
+ * @param arg Unused
+ * @return NULL
+ */
+static void *archiver_main(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_archive_mutex);
+    while (1) {
+        while (g_archive_count == 0 && !g_archiver_stop) {
+            pthread_cond_wait(&g_archive_wake, &g_archive_mutex);
+        }
+        if (g_archive_count == 0) {
+            break;
+        }
+        
+        long seq = g_archive_queue[0];
+        g_archive_count--;
+        memmove(g_archive_queue, g_archive_queue + 1, g_archive_count * sizeof(*g_archive_queue));
+        pthread_mutex_unlock(&g_archive_mutex);
+        
+        compress_segment(seq);
+        prune_segments();
+        
+        pthread_mutex_lock(&g_archive_mutex);
+    }
+    pthread_mutex_unlock(&g_archive_mutex);
+    
+    return NULL;
+}
+
+/**
+ * Hand a segment to the archiver thread to compress, pruning old ones after
+ * Only a queue entry is added here, so the log lock held by the caller is
+ * not kept during compression. The thread is started on first use; if the
+ * queue is full or the thread can't start, the segment stays plain, which
+ * readers handle the same.
+ * 
+ * @param seq Segment sequence number
+ */
+static void archive_segment_async(long seq) {
+    static int atfork_registered = 0;
+    
+    pthread_mutex_lock(&g_archive_mutex);
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, reset_archiver_in_child);
+        atfork_registered = 1;
+    }
+    if (!g_archiver_running) {
+        g_archiver_stop = 0;
+        g_archiver_running = (pthread_create(&g_archiver_thread, NULL, archiver_main, NULL) == 0);
+    }
+    if (g_archiver_running && g_archive_count < ARCHIVE_QUEUE_SIZE) {
+        g_archive_queue[g_archive_count++] = seq;
+        pthread_cond_signal(&g_archive_wake);
+    }
+    pthread_mutex_unlock(&g_archive_mutex);
+}
+
+/**
+ * Wait for the archiver thread to compress every queued segment
+ * Called on the way out, so a short-lived process that rotated the log
+ * still leaves its segment compressed and the old ones pruned.
+ */
+void finish_log_archives(void) {
+    pthread_mutex_lock(&g_archive_mutex);
+    int running = g_archiver_running;
+    g_archiver_stop = 1;
+    pthread_cond_signal(&g_archive_wake);
+    pthread_mutex_unlock(&g_archive_mutex);
+    
+    if (running) {
+        pthread_join(g_archiver_thread, NULL);
+        pthread_mutex_lock(&g_archive_mutex);
+        g_archiver_running = 0;
+        pthread_mutex_unlock(&g_archive_mutex);
+    }
+}
+
+/**
+ * Move the current log and its index aside as the next archived segment
+ * Must be called with the log lock held. The caller then opens a fresh
+ * log file.
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int rotate_log_segment(void) {
+    struct log_segment *segments;
+    int count;
+    if (list_log_segments(&segments, &count) == -1) {
+        return -1;
+    }
+    
+    long seq = (count > 0) ? segments[count - 1].seq + 1 : 1;
+    free(segments);
+    
+    char name[64];
+    log_segment_name(name, sizeof(name), seq, "");
+    if (renameat(log_directory(), log_file_name(), log_directory(), name) == -1) {
+        return -1;
+    }
+    
+    // Archived segments are read sequentially, so their index is dropped
+    unlinkat(log_directory(), log_index_name(), 0);
+    
+    archive_segment_async(seq);
+    return 0;
+}
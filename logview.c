@@ -0,0 +1,1092 @@
+#define _GNU_SOURCE
+#include "logging.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+
+// Bytes read per chunk when scanning or streaming the log
+#define LOG_CHUNK_SIZE 65536
+
+// Length of a "[YYYY-MM-DD HH:MM:SS]" timestamp
+#define TIMESTAMP_LEN 21
+
+// Entries may reach a segment this many seconds after they were stamped
+#define SEGMENT_SKEW 5
+
+// Worst-case size of one entry printed as JSON
+#define JSON_ENTRY_SIZE (6 * (LOG_RECORD_MAX_PATH + LOG_RECORD_MAX_MESSAGE) + 256)
+
+// Parsed query state shared by the streaming helpers
+struct log_filter {
+    char since[TIMESTAMP_LEN + 1];  // Timestamp in log format, or empty
+    time_t since_time;              // The same time, for binary records
+    const char *grep;               // Substring to match, or NULL
+    size_t grep_len;
+    long skip_lines;                // Lines to drop before filtering
+    long matched;                   // Number of lines written
+    char last_char;                 // Last byte written
+    int json;                       // Write entries as JSON objects
+    time_t cached_sec;              // Second formatted in cached_time
+    char cached_time[TIMESTAMP_LEN + 1];
+    char out[LOG_CHUNK_SIZE];       // Pending output
+    size_t out_len;
+};
+
+// A log segment opened for reading, plain or compressed
+struct log_source {
+    int fd;      // Plain file, or -1
+    gzFile gz;   // Compressed file, or NULL
+    off_t pos;   // Plain files: next byte to read
+    off_t end;   // Plain files: end of the snapshot being read
+};
+
+// A point in the log: a segment plus an offset or a number of lines
+struct log_position {
+    int segment;       // Index into the segment list; the current log is last
+    off_t offset;      // Byte offset, current log only
+    long skip_lines;   // Lines to skip, archived segments only
+};
+
+/**
+ * Parse a fixed number of digits
+ * 
+ * @param text Text to parse
+ * @param digits Number of digits expected
+ * @param value Set to the parsed value
+ * @return 0 on success, -1 if a character is not a digit
+ */
+static int parse_digits(const char *text, int digits, int *value) {
+    *value = 0;
+    for (int i = 0; i < digits; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return -1;
+        }
+        *value = *value * 10 + (text[i] - '0');
+    }
+    return 0;
+}
+
+/**
+ * Parse a --since timestamp
+ * Accepts "YYYY-MM-DD", "YYYY-MM-DD HH:MM:SS" or "YYYY-MM-DDTHH:MM:SS",
+ * optionally inside brackets as printed in the log.
+ * 
+ * @param text Timestamp to parse
+ * @param when Set to the timestamp as local time
+ * @param formatted Set to the timestamp in log format
+ * @return 0 on success, -1 if the timestamp is invalid
+ */
+static int parse_since(const char *text, time_t *when, char formatted[TIMESTAMP_LEN + 1]) {
+    if (*text == '[') {
+        text++;
+    }
+    
+    size_t len = strlen(text);
+    if (len > 0 && text[len - 1] == ']') {
+        len--;
+    }
+    
+    struct tm tm_info;
+    memset(&tm_info, 0, sizeof(tm_info));
+    
+    int year, month, day;
+    if (len < 10 || text[4] != '-' || text[7] != '-' ||
+        parse_digits(text, 4, &year) == -1 ||
+        parse_digits(text + 5, 2, &month) == -1 ||
+        parse_digits(text + 8, 2, &day) == -1) {
+        return -1;
+    }
+    
+    if (len > 10) {
+        if (len != 19 || (text[10] != ' ' && text[10] != 'T') ||
+            text[13] != ':' || text[16] != ':' ||
+            parse_digits(text + 11, 2, &tm_info.tm_hour) == -1 ||
+            parse_digits(text + 14, 2, &tm_info.tm_min) == -1 ||
+            parse_digits(text + 17, 2, &tm_info.tm_sec) == -1) {
+            return -1;
+        }
+    }
+    
+    tm_info.tm_year = year - 1900;
+    tm_info.tm_mon = month - 1;
+    tm_info.tm_mday = day;
+    tm_info.tm_isdst = -1;
+    
+    *when = mktime(&tm_info);
+    if (*when == (time_t)-1) {
+        return -1;
+    }
+    
+    // mktime() normalized the fields, so this is a valid log timestamp
+    if (strftime(formatted, TIMESTAMP_LEN + 1, "[%Y-%m-%d %H:%M:%S]", &tm_info) == 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Find where entries at or after a time can start, using the index
+ * Binary search for the newest checkpoint written before the time.
+ * 
+ * @param when Time to search for
+ * @param end Size of the log snapshot being read
+ * @return Offset to start reading from
+ */
+static off_t find_since_offset(time_t when, off_t end) {
+    int fd = openat(log_directory(), log_index_name(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 0;
+    }
+    
+    off_t low = 0;
+    off_t high = st.st_size / sizeof(struct log_checkpoint);
+    off_t offset = 0;
+    
+    while (low < high) {
+        off_t mid = low + (high - low) / 2;
+        struct log_checkpoint checkpoint;
+        if (pread(fd, &checkpoint, sizeof(checkpoint),
+                  mid * sizeof(checkpoint)) != sizeof(checkpoint)) {
+            break;
+        }
+        
+        if (checkpoint.time < when) {
+            if (checkpoint.offset <= end) {
+                offset = checkpoint.offset;
+            }
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    
+    close(fd);
+    return offset;
+}
+
+/**
+ * Open an archived segment for reading
+ * If the segment was compressed or pruned since it was listed, the other
+ * form is tried.
+ * 
+ * @param segment Segment to open
+ * @param source Set to the opened source
+ * @return 0 on success, -1 if the segment no longer exists
+ */
+static int open_segment(const struct log_segment *segment, struct log_source *source) {
+    char name[64];
+    source->fd = -1;
+    source->gz = NULL;
+    source->pos = 0;
+    source->end = 0;
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int compressed = segment->compressed ^ attempt;
+        log_segment_name(name, sizeof(name), segment->seq, compressed ? ".gz" : "");
+        
+        int fd = openat(log_directory(), name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        
+        if (compressed) {
+            source->gz = gzdopen(fd, "rb");
+            if (!source->gz) {
+                close(fd);
+                continue;
+            }
+            gzbuffer(source->gz, LOG_CHUNK_SIZE);
+            return 0;
+        }
+        
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            continue;
+        }
+        source->fd = fd;
+        source->end = st.st_size;
+        return 0;
+    }
+    
+    return -1;
+}
+
+/**
+ * Close a source opened by open_segment()
+ * 
+ * @param source Source to close
+ */
+static void close_segment(struct log_source *source) {
+    if (source->gz) {
+        gzclose(source->gz);
+    } else if (source->fd != -1) {
+        close(source->fd);
+    }
+}
+
+/**
+ * Read the next bytes of a source
+ * 
+ * @param source Source to read from
+ * @param buffer Buffer to fill
+ * @param len Maximum number of bytes
+ * @return Bytes read, 0 at the end, -1 on failure
+ */
+static ssize_t read_source(struct log_source *source, char *buffer, size_t len) {
+    if (source->gz) {
+        int bytes_read = gzread(source->gz, buffer, len);
+        return (bytes_read < 0) ? -1 : bytes_read;
+    }
+    
+    if ((off_t)len > source->end - source->pos) {
+        len = source->end - source->pos;
+    }
+    
+    while (len > 0) {
+        ssize_t bytes_read = pread(source->fd, buffer, len, source->pos);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read > 0) {
+            source->pos += bytes_read;
+        }
+        return bytes_read;
+    }
+    
+    return 0;
+}
+
+/**
+ * Format a time the way text log entries are stamped
+ * 
+ * @param when Time to format
+ * @param timestamp Set to "[YYYY-MM-DD HH:MM:SS]", or an empty string
+ */
+static void format_log_time(time_t when, char timestamp[TIMESTAMP_LEN + 1]) {
+    struct tm tm_info;
+    if (!localtime_r(&when, &tm_info) || 
+        strftime(timestamp, TIMESTAMP_LEN + 1, "[%Y-%m-%d %H:%M:%S]", &tm_info) == 0) {
+        timestamp[0] = '\0';
+    }
+}
+
+/**
+ * Check that a binary record header is consistent
+ * 
+ * @param header Header to check
+ * @return 1 if the header can start a record, 0 otherwise
+ */
+static int record_header_valid(const struct log_record_header *header) {
+    return header->magic == LOG_RECORD_MAGIC && 
+           header->path_len <= LOG_RECORD_MAX_PATH && 
+           header->message_len <= LOG_RECORD_MAX_MESSAGE && 
+           header->length == LOG_RECORD_MIN_SIZE + header->path_len + header->message_len;
+}
+
+/**
+ * Read the timestamp that starts a source
+ * 
+ * @param source Source positioned at its start
+ * @param timestamp Set to the timestamp, or an empty string
+ */
+static void read_first_timestamp(struct log_source *source, char timestamp[TIMESTAMP_LEN + 1]) {
+    if (log_format_binary()) {
+        struct log_record_header header;
+        if (read_source(source, (char *)&header, sizeof(header)) == sizeof(header) && 
+            record_header_valid(&header)) {
+            format_log_time(header.wall_sec, timestamp);
+        } else {
+            timestamp[0] = '\0';
+        }
+        return;
+    }
+    
+    ssize_t bytes_read = read_source(source, timestamp, TIMESTAMP_LEN);
+    timestamp[(bytes_read == TIMESTAMP_LEN) ? TIMESTAMP_LEN : 0] = '\0';
+}
+
+/**
+ * Count the lines in a source
+ * 
+ * @param source Source to count
+ * @return Number of lines, counting an unterminated last line
+ */
+static long count_source_lines(struct log_source *source) {
+    char buffer[LOG_CHUNK_SIZE];
+    long lines = 0;
+    char last_char = '\n';
+    ssize_t bytes_read;
+    
+    while ((bytes_read = read_source(source, buffer, sizeof(buffer))) > 0) {
+        for (const char *p = buffer; (p = memchr(p, '\n', buffer + bytes_read - p)) != NULL; p++) {
+            lines++;
+        }
+        last_char = buffer[bytes_read - 1];
+    }
+    
+    return lines + (last_char != '\n');
+}
+
+/**
+ * Find where the last lines of the current log start
+ * Scans backwards from the end one chunk at a time.
+ * 
+ * @param fd Log file descriptor
+ * @param end Size of the log snapshot being read
+ * @param lines Number of lines wanted
+ * @param found Set to the number of lines between the result and the end
+ * @return Offset of the first of the last lines
+ */
+static off_t find_last_offset(int fd, off_t end, long lines, long *found) {
+    char buffer[LOG_CHUNK_SIZE];
+    off_t pos = end;
+    int skip_trailing = 1;
+    
+    *found = 0;
+    
+    while (pos > 0) {
+        size_t chunk = (pos < LOG_CHUNK_SIZE) ? (size_t)pos : LOG_CHUNK_SIZE;
+        ssize_t bytes_read = pread(fd, buffer, chunk, pos - chunk);
+        if (bytes_read != (ssize_t)chunk) {
+            return 0;
+        }
+        
+        for (ssize_t i = bytes_read - 1; i >= 0; i--) {
+            if (buffer[i] != '\n') {
+                skip_trailing = 0;
+                continue;
+            }
+            
+            // A trailing newline ends the last line rather than starting a new one
+            if (skip_trailing) {
+                skip_trailing = 0;
+                continue;
+            }
+            
+            if (++(*found) == lines) {
+                return pos - chunk + i + 1;
+            }
+        }
+        
+        pos -= chunk;
+    }
+    
+    // Reached the start: the first line counts too
+    if (end > 0) {
+        (*found)++;
+    }
+    return 0;
+}
+
+/**
+ * Find where the last records of the current binary log start
+ * Walks backwards from the end using the length trailer of each record.
+ * 
+ * @param fd Log file descriptor
+ * @param end Size of the log snapshot being read
+ * @param records Number of records wanted
+ * @param found Set to the number of records between the result and the end
+ * @return Offset of the first of the last records
+ */
+static off_t find_last_record(int fd, off_t end, long records, long *found) {
+    char buffer[LOG_CHUNK_SIZE];
+    off_t chunk_start = end;  // buffer holds the bytes from here up to pos
+    off_t pos = end;
+    
+    *found = 0;
+    
+    while (pos > 0 && *found < records) {
+        // Keep at least one whole record of the log before pos in the buffer
+        if (chunk_start > 0 && pos - chunk_start < (off_t)LOG_RECORD_MAX_SIZE) {
+            chunk_start = (pos > LOG_CHUNK_SIZE) ? pos - LOG_CHUNK_SIZE : 0;
+            if (pread(fd, buffer, pos - chunk_start, chunk_start) != pos - chunk_start) {
+                return 0;
+            }
+        }
+        
+        uint32_t length;
+        struct log_record_header header;
+        if (pos - chunk_start < (off_t)LOG_RECORD_MIN_SIZE) {
+            return 0;
+        }
+        memcpy(&length, buffer + (pos - chunk_start) - sizeof(length), sizeof(length));
+        if (length < LOG_RECORD_MIN_SIZE || length > pos - chunk_start) {
+            return 0;
+        }
+        memcpy(&header, buffer + (pos - chunk_start) - length, sizeof(header));
+        if (!record_header_valid(&header) || header.length != length) {
+            return 0;  // Damaged; read the whole log and resynchronize instead
+        }
+        
+        pos -= length;
+        (*found)++;
+    }
+    
+    return pos;
+}
+
+/**
+ * Write the pending filter output to standard output
+ * 
+ * @param filter Filter holding the output
+ */
+static void flush_filter_output(struct log_filter *filter) {
+    if (filter->out_len > 0) {
+        out_write(filter->out, filter->out_len);
+        filter->out_len = 0;
+    }
+}
+
+/**
+ * Add one selected entry to the filter output
+ * 
+ * @param filter Active filter
+ * @param entry Formatted entry
+ * @param len Length of the entry
+ */
+static void emit_entry(struct log_filter *filter, const char *entry, size_t len) {
+    if (filter->out_len + len > sizeof(filter->out)) {
+        flush_filter_output(filter);
+    }
+    if (len > sizeof(filter->out)) {
+        out_write(entry, len);
+    } else {
+        memcpy(filter->out + filter->out_len, entry, len);
+        filter->out_len += len;
+    }
+    
+    filter->matched++;
+    filter->last_char = entry[len - 1];
+}
+
+/**
+ * Copy bytes to an output position
+ * 
+ * @param out Output position
+ * @param data Bytes to copy
+ * @param len Number of bytes
+ * @return Position after the copied bytes
+ */
+static char *append_bytes(char *out, const char *data, size_t len) {
+    memcpy(out, data, len);
+    return out + len;
+}
+
+/**
+ * Copy a string to an output position
+ * 
+ * @param out Output position
+ * @param text String to copy
+ * @return Position after the copied string
+ */
+static char *append_text(char *out, const char *text) {
+    return append_bytes(out, text, strlen(text));
+}
+
+/**
+ * Copy bytes to an output position as the inside of a JSON string
+ * Needs room for up to 6 output bytes per input byte.
+ * 
+ * @param out Output position
+ * @param data Bytes to escape
+ * @param len Number of bytes
+ * @return Position after the escaped bytes
+ */
+static char *append_json_string(char *out, const char *data, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = c;
+        } else if (c == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        } else if (c == '\t') {
+            *out++ = '\\';
+            *out++ = 't';
+        } else if (c < 0x20) {
+            out = append_text(out, "\\u00");
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xf];
+        } else {
+            *out++ = c;
+        }
+    }
+    return out;
+}
+
+/**
+ * Write one log line if it passes the filter
+ * 
+ * @param filter Active filter
+ * @param line Line, including its newline if it has one
+ * @param len Length of the line
+ */
+static void filter_line(struct log_filter *filter, const char *line, size_t len) {
+    if (filter->skip_lines > 0) {
+        filter->skip_lines--;
+        return;
+    }
+    
+    // Timestamps sort the same as text, so no conversion is needed
+    if (filter->since[0] != '\0' && 
+        (len < TIMESTAMP_LEN || memcmp(line, filter->since, TIMESTAMP_LEN) < 0)) {
+        return;
+    }
+    
+    if (filter->grep && !memmem(line, len, filter->grep, filter->grep_len)) {
+        return;
+    }
+    
+    if (filter->json) {
+        // Split "[timestamp] message" into its fields
+        const char *message = line;
+        size_t message_len = len;
+        char time_text[TIMESTAMP_LEN];
+        size_t time_len = 0;
+        
+        if (len > TIMESTAMP_LEN && line[0] == '[' && line[TIMESTAMP_LEN - 1] == ']') {
+            time_len = TIMESTAMP_LEN - 2;
+            memcpy(time_text, line + 1, time_len);
+            message = line + TIMESTAMP_LEN + (line[TIMESTAMP_LEN] == ' ');
+            message_len = len - (message - line);
+        }
+        if (message_len > 0 && message[message_len - 1] == '\n') {
+            message_len--;
+        }
+        
+        char *entry = malloc(6 * message_len + 64);
+        if (!entry) {
+            return;
+        }
+        char *p = entry;
+        p = append_text(p, "{\"time\":\"");
+        p = append_json_string(p, time_text, time_len);
+        p = append_text(p, "\",\"message\":\"");
+        p = append_json_string(p, message, message_len);
+        p = append_text(p, "\"}\n");
+        emit_entry(filter, entry, p - entry);
+        free(entry);
+        return;
+    }
+    
+    emit_entry(filter, line, len);
+}
+
+/**
+ * Write one binary record if it passes the filter
+ * The record is only formatted after it has been selected.
+ * 
+ * @param filter Active filter
+ * @param header Record header
+ * @param body Path and message following the header
+ */
+static void filter_record(struct log_filter *filter, const struct log_record_header *header, 
+                          const char *body) {
+    if (filter->skip_lines > 0) {
+        filter->skip_lines--;
+        return;
+    }
+    
+    if (filter->since[0] != '\0' && header->wall_sec < filter->since_time) {
+        return;
+    }
+    
+    const char *path = body;
+    const char *message = body + header->path_len;
+    if (filter->grep && !memmem(message, header->message_len, filter->grep, filter->grep_len)) {
+        return;
+    }
+    
+    // Records arrive in time order, so one formatted second serves many
+    if (header->wall_sec != filter->cached_sec || filter->cached_time[0] == '\0') {
+        filter->cached_sec = header->wall_sec;
+        format_log_time(header->wall_sec, filter->cached_time);
+    }
+    
+    char entry[JSON_ENTRY_SIZE];
+    char *p = entry;
+    
+    if (!filter->json) {
+        p = append_bytes(p, filter->cached_time, strlen(filter->cached_time));
+        p = append_text(p, " ");
+        p = append_bytes(p, message, header->message_len);
+        p = append_text(p, "\n");
+        emit_entry(filter, entry, p - entry);
+        return;
+    }
+    
+    char number[32];
+    const char *time_text = filter->cached_time[0] ? filter->cached_time + 1 : "";
+    size_t time_len = filter->cached_time[0] ? TIMESTAMP_LEN - 2 : 0;
+    
+    p = append_text(p, "{\"time\":\"");
+    p = append_json_string(p, time_text, time_len);
+    string_format(number, sizeof(number), "\",\"ts\":%ld", (long)header->wall_sec);
+    p = append_text(p, number);
+    string_format(number, sizeof(number), ",\"nsec\":%d", header->wall_nsec);
+    p = append_text(p, number);
+    string_format(number, sizeof(number), ",\"mono_ns\":%ld", (long)header->mono_ns);
+    p = append_text(p, number);
+    p = append_text(p, ",\"op\":\"");
+    p = append_text(p, log_operation_name(header->op));
+    string_format(number, sizeof(number), "\",\"result\":%d", header->result);
+    p = append_text(p, number);
+    string_format(number, sizeof(number), ",\"pid\":%ld", (long)header->pid);
+    p = append_text(p, number);
+    p = append_text(p, ",\"path\":\"");
+    p = append_json_string(p, path, header->path_len);
+    p = append_text(p, "\",\"message\":\"");
+    p = append_json_string(p, message, header->message_len);
+    p = append_text(p, "\"}\n");
+    emit_entry(filter, entry, p - entry);
+}
+
+/**
+ * Stream the rest of a source through the filter
+ * 
+ * @param source Source to read
+ * @param filter Active filter
+ * @return 0 on success, -1 on read failure
+ */
+static int stream_source(struct log_source *source, struct log_filter *filter) {
+    char buffer[LOG_CHUNK_SIZE];
+    size_t carry = 0;  // Bytes of an unfinished line at the start of buffer
+    
+    while (1) {
+        ssize_t bytes_read = read_source(source, buffer + carry, sizeof(buffer) - carry);
+        if (bytes_read == -1) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        
+        size_t filled = carry + bytes_read;
+        size_t line_start = 0;
+        char *newline;
+        
+        while ((newline = memchr(buffer + line_start, '\n', filled - line_start)) != NULL) {
+            size_t line_end = newline - buffer + 1;
+            filter_line(filter, buffer + line_start, line_end - line_start);
+            line_start = line_end;
+        }
+        
+        // Keep the unfinished line; a line longer than the buffer is split
+        carry = filled - line_start;
+        if (carry == sizeof(buffer)) {
+            filter_line(filter, buffer, carry);
+            carry = 0;
+        } else {
+            memmove(buffer, buffer + line_start, carry);
+        }
+    }
+    
+    if (carry > 0) {
+        filter_line(filter, buffer, carry);
+    }
+    
+    return 0;
+}
+
+/**
+ * Find the next possible record start after a damaged one
+ * 
+ * @param buffer Buffered log data
+ * @param start Offset of the damaged record
+ * @param filled Number of bytes in the buffer
+ * @return Offset of the next magic number, or of a partial one at the end
+ */
+static size_t find_next_magic(const char *buffer, size_t start, size_t filled) {
+    uint32_t magic = LOG_RECORD_MAGIC;
+    const char *next = memmem(buffer + start + 1, filled - start - 1, &magic, sizeof(magic));
+    if (next) {
+        return next - buffer;
+    }
+    
+    // Keep a tail that may be the start of a magic number cut by the read
+    size_t keep = sizeof(magic) - 1;
+    return (filled - start > keep + 1) ? filled - keep : start + 1;
+}
+
+/**
+ * Stream the rest of a binary source through the filter
+ * Damaged bytes are skipped up to the next record that checks out.
+ * 
+ * @param source Source to read
+ * @param filter Active filter, or NULL to only count the records
+ * @return Number of records read, or -1 on read failure
+ */
+static long stream_records(struct log_source *source, struct log_filter *filter) {
+    char buffer[LOG_CHUNK_SIZE];
+    size_t filled = 0;
+    size_t start = 0;
+    long records = 0;
+    
+    while (1) {
+        memmove(buffer, buffer + start, filled - start);
+        filled -= start;
+        start = 0;
+        
+        ssize_t bytes_read = read_source(source, buffer + filled, sizeof(buffer) - filled);
+        if (bytes_read == -1) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        filled += bytes_read;
+        
+        while (filled - start >= sizeof(struct log_record_header)) {
+            struct log_record_header header;
+            memcpy(&header, buffer + start, sizeof(header));
+            if (!record_header_valid(&header)) {
+                start = find_next_magic(buffer, start, filled);
+                continue;
+            }
+            if (header.length > filled - start) {
+                break;  // The rest of the record is in the next read
+            }
+            
+            uint32_t trailer;
+            memcpy(&trailer, buffer + start + header.length - sizeof(trailer), sizeof(trailer));
+            if (trailer != header.length) {
+                start = find_next_magic(buffer, start, filled);
+                continue;
+            }
+            
+            if (filter) {
+                filter_record(filter, &header, buffer + start + sizeof(header));
+            }
+            records++;
+            start += header.length;
+        }
+    }
+    
+    return records;
+}
+
+/**
+ * Stream the rest of a source in the configured format through the filter
+ * 
+ * @param source Source to read
+ * @param filter Active filter
+ * @return 0 on success, -1 on read failure
+ */
+static int stream_log(struct log_source *source, struct log_filter *filter) {
+    if (log_format_binary()) {
+        return (stream_records(source, filter) < 0) ? -1 : 0;
+    }
+    return stream_source(source, filter);
+}
+
+/**
+ * Find the first position that can hold entries at or after a time
+ * Walks back from the current log to the newest segment that started
+ * before the time; older segments are skipped entirely.
+ * 
+ * @param segments Archived segments, oldest first
+ * @param count Number of archived segments
+ * @param current Current log, as a source covering the snapshot
+ * @param when Time to search for
+ * @param position Set to the starting position
+ */
+static void find_since_position(const struct log_segment *segments, int count, 
+                                struct log_source *current, time_t when, 
+                                struct log_position *position) {
+    position->segment = count;
+    position->offset = find_since_offset(when, current->end);
+    position->skip_lines = 0;
+    
+    // Allow for entries that were buffered across a rotation
+    char margin[TIMESTAMP_LEN + 1];
+    format_log_time(when - SEGMENT_SKEW, margin);
+    if (margin[0] == '\0') {
+        position->segment = 0;
+        position->offset = 0;
+        return;
+    }
+    
+    char first[TIMESTAMP_LEN + 1];
+    current->pos = 0;
+    read_first_timestamp(current, first);
+    current->pos = 0;
+    if (first[0] != '\0' && memcmp(first, margin, TIMESTAMP_LEN) < 0) {
+        return;
+    }
+    
+    position->offset = 0;
+    
+    for (int i = count - 1; i >= 0; i--) {
+        position->segment = i;
+        
+        struct log_source source;
+        if (open_segment(&segments[i], &source) == -1) {
+            continue;
+        }
+        read_first_timestamp(&source, first);
+        close_segment(&source);
+        
+        if (first[0] != '\0' && memcmp(first, margin, TIMESTAMP_LEN) < 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * Find the position of the last lines across all segments
+ * 
+ * @param segments Archived segments, oldest first
+ * @param count Number of archived segments
+ * @param current Current log, as a source covering the snapshot
+ * @param lines Number of lines wanted
+ * @param position Set to the starting position
+ */
+static void find_last_position(const struct log_segment *segments, int count, 
+                               struct log_source *current, long lines, 
+                               struct log_position *position) {
+    position->segment = count;
+    position->skip_lines = 0;
+    
+    if (lines == 0) {
+        position->offset = current->end;
+        return;
+    }
+    
+    long found = 0;
+    if (current->fd == -1) {
+        position->offset = 0;
+    } else if (log_format_binary()) {
+        position->offset = find_last_record(current->fd, current->end, lines, &found);
+    } else {
+        position->offset = find_last_offset(current->fd, current->end, lines, &found);
+    }
+    
+    // Older lines come from the archived segments, newest first
+    long remaining = lines - found;
+    for (int i = count - 1; i >= 0 && remaining > 0; i--) {
+        struct log_source source;
+        if (open_segment(&segments[i], &source) == -1) {
+            continue;
+        }
+        long segment_lines = log_format_binary() ? stream_records(&source, NULL) : 
+                                                   count_source_lines(&source);
+        if (segment_lines < 0) {
+            segment_lines = 0;
+        }
+        close_segment(&source);
+        
+        position->segment = i;
+        position->offset = 0;
+        position->skip_lines = (segment_lines > remaining) ? segment_lines - remaining : 0;
+        remaining -= segment_lines;
+    }
+}
+
+/**
+ * Display all logs
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int show_logs(void) {
+    struct log_query query = { -1, NULL, NULL, 0 };
+    return show_logs_query(&query);
+}
+
+/**
+ * Display the logs selected by a query
+ * Archived segments are read oldest first, followed by the current log.
+ * The log is streamed in chunks, and the shared lock is only held long
+ * enough to take a consistent snapshot of the current log's size, so
+ * writers are never blocked for the length of the read.
+ * 
+ * @param query Filters to apply
+ * @return 0 on success, -1 on failure
+ */
+int show_logs_query(const struct log_query *query) {
+    struct log_filter *filter = malloc(sizeof(*filter));
+    if (!filter) {
+        char error_msg[] = "Error: Memory allocation failed\n";
+        err_write(error_msg, strlen(error_msg));
+        return -1;
+    }
+    filter->since[0] = '\0';
+    filter->grep = query->grep;
+    filter->grep_len = query->grep ? strlen(query->grep) : 0;
+    filter->skip_lines = 0;
+    filter->matched = 0;
+    filter->last_char = '\n';
+    filter->json = query->json;
+    filter->cached_sec = 0;
+    filter->cached_time[0] = '\0';
+    filter->out_len = 0;
+    
+    time_t since_time = 0;
+    if (query->since && parse_since(query->since, &since_time, filter->since) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Invalid timestamp \"%s\"\n", query->since);
+        err_write(error_msg, len);
+        free(filter);
+        return -1;
+    }
+    filter->since_time = since_time;
+    
+    // Make this process's own pending entries visible
+    flush_logs();
+    
+    struct log_segment *segments = NULL;
+    int segment_count = 0;
+    list_log_segments(&segments, &segment_count);
+    
+    // Open log file for reading
+    struct log_source current = { -1, NULL, 0, 0 };
+    current.fd = openat(log_directory(), log_file_name(), O_RDONLY | O_CLOEXEC);
+    if (current.fd == -1 && (errno != ENOENT || segment_count == 0)) {
+        int result = 0;
+        if (errno == ENOENT && !query->json) {
+            const char *no_logs_msg = "No logs available.\n";
+            out_write(no_logs_msg, strlen(no_logs_msg));
+        } else if (errno != ENOENT) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not open log file: %s\n", 
+                              strerror(errno));
+            err_write(error_msg, len);
+            result = -1;
+        }
+        free(segments);
+        free(filter);
+        return result;
+    }
+    
+    if (current.fd != -1) {
+        // Writers hold the exclusive lock for a whole batch, so the size
+        // seen under the shared lock always ends on a complete batch
+        if (flock(current.fd, LOCK_SH) == -1) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not lock log file: %s\n", 
+                              strerror(errno));
+            err_write(error_msg, len);
+            close(current.fd);
+            free(segments);
+            free(filter);
+            return -1;
+        }
+        
+        struct stat st;
+        int stat_result = fstat(current.fd, &st);
+        int stat_errno = errno;
+        flock(current.fd, LOCK_UN);
+        
+        if (stat_result == -1) {
+            char error_msg[256];
+            int len = string_format(error_msg, sizeof(error_msg), 
+                              "Error: Could not get log file size: %s\n", 
+                              strerror(stat_errno));
+            err_write(error_msg, len);
+            close(current.fd);
+            free(segments);
+            free(filter);
+            return -1;
+        }
+        current.end = st.st_size;
+    }
+    
+    // Check if there is anything to show
+    if (current.end == 0 && segment_count == 0) {
+        if (!query->json) {
+            const char *empty_log_msg = "Log file is empty.\n";
+            out_write(empty_log_msg, strlen(empty_log_msg));
+        }
+        close(current.fd);
+        free(segments);
+        free(filter);
+        return 0;
+    }
+    
+    // Seek straight to the region the query covers
+    struct log_position start = { 0, 0, 0 };
+    if (query->since) {
+        find_since_position(segments, segment_count, &current, since_time, &start);
+    }
+    if (query->last >= 0) {
+        struct log_position last_start;
+        find_last_position(segments, segment_count, &current, query->last, &last_start);
+        
+        // Start from whichever position is later
+        if (last_start.segment > start.segment || 
+            (last_start.segment == start.segment && 
+             (last_start.offset > start.offset || last_start.skip_lines > start.skip_lines))) {
+            start = last_start;
+        }
+    }
+    
+    // Display logs header; JSON output is one object per line and nothing else
+    if (!query->json) {
+        const char *logs_header = "Operation Logs:\n";
+        out_write(logs_header, strlen(logs_header));
+    }
+    
+    int result = 0;
+    for (int i = start.segment; i < segment_count && result == 0; i++) {
+        struct log_source source;
+        if (open_segment(&segments[i], &source) == -1) {
+            continue; // Pruned while we were reading
+        }
+        filter->skip_lines = (i == start.segment) ? start.skip_lines : 0;
+        result = stream_log(&source, filter);
+        close_segment(&source);
+    }
+    
+    if (result == 0 && current.fd != -1) {
+        current.pos = (start.segment == segment_count) ? start.offset : 0;
+        filter->skip_lines = 0;
+        posix_fadvise(current.fd, current.pos, current.end - current.pos, POSIX_FADV_SEQUENTIAL);
+        result = stream_log(&current, filter);
+    }
+    flush_filter_output(filter);
+    
+    if (result == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not read log file: %s\n", 
+                          strerror(errno));
+        err_write(error_msg, len);
+    } else if (filter->matched == 0 && !query->json && 
+               (query->since || query->grep || query->last >= 0)) {
+        const char *no_match_msg = "No matching log entries.\n";
+        out_write(no_match_msg, strlen(no_match_msg));
+    } else if (filter->last_char != '\n') {
+        // Add a newline if the log doesn't end with one
+        out_write("\n", 1);
+    }
+    
+    if (current.fd != -1) {
+        close(current.fd);
+    }
+    free(segments);
+    free(filter);
+    
+    return result;
+}
@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include "match.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Most glob states all patterns together may compile to
+#define MATCH_MAX_STATES 1024
+
+// Words of a state set
+#define STATE_WORDS (MATCH_MAX_STATES / 64)
+
+// Kinds of glob tokens
+enum glob_kind {
+    GLOB_LITERAL,  // One given character
+    GLOB_ANY,      // '?': any one character
+    GLOB_CLASS,    // "[...]": one character from a set
+    GLOB_STAR,     // '*': any run of characters
+    GLOB_END       // End of one pattern: the name matched
+};
+
+// One glob token; a state is the index of the next token to match
+struct glob_token {
+    unsigned char kind;
+    unsigned char c;  // GLOB_LITERAL: the character
+    int set;          // GLOB_CLASS: index into the class table
+};
+
+// Node of the trie of reversed suffixes
+struct trie_node {
+    int child;                // First child, or -1
+    int sibling;              // Next child of the same parent, or -1
+    unsigned char c;
+    unsigned char terminal;   // A whole suffix ends here
+};
+
+struct matcher {
+    // Suffix patterns, stored backwards from their last character
+    struct trie_node *nodes;
+    int node_count;
+    int node_capacity;
+    
+    // Glob patterns, compiled one after another into a single automaton
+    struct glob_token *tokens;
+    int token_count;
+    int token_capacity;
+    uint64_t (*sets)[4];      // Character bitmaps of the classes
+    int set_count;
+    int start[MATCH_MAX_STATES];
+    int start_count;
+};
+
+/**
+ * Grow an array to hold at least one more element
+ * 
+ * @param array Array to grow
+ * @param capacity Current capacity in elements, updated
+ * @param count Elements in use
+ * @param size Size of an element
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int reserve(void **array, int *capacity, int count, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 16;
+    void *grown = realloc(*array, new_capacity * size);
+    if (!grown) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Add a suffix to the trie
+ * 
+ * @param matcher Matcher being compiled
+ * @param suffix Suffix to add
+ * @param len Length of the suffix
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int add_suffix(struct matcher *matcher, const char *suffix, size_t len) {
+    int node = 0;
+    
+    for (size_t i = len; i-- > 0; ) {
+        unsigned char c = suffix[i];
+        int child = matcher->nodes[node].child;
+        while (child != -1 && matcher->nodes[child].c != c) {
+            child = matcher->nodes[child].sibling;
+        }
+        
+        if (child == -1) {
+            if (reserve((void **)&matcher->nodes, &matcher->node_capacity,
+                        matcher->node_count, sizeof(*matcher->nodes)) == -1) {
+                return -1;
+            }
+            child = matcher->node_count++;
+            matcher->nodes[child].child = -1;
+            matcher->nodes[child].sibling = matcher->nodes[node].child;
+            matcher->nodes[child].c = c;
+            matcher->nodes[child].terminal = 0;
+            matcher->nodes[node].child = child;
+        }
+        node = child;
+    }
+    
+    matcher->nodes[node].terminal = 1;
+    return 0;
+}
+
+/**
+ * Append a token to the glob automaton
+ * 
+ * @param matcher Matcher being compiled
+ * @param kind Token kind
+ * @param c Character, for GLOB_LITERAL
+ * @param set Class index, for GLOB_CLASS
+ * @return 0 on success, -1 on failure
+ */
+static int add_token(struct matcher *matcher, int kind, unsigned char c, int set) {
+    if (matcher->token_count >= MATCH_MAX_STATES ||
+        reserve((void **)&matcher->tokens, &matcher->token_capacity,
+                matcher->token_count, sizeof(*matcher->tokens)) == -1) {
+        return -1;
+    }
+    struct glob_token *token = &matcher->tokens[matcher->token_count++];
+    token->kind = kind;
+    token->c = c;
+    token->set = set;
+    return 0;
+}
+
+/**
+ * Compile a "[...]" class into a character bitmap
+ * Supports ranges such as "a-z" and negation with '!' or '^'.
+ * 
+ * @param matcher Matcher being compiled
+ * @param pattern Pattern text, at the opening bracket
+ * @param len Bytes of pattern text available
+ * @param used Set to the length of the class, brackets included
+ * @return Index of the class, or -1 if it is invalid
+ */
+static int add_class(struct matcher *matcher, const char *pattern, size_t len, size_t *used) {
+    int capacity = matcher->set_count;  // Classes are rare; grow one at a time
+    void *grown = realloc(matcher->sets, (capacity + 1) * sizeof(*matcher->sets));
+    if (!grown) {
+        return -1;
+    }
+    matcher->sets = grown;
+    uint64_t *bits = matcher->sets[matcher->set_count];
+    memset(bits, 0, sizeof(*matcher->sets));
+    
+    size_t i = 1;
+    int negate = (i < len && (pattern[i] == '!' || pattern[i] == '^'));
+    if (negate) {
+        i++;
+    }
+    
+    // A ']' right after the opening bracket is a member
+    size_t first = i;
+    while (i < len && (pattern[i] != ']' || i == first)) {
+        unsigned char low = pattern[i];
+        unsigned char high = low;
+        if (i + 2 < len && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+            high = pattern[i + 2];
+            i += 2;
+        }
+        for (unsigned c = low; c <= high; c++) {
+            bits[c / 64] |= (uint64_t)1 << (c % 64);
+        }
+        i++;
+    }
+    if (i >= len) {
+        return -1;  // Unterminated class
+    }
+    
+    if (negate) {
+        for (int w = 0; w < 4; w++) {
+            bits[w] = ~bits[w];
+        }
+    }
+    
+    *used = i + 1;
+    return matcher->set_count++;
+}
+
+/**
+ * Compile one glob into the automaton
+ * 
+ * @param matcher Matcher being compiled
+ * @param pattern Glob text
+ * @param len Length of the glob
+ * @return 0 on success, -1 if the glob is invalid or too large
+ */
+static int add_glob(struct matcher *matcher, const char *pattern, size_t len) {
+    if (matcher->start_count >= MATCH_MAX_STATES) {
+        return -1;
+    }
+    matcher->start[matcher->start_count++] = matcher->token_count;
+    
+    for (size_t i = 0; i < len; ) {
+        int result;
+        if (pattern[i] == '*') {
+            // Runs of stars are one star
+            if (matcher->token_count > 0 &&
+                matcher->tokens[matcher->token_count - 1].kind == GLOB_STAR &&
+                matcher->start[matcher->start_count - 1] < matcher->token_count) {
+                i++;
+                continue;
+            }
+            result = add_token(matcher, GLOB_STAR, 0, 0);
+            i++;
+        } else if (pattern[i] == '?') {
+            result = add_token(matcher, GLOB_ANY, 0, 0);
+            i++;
+        } else if (pattern[i] == '[') {
+            size_t used;
+            int set = add_class(matcher, pattern + i, len - i, &used);
+            result = (set == -1) ? -1 : add_token(matcher, GLOB_CLASS, 0, set);
+            i += (set == -1) ? 1 : used;
+        } else {
+            // A backslash makes the next character literal
+            if (pattern[i] == '\\' && i + 1 < len) {
+                i++;
+            }
+            result = add_token(matcher, GLOB_LITERAL, pattern[i], 0);
+            i++;
+        }
+        if (result == -1) {
+            return -1;
+        }
+    }
+    
+    return add_token(matcher, GLOB_END, 0, 0);
+}
+
+/**
+ * Compile a comma-separated list of suffixes and globs
+ * 
+ * @param patterns Pattern list, e.g. ".log,.gz,*.2026-*.log"
+ * @return New matcher, or NULL if a pattern is invalid or memory ran out
+ */
+struct matcher *matcher_compile(const char *patterns) {
+    struct matcher *matcher = calloc(1, sizeof(*matcher));
+    if (!matcher) {
+        return NULL;
+    }
+    
+    // Node 0 is the trie root
+    if (reserve((void **)&matcher->nodes, &matcher->node_capacity, 0, sizeof(*matcher->nodes)) == -1) {
+        free(matcher);
+        return NULL;
+    }
+    matcher->nodes[0].child = -1;
+    matcher->nodes[0].sibling = -1;
+    matcher->nodes[0].terminal = 0;
+    matcher->node_count = 1;
+    
+    const char *p = patterns;
+    while (1) {
+        size_t len = strcspn(p, ",");
+        if (len == 0) {
+            // Empty patterns would match everything
+            matcher_free(matcher);
+            return NULL;
+        }
+        
+        int result;
+        if (memchr(p, '*', len) || memchr(p, '?', len) || memchr(p, '[', len)) {
+            result = add_glob(matcher, p, len);
+        } else {
+            result = add_suffix(matcher, p, len);
+        }
+        if (result == -1) {
+            matcher_free(matcher);
+            return NULL;
+        }
+        
+        if (p[len] == '\0') {
+            break;
+        }
+        p += len + 1;
+    }
+    
+    return matcher;
+}
+
+/**
+ * Check a name against the suffix trie
+ * Walks the name backwards once, however many suffixes there are.
+ * 
+ * @param matcher Compiled matcher
+ * @param name Name to check
+ * @param len Length of the name
+ * @return 1 if some suffix matches, 0 otherwise
+ */
+static int match_suffix(const struct matcher *matcher, const char *name, size_t len) {
+    int node = 0;
+    
+    // Stop before the first character: a suffix must not be the whole name
+    for (size_t i = len; i-- > 1; ) {
+        unsigned char c = name[i];
+        int child = matcher->nodes[node].child;
+        while (child != -1 && matcher->nodes[child].c != c) {
+            child = matcher->nodes[child].sibling;
+        }
+        if (child == -1) {
+            return 0;
+        }
+        node = child;
+        if (matcher->nodes[node].terminal) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Add a state to a set, along with the states a star lets it skip to
+ * 
+ * @param matcher Compiled matcher
+ * @param states State set
+ * @param state State to add
+ */
+static void add_state(const struct matcher *matcher, uint64_t *states, int state) {
+    while (1) {
+        states[state / 64] |= (uint64_t)1 << (state % 64);
+        if (matcher->tokens[state].kind != GLOB_STAR) {
+            return;
+        }
+        state++;  // A star may match nothing
+    }
+}
+
+/**
+ * Check a name against all globs at once
+ * The globs form one automaton whose set of live states is advanced
+ * once per character, so the name is read a single time.
+ * 
+ * @param matcher Compiled matcher
+ * @param name Name to check
+ * @param len Length of the name
+ * @return 1 if some glob matches, 0 otherwise
+ */
+static int match_globs(const struct matcher *matcher, const char *name, size_t len) {
+    uint64_t current[STATE_WORDS];
+    uint64_t next[STATE_WORDS];
+    int words = (matcher->token_count + 63) / 64;
+    
+    memset(current, 0, words * sizeof(uint64_t));
+    for (int i = 0; i < matcher->start_count; i++) {
+        add_state(matcher, current, matcher->start[i]);
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = name[i];
+        int live = 0;
+        memset(next, 0, words * sizeof(uint64_t));
+        
+        for (int w = 0; w < words; w++) {
+            for (uint64_t bits = current[w]; bits; bits &= bits - 1) {
+                int state = w * 64 + __builtin_ctzll(bits);
+                const struct glob_token *token = &matcher->tokens[state];
+                
+                switch (token->kind) {
+                    case GLOB_STAR:
+                        add_state(matcher, next, state);
+                        live = 1;
+                        break;
+                    case GLOB_LITERAL:
+                        if (token->c == c) {
+                            add_state(matcher, next, state + 1);
+                            live = 1;
+                        }
+                        break;
+                    case GLOB_ANY:
+                        add_state(matcher, next, state + 1);
+                        live = 1;
+                        break;
+                    case GLOB_CLASS:
+                        if (matcher->sets[token->set][c / 64] & ((uint64_t)1 << (c % 64))) {
+                            add_state(matcher, next, state + 1);
+                            live = 1;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        
+        if (!live) {
+            return 0;
+        }
+        memcpy(current, next, words * sizeof(uint64_t));
+    }
+    
+    for (int w = 0; w < words; w++) {
+        for (uint64_t bits = current[w]; bits; bits &= bits - 1) {
+            if (matcher->tokens[w * 64 + __builtin_ctzll(bits)].kind == GLOB_END) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check whether a name matches any of the patterns
+ * Safe to call from several threads at once.
+ * 
+ * @param matcher Compiled matcher
+ * @param name Name to check
+ * @param len Length of the name
+ * @return 1 on a match, 0 otherwise
+ */
+int matcher_match(const struct matcher *matcher, const char *name, size_t len) {
+    if (matcher->node_count > 1 && match_suffix(matcher, name, len)) {
+        return 1;
+    }
+    return matcher->token_count > 0 && match_globs(matcher, name, len);
+}
+
+/**
+ * Free a compiled matcher
+ * 
+ * @param matcher Matcher to free, or NULL
+ */
+void matcher_free(struct matcher *matcher) {
+    if (!matcher) {
+        return;
+    }
+    free(matcher->nodes);
+    free(matcher->tokens);
+    free(matcher->sets);
+    free(matcher);
+}
@@ -0,0 +1,21 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+
+// Compiled set of name patterns
+// Patterns are separated by commas. A pattern containing '*', '?' or '['
+// is a glob matched against the whole name; any other pattern is a
+// suffix such as ".txt", which only matches names longer than itself.
+struct matcher;
+
+// Compile a comma-separated pattern list; NULL if a pattern is invalid
+struct matcher *matcher_compile(const char *patterns);
+
+// Check whether a name matches any of the patterns
+int matcher_match(const struct matcher *matcher, const char *name, size_t len);
+
+// Free a compiled matcher
+void matcher_free(struct matcher *matcher);
+
+#endif // MATCH_H
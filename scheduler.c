@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Command in the window, in submission order
+struct sched_slot {
+    void *task;
+    int result;
+    int finished;
+};
+
+// Serial lane: a ring of window positions run by one worker, oldest first
+struct sched_lane {
+    struct scheduler *sched;
+    size_t queue[SCHED_LANE_DEPTH];
+    size_t head;
+    size_t count;
+    pthread_cond_t wake;
+    pthread_t thread;
+};
+
+// Scheduler state; the mutex guards everything but the callbacks
+struct scheduler {
+    pthread_mutex_t mutex;
+    pthread_cond_t progress;    // A command finished or a lane has room
+    struct sched_lane *lanes;
+    int lane_count;
+    struct sched_slot window[SCHED_WINDOW];
+    size_t delivered;           // Position of the oldest undelivered command
+    size_t submitted;           // Position of the next command
+    int delivering;             // Set while done callbacks run
+    int stop;
+    int notify_fd;              // eventfd, or -1
+    sched_run_fn run;
+    sched_done_fn done;
+    void *context;
+};
+
+/**
+ * Hash the name a path ends in (FNV-1a)
+ * Only the last component counts, so "a" and "./a" share a lane.
+ * 
+ * @param path Path to hash
+ * @return Hash value
+ */
+static uint32_t hash_name(const char *path) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Run the commands of one lane in order
+ * 
+ * @param arg Pointer to the struct sched_lane
+ * @return NULL
+ */
+static void *lane_main(void *arg) {
+    struct sched_lane *lane = (struct sched_lane *)arg;
+    struct scheduler *sched = lane->sched;
+    
+    pthread_mutex_lock(&sched->mutex);
+    while (1) {
+        while (lane->count == 0 && !sched->stop) {
+            pthread_cond_wait(&lane->wake, &sched->mutex);
+        }
+        if (lane->count == 0) {
+            break;
+        }
+        
+        struct sched_slot *slot = &sched->window[lane->queue[lane->head] % SCHED_WINDOW];
+        pthread_mutex_unlock(&sched->mutex);
+        
+        int result = sched->run(slot->task, sched->context);
+        
+        pthread_mutex_lock(&sched->mutex);
+        slot->result = result;
+        slot->finished = 1;
+        lane->head = (lane->head + 1) % SCHED_LANE_DEPTH;
+        lane->count--;
+        pthread_cond_broadcast(&sched->progress);
+        if (sched->notify_fd != -1) {
+            uint64_t one = 1;
+            write(sched->notify_fd, &one, sizeof(one));
+        }
+    }
+    pthread_mutex_unlock(&sched->mutex);
+    return NULL;
+}
+
+/**
+ * Create a scheduler with one worker thread per lane
+ * 
+ * @param lanes Number of lanes
+ * @param run Runs a command on a worker thread
+ * @param done Receives finished commands in submission order
+ * @param context Passed to run and done
+ * @return New scheduler, or NULL on failure
+ */
+struct scheduler *sched_create(int lanes, sched_run_fn run, sched_done_fn done, void *context) {
+    struct scheduler *sched = calloc(1, sizeof(*sched));
+    if (!sched) {
+        return NULL;
+    }
+    sched->lanes = calloc(lanes, sizeof(*sched->lanes));
+    if (!sched->lanes) {
+        free(sched);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&sched->mutex, NULL);
+    pthread_cond_init(&sched->progress, NULL);
+    sched->run = run;
+    sched->done = done;
+    sched->context = context;
+    sched->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    
+    for (int i = 0; i < lanes; i++) {
+        struct sched_lane *lane = &sched->lanes[i];
+        lane->sched = sched;
+        pthread_cond_init(&lane->wake, NULL);
+        if (pthread_create(&lane->thread, NULL, lane_main, lane) != 0) {
+            pthread_cond_destroy(&lane->wake);
+            break;
+        }
+        sched->lane_count++;
+    }
+    
+    if (sched->lane_count == 0) {
+        sched_destroy(sched);
+        return NULL;
+    }
+    return sched;
+}
+
+/**
+ * Hand finished commands to the done callback, in submission order
+ * Must be called with the mutex held; it is released around callbacks.
+ * Only one thread delivers at a time.
+ * 
+ * @param sched Scheduler
+ */
+static void deliver_locked(struct scheduler *sched) {
+    if (sched->delivering) {
+        return;
+    }
+    sched->delivering = 1;
+    
+    while (sched->delivered < sched->submitted) {
+        struct sched_slot *slot = &sched->window[sched->delivered % SCHED_WINDOW];
+        if (!slot->finished) {
+            break;
+        }
+        void *task = slot->task;
+        int result = slot->result;
+        slot->finished = 0;
+        sched->delivered++;
+        
+        pthread_mutex_unlock(&sched->mutex);
+        sched->done(task, result, sched->context);
+        pthread_mutex_lock(&sched->mutex);
+    }
+    
+    sched->delivering = 0;
+    pthread_cond_broadcast(&sched->progress);
+}
+
+/**
+ * Queue a command on its path's lane
+ * While the lane or the window is full, finished commands are delivered
+ * and the caller waits, which keeps memory bounded however fast commands
+ * are submitted.
+ * 
+ * @param sched Scheduler
+ * @param path Path the command works on
+ * @param task Command, passed to run and then done
+ * @return 0 on success
+ */
+int sched_submit(struct scheduler *sched, const char *path, void *task) {
+    struct sched_lane *lane = &sched->lanes[hash_name(path) % sched->lane_count];
+    
+    pthread_mutex_lock(&sched->mutex);
+    while (1) {
+        deliver_locked(sched);
+        if (lane->count < SCHED_LANE_DEPTH && sched->submitted - sched->delivered < SCHED_WINDOW) {
+            break;
+        }
+        pthread_cond_wait(&sched->progress, &sched->mutex);
+    }
+    
+    size_t position = sched->submitted++;
+    struct sched_slot *slot = &sched->window[position % SCHED_WINDOW];
+    slot->task = task;
+    slot->finished = 0;
+    lane->queue[(lane->head + lane->count) % SCHED_LANE_DEPTH] = position;
+    lane->count++;
+    pthread_cond_signal(&lane->wake);
+    pthread_mutex_unlock(&sched->mutex);
+    
+    return 0;
+}
+
+/**
+ * Deliver whatever has finished, in order, without waiting
+ * 
+ * @param sched Scheduler
+ */
+void sched_collect(struct scheduler *sched) {
+    if (sched->notify_fd != -1) {
+        uint64_t count;
+        read(sched->notify_fd, &count, sizeof(count)); // Reset; EAGAIN if nothing was pending
+    }
+    
+    pthread_mutex_lock(&sched->mutex);
+    deliver_locked(sched);
+    pthread_mutex_unlock(&sched->mutex);
+}
+
+/**
+ * Wait until every submitted command has run and been delivered
+ * 
+ * @param sched Scheduler
+ */
+void sched_drain(struct scheduler *sched) {
+    pthread_mutex_lock(&sched->mutex);
+    while (1) {
+        deliver_locked(sched);
+        if (sched->delivered == sched->submitted) {
+            break;
+        }
+        pthread_cond_wait(&sched->progress, &sched->mutex);
+    }
+    pthread_mutex_unlock(&sched->mutex);
+}
+
+/**
+ * Get a descriptor that becomes readable when a command finishes
+ * 
+ * @param sched Scheduler
+ * @return eventfd to poll, or -1 if none could be created
+ */
+int sched_notify_fd(const struct scheduler *sched) {
+    return sched->notify_fd;
+}
+
+/**
+ * Drain the scheduler, stop its workers and free it
+ * 
+ * @param sched Scheduler to destroy, or NULL
+ */
+void sched_destroy(struct scheduler *sched) {
+    if (!sched) {
+        return;
+    }
+    sched_drain(sched);
+    
+    pthread_mutex_lock(&sched->mutex);
+    sched->stop = 1;
+    for (int i = 0; i < sched->lane_count; i++) {
+        pthread_cond_signal(&sched->lanes[i].wake);
+    }
+    pthread_mutex_unlock(&sched->mutex);
+    
+    for (int i = 0; i < sched->lane_count; i++) {
+        pthread_join(sched->lanes[i].thread, NULL);
+        pthread_cond_destroy(&sched->lanes[i].wake);
+    }
+    if (sched->notify_fd != -1) {
+        close(sched->notify_fd);
+    }
+    pthread_cond_destroy(&sched->progress);
+    pthread_mutex_destroy(&sched->mutex);
+    free(sched->lanes);
+    free(sched);
+}
@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Commands a lane holds before submitting to it blocks
+#define SCHED_LANE_DEPTH 64
+
+// Commands in flight, queued or finished but not yet delivered
+#define SCHED_WINDOW 1024
+
+// Scheduler running commands on a fixed set of serial lanes
+// Commands on the same path always share a lane and run in submission
+// order; commands on other paths run concurrently on other lanes.
+// Results are delivered to the submitting thread in submission order.
+struct scheduler;
+
+// Run one command on a lane's worker thread and return its result
+typedef int (*sched_run_fn)(void *task, void *context);
+
+// Deliver a finished command, on the thread that submits or drains
+typedef void (*sched_done_fn)(void *task, int result, void *context);
+
+// Create a scheduler with one worker thread per lane
+struct scheduler *sched_create(int lanes, sched_run_fn run, sched_done_fn done, void *context);
+
+// Queue a command on its path's lane, blocking while that lane or the window is full
+int sched_submit(struct scheduler *sched, const char *path, void *task);
+
+// Deliver whatever has finished, in order, without waiting
+void sched_collect(struct scheduler *sched);
+
+// Wait until every submitted command has run and been delivered
+void sched_drain(struct scheduler *sched);
+
+// Descriptor that becomes readable when a command finishes, for epoll
+int sched_notify_fd(const struct scheduler *sched);
+
+// Drain the scheduler, stop its workers and free it
+void sched_destroy(struct scheduler *sched);
+
+#endif // SCHEDULER_H
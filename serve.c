@@ -0,0 +1,1042 @@
+#define _GNU_SOURCE
+#include "serve.h"
+#include "logging.h"
+#include "utils.h"
+#include "fdcache.h"
+#include "dirindex.h"
+#include "durability.h"
+#include "config.h"
+#include "scheduler.h"
+#include "stats.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+// Descriptors a client passes with a request: output, errors, working
+// directory and input
+#define SERVE_PASSED_FDS 4
+
+// Events taken from epoll at a time
+#define SERVE_EVENT_BATCH 64
+
+// Bytes of an HTTP request read from a metrics client before answering
+#define METRICS_REQUEST_SIZE 4096
+
+// How long a metrics client may take to send its request or read the answer
+#define METRICS_TIMEOUT_MS 1000
+
+// A connected client
+struct client {
+    int fd;
+    char *buffer;       // Received bytes not yet part of a complete request
+    size_t len;
+    size_t capacity;
+    int passed[SERVE_PASSED_FDS];
+    int passed_count;   // 0, or SERVE_PASSED_FDS for the next request
+    long requests;
+    int inflight;       // Requests still on a scheduler lane
+    int closing;        // Disconnected; freed once nothing is in flight
+};
+
+// Request running on a scheduler lane
+struct serve_task {
+    struct client *client;
+    char **args;
+    int arg_count;
+    long number;        // Request number on the connection
+    int passed[SERVE_PASSED_FDS];
+    int passed_count;
+    struct out_capture capture;
+};
+
+// Request queued for the next group commit, answered once it is written
+struct serve_queued {
+    struct client *client;
+    long number;        // Request number on the connection
+    int passed[SERVE_PASSED_FDS];
+    int passed_count;
+};
+
+// Requests of the group commit being collected; the tag of each is its index
+static struct serve_queued *g_queued = NULL;
+static int g_queued_count = 0;
+static int g_queued_capacity = 0;
+
+// Working directory of the server, restored after each request
+static int g_home_fd = -1;
+static struct stat g_home_stat;
+
+// Socket answering HTTP requests with the stats, or -1; its address tags it in epoll
+static int g_metrics_fd = -1;
+
+// Tags the exit request descriptor in epoll
+static int g_exit_tag;
+
+/**
+ * Write all of a buffer to a descriptor
+ * 
+ * @param fd Descriptor to write to
+ * @param data Data to write
+ * @param len Number of bytes
+ * @return 0 on success, -1 on failure
+ */
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = write(fd, data, len);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/**
+ * Switch a descriptor between blocking and non-blocking mode
+ * 
+ * @param fd Descriptor to change
+ * @param blocking 1 for blocking, 0 for non-blocking
+ */
+static void set_blocking(int fd, int blocking) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags != -1) {
+        fcntl(fd, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+    }
+}
+
+/**
+ * Close the descriptors a client passed for its next request
+ * 
+ * @param client Client whose descriptors to close
+ */
+static void close_passed(struct client *client) {
+    for (int i = 0; i < client->passed_count; i++) {
+        close(client->passed[i]);
+    }
+    client->passed_count = 0;
+}
+
+/**
+ * Free a disconnected client once none of its requests are in flight
+ * 
+ * @param client Client to free
+ */
+static void release_client(struct client *client) {
+    if (!client->closing || client->inflight > 0) {
+        return;
+    }
+    close(client->fd);
+    close_passed(client);
+    free(client->buffer);
+    free(client);
+}
+
+/**
+ * Disconnect a client
+ * Requests still on a lane keep the connection open for their replies.
+ * 
+ * @param epoll_fd epoll instance watching the client
+ * @param client Client to disconnect
+ */
+static void close_client(int epoll_fd, struct client *client) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    client->closing = 1;
+    release_client(client);
+}
+
+/**
+ * Send the status line of a finished request
+ * 
+ * @param client Client that sent the request
+ * @param number Request number on the connection
+ * @param result The command's result
+ */
+static void send_status(struct client *client, long number, int result) {
+    char status_msg[64];
+    int status_len = string_format(status_msg, sizeof(status_msg), 
+                             "[%ld] exit status %d\n", number,
+                             (result < 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+    
+    // Output must not be dropped because a client reads slowly
+    set_blocking(client->fd, 1);
+    send_all(client->fd, status_msg, status_len);
+    set_blocking(client->fd, 0);
+}
+
+/**
+ * Read what a client has sent, with any descriptors passed alongside
+ * 
+ * @param client Client to read from
+ * @return 1 if data arrived, 0 if there was nothing yet, -1 if the
+ *         client closed the connection or sent too much
+ */
+static int receive_client(struct client *client) {
+    if (client->len == client->capacity) {
+        size_t capacity = client->capacity ? client->capacity * 2 : 4096;
+        if (capacity > 2 * SERVE_MAX_REQUEST) {
+            return -1;
+        }
+        char *buffer = realloc(client->buffer, capacity);
+        if (!buffer) {
+            return -1;
+        }
+        client->buffer = buffer;
+        client->capacity = capacity;
+    }
+    
+    struct iovec iov = { client->buffer + client->len, client->capacity - client->len };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(SERVE_PASSED_FDS * sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    
+    ssize_t received;
+    do {
+        received = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    } while (received == -1 && errno == EINTR);
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    
+    // Keep one set of descriptors per request; every other descriptor
+    // the kernel installed is closed
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char *data = CMSG_DATA(cmsg);
+        int keep = (count == SERVE_PASSED_FDS && client->passed_count == 0);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, data + i * sizeof(int), sizeof(int));
+            if (keep) {
+                client->passed[i] = fd;
+            } else {
+                close(fd);
+            }
+        }
+        if (keep) {
+            client->passed_count = SERVE_PASSED_FDS;
+        }
+    }
+    
+    // Control data that did not fit means a malformed request
+    if (received > 0 && (msg.msg_flags & MSG_CTRUNC)) {
+        return -1;
+    }
+    
+    if (received <= 0) {
+        return -1;
+    }
+    client->len += received;
+    return 1;
+}
+
+/**
+ * Check whether a client's request runs in the server's working directory
+ * Lanes share the process's working directory, so only those requests
+ * may leave the main thread.
+ * 
+ * @param client Client that sent the request
+ * @return 1 if relative paths resolve the same for the server
+ */
+static int in_home_directory(const struct client *client) {
+    struct stat st;
+    if (client->passed_count != SERVE_PASSED_FDS) {
+        return 1;
+    }
+    return fstat(client->passed[2], &st) == 0 && st.st_dev == g_home_stat.st_dev &&
+           st.st_ino == g_home_stat.st_ino;
+}
+
+/**
+ * Run a request on a scheduler lane, capturing its output
+ * 
+ * @param task Pointer to struct serve_task
+ * @param context The struct serve_commands
+ * @return The command's result
+ */
+static int run_lane_task(void *task, void *context) {
+    struct serve_task *request = (struct serve_task *)task;
+    const struct serve_commands *commands = (const struct serve_commands *)context;
+    
+    out_capture(&request->capture);
+    int result = commands->run(request->args, request->arg_count);
+    out_capture(NULL);
+    return result;
+}
+
+/**
+ * Send a lane request's output and status line, in arrival order
+ * 
+ * @param task Pointer to struct serve_task
+ * @param result The command's result
+ * @param context Unused
+ */
+static void finish_lane_task(void *task, int result, void *context) {
+    struct serve_task *request = (struct serve_task *)task;
+    struct client *client = request->client;
+    int passed = (request->passed_count == SERVE_PASSED_FDS);
+    (void)context;
+    
+    set_blocking(client->fd, 1);
+    out_redirect(passed ? request->passed[0] : client->fd,
+                 passed ? request->passed[1] : client->fd);
+    out_replay(&request->capture);
+    out_redirect(STDOUT_FILENO, STDERR_FILENO);
+    set_blocking(client->fd, 0);
+    send_status(client, request->number, result);
+    
+    for (int i = 0; i < request->passed_count; i++) {
+        close(request->passed[i]);
+    }
+    free(request->args);
+    free(request);
+    
+    client->inflight--;
+    release_client(client);
+}
+
+/**
+ * Queue a request on its path's lane
+ * The task takes over the arguments and the passed descriptors.
+ * 
+ * @param sched Scheduler of the server
+ * @param client Client that sent the request
+ * @param path Path the command works on
+ * @param args Parsed arguments
+ * @param arg_count Number of arguments
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int queue_client_request(struct scheduler *sched, struct client *client,
+                                const char *path, char **args, int arg_count) {
+    struct serve_task *request = calloc(1, sizeof(*request));
+    if (!request) {
+        return -1;
+    }
+    
+    request->client = client;
+    request->args = args;
+    request->arg_count = arg_count;
+    request->number = ++client->requests;
+    memcpy(request->passed, client->passed, sizeof(request->passed));
+    request->passed_count = client->passed_count;
+    client->passed_count = 0;
+    client->inflight++;
+    return sched_submit(sched, path, request);
+}
+
+/**
+ * Queue a request for the next group commit, if the command can join one
+ * The entry takes over the passed descriptors; the arguments are copied
+ * by the queue.
+ * 
+ * @param client Client that sent the request
+ * @param args Parsed arguments
+ * @param arg_count Number of arguments
+ * @param commands How to queue commands
+ * @return 0 if queued, 1 if queued and the group is full, -1 if the
+ *         request must run on its own
+ */
+static int queue_client_group(struct client *client, char **args, int arg_count,
+                              const struct serve_commands *commands) {
+    if (g_queued_count == g_queued_capacity) {
+        int capacity = g_queued_capacity ? g_queued_capacity * 2 : 64;
+        struct serve_queued *queued = realloc(g_queued, capacity * sizeof(*queued));
+        if (!queued) {
+            return -1;
+        }
+        g_queued = queued;
+        g_queued_capacity = capacity;
+    }
+    
+    int result = commands->queue(args, arg_count, g_queued_count);
+    if (result == -1) {
+        return -1;
+    }
+    
+    struct serve_queued *entry = &g_queued[g_queued_count++];
+    entry->client = client;
+    entry->number = ++client->requests;
+    memcpy(entry->passed, client->passed, sizeof(entry->passed));
+    entry->passed_count = client->passed_count;
+    client->passed_count = 0;
+    client->inflight++;
+    return result;
+}
+
+/**
+ * Send a queued request's output to its client
+ * 
+ * @param tag Index of the request in g_queued
+ * @param context Unused
+ */
+static void start_group_reply(long tag, void *context) {
+    struct serve_queued *entry = &g_queued[tag];
+    int passed = (entry->passed_count == SERVE_PASSED_FDS);
+    (void)context;
+    
+    set_blocking(entry->client->fd, 1);
+    out_redirect(passed ? entry->passed[0] : entry->client->fd,
+                 passed ? entry->passed[1] : entry->client->fd);
+}
+
+/**
+ * Finish a queued request's reply with its status line
+ * 
+ * @param tag Index of the request in g_queued
+ * @param result The command's result
+ * @param context Unused
+ */
+static void finish_group_reply(long tag, int result, void *context) {
+    struct serve_queued *entry = &g_queued[tag];
+    struct client *client = entry->client;
+    (void)context;
+    
+    out_redirect(STDOUT_FILENO, STDERR_FILENO);
+    set_blocking(client->fd, 0);
+    send_status(client, entry->number, result);
+    
+    for (int i = 0; i < entry->passed_count; i++) {
+        close(entry->passed[i]);
+    }
+    client->inflight--;
+    release_client(client);
+}
+
+/**
+ * Commit the queued requests and answer them
+ * Lane requests that arrived before them are finished first, so each
+ * client's requests still take effect, and are answered, in order.
+ * 
+ * @param commands How to commit queued commands
+ * @param sched Scheduler of the server, or NULL
+ */
+static void commit_client_group(const struct serve_commands *commands, struct scheduler *sched) {
+    if (g_queued_count == 0) {
+        return;
+    }
+    if (sched) {
+        sched_drain(sched);
+    }
+    commands->commit(start_group_reply, finish_group_reply, NULL);
+    g_queued_count = 0;
+}
+
+/**
+ * Run one request of a client and send back its exit status
+ * Output goes to the descriptors the client passed with the request, or
+ * to the connection itself, and the status line follows it. Relative
+ * paths are resolved in the client's working directory and input is read
+ * from the client's standard input when it passed them; without them a
+ * command has no input at all, never the server's own.
+ * Appends from the server's own directory may join a group commit, and
+ * other single-file commands from there go to a lane; anything else
+ * waits for both and runs here.
+ * 
+ * @param client Client that sent the request
+ * @param request The request
+ * @param len Length of the request
+ * @param is_line 1 for a command line, 0 for NUL-terminated arguments
+ * @param commands How to parse and run commands
+ * @param sched Scheduler of the server, or NULL to run everything here
+ * @return The command's result
+ */
+static int run_client_request(struct client *client, char *request, size_t len, int is_line,
+                              const struct serve_commands *commands, struct scheduler *sched) {
+    char **args = NULL;
+    int arg_count = commands->parse(request, len, is_line, &args);
+    
+    // Queued requests run in the server's directory, at the next commit
+    if (arg_count > 0 && in_home_directory(client)) {
+        int queued = queue_client_group(client, args, arg_count, commands);
+        if (queued != -1) {
+            free(args);
+            if (queued == 1) {
+                commit_client_group(commands, sched);
+            }
+            return 0;
+        }
+    }
+    commit_client_group(commands, sched);
+    
+    const char *path = (sched && arg_count > 0) ? commands->lane(args, arg_count) : NULL;
+    if (path && in_home_directory(client) &&
+        queue_client_request(sched, client, path, args, arg_count) == 0) {
+        return 0;
+    }
+    if (sched) {
+        sched_drain(sched);
+    }
+    
+    long number = ++client->requests;
+    int passed = (client->passed_count == SERVE_PASSED_FDS);
+    int out_fd = passed ? client->passed[0] : client->fd;
+    int err_fd = passed ? client->passed[1] : client->fd;
+    
+    set_blocking(client->fd, 1);
+    if (passed && fchdir(client->passed[2]) == -1) {
+        passed = 0;
+    }
+    out_redirect(out_fd, err_fd);
+    in_redirect(passed ? client->passed[3] : -1);
+    
+    int result = 0;
+    if (arg_count == SERVE_TOO_MANY_ARGS) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Too many arguments (at most %d)\n", SERVE_MAX_ARGS);
+        err_write(error_msg, len);
+        result = -1;
+    } else if (arg_count < 0) {
+        err_write("Error: Memory allocation failed\n", 32);
+        result = -1;
+    } else if (arg_count > 0) {
+        result = commands->run(args, arg_count);
+    }
+    free(args);
+    
+    out_redirect(STDOUT_FILENO, STDERR_FILENO);
+    in_redirect(STDIN_FILENO);
+    if (passed && fchdir(g_home_fd) == -1) {
+        err_write("Error: Could not return to the server's working directory\n", 58);
+    }
+    close_passed(client);
+    set_blocking(client->fd, 0);
+    
+    if (result != 1) {
+        send_status(client, number, result);
+    }
+    return result;
+}
+
+/**
+ * Run every complete request a client has sent so far
+ * A request is either a command line ending in '\n', or ':' and a
+ * decimal length on a line of its own, followed by that many bytes of
+ * NUL-terminated arguments.
+ * 
+ * @param client Client to serve
+ * @param commands How to parse and run commands
+ * @param sched Scheduler of the server, or NULL
+ * @return 0 to keep the connection, -1 to close it
+ */
+static int serve_client(struct client *client, const struct serve_commands *commands,
+                        struct scheduler *sched) {
+    size_t pos = 0;
+    int keep = 1;
+    
+    while (keep && pos < client->len) {
+        char *frame = client->buffer + pos;
+        size_t avail = client->len - pos;
+        char *newline = memchr(frame, '\n', avail);
+        if (!newline) {
+            keep = (avail <= SERVE_MAX_REQUEST);
+            break;
+        }
+        
+        if (frame[0] == ':') {
+            long request_len = 0;
+            *newline = '\0';
+            if (parse_number(frame + 1, &request_len) == -1 || request_len == 0 ||
+                request_len > SERVE_MAX_REQUEST) {
+                keep = 0;
+                break;
+            }
+            *newline = '\n';
+            
+            size_t header_len = newline - frame + 1;
+            if (avail < header_len + request_len) {
+                break; // The rest has not arrived yet
+            }
+            char *request = frame + header_len;
+            if (request[request_len - 1] != '\0') {
+                keep = 0;
+                break;
+            }
+            keep = run_client_request(client, request, request_len, 0, commands, sched) != 1;
+            pos += header_len + request_len;
+            continue;
+        }
+        
+        size_t line_len = newline - frame;
+        pos += line_len + 1;
+        *newline = '\0';
+        if (line_len > 0 && frame[line_len - 1] == '\r') {
+            frame[line_len - 1] = '\0';
+        }
+        
+        // Blank lines and comments are skipped, as in a batch script
+        char *command = frame;
+        while (*command == ' ' || *command == '\t') {
+            command++;
+        }
+        if (*command != '\0' && *command != '#') {
+            keep = run_client_request(client, command, strlen(command), 1, commands, sched) != 1;
+        }
+    }
+    
+    if (!keep && pos < client->len) {
+        const char *message = "Error: Malformed request\n";
+        set_blocking(client->fd, 1);
+        send_all(client->fd, message, strlen(message));
+    }
+    
+    memmove(client->buffer, client->buffer + pos, client->len - pos);
+    client->len -= pos;
+    return keep ? 0 : -1;
+}
+
+/**
+ * Create the listening socket, replacing a stale one left by a dead server
+ * 
+ * @param path Path of the socket
+ * @return Listening descriptor, or -1 after reporting the failure
+ */
+static int listen_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Socket path \"%s\" is too long\n", path);
+        err_write(error_msg, len);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    int result = (fd == -1) ? -1 : bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (result == -1 && errno == EADDRINUSE) {
+        // Nobody answering means the socket outlived its server
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == -1 &&
+            errno == ECONNREFUSED && unlink(path) == 0) {
+            result = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        } else {
+            errno = EADDRINUSE;
+        }
+        if (probe != -1) {
+            close(probe);
+        }
+    }
+    if (result == 0) {
+        result = listen(fd, 128);
+    }
+    
+    if (result == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not listen on \"%s\": %s\n", path, strerror(errno));
+        err_write(error_msg, len);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Accept every pending connection
+ * 
+ * @param epoll_fd epoll instance to add the clients to
+ * @param listen_fd Listening socket
+ * @param client_count Number of connected clients, updated
+ */
+static void accept_clients(int epoll_fd, int listen_fd, int *client_count) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // EAGAIN once the backlog is empty
+        }
+        
+        struct client *client = (*client_count < SERVE_MAX_CLIENTS) ?
+                                calloc(1, sizeof(*client)) : NULL;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        if (!client || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            free(client);
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        (*client_count)++;
+    }
+}
+
+/**
+ * Answer every pending connection to the metrics socket with the stats
+ * The answer is plain HTTP/1.0 carrying the Prometheus text format, so
+ * curl --unix-socket or a scraper behind a socket proxy can read it.
+ * The request itself is read but not looked at.
+ * 
+ * @param listen_fd Metrics listening socket
+ */
+static void answer_metrics(int listen_fd) {
+    static const char *const header = 
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Connection: close\r\n\r\n";
+    
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // EAGAIN once the backlog is empty
+        }
+        
+        // A stalled client must not hold up the other clients for long
+        struct timeval timeout = { METRICS_TIMEOUT_MS / 1000, (METRICS_TIMEOUT_MS % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        
+        // Taking the whole request first keeps the close from resetting it
+        char request[METRICS_REQUEST_SIZE];
+        size_t len = 0;
+        while (len < sizeof(request)) {
+            ssize_t received = read(fd, request + len, sizeof(request) - len);
+            if (received <= 0 && !(received == -1 && errno == EINTR)) {
+                break;
+            }
+            len += (received > 0) ? received : 0;
+            if (memmem(request, len, "\r\n\r\n", 4)) {
+                break;
+            }
+        }
+        
+        if (send_all(fd, header, strlen(header)) == 0) {
+            out_redirect(fd, fd);
+            stats_write(out_write, STATS_PROMETHEUS);
+            out_redirect(STDOUT_FILENO, STDERR_FILENO);
+        }
+        close(fd);
+    }
+}
+
+/**
+ * Serve requests on a UNIX socket until the process is stopped
+ * SIGINT or SIGTERM stops the server once the current request and those
+ * queued or on lanes are done. With append_mode = group, the appends
+ * that arrive in one wakeup, from any clients, are committed together
+ * before the server waits again. Clients are multiplexed with epoll and
+ * their requests run in this process, which keeps the log writer, the
+ * directory cache and mapped indexes warm from one request to the next.
+ * With more than one job, single-file commands run on scheduler lanes
+ * while the loop goes on reading; replies still go out in the order
+ * requests arrived.
+ * 
+ * @param path Path of the socket
+ * @param metrics_path Path of a socket to answer HTTP requests for the
+ *        stats on, or NULL
+ * @param commands How to parse and run commands
+ * @param jobs Number of lanes, 1 to run every request on this thread
+ * @return 0 once stopped by a signal, -1 if the server could not start or failed
+ */
+int serve_socket(const char *path, const char *metrics_path, 
+                 const struct serve_commands *commands, int jobs) {
+    int listen_fd = listen_socket(path);
+    if (listen_fd == -1) {
+        return -1;
+    }
+    if (metrics_path && (g_metrics_fd = listen_socket(metrics_path)) == -1) {
+        close(listen_fd);
+        return -1;
+    }
+    
+    g_home_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    struct epoll_event metrics_event;
+    metrics_event.events = EPOLLIN;
+    metrics_event.data.ptr = &g_metrics_fd;
+    struct epoll_event exit_event;
+    exit_event.events = EPOLLIN;
+    exit_event.data.ptr = &g_exit_tag;
+    if (g_home_fd == -1 || fstat(g_home_fd, &g_home_stat) == -1 || epoll_fd == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1 ||
+        (g_metrics_fd != -1 && 
+         epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_metrics_fd, &metrics_event) == -1) ||
+        (exit_request_fd() != -1 &&
+         epoll_ctl(epoll_fd, EPOLL_CTL_ADD, exit_request_fd(), &exit_event) == -1)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not start server: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        close(listen_fd);
+        if (g_metrics_fd != -1) {
+            close(g_metrics_fd);
+        }
+        return -1;
+    }
+    
+    // A client that hangs up mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+    start_log_flusher();
+    fd_cache_keep_warm(1, 1);
+    dir_index_keep_warm(1);
+    
+    // Finished lane requests are announced on the scheduler's eventfd
+    struct scheduler *sched = (jobs > 1) ?
+                              sched_create(jobs, run_lane_task, finish_lane_task,
+                                           (void *)commands) : NULL;
+    event.events = EPOLLIN;
+    event.data.ptr = sched;
+    if (sched && (sched_notify_fd(sched) == -1 ||
+                  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sched_notify_fd(sched), &event) == -1)) {
+        sched_destroy(sched); // Replies would wait for the next request
+        sched = NULL;
+    }
+    
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "Server listening on \"%s\".", path);
+    log_operation(log_msg);
+    
+    char start_msg[256];
+    int start_len = string_format(start_msg, sizeof(start_msg), "Serving on \"%s\"\n", path);
+    out_write(start_msg, start_len);
+    out_flush();
+    
+    int client_count = 0;
+    struct epoll_event events[SERVE_EVENT_BATCH];
+    while (!exit_requested()) {
+        // Files held for a group sync are synced once the server goes idle
+        int timeout = -1;
+        if (durability_level() == DURABILITY_GROUP) {
+            timeout = config_get_number("durability_interval", DURABILITY_DEFAULT_INTERVAL);
+        }
+        
+        int ready = epoll_wait(epoll_fd, events, SERVE_EVENT_BATCH, timeout);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (ready == 0) {
+            durability_commit();
+            continue;
+        }
+        
+        for (int i = 0; i < ready && !exit_requested(); i++) {
+            if (events[i].data.ptr == &g_exit_tag) {
+                continue; // The loop condition sees the request
+            }
+            if (sched && events[i].data.ptr == sched) {
+                sched_collect(sched);
+                continue;
+            }
+            if (events[i].data.ptr == &g_metrics_fd) {
+                answer_metrics(g_metrics_fd);
+                continue;
+            }
+            struct client *client = (struct client *)events[i].data.ptr;
+            if (!client) {
+                accept_clients(epoll_fd, listen_fd, &client_count);
+                continue;
+            }
+            
+            int received = receive_client(client);
+            if (received == -1 ||
+                (received == 1 && serve_client(client, commands, sched) == -1)) {
+                close_client(epoll_fd, client);
+                client_count--;
+            }
+        }
+        
+        // Appends that arrived in this wakeup are written together
+        commit_client_group(commands, sched);
+    }
+    
+    int result = 0;
+    if (exit_requested()) {
+        string_format(log_msg, sizeof(log_msg), "Server on \"%s\" stopped.", path);
+        log_operation(log_msg);
+    } else {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Server stopped: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        result = -1;
+    }
+    
+    // Requests still queued or on lanes finish and get their replies
+    commit_client_group(commands, sched);
+    sched_destroy(sched);
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(path);
+    if (g_metrics_fd != -1) {
+        close(g_metrics_fd);
+        unlink(metrics_path);
+    }
+    return result;
+}
+
+/**
+ * Forward a command to a server and return its exit status
+ * The command's arguments go as one length-framed request, together
+ * with this process's standard output, standard error, working directory
+ * and standard input, so the server's output lands where ours would have
+ * and -0 reads the paths we were given.
+ * 
+ * @param path Path of the server's socket
+ * @param args Command and its arguments
+ * @param count Number of arguments
+ * @return Exit status of the command, EXIT_FAILURE if it could not be sent
+ */
+int serve_forward(const char *path, char *const args[], int count) {
+    size_t request_len = 0;
+    for (int i = 0; i < count; i++) {
+        request_len += strlen(args[i]) + 1;
+    }
+    if (request_len > SERVE_MAX_REQUEST) {
+        err_write("Error: Command is too long to forward\n", 38);
+        return EXIT_FAILURE;
+    }
+    
+    char *request = malloc(request_len);
+    if (!request) {
+        err_write("Error: Memory allocation failed\n", 32);
+        return EXIT_FAILURE;
+    }
+    char *end = request;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(args[i]) + 1;
+        memcpy(end, args[i], len);
+        end += len;
+    }
+    
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    size_t path_len = strlen(path);
+    int fd = (path_len < sizeof(addr.sun_path)) ? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+    if (fd != -1) {
+        memcpy(addr.sun_path, path, path_len + 1);
+    }
+    int cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (path_len >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+    }
+    if (fd == -1 || cwd_fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not connect to \"%s\": %s\n", path, strerror(errno));
+        err_write(error_msg, len);
+        if (fd != -1) {
+            close(fd);
+        }
+        if (cwd_fd != -1) {
+            close(cwd_fd);
+        }
+        free(request);
+        return EXIT_FAILURE;
+    }
+    
+    char header[32];
+    int header_len = string_format(header, sizeof(header), ":%ld\n", (long)request_len);
+    struct iovec iov[2] = { { header, header_len }, { request, request_len } };
+    int passed[SERVE_PASSED_FDS] = { STDOUT_FILENO, STDERR_FILENO, cwd_fd, STDIN_FILENO };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(passed))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(passed));
+    memcpy(CMSG_DATA(cmsg), passed, sizeof(passed));
+    
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    close(cwd_fd);
+    
+    // The descriptors went with the first bytes; send whatever is left
+    size_t total = header_len + request_len;
+    int result = (sent == -1) ? -1 : 0;
+    if (result == 0 && (size_t)sent < total) {
+        size_t header_left = ((size_t)sent < (size_t)header_len) ? header_len - sent : 0;
+        size_t request_done = ((size_t)sent > (size_t)header_len) ? sent - header_len : 0;
+        if (send_all(fd, header + header_len - header_left, header_left) == -1 ||
+            send_all(fd, request + request_done, request_len - request_done) == -1) {
+            result = -1;
+        }
+    }
+    free(request);
+    
+    // The reply is the status line; the output went straight to our descriptors
+    char reply[128];
+    size_t reply_len = 0;
+    while (result == 0 && reply_len < sizeof(reply) - 1) {
+        ssize_t received = read(fd, reply + reply_len, sizeof(reply) - 1 - reply_len);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        reply_len += received;
+        if (memchr(reply, '\n', reply_len)) {
+            break;
+        }
+    }
+    close(fd);
+    reply[reply_len] = '\0';
+    
+    char *line_end = strchr(reply, '\n');
+    if (line_end) {
+        *line_end = '\0';
+    }
+    const char *status = strstr(reply, "] exit status ");
+    long exit_status;
+    if (result == -1 || !status || parse_number(status + 14, &exit_status) == -1) {
+        // exit and quit end the connection without a status
+        if (result == 0 && reply_len == 0 && count == 1 &&
+            (strcmp(args[0], "exit") == 0 || strcmp(args[0], "quit") == 0)) {
+            return EXIT_SUCCESS;
+        }
+        err_write("Error: No reply from the server\n", 32);
+        return EXIT_FAILURE;
+    }
+    return (int)exit_status;
+}
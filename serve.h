@@ -0,0 +1,52 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+
+// Longest request a client may send
+#define SERVE_MAX_REQUEST (1024 * 1024)
+
+// Connections a server accepts at once
+#define SERVE_MAX_CLIENTS 256
+
+// Most arguments a request may hold
+#define SERVE_MAX_ARGS 65536
+
+// parse() result for a request with more than SERVE_MAX_ARGS arguments
+#define SERVE_TOO_MANY_ARGS -2
+
+// How the server turns requests into commands and runs them
+struct serve_commands {
+    // Split a request into NULL-terminated arguments and return their
+    // count, -1 if memory allocation failed, or SERVE_TOO_MANY_ARGS; a
+    // line request is a command line in batch syntax, otherwise the
+    // request holds NUL-terminated arguments; the array and its
+    // arguments are one malloc() block, freed by the server
+    int (*parse)(char *request, size_t len, int is_line, char ***args);
+    
+    // Path a command works on if it may run beside others, or NULL
+    const char *(*lane)(char *args[], int count);
+    
+    // Run a command and return its result (1 ends the connection)
+    int (*run)(char *args[], int count);
+    
+    // Queue a command to be run with others in one group commit: 0 if
+    // queued, 1 if queued and the group is full, -1 if it must run alone
+    int (*queue)(char *args[], int count, long tag);
+    
+    // Run every queued command, calling start before and done after the
+    // output of each, in queue order
+    int (*commit)(void (*start)(long tag, void *context),
+                  void (*done)(long tag, int result, void *context), void *context);
+};
+
+// Serve requests on a UNIX socket until the process is stopped, running
+// commands on up to jobs threads; metrics_path, if not NULL, answers
+// HTTP requests with the stats in the Prometheus format
+int serve_socket(const char *path, const char *metrics_path, 
+                 const struct serve_commands *commands, int jobs);
+
+// Forward a command to a server and return its exit status
+int serve_forward(const char *path, char *const args[], int count);
+
+#endif // SERVE_H
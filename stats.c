@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include "stats.h"
+#include "utils.h"
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Linear buckets below this value; log-linear above it
+#define LINEAR_LIMIT (2 << STATS_SUB_BITS)
+
+// Counts of values falling into log-linear ranges
+struct histogram {
+    unsigned long count;
+    unsigned long long sum_ns;
+    unsigned long long max_ns;
+    unsigned long buckets[STATS_BUCKETS];
+};
+
+// Everything recorded for one operation
+struct operation_stats {
+    char name[32];
+    unsigned long failed;
+    unsigned long long sys_ns;  // Kernel time, the command's own and its child's
+    unsigned long long wait_ns[STATS_WAIT_KINDS];
+    struct histogram latency;
+};
+
+// Names of the wait kinds, indexed by enum stats_wait
+static const char *const g_wait_names[] = { "append_lock", "log_lock", "fork_wait", "sync" };
+
+// Operations in the order first seen; entries are only ever appended,
+// and the one past the named entries collects every operation beyond
+static struct operation_stats g_operations[STATS_MAX_OPERATIONS + 1] = {
+    [STATS_MAX_OPERATIONS] = { .name = "other" }
+};
+static int g_operation_count = 0;
+static pthread_mutex_t g_register_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Every wait, whether or not a command was being timed
+static struct histogram g_waits[STATS_WAIT_KINDS];
+
+// The calling thread's running totals, read at both ends of a command
+static __thread long long t_wait_ns[STATS_WAIT_KINDS];
+static __thread long long t_child_sys_ns = 0;
+
+/**
+ * Get the monotonic time in nanoseconds
+ * 
+ * @return Current time
+ */
+long long stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Get the kernel time used by the calling thread and its children
+ * 
+ * @return System time in nanoseconds
+ */
+static long long thread_sys_ns(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == -1) {
+        return t_child_sys_ns;
+    }
+    return (long long)usage.ru_stime.tv_sec * 1000000000LL +
+           usage.ru_stime.tv_usec * 1000LL + t_child_sys_ns;
+}
+
+/**
+ * Find the bucket of a value
+ * Values below LINEAR_LIMIT get a bucket each; above it every power of
+ * two is split into 2^STATS_SUB_BITS buckets of equal width.
+ * 
+ * @param ns Value in nanoseconds
+ * @return Bucket index
+ */
+static int bucket_index(unsigned long long ns) {
+    if (ns < LINEAR_LIMIT) {
+        return (int)ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - STATS_SUB_BITS;
+    int index = (shift << STATS_SUB_BITS) + (int)(ns >> shift);
+    return (index < STATS_BUCKETS) ? index : STATS_BUCKETS - 1;
+}
+
+/**
+ * Get the value in the middle of a bucket
+ * 
+ * @param index Bucket index
+ * @return Value in nanoseconds
+ */
+static unsigned long long bucket_value(int index) {
+    if (index < LINEAR_LIMIT) {
+        return index;
+    }
+    int shift = (index >> STATS_SUB_BITS) - 1;
+    unsigned long long sub = (index & ((1 << STATS_SUB_BITS) - 1)) + (1 << STATS_SUB_BITS);
+    return (sub << shift) + ((1ULL << shift) >> 1);
+}
+
+/**
+ * Add a value to a histogram
+ * Atomic, as commands on several lanes record at once.
+ * 
+ * @param histogram Histogram to add to
+ * @param ns Value in nanoseconds
+ */
+static void histogram_add(struct histogram *histogram, long long ns) {
+    unsigned long long value = (ns > 0) ? (unsigned long long)ns : 0;
+    __atomic_add_fetch(&histogram->buckets[bucket_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum_ns, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    
+    unsigned long long max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&histogram->max_ns, &max, value, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * Get a value below which a fraction of a histogram's values fall
+ * 
+ * @param histogram Histogram to read
+ * @param permille Fraction, in thousandths
+ * @return The value in microseconds, 0 for an empty histogram
+ */
+static long histogram_quantile(const struct histogram *histogram, int permille) {
+    unsigned long count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    unsigned long wanted = (count * permille + 999) / 1000;
+    unsigned long seen = 0;
+    for (int i = 0; i < STATS_BUCKETS && count > 0; i++) {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= wanted) {
+            // The top bucket's middle may lie past the largest value seen
+            unsigned long long value = bucket_value(i);
+            return (long)(((value < max) ? value : max) / 1000);
+        }
+    }
+    return (long)(max / 1000);
+}
+
+/**
+ * Find an operation's entry, adding it the first time
+ * 
+ * @param name Operation name
+ * @return The entry; the shared "other" entry once the table is full
+ */
+static struct operation_stats *find_operation(const char *name) {
+    int count = __atomic_load_n(&g_operation_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(g_operations[i].name, name) == 0) {
+            return &g_operations[i];
+        }
+    }
+    
+    pthread_mutex_lock(&g_register_mutex);
+    struct operation_stats *entry = NULL;
+    count = g_operation_count;
+    for (int i = 0; i < count && !entry; i++) {
+        if (strcmp(g_operations[i].name, name) == 0) {
+            entry = &g_operations[i];
+        }
+    }
+    if (!entry && count == STATS_MAX_OPERATIONS) {
+        entry = &g_operations[STATS_MAX_OPERATIONS];
+    }
+    if (!entry) {
+        entry = &g_operations[count];
+        size_t len = strlen(name);
+        if (len >= sizeof(entry->name)) {
+            len = sizeof(entry->name) - 1;
+        }
+        memcpy(entry->name, name, len);
+        entry->name[len] = '\0';
+        
+        // Published once the name is complete, for lock-free lookups
+        __atomic_store_n(&g_operation_count, count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_register_mutex);
+    return entry;
+}
+
+/**
+ * Start timing a command on the calling thread
+ * 
+ * @param timer Filled with the thread's starting totals
+ */
+void stats_command_begin(struct stats_timer *timer) {
+    timer->sys_ns = thread_sys_ns();
+    memcpy(timer->wait_ns, t_wait_ns, sizeof(timer->wait_ns));
+    timer->start_ns = stats_now();
+}
+
+/**
+ * Record a finished command
+ * Its latency goes into the operation's histogram; the kernel time and
+ * waits it ran up are added to the operation's totals.
+ * 
+ * @param timer Timer started by stats_command_begin()
+ * @param operation Operation name
+ * @param failed 1 if the command failed
+ */
+void stats_command_end(const struct stats_timer *timer, const char *operation, int failed) {
+    long long elapsed = stats_now() - timer->start_ns;
+    struct operation_stats *entry = find_operation(operation);
+    
+    histogram_add(&entry->latency, elapsed);
+    if (failed) {
+        __atomic_add_fetch(&entry->failed, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&entry->sys_ns, thread_sys_ns() - timer->sys_ns, __ATOMIC_RELAXED);
+    for (int i = 0; i < STATS_WAIT_KINDS; i++) {
+        __atomic_add_fetch(&entry->wait_ns[i], t_wait_ns[i] - timer->wait_ns[i], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Record a wait that started at start_ns and ends now
+ * 
+ * @param kind What was waited for
+ * @param start_ns stats_now() when the wait started
+ */
+void stats_wait(enum stats_wait kind, long long start_ns) {
+    long long waited = stats_now() - start_ns;
+    histogram_add(&g_waits[kind], waited);
+    t_wait_ns[kind] += waited;
+}
+
+/**
+ * Add kernel time used by an isolated child to the current command
+ * 
+ * @param sys_ns The child's system time in nanoseconds
+ */
+void stats_child_time(long long sys_ns) {
+    t_child_sys_ns += sys_ns;
+}
+
+/**
+ * Write the summary of one histogram in the Prometheus format
+ * 
+ * @param emit Function to write with
+ * @param metric Metric name
+ * @param label Label name
+ * @param value Label value
+ * @param histogram Histogram to write
+ * @return 0 on success, -1 if writing failed
+ */
+static int write_summary(int (*emit)(const char *, size_t), const char *metric,
+                         const char *label, const char *value,
+                         const struct histogram *histogram) {
+    static const int permilles[] = { 500, 900, 990, 999 };
+    static const char *const quantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+    char line[256];
+    int len;
+    int result = 0;
+    
+    for (int i = 0; i < 4; i++) {
+        len = string_format(line, sizeof(line), "%s{%s=\"%s\",quantile=\"%s\"} %ld\n", 
+                      metric, label, value, quantiles[i],
+                      histogram_quantile(histogram, permilles[i]));
+        result |= emit(line, len);
+    }
+    len = string_format(line, sizeof(line), "%s_sum{%s=\"%s\"} %ld\n%s_count{%s=\"%s\"} %ld\n", 
+                  metric, label, value,
+                  (long)(__atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED) / 1000),
+                  metric, label, value,
+                  (long)__atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+    result |= emit(line, len);
+    return result;
+}
+
+/**
+ * Write every operation's stats in the Prometheus text format
+ * Times are in microseconds.
+ * 
+ * @param emit Function to write with
+ * @param entries Operations to write
+ * @param count Number of operations
+ * @return 0 on success, -1 if writing failed
+ */
+static int write_prometheus(int (*emit)(const char *, size_t), 
+                            const struct operation_stats *const *entries, int count) {
+    static const char *const latency_header =
+        "# HELP fileManager_operation_latency_microseconds Time to run a command.\n"
+        "# TYPE fileManager_operation_latency_microseconds summary\n";
+    static const char *const failed_header =
+        "# HELP fileManager_operation_failures_total Commands that failed.\n"
+        "# TYPE fileManager_operation_failures_total counter\n";
+    static const char *const time_header =
+        "# HELP fileManager_operation_time_microseconds_total Kernel time and waits of commands.\n"
+        "# TYPE fileManager_operation_time_microseconds_total counter\n";
+    static const char *const wait_header =
+        "# HELP fileManager_wait_microseconds Time spent in a single wait.\n"
+        "# TYPE fileManager_wait_microseconds summary\n";
+    char line[256];
+    int len;
+    int result = emit(latency_header, strlen(latency_header));
+    
+    for (int i = 0; i < count; i++) {
+        result |= write_summary(emit, "fileManager_operation_latency_microseconds",
+                                "operation", entries[i]->name, &entries[i]->latency);
+    }
+    
+    result |= emit(failed_header, strlen(failed_header));
+    for (int i = 0; i < count; i++) {
+        len = string_format(line, sizeof(line), 
+                      "fileManager_operation_failures_total{operation=\"%s\"} %ld\n", 
+                      entries[i]->name,
+                      (long)__atomic_load_n(&entries[i]->failed, __ATOMIC_RELAXED));
+        result |= emit(line, len);
+    }
+    
+    result |= emit(time_header, strlen(time_header));
+    for (int i = 0; i < count; i++) {
+        const struct operation_stats *entry = entries[i];
+        len = string_format(line, sizeof(line), 
+                      "fileManager_operation_time_microseconds_total{operation=\"%s\",kind=\"system\"} %ld\n", 
+                      entry->name, (long)(__atomic_load_n(&entry->sys_ns, __ATOMIC_RELAXED) / 1000));
+        result |= emit(line, len);
+        for (int kind = 0; kind < STATS_WAIT_KINDS; kind++) {
+            len = string_format(line, sizeof(line), 
+                          "fileManager_operation_time_microseconds_total{operation=\"%s\",kind=\"%s\"} %ld\n", 
+                          entry->name, g_wait_names[kind],
+                          (long)(__atomic_load_n(&entry->wait_ns[kind], __ATOMIC_RELAXED) / 1000));
+            result |= emit(line, len);
+        }
+    }
+    
+    result |= emit(wait_header, strlen(wait_header));
+    for (int kind = 0; kind < STATS_WAIT_KINDS; kind++) {
+        result |= write_summary(emit, "fileManager_wait_microseconds", "kind",
+                                g_wait_names[kind], &g_waits[kind]);
+    }
+    return result ? -1 : 0;
+}
+
+/**
+ * Write every operation's stats
+ * The text format has a line per operation with its count, failures,
+ * latency percentiles and the time its commands spent in the kernel and
+ * waiting, then a line per kind of wait. Times are in microseconds.
+ * 
+ * @param emit Function to write with, such as out_write or err_write
+ * @param format Output format
+ * @return 0 on success, -1 if writing failed
+ */
+int stats_write(int (*emit)(const char *, size_t), enum stats_format format) {
+    // The named operations, then "other" once anything was counted there
+    const struct operation_stats *entries[STATS_MAX_OPERATIONS + 1];
+    int count = __atomic_load_n(&g_operation_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        entries[i] = &g_operations[i];
+    }
+    const struct operation_stats *other = &g_operations[STATS_MAX_OPERATIONS];
+    if (__atomic_load_n(&other->latency.count, __ATOMIC_RELAXED) > 0) {
+        entries[count++] = other;
+    }
+    
+    if (format == STATS_PROMETHEUS) {
+        return write_prometheus(emit, entries, count);
+    }
+    
+    char line[512];
+    int len;
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        const struct operation_stats *entry = entries[i];
+        const struct histogram *latency = &entry->latency;
+        len = string_format(line, sizeof(line), 
+                      "%s count=%ld failed=%ld p50=%ldus p90=%ldus p99=%ldus max=%ldus "
+                      "total=%ldus system=%ldus", 
+                      entry->name, (long)__atomic_load_n(&latency->count, __ATOMIC_RELAXED),
+                      (long)__atomic_load_n(&entry->failed, __ATOMIC_RELAXED),
+                      histogram_quantile(latency, 500), histogram_quantile(latency, 900),
+                      histogram_quantile(latency, 990),
+                      (long)(__atomic_load_n(&latency->max_ns, __ATOMIC_RELAXED) / 1000),
+                      (long)(__atomic_load_n(&latency->sum_ns, __ATOMIC_RELAXED) / 1000),
+                      (long)(__atomic_load_n(&entry->sys_ns, __ATOMIC_RELAXED) / 1000));
+        for (int kind = 0; kind < STATS_WAIT_KINDS; kind++) {
+            len += string_format(line + len, sizeof(line) - len, " %s=%ldus", g_wait_names[kind], 
+                           (long)(__atomic_load_n(&entry->wait_ns[kind], __ATOMIC_RELAXED) / 1000));
+        }
+        line[len++] = '\n';
+        result |= emit(line, len);
+    }
+    
+    for (int kind = 0; kind < STATS_WAIT_KINDS; kind++) {
+        const struct histogram *waits = &g_waits[kind];
+        len = string_format(line, sizeof(line), 
+                      "wait:%s count=%ld p50=%ldus p90=%ldus p99=%ldus max=%ldus total=%ldus\n", 
+                      g_wait_names[kind], (long)__atomic_load_n(&waits->count, __ATOMIC_RELAXED),
+                      histogram_quantile(waits, 500), histogram_quantile(waits, 900),
+                      histogram_quantile(waits, 990),
+                      (long)(__atomic_load_n(&waits->max_ns, __ATOMIC_RELAXED) / 1000),
+                      (long)(__atomic_load_n(&waits->sum_ns, __ATOMIC_RELAXED) / 1000));
+        result |= emit(line, len);
+    }
+    return result ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+// Latency histograms: 2^STATS_SUB_BITS buckets per power of two of
+// nanoseconds (about 6% apart), up to 2^40 ns
+#define STATS_SUB_BITS 4
+#define STATS_BUCKETS 608
+
+// Operations tracked by name; any beyond are counted together as "other"
+#define STATS_MAX_OPERATIONS 48
+
+// Time spent waiting, counted per command and with a histogram of its own
+enum stats_wait {
+    STATS_APPEND_LOCK,  // flock() on a file being appended to
+    STATS_LOG_LOCK,     // flock() on the log
+    STATS_FORK_WAIT,    // Forking and waiting for an isolated child
+    STATS_SYNC,         // fdatasync() for the durability level
+    STATS_WAIT_KINDS
+};
+
+// How stats are written
+enum stats_format {
+    STATS_TEXT,         // One line of key=value pairs per operation
+    STATS_PROMETHEUS    // Prometheus text exposition format
+};
+
+// A command being timed on the calling thread
+struct stats_timer {
+    long long start_ns;
+    long long sys_ns;
+    long long wait_ns[STATS_WAIT_KINDS];
+};
+
+// Get the monotonic time in nanoseconds
+long long stats_now(void);
+
+// Start timing a command on the calling thread
+void stats_command_begin(struct stats_timer *timer);
+
+// Record a finished command under its operation name
+void stats_command_end(const struct stats_timer *timer, const char *operation, int failed);
+
+// Record a wait that started at start_ns and ends now
+void stats_wait(enum stats_wait kind, long long start_ns);
+
+// Add kernel time used by an isolated child to the calling thread's command
+void stats_child_time(long long sys_ns);
+
+// Write every operation's stats through emit (out_write or err_write)
+int stats_write(int (*emit)(const char *, size_t), enum stats_format format);
+
+#endif // STATS_H
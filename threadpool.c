@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include "threadpool.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Initial number of task slots in each deque
+#define POOL_DEQUE_SIZE 64
+
+// Most workers a pool will start
+#define POOL_MAX_WORKERS 256
+
+// Tasks of one worker: the owner works at the tail, thieves at the head
+struct pool_deque {
+    pthread_mutex_t lock;
+    void **tasks;       // Ring of capacity slots
+    size_t capacity;
+    size_t head;        // Slot of the oldest task
+    size_t count;
+};
+
+struct pool_worker {
+    struct thread_pool *pool;
+    pthread_t thread;
+    int index;
+    int started;
+};
+
+struct thread_pool {
+    pool_task_fn run;
+    void *context;
+    int size;
+    struct pool_worker *workers;
+    struct pool_deque *deques;
+    
+    long queued;     // Tasks sitting in deques; accessed atomically
+    long pending;    // Tasks queued or running; accessed atomically
+    int sleepers;    // Workers waiting for tasks; accessed atomically
+    int stop;
+    unsigned next;   // Deque for the next task from outside the pool
+    
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;  // Signalled when a task is queued
+    pthread_cond_t idle_cond;  // Signalled when pending drops to zero
+};
+
+/**
+ * Add a task at the tail of a deque, growing it if needed
+ * 
+ * @param deque Deque to push onto
+ * @param task Task to add
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int deque_push(struct pool_deque *deque, void *task) {
+    pthread_mutex_lock(&deque->lock);
+    
+    if (deque->count == deque->capacity) {
+        size_t capacity = deque->capacity * 2;
+        void **tasks = malloc(capacity * sizeof(*tasks));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+    
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/**
+ * Take a task from a deque
+ * 
+ * @param deque Deque to take from
+ * @param newest 1 to take the newest task (owner), 0 for the oldest (thief)
+ * @return Task, or NULL if the deque is empty
+ */
+static void *deque_take(struct pool_deque *deque, int newest) {
+    void *task = NULL;
+    
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        if (newest) {
+            task = deque->tasks[(deque->head + deque->count - 1) % deque->capacity];
+        } else {
+            task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    
+    return task;
+}
+
+/**
+ * Find a task for a worker: its own newest, else another worker's oldest
+ * Newest-first keeps a worker deep in the part of the work it already
+ * started, while thieves take the oldest tasks, which tend to be largest.
+ * 
+ * @param pool Pool to search
+ * @param index Worker looking for a task
+ * @return Task, or NULL if every deque is empty
+ */
+static void *find_task(struct thread_pool *pool, int index) {
+    void *task = deque_take(&pool->deques[index], 1);
+    
+    for (int i = 1; !task && i < pool->size; i++) {
+        task = deque_take(&pool->deques[(index + i) % pool->size], 0);
+    }
+    
+    if (task) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return task;
+}
+
+/**
+ * Worker thread: run tasks until the pool is stopped
+ * 
+ * @param arg Pointer to the worker's struct pool_worker
+ * @return NULL
+ */
+static void *worker_main(void *arg) {
+    struct pool_worker *worker = (struct pool_worker *)arg;
+    struct thread_pool *pool = worker->pool;
+    
+    while (1) {
+        void *task = find_task(pool, worker->index);
+        if (task) {
+            pool->run(task, worker->index, pool->context);
+            
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->idle_cond);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+        
+        // Nothing to run or steal; sleep until a task is queued
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (!pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Get the default number of workers
+ * 
+ * @return Number of online CPUs, at least 1
+ */
+int pool_default_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return (cpus > POOL_MAX_WORKERS) ? POOL_MAX_WORKERS : (int)cpus;
+}
+
+/**
+ * Create a pool and start its workers
+ * 
+ * @param workers Number of worker threads, capped at POOL_MAX_WORKERS
+ * @param run Function that runs one task
+ * @param context Passed to every call of run
+ * @return New pool, or NULL on failure
+ */
+struct thread_pool *pool_create(int workers, pool_task_fn run, void *context) {
+    if (workers < 1) {
+        workers = 1;
+    }
+    if (workers > POOL_MAX_WORKERS) {
+        workers = POOL_MAX_WORKERS;
+    }
+    
+    struct thread_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->run = run;
+    pool->context = context;
+    pool->workers = calloc(workers, sizeof(*pool->workers));
+    pool->deques = calloc(workers, sizeof(*pool->deques));
+    if (!pool->workers || !pool->deques) {
+        free(pool->workers);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    
+    for (int i = 0; i < workers; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].tasks = malloc(POOL_DEQUE_SIZE * sizeof(void *));
+        pool->deques[i].capacity = POOL_DEQUE_SIZE;
+        pool->size = i + 1;
+        if (!pool->deques[i].tasks) {
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+    
+    for (int i = 0; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            // Run with the workers that did start, if any
+            if (i == 0) {
+                pool_destroy(pool);
+                return NULL;
+            }
+            break;
+        }
+        pool->workers[i].started = 1;
+    }
+    
+    return pool;
+}
+
+/**
+ * Queue a task
+ * Tasks queued by a worker go to its own deque, so related work stays
+ * on one thread unless another worker runs out.
+ * 
+ * @param pool Pool to run the task
+ * @param worker Index of the calling worker, or -1 when called from outside
+ * @param task Task to queue
+ * @return 0 on success, -1 if memory allocation failed
+ */
+int pool_submit(struct thread_pool *pool, int worker, void *task) {
+    if (worker < 0 || worker >= pool->size) {
+        worker = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->size;
+    }
+    
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if (deque_push(&pool->deques[worker], task) == -1) {
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    
+    // A sleeper checks queued under the lock, so this wakeup cannot be lost
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    
+    return 0;
+}
+
+/**
+ * Get the number of workers
+ * 
+ * @param pool Pool to query
+ * @return Number of workers, and so of valid worker indexes
+ */
+int pool_size(const struct thread_pool *pool) {
+    return pool->size;
+}
+
+/**
+ * Wait until every queued task has run
+ * 
+ * @param pool Pool to wait for
+ */
+void pool_wait(struct thread_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0) {
+        pthread_cond_wait(&pool->idle_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Stop the workers and free the pool
+ * 
+ * @param pool Pool to destroy, with no tasks pending
+ */
+void pool_destroy(struct thread_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 0; i < pool->size; i++) {
+        if (pool->workers[i].started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+    
+    for (int i = 0; i < pool->size; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
@@ -0,0 +1,30 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Pool of worker threads, each with its own deque of tasks
+// A worker runs its newest task first and, when its deque is empty,
+// steals the oldest task of another worker.
+struct thread_pool;
+
+// Run one task; worker is the index of the calling worker thread
+typedef void (*pool_task_fn)(void *task, int worker, void *context);
+
+// Default number of workers: one per online CPU
+int pool_default_workers(void);
+
+// Create a pool of workers that run tasks with the given function
+struct thread_pool *pool_create(int workers, pool_task_fn run, void *context);
+
+// Queue a task; worker is the calling worker's index, or -1 from outside
+int pool_submit(struct thread_pool *pool, int worker, void *task);
+
+// Get the number of workers
+int pool_size(const struct thread_pool *pool);
+
+// Wait until every task, including those queued by tasks, has run
+void pool_wait(struct thread_pool *pool);
+
+// Stop the workers and free the pool; the pool must be idle
+void pool_destroy(struct thread_pool *pool);
+
+#endif // THREADPOOL_H
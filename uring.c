@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include "config.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Ring shared with the kernel, set up without liburing
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned cq_entries;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;             // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned supported;       // Bit per enum uring_opcode
+};
+
+// Kernel operation for each enum uring_opcode
+static const unsigned char g_kernel_ops[URING_OPCODE_COUNT] = {
+    IORING_OP_OPENAT,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_CLOSE,
+    IORING_OP_UNLINKAT,
+    IORING_OP_MKDIRAT,
+    IORING_OP_STATX,
+};
+
+/**
+ * Ask the kernel which of our operations it supports
+ * 
+ * @param ring Ring to probe
+ */
+static void probe_operations(struct uring *ring) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) {
+        return;
+    }
+    
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        for (int op = 0; op < URING_OPCODE_COUNT; op++) {
+            unsigned kernel_op = g_kernel_ops[op];
+            if (kernel_op <= probe->last_op &&
+                (probe->ops[kernel_op].flags & IO_URING_OP_SUPPORTED)) {
+                ring->supported |= 1u << op;
+            }
+        }
+    }
+    free(probe);
+}
+
+/**
+ * Set up a ring
+ * 
+ * @param entries Submission queue size
+ * @return New ring, or NULL if io_uring is unavailable or disabled
+ */
+struct uring *uring_create(unsigned entries) {
+    struct uring *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1) {
+        free(ring); // ENOSYS, or disabled by sysctl or seccomp
+        return NULL;
+    }
+    ring->sq_entries = params.sq_entries;
+    ring->cq_entries = params.cq_entries;
+    
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map && ring->cq_map_size > ring->sq_map_size) {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+    
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single_map ? ring->sq_map :
+                   mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (!single_map && ring->cq_map != MAP_FAILED) {
+            munmap(ring->cq_map, ring->cq_map_size);
+        }
+        if (ring->sq_map != MAP_FAILED) {
+            munmap(ring->sq_map, ring->sq_map_size);
+        }
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    
+    char *sq = (char *)ring->sq_map;
+    char *cq = (char *)ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    
+    probe_operations(ring);
+    return ring;
+}
+
+/**
+ * Check whether the kernel supports an operation
+ * 
+ * @param ring Ring to check
+ * @param opcode Operation
+ * @return 1 if supported, 0 otherwise
+ */
+int uring_supports(const struct uring *ring, enum uring_opcode opcode) {
+    return (ring->supported >> opcode) & 1;
+}
+
+/**
+ * Fill a submission queue entry for an operation
+ * 
+ * @param sqe Entry to fill
+ * @param op Operation
+ * @param index Index of the operation, returned with its completion
+ */
+static void prepare_entry(struct io_uring_sqe *sqe, const struct uring_op *op, size_t index) {
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = g_kernel_ops[op->opcode];
+    sqe->fd = op->fd;
+    sqe->user_data = index;
+    
+    switch (op->opcode) {
+        case URING_OPENAT:
+            sqe->addr = (unsigned long)op->path;
+            sqe->len = op->mode;
+            sqe->open_flags = op->flags;
+            break;
+        case URING_READ:
+        case URING_WRITE:
+            sqe->addr = (unsigned long)op->buffer;
+            sqe->len = op->len;
+            sqe->off = op->offset;
+            break;
+        case URING_UNLINKAT:
+            sqe->addr = (unsigned long)op->path;
+            sqe->unlink_flags = op->flags;
+            break;
+        case URING_MKDIRAT:
+            sqe->addr = (unsigned long)op->path;
+            sqe->len = op->mode;
+            break;
+        case URING_STATX:
+            sqe->addr = (unsigned long)op->path;
+            sqe->len = op->len;
+            sqe->off = (unsigned long)op->buffer;
+            sqe->statx_flags = op->flags;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Store the results of every completion the kernel has posted
+ * 
+ * @param ring Ring to reap
+ * @param ops Operations of the batch
+ * @param count Number of operations
+ * @return Number of operations completed
+ */
+static size_t reap_completions(struct uring *ring, struct uring_op *ops, size_t count) {
+    size_t completed = 0;
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        if (cqe->user_data < count) {
+            ops[cqe->user_data].result = cqe->res;
+            completed++;
+        }
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return completed;
+}
+
+/**
+ * Run a batch of operations
+ * Operations are independent and complete in any order; callers report
+ * them afterwards in their own order, so output stays deterministic.
+ * If the ring fails, entries the kernel has not taken are withdrawn and
+ * those it has are waited for, so nothing is left running; operations
+ * that never ran keep the result they had.
+ * 
+ * @param ring Ring to use
+ * @param ops Operations; each one's result is set on completion
+ * @param count Number of operations
+ * @return 0 when every operation has completed, -1 if the ring failed
+ */
+int uring_run(struct uring *ring, struct uring_op *ops, size_t count) {
+    size_t submitted = 0;   // Placed in the submission queue
+    size_t completed = 0;
+    unsigned queued = 0;    // Placed but not yet taken by the kernel
+    
+    while (completed < count) {
+        // Keep at most a queue's worth in flight, so completions never overflow
+        unsigned tail = *ring->sq_tail;
+        while (submitted < count && submitted - completed < ring->sq_entries) {
+            unsigned slot = tail & *ring->sq_mask;
+            prepare_entry(&ring->sqes[slot], &ops[submitted], submitted);
+            ring->sq_array[slot] = slot;
+            tail++;
+            submitted++;
+            queued++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        
+        // Interrupted waits just reap what has completed and wait again
+        long entered = syscall(__NR_io_uring_enter, ring->fd, queued, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (entered == -1 && errno != EINTR) {
+            break;
+        }
+        if (entered > 0) {
+            queued -= entered;
+        }
+        completed += reap_completions(ring, ops, count);
+    }
+    if (completed == count) {
+        return 0;
+    }
+    
+    // The kernel only takes entries inside io_uring_enter(), so the
+    // untaken ones can be dropped from the tail
+    int saved_errno = errno;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail - queued, __ATOMIC_RELEASE);
+    submitted -= queued;
+    while (completed < submitted) {
+        long entered = syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (entered == -1 && errno != EINTR) {
+            break;
+        }
+        completed += reap_completions(ring, ops, count);
+    }
+    errno = saved_errno;
+    return -1;
+}
+
+/**
+ * Run a batch of operations one at a time with plain system calls
+ * Used for what a failed ring left undone.
+ * 
+ * @param ops Operations; each one's result is set like the ring's
+ * @param count Number of operations
+ */
+void uring_run_sync(struct uring_op *ops, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        struct uring_op *op = &ops[i];
+        long result;
+        switch (op->opcode) {
+            case URING_OPENAT:
+                result = openat(op->fd, op->path, op->flags, op->mode);
+                break;
+            case URING_READ:
+                result = pread(op->fd, op->buffer, op->len, op->offset);
+                break;
+            case URING_WRITE:
+                result = pwrite(op->fd, op->buffer, op->len, op->offset);
+                break;
+            case URING_CLOSE:
+                result = close(op->fd);
+                break;
+            case URING_UNLINKAT:
+                result = unlinkat(op->fd, op->path, op->flags);
+                break;
+            case URING_MKDIRAT:
+                result = mkdirat(op->fd, op->path, op->mode);
+                break;
+            case URING_STATX:
+                result = statx(op->fd, op->path, op->flags, op->len, (struct statx *)op->buffer);
+                break;
+            default:
+                result = -1;
+                errno = EINVAL;
+                break;
+        }
+        op->result = (result == -1) ? -errno : (int)result;
+    }
+}
+
+/**
+ * Tear down a ring
+ * 
+ * @param ring Ring to destroy, or NULL
+ */
+void uring_destroy(struct uring *ring) {
+    if (!ring) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    free(ring);
+}
+
+/**
+ * Check whether the io_backend setting asks for io_uring
+ * "auto" (the default) and "uring" both try io_uring and fall back to
+ * plain system calls when it is missing; "sync" never uses it.
+ * 
+ * @return 1 to try io_uring, 0 otherwise
+ */
+int uring_enabled(void) {
+    return strcmp(config_get_string("io_backend", "auto"), "sync") != 0;
+}
@@ -0,0 +1,57 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+
+// Submission queue size used for batches of file operations
+#define URING_ENTRIES 256
+
+// Operations a batch can hold
+enum uring_opcode {
+    URING_OPENAT,     // fd = directory, path, flags, mode; result = new fd
+    URING_READ,       // fd, buffer, len, offset; result = bytes read
+    URING_WRITE,      // fd, buffer, len, offset; result = bytes written
+    URING_CLOSE,      // fd
+    URING_UNLINKAT,   // fd = directory, path, flags
+    URING_MKDIRAT,    // fd = directory, path, mode
+    URING_STATX,      // fd = directory, path, flags, len = mask, buffer = struct statx
+    URING_OPCODE_COUNT
+};
+
+// One operation of a batch
+struct uring_op {
+    enum uring_opcode opcode;
+    int fd;
+    const char *path;
+    void *buffer;
+    unsigned len;
+    int flags;
+    unsigned mode;
+    unsigned long long offset;
+    int result;       // Set on completion: >= 0 on success, -errno on failure
+};
+
+// Ring shared with the kernel
+struct uring;
+
+// Set up a ring; NULL if io_uring is unavailable or disabled
+struct uring *uring_create(unsigned entries);
+
+// Check whether the kernel supports an operation
+int uring_supports(const struct uring *ring, enum uring_opcode opcode);
+
+// Run a batch; operations complete in any order, results are stored in each
+// On failure nothing is left in flight, and operations that never ran
+// keep their previous result
+int uring_run(struct uring *ring, struct uring_op *ops, size_t count);
+
+// Run a batch with plain system calls, storing results the same way
+void uring_run_sync(struct uring_op *ops, size_t count);
+
+// Tear down a ring
+void uring_destroy(struct uring *ring);
+
+// Check whether the io_backend setting asks for io_uring
+int uring_enabled(void);
+
+#endif // URING_H
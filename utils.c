@@ -1,15 +1,23 @@
 #define _GNU_SOURCE
 #include "utils.h"
+#include "logging.h"
+#include "stats.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
 
 /**
  * Get the current timestamp as a formatted string
@@ -20,28 +28,50 @@
  * @return Pointer to the buffer on success, NULL on failure
  */
 char *get_timestamp(char *buffer, size_t size) {
-    if (!buffer || size < 22) { // [YYYY-MM-DD HH:MM:SS] requires at least 22 bytes
+    if (!buffer || size < TIMESTAMP_LENGTH + 1) { // [YYYY-MM-DD HH:MM:SS] requires at least 22 bytes
         return NULL;
     }
     
-    time_t now;
-    struct tm *tm_info;
-    
-    // Get current time
-    time(&now);
-    tm_info = localtime(&now);
-    
-    if (!tm_info) {
+    size_t len;
+    const char *timestamp = cached_timestamp(&len);
+    if (!timestamp) {
         return NULL;
     }
     
-    // Format timestamp
-    int len = strftime(buffer, size, "[%Y-%m-%d %H:%M:%S]", tm_info);
-    if (len == 0) {
-        return NULL;
+    memcpy(buffer, timestamp, len + 1);
+    return buffer;
+}
+
+// Per-thread cache of the last formatted second
+static __thread time_t t_timestamp_sec = -1;
+static __thread char t_timestamp[TIMESTAMP_LENGTH + 1];
+
+/**
+ * Get the current timestamp from a per-thread cache
+ * localtime_r() and strftime() only run when the second has changed
+ * since this thread's previous call, so a burst of log entries costs
+ * one time() call each.
+ * 
+ * @param len Set to the length of the timestamp, if not NULL
+ * @return Timestamp valid until the thread's next call, or NULL on failure
+ */
+const char *cached_timestamp(size_t *len) {
+    time_t now = time(NULL);
+    
+    if (now != t_timestamp_sec) {
+        struct tm tm_info;
+        if (!localtime_r(&now, &tm_info) || 
+            strftime(t_timestamp, sizeof(t_timestamp), "[%Y-%m-%d %H:%M:%S]", &tm_info) == 0) {
+            t_timestamp_sec = -1;
+            return NULL;
+        }
+        t_timestamp_sec = now;
     }
     
-    return buffer;
+    if (len) {
+        *len = TIMESTAMP_LENGTH;
+    }
+    return t_timestamp;
 }
 
 /**
@@ -61,6 +91,35 @@ int file_exists(const char *filename) {
     return 0;
 }
 
+/**
+ * Open a file, failing unless it is a regular file
+ * Folds the file_exists() check into the open, so the file that was
+ * checked is the one that is used. O_NONBLOCK keeps a FIFO from blocking
+ * the open; it makes no difference to a regular file.
+ * 
+ * @param dir_fd Directory holding the file, or AT_FDCWD
+ * @param name Name of the file within the directory
+ * @param flags Open flags
+ * @return File descriptor, or -1 with errno set (ENOENT if not a regular file)
+ */
+int open_regular_at(int dir_fd, const char *name, int flags) {
+    int fd = openat(dir_fd, name, flags | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == EISDIR) {
+            errno = ENOENT; // Opened for writing
+        }
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+    return fd;
+}
+
 /**
  * Check if a directory exists
  * 
@@ -80,7 +139,7 @@ int directory_exists(const char *dirname) {
 
 /**
  * Custom string formatting function to avoid standard input&output dependency
- * Only supports a limited set of format specifiers: %s, %d
+ * Only supports a limited set of format specifiers: %s, %d, %ld
  * 
  * @param buffer Output buffer
  * @param size Buffer size
@@ -115,20 +174,33 @@ int string_format(char *buffer, size_t size, const char *format, ...) {
                     }
                     break;
                 }
-                case 'd': {
-                    // Integer
-                    i++;  // Skip the 'd'
-                    int value = va_arg(args, int);
+                case 'd':
+                case 'l': {
+                    // Integer (%d) or long integer (%ld)
+                    long value;
+                    if (format[i + 1] == 'l') {
+                        if (format[i + 2] != 'd') {
+                            // Not %ld, just copy it
+                            buffer[buffer_pos++] = format[i];
+                            break;
+                        }
+                        i += 2;  // Skip the 'ld'
+                        value = va_arg(args, long);
+                    } else {
+                        i++;  // Skip the 'd'
+                        value = va_arg(args, int);
+                    }
                     
                     // Handle negative numbers
+                    unsigned long magnitude = (unsigned long)value;
                     if (value < 0) {
                         buffer[buffer_pos++] = '-';
                         if (buffer_pos >= size - 1) break;
-                        value = -value;
+                        magnitude = 0UL - magnitude;
                     }
                     
                     // Special case for zero
-                    if (value == 0) {
+                    if (magnitude == 0) {
                         buffer[buffer_pos++] = '0';
                         break;
                     }
@@ -137,9 +209,9 @@ int string_format(char *buffer, size_t size, const char *format, ...) {
                     char temp[20]; // Enough for 64-bit integers
                     int temp_pos = 0;
                     
-                    while (value > 0 && temp_pos < 20) {
-                        temp[temp_pos++] = '0' + (value % 10);
-                        value /= 10;
+                    while (magnitude > 0 && temp_pos < 20) {
+                        temp[temp_pos++] = '0' + (magnitude % 10);
+                        magnitude /= 10;
                     }
                     
                     // Reverse digits into buffer
@@ -174,40 +246,292 @@ int string_format(char *buffer, size_t size, const char *format, ...) {
 }
 
 /**
- * Safely write a message to standard output
+ * Parse a non-negative decimal number
  * 
- * @param message Message to write
+ * @param text Text to parse
+ * @param value Set to the parsed value on success
+ * @return 0 on success, -1 if the text is not a valid number
  */
-void write_message(const char *message) {
-    if (!message) {
-        return;
+int parse_number(const char *text, long *value) {
+    if (!text || !value || *text == '\0') {
+        return -1;
     }
     
-    // Get message length
-    size_t len = strlen(message);
-    
-    // Write message to stdout
-    ssize_t bytes_written = 0;
-    size_t total_written = 0;
-    
-    while (total_written < len) {
-        bytes_written = write(STDOUT_FILENO, 
-                             message + total_written, 
-                             len - total_written);
+    long result = 0;
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return -1;
+        }
+        int digit = text[i] - '0';
         
+        // Reject values that don't fit in a long
+        if (result > (LONG_MAX - digit) / 10) {
+            return -1;
+        }
+        result = result * 10 + digit;
+    }
+    
+    *value = result;
+    return 0;
+}
+
+// Standard output waiting to be written; g_out_lock guards it
+static char g_out_buffer[OUT_BUFFER_SIZE];
+static size_t g_out_len = 0;
+static char g_out_lock = 0;
+
+// Where output goes; a server points these at the client of a request
+static int g_out_fd = STDOUT_FILENO;
+static int g_err_fd = STDERR_FILENO;
+
+// Where commands read standard input from, or -1 when a request passed none
+static int g_in_fd = STDIN_FILENO;
+
+// Capture taking this thread's output instead, or NULL
+static __thread struct out_capture *t_capture = NULL;
+
+/**
+ * Write all of a buffer to a descriptor
+ * Retries partial writes and writes interrupted by signals.
+ * 
+ * @param fd Descriptor to write to
+ * @param data Data to write
+ * @param len Number of bytes
+ * @return 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t bytes_written = write(fd, data, len);
         if (bytes_written == -1) {
-            // Error occurred
             if (errno == EINTR) {
                 // Interrupted by signal, try again
                 continue;
-            } else {
-                // Other error, abort
-                break;
             }
+            return -1;
         }
-        
-        total_written += bytes_written;
+        data += bytes_written;
+        len -= bytes_written;
+    }
+    return 0;
+}
+
+/**
+ * Add output to a capture as a segment: stream byte, length, data
+ * 
+ * @param capture Capture to add to
+ * @param stream 1 for standard output, 2 for standard error
+ * @param data Output
+ * @param len Number of bytes
+ * @return 0 on success, -1 if memory allocation failed
+ */
+static int capture_append(struct out_capture *capture, char stream, 
+                          const char *data, size_t len) {
+    size_t needed = capture->len + 1 + sizeof(size_t) + len;
+    if (needed > capture->capacity) {
+        size_t capacity = capture->capacity ? capture->capacity : 256;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char *grown = realloc(capture->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        capture->data = grown;
+        capture->capacity = capacity;
+    }
+    
+    capture->data[capture->len] = stream;
+    memcpy(capture->data + capture->len + 1, &len, sizeof(size_t));
+    memcpy(capture->data + capture->len + 1 + sizeof(size_t), data, len);
+    capture->len = needed;
+    return 0;
+}
+
+/**
+ * Take the output lock
+ * A spin lock rather than a mutex: it is only ever held to copy or write
+ * one buffer.
+ */
+static void out_lock(void) {
+    while (__atomic_test_and_set(&g_out_lock, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+/**
+ * Release the output lock
+ */
+static void out_unlock(void) {
+    __atomic_clear(&g_out_lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * Write the buffered output; the output lock must be held
+ * 
+ * @return 0 on success, -1 on failure
+ */
+static int out_flush_locked(void) {
+    int result = write_all(g_out_fd, g_out_buffer, g_out_len);
+    g_out_len = 0;
+    return result;
+}
+
+/**
+ * Write to standard output through the shared buffer
+ * The buffer is written once it fills up, so a listing of many entries
+ * takes one system call per OUT_BUFFER_SIZE bytes instead of one per line.
+ * Safe to call from several threads.
+ * 
+ * @param data Data to write
+ * @param len Number of bytes
+ * @return 0 on success, -1 if writing failed
+ */
+int out_write(const char *data, size_t len) {
+    if (t_capture) {
+        return capture_append(t_capture, 1, data, len);
+    }
+    
+    int result = 0;
+    
+    out_lock();
+    if (g_out_len + len > sizeof(g_out_buffer)) {
+        result = out_flush_locked();
+    }
+    if (len >= sizeof(g_out_buffer)) {
+        // Too large to be worth copying
+        if (write_all(g_out_fd, data, len) == -1) {
+            result = -1;
+        }
+    } else {
+        memcpy(g_out_buffer + g_out_len, data, len);
+        g_out_len += len;
+    }
+    out_unlock();
+    
+    return result;
+}
+
+/**
+ * Write the buffered standard output
+ * Must be called before anything writes to standard output directly.
+ * 
+ * @return 0 on success, -1 if writing failed
+ */
+int out_flush(void) {
+    out_lock();
+    int result = out_flush_locked();
+    out_unlock();
+    return result;
+}
+
+/**
+ * Write to standard error, unbuffered
+ * Pending standard output is written first so messages stay in order.
+ * 
+ * @param data Data to write
+ * @param len Number of bytes
+ * @return 0 on success, -1 if writing failed
+ */
+int err_write(const char *data, size_t len) {
+    if (t_capture) {
+        return capture_append(t_capture, 2, data, len);
+    }
+    out_flush();
+    return write_all(g_err_fd, data, len);
+}
+
+/**
+ * Start capturing the calling thread's output
+ * Lets commands run on worker threads while their output still comes
+ * out in order: each is captured, then replayed by one thread.
+ * 
+ * @param capture Empty capture to fill, or NULL to stop capturing
+ */
+void out_capture(struct out_capture *capture) {
+    t_capture = capture;
+}
+
+/**
+ * Write captured output and free the capture
+ * 
+ * @param capture Capture to replay
+ */
+void out_replay(struct out_capture *capture) {
+    for (size_t pos = 0; pos < capture->len; ) {
+        char stream = capture->data[pos];
+        size_t len;
+        memcpy(&len, capture->data + pos + 1, sizeof(size_t));
+        const char *data = capture->data + pos + 1 + sizeof(size_t);
+        if (stream == 1) {
+            out_write(data, len);
+        } else {
+            err_write(data, len);
+        }
+        pos += 1 + sizeof(size_t) + len;
+    }
+    
+    free(capture->data);
+    capture->data = NULL;
+    capture->len = 0;
+    capture->capacity = 0;
+}
+
+/**
+ * Get the descriptor standard output is written to
+ * For callers that stream to it directly, after out_flush().
+ * 
+ * @return Output descriptor
+ */
+int out_descriptor(void) {
+    return g_out_fd;
+}
+
+/**
+ * Send standard output and standard error somewhere else
+ * Pending output is written to the old destination first.
+ * 
+ * @param out_fd Descriptor for standard output
+ * @param err_fd Descriptor for standard error
+ */
+void out_redirect(int out_fd, int err_fd) {
+    out_lock();
+    out_flush_locked();
+    g_out_fd = out_fd;
+    g_err_fd = err_fd;
+    out_unlock();
+}
+
+/**
+ * Get the descriptor standard input is read from
+ * Commands that read their input, like -0 path lists, use this instead
+ * of STDIN_FILENO so a server reads its client's input, not its own.
+ * 
+ * @return Input descriptor, or -1 if there is no input
+ */
+int in_descriptor(void) {
+    return g_in_fd;
+}
+
+/**
+ * Read standard input from another descriptor
+ * 
+ * @param in_fd Descriptor for standard input, or -1 for none
+ */
+void in_redirect(int in_fd) {
+    g_in_fd = in_fd;
+}
+
+/**
+ * Safely write a message to standard output
+ * 
+ * @param message Message to write
+ */
+void write_message(const char *message) {
+    if (!message) {
+        return;
     }
+    
+    out_write(message, strlen(message));
 }
 
 /**
@@ -220,29 +544,134 @@ void write_error(const char *message) {
         return;
     }
     
-    // Get message length
-    size_t len = strlen(message);
+    err_write(message, strlen(message));
+}
+
+// Signal that asked the process to exit, and the eventfd that announces it
+static volatile sig_atomic_t g_exit_signal = 0;
+static int g_exit_fd = -1;
+
+/**
+ * Set up exit requests
+ * A signal handler only records the request; the command loops notice
+ * it where they wait and return, so the log is drained and closed on the
+ * normal exit path.
+ * 
+ * @return 0 on success, -1 if the eventfd could not be created
+ */
+int exit_request_init(void) {
+    if (g_exit_fd == -1) {
+        g_exit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+    return (g_exit_fd == -1) ? -1 : 0;
+}
+
+/**
+ * Ask the process to exit once the running command is done
+ * Only async-signal-safe calls are made.
+ * 
+ * @param signum Signal that asked for the exit
+ */
+void exit_request(int signum) {
+    int saved_errno = errno;
+    g_exit_signal = signum;
+    if (g_exit_fd != -1) {
+        uint64_t one = 1;
+        write(g_exit_fd, &one, sizeof(one));
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Get the signal number of a pending exit request
+ * 
+ * @return Signal number, or 0 if no exit was requested
+ */
+int exit_requested(void) {
+    return g_exit_signal;
+}
+
+/**
+ * Get the descriptor that becomes readable on an exit request
+ * It stays readable, so every loop waiting on it sees the request.
+ * 
+ * @return eventfd descriptor, or -1 if exit requests are not set up
+ */
+int exit_request_fd(void) {
+    return g_exit_fd;
+}
+
+// Operations run in-process unless isolation is requested
+static int g_process_isolation = 0;
+
+/**
+ * Enable or disable running operations in an isolated child process
+ * 
+ * @param enabled Non-zero to fork a child for each operation
+ */
+void set_process_isolation(int enabled) {
+    g_process_isolation = enabled ? 1 : 0;
+}
+
+/**
+ * Check whether operations run in an isolated child process
+ * 
+ * @return 1 if isolation is enabled, 0 otherwise
+ */
+int process_isolation_enabled(void) {
+    return g_process_isolation;
+}
+
+/**
+ * Run an operation in-process, or in a child process when isolation is enabled
+ * The operation reports its own errors and returns 0 on success, -1 on failure.
+ * 
+ * @param operation Operation to run
+ * @param arg Argument passed to the operation
+ * @return Result of the operation, RUN_FORK_FAILED or RUN_ABNORMAL
+ */
+int run_operation(int (*operation)(void *), void *arg) {
+    if (!g_process_isolation) {
+        return operation(arg);
+    }
     
-    // Write message to stderr
-    ssize_t bytes_written = 0;
-    size_t total_written = 0;
+    // Pending output and log entries must not be inherited and written twice
+    out_flush();
+    flush_logs();
     
-    while (total_written < len) {
-        bytes_written = write(STDERR_FILENO, 
-                             message + total_written, 
-                             len - total_written);
-        
-        if (bytes_written == -1) {
-            // Error occurred
-            if (errno == EINTR) {
-                // Interrupted by signal, try again
-                continue;
-            } else {
-                // Other error, abort
-                break;
-            }
+    // Fork a child process to perform the operation
+    long long wait_start = stats_now();
+    pid_t pid = fork();
+    
+    if (pid == -1) {
+        stats_wait(STATS_FORK_WAIT, wait_start);
+        return RUN_FORK_FAILED;
+    }
+    else if (pid == 0) {
+        // Child process; its exit requests are its own
+        g_exit_fd = -1;
+        int result = operation(arg);
+        out_flush();
+        shutdown_logging();
+        _exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    // Parent process; the child's kernel time counts towards the command
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) == -1) {
+        if (errno != EINTR) {
+            stats_wait(STATS_FORK_WAIT, wait_start);
+            return RUN_ABNORMAL;
         }
-        
-        total_written += bytes_written;
     }
+    stats_wait(STATS_FORK_WAIT, wait_start);
+    stats_child_time((long long)usage.ru_stime.tv_sec * 1000000000LL + 
+                     usage.ru_stime.tv_usec * 1000LL);
+    
+    if (!WIFEXITED(status)) {
+        return RUN_ABNORMAL;
+    }
+    
+    return (WEXITSTATUS(status) == EXIT_SUCCESS) ? 0 : -1;
 }
\ No newline at end of file
@@ -4,24 +4,101 @@
 #include <stddef.h>
 #include <stdarg.h>
 
+// Length of a formatted timestamp, not counting the terminator
+#define TIMESTAMP_LENGTH 21
+
 // Get the current timestamp as a formatted string
 // Format: [YYYY-MM-DD HH:MM:SS]
 char *get_timestamp(char *buffer, size_t size);
 
+// Get the current timestamp from a per-thread cache, reformatted only
+// when the second changes; valid until the thread's next call
+const char *cached_timestamp(size_t *len);
+
 // Check if a file exists
 int file_exists(const char *filename);
 
 // Check if a directory exists
 int directory_exists(const char *dirname);
 
+// Open a regular file; anything else fails with ENOENT, as for file_exists()
+int open_regular_at(int dir_fd, const char *name, int flags);
+
 // Custom string formatting function to avoid standard input&output dependency
-// Only supports a limited set of format specifiers: %s, %d
+// Only supports a limited set of format specifiers: %s, %d, %ld
 int string_format(char *buffer, size_t size, const char *format, ...);
 
+// Parse a non-negative decimal number
+int parse_number(const char *text, long *value);
+
+// Size of the standard output buffer
+#define OUT_BUFFER_SIZE 65536
+
+// Write to standard output through a shared buffer
+int out_write(const char *data, size_t len);
+
+// Write the buffered standard output
+int out_flush(void);
+
+// Write to standard error after flushing standard output
+int err_write(const char *data, size_t len);
+
+// Output of one command held back so it can be written later, in order
+struct out_capture {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+// Send the calling thread's output to a capture; NULL stops capturing
+void out_capture(struct out_capture *capture);
+
+// Write captured output and free the capture
+void out_replay(struct out_capture *capture);
+
+// Get the descriptor standard output is written to
+int out_descriptor(void);
+
+// Send standard output and standard error to other descriptors
+void out_redirect(int out_fd, int err_fd);
+
+// Get the descriptor standard input is read from, or -1 if there is none
+int in_descriptor(void);
+
+// Read standard input from another descriptor, or -1 for none
+void in_redirect(int in_fd);
+
 // Safely write a message to standard output
 void write_message(const char *message);
 
 // Safely write an error message to standard error
 void write_error(const char *message);
 
+// Set up exit requests; call once before installing the signal handlers
+int exit_request_init(void);
+
+// Ask the process to exit once the running command is done; safe to call
+// from a signal handler
+void exit_request(int signum);
+
+// Get the signal number of a pending exit request, or 0 if there is none
+int exit_requested(void);
+
+// Get a descriptor that becomes readable on an exit request, or -1, for
+// loops that wait in poll() or epoll_wait()
+int exit_request_fd(void);
+
+// run_operation() results besides the operation's own 0 / -1
+#define RUN_FORK_FAILED -2   // fork() failed, errno is preserved
+#define RUN_ABNORMAL    -3   // isolated child did not exit normally
+
+// Enable or disable running operations in an isolated child process
+void set_process_isolation(int enabled);
+
+// Check whether operations run in an isolated child process
+int process_isolation_enabled(void);
+
+// Run an operation in-process, or in a child process when isolation is enabled
+int run_operation(int (*operation)(void *), void *arg);
+
 #endif // UTILS_H
\ No newline at end of file
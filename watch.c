@@ -0,0 +1,553 @@
+#define _GNU_SOURCE
+#include "watch.h"
+#include "dirindex.h"
+#include "dirscan.h"
+#include "logging.h"
+#include "config.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Events that change what the index holds for a directory
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | \
+                    IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+// State of a running watch
+struct watcher {
+    const char *root;
+    size_t root_len;
+    int inotify_fd;
+    char **paths;           // Path relative to the root, by watch descriptor
+    size_t path_capacity;
+    char **dirty;           // Open-addressed set of directories to read again
+    size_t dirty_capacity;  // Power of two
+    size_t dirty_count;
+    int full;               // Read every directory at the next flush
+    int root_gone;
+};
+
+// Subdirectory names collected while scanning a directory
+struct subdirs {
+    int fd;
+    char *names;            // NUL-separated
+    size_t len;
+    size_t capacity;
+};
+
+/**
+ * Hash a path for the dirty set (FNV-1a)
+ * 
+ * @param path Path to hash
+ * @param len Length of the path
+ * @return Hash value
+ */
+static uint64_t hash_path(const char *path, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)path[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Find the slot of a path in the dirty set
+ * 
+ * @param w Watch state
+ * @param path Path to find
+ * @param len Length of the path
+ * @return Slot holding the path, or the empty slot where it belongs
+ */
+static size_t dirty_slot(const struct watcher *w, const char *path, size_t len) {
+    size_t mask = w->dirty_capacity - 1;
+    size_t slot = hash_path(path, len) & mask;
+    while (w->dirty[slot] &&
+           (strncmp(w->dirty[slot], path, len) != 0 || w->dirty[slot][len] != '\0')) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * Add a directory to the set read again at the next flush
+ * If memory runs out, the next flush reads everything instead.
+ * 
+ * @param w Watch state
+ * @param path Path relative to the root
+ * @param len Length of the path
+ */
+static void mark_dirty(struct watcher *w, const char *path, size_t len) {
+    if ((w->dirty_count + 1) * 2 > w->dirty_capacity) {
+        size_t capacity = w->dirty_capacity ? w->dirty_capacity * 2 : 256;
+        char **old = w->dirty;
+        size_t old_capacity = w->dirty_capacity;
+        
+        w->dirty = calloc(capacity, sizeof(*w->dirty));
+        if (!w->dirty) {
+            w->dirty = old;
+            w->full = 1;
+            return;
+        }
+        w->dirty_capacity = capacity;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i]) {
+                w->dirty[dirty_slot(w, old[i], strlen(old[i]))] = old[i];
+            }
+        }
+        free(old);
+    }
+    
+    size_t slot = dirty_slot(w, path, len);
+    if (!w->dirty[slot]) {
+        w->dirty[slot] = strndup(path, len);
+        if (!w->dirty[slot]) {
+            w->full = 1;
+            return;
+        }
+        w->dirty_count++;
+    }
+}
+
+/**
+ * Tell the index refresh which directories changed
+ * 
+ * @param path Path relative to the root
+ * @param context Watch state
+ * @return 1 if the directory must be read again, 0 if its entries are current
+ */
+static int is_dirty(const char *path, void *context) {
+    const struct watcher *w = (const struct watcher *)context;
+    return w->full || (w->dirty_count > 0 && w->dirty[dirty_slot(w, path, strlen(path))] != NULL);
+}
+
+/**
+ * Empty the dirty set after a flush
+ * 
+ * @param w Watch state
+ */
+static void clear_dirty(struct watcher *w) {
+    for (size_t i = 0; i < w->dirty_capacity; i++) {
+        free(w->dirty[i]);
+        w->dirty[i] = NULL;
+    }
+    w->dirty_count = 0;
+    w->full = 0;
+}
+
+/**
+ * Collect the subdirectories of a batch of entries
+ * 
+ * @param entries Entries read from the directory
+ * @param count Number of entries
+ * @param context Pointer to struct subdirs
+ * @return 0 to keep scanning, -1 if memory allocation failed
+ */
+static int subdir_batch(const struct dir_entry *entries, size_t count, void *context) {
+    struct subdirs *subdirs = (struct subdirs *)context;
+    
+    for (size_t i = 0; i < count; i++) {
+        const struct dir_entry *entry = &entries[i];
+        int is_dir = (entry->type == DT_DIR);
+        if (entry->type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(subdirs->fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                     S_ISDIR(st.st_mode);
+        }
+        if (!is_dir) {
+            continue;
+        }
+        
+        if (subdirs->len + entry->name_len + 1 > subdirs->capacity) {
+            size_t capacity = subdirs->capacity ? subdirs->capacity * 2 : 4096;
+            while (capacity < subdirs->len + entry->name_len + 1) {
+                capacity *= 2;
+            }
+            char *names = realloc(subdirs->names, capacity);
+            if (!names) {
+                return -1;
+            }
+            subdirs->names = names;
+            subdirs->capacity = capacity;
+        }
+        memcpy(subdirs->names + subdirs->len, entry->name, entry->name_len + 1);
+        subdirs->len += entry->name_len + 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Watch a directory and every directory below it
+ * Each directory is marked dirty once its watch is in place, so entries
+ * created before the watch existed are picked up by the next flush.
+ * 
+ * @param w Watch state
+ * @param path Path relative to the root, "" for the root
+ * @return 0 on success, -1 if the watches could not be added
+ */
+static int add_watches(struct watcher *w, const char *path) {
+    size_t path_len = strlen(path);
+    char *full_path = malloc(w->root_len + path_len + 2);
+    if (!full_path) {
+        return -1;
+    }
+    memcpy(full_path, w->root, w->root_len);
+    full_path[w->root_len] = '/';
+    memcpy(full_path + w->root_len + 1, path, path_len + 1);
+    
+    int wd = inotify_add_watch(w->inotify_fd, full_path, WATCH_MASK);
+    if (wd == -1) {
+        int add_errno = errno;
+        free(full_path);
+        if (add_errno == ENOENT || add_errno == ENOTDIR || add_errno == EACCES) {
+            return 0; // Gone again, or not ours to watch
+        }
+        
+        char error_msg[512];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not watch directory \"%s/%s\": %s\n", 
+                          w->root, path, strerror(add_errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    if ((size_t)wd >= w->path_capacity) {
+        size_t capacity = w->path_capacity ? w->path_capacity * 2 : 1024;
+        while (capacity <= (size_t)wd) {
+            capacity *= 2;
+        }
+        char **paths = realloc(w->paths, capacity * sizeof(*paths));
+        if (!paths) {
+            free(full_path);
+            return -1;
+        }
+        memset(paths + w->path_capacity, 0, (capacity - w->path_capacity) * sizeof(*paths));
+        w->paths = paths;
+        w->path_capacity = capacity;
+    }
+    free(w->paths[wd]);
+    w->paths[wd] = strdup(path);
+    if (!w->paths[wd]) {
+        free(full_path);
+        return -1;
+    }
+    mark_dirty(w, path, path_len);
+    
+    struct subdirs subdirs = { -1, NULL, 0, 0 };
+    subdirs.fd = open(full_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    free(full_path);
+    if (subdirs.fd == -1) {
+        return 0;
+    }
+    int result = dir_scan(subdirs.fd, subdir_batch, &subdirs);
+    close(subdirs.fd);
+    
+    for (size_t pos = 0; pos < subdirs.len && result == 0; ) {
+        const char *name = subdirs.names + pos;
+        size_t name_len = strlen(name);
+        pos += name_len + 1;
+        
+        char *child = malloc(path_len + name_len + 2);
+        if (!child) {
+            result = -1;
+            break;
+        }
+        if (path_len > 0) {
+            memcpy(child, path, path_len);
+            child[path_len] = '/';
+            memcpy(child + path_len + 1, name, name_len + 1);
+        } else {
+            memcpy(child, name, name_len + 1);
+        }
+        result = add_watches(w, child);
+        free(child);
+    }
+    
+    free(subdirs.names);
+    return result;
+}
+
+/**
+ * Stop watching a directory that left the tree, and everything below it
+ * 
+ * @param w Watch state
+ * @param path Path relative to the root
+ */
+static void remove_watches(struct watcher *w, const char *path) {
+    size_t len = strlen(path);
+    for (size_t wd = 0; wd < w->path_capacity; wd++) {
+        const char *watched = w->paths[wd];
+        if (watched && strncmp(watched, path, len) == 0 &&
+            (watched[len] == '\0' || watched[len] == '/')) {
+            inotify_rm_watch(w->inotify_fd, (int)wd);
+            free(w->paths[wd]);
+            w->paths[wd] = NULL;
+        }
+    }
+}
+
+/**
+ * Drop every watch and start over from the root
+ * Used when the kernel's event queue overflowed and changes were lost.
+ * 
+ * @param w Watch state
+ * @return 0 on success, -1 on failure
+ */
+static int restart_watches(struct watcher *w) {
+    if (w->inotify_fd != -1) {
+        close(w->inotify_fd);
+    }
+    for (size_t wd = 0; wd < w->path_capacity; wd++) {
+        free(w->paths[wd]);
+        w->paths[wd] = NULL;
+    }
+    
+    w->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->inotify_fd == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not start watching: %s\n", strerror(errno));
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    w->full = 1;
+    return add_watches(w, "");
+}
+
+/**
+ * Apply one event to the watch state
+ * 
+ * @param w Watch state
+ * @param event Event read from the kernel
+ * @return 0 on success, -1 if new directories could not be watched
+ */
+static int handle_event(struct watcher *w, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        return restart_watches(w);
+    }
+    if (event->wd < 0 || (size_t)event->wd >= w->path_capacity || !w->paths[event->wd]) {
+        return 0; // Watch already removed
+    }
+    
+    const char *path = w->paths[event->wd];
+    size_t path_len = strlen(path);
+    
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        if (path_len == 0) {
+            w->root_gone = 1;
+        }
+        if (event->mask & IN_IGNORED) {
+            free(w->paths[event->wd]);
+            w->paths[event->wd] = NULL;
+        }
+        return 0;
+    }
+    
+    const char *name = (event->len > 0) ? event->name : NULL;
+    if (name && path_len == 0 && dir_index_own_file(name)) {
+        return 0; // Written by our own flushes
+    }
+    mark_dirty(w, path, path_len);
+    
+    if (!name || !(event->mask & IN_ISDIR) ||
+        !(event->mask & (IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE))) {
+        return 0;
+    }
+    
+    // A moved directory is watched afresh under its new path
+    size_t name_len = strlen(name);
+    char *child = malloc(path_len + name_len + 2);
+    if (!child) {
+        w->full = 1;
+        return 0;
+    }
+    if (path_len > 0) {
+        memcpy(child, path, path_len);
+        child[path_len] = '/';
+        memcpy(child + path_len + 1, name, name_len + 1);
+    } else {
+        memcpy(child, name, name_len + 1);
+    }
+    
+    int result = 0;
+    if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+        remove_watches(w, child);
+    } else {
+        result = add_watches(w, child);
+    }
+    free(child);
+    return result;
+}
+
+/**
+ * Write the changes collected so far to the index
+ * 
+ * @param w Watch state
+ */
+static void flush_changes(struct watcher *w) {
+    if (dir_index_refresh(w->root, is_dirty, w) == -1) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not update index for \"%s\": %s\n", 
+                          w->root, strerror(errno));
+        err_write(error_msg, len);
+    }
+    clear_dirty(w);
+}
+
+/**
+ * Get the monotonic clock in milliseconds
+ * 
+ * @return Milliseconds since an arbitrary point
+ */
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Keep the index of a directory tree current until SIGINT or SIGTERM
+ * Every directory is watched with inotify. Events only mark directories
+ * dirty; once changes have been collected for watch_delay milliseconds
+ * the index is rewritten, reading just the dirty directories. While
+ * this runs, --indexed listings of the tree skip their own refresh.
+ * fanotify would need CAP_SYS_ADMIN, so it is not used.
+ * 
+ * @param dirname Root of the tree to watch
+ * @return 0 once stopped by a signal, -1 on failure
+ */
+int watch_directory(const char *dirname) {
+    // Check if directory exists
+    if (!directory_exists(dirname)) {
+        char error_msg[256];
+        int len = string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" not found.\n", dirname);
+        err_write(error_msg, len);
+        return -1;
+    }
+    
+    // Hold the watch lock for as long as the process lives
+    char lock_path[4096];
+    string_format(lock_path, sizeof(lock_path), "%s/%s", dirname, DIR_INDEX_WATCH_FILE);
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd == -1 || flock(lock_fd, LOCK_EX | LOCK_NB) == -1) {
+        char error_msg[256];
+        int len = (lock_fd != -1 && errno == EWOULDBLOCK) ?
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: Directory \"%s\" is already being watched.\n", dirname) :
+                  string_format(error_msg, sizeof(error_msg), 
+                          "Error: Could not lock \"%s\": %s\n", lock_path, strerror(errno));
+        err_write(error_msg, len);
+        if (lock_fd != -1) {
+            close(lock_fd);
+        }
+        return -1;
+    }
+    
+    struct watcher w;
+    memset(&w, 0, sizeof(w));
+    w.root = dirname;
+    w.root_len = strlen(dirname);
+    w.inotify_fd = -1;
+    
+    if (restart_watches(&w) == -1) {
+        close(lock_fd);
+        return -1;
+    }
+    flush_changes(&w);
+    
+    long delay = config_get_number("watch_delay", WATCH_DEFAULT_DELAY);
+    
+    char start_msg[256];
+    int len = string_format(start_msg, sizeof(start_msg), 
+                      "Watching directory \"%s\"; press Ctrl-C to stop.\n", dirname);
+    out_write(start_msg, len);
+    out_flush();
+    
+    char log_msg[256];
+    string_format(log_msg, sizeof(log_msg), "Started watching directory \"%s\".", dirname);
+    log_operation(log_msg);
+    flush_logs();
+    
+    union {
+        struct inotify_event event;
+        char bytes[65536];
+    } buffer;
+    long deadline = 0;
+    int result = 0;
+    
+    while (result == 0 && !w.root_gone && !exit_requested()) {
+        int pending = w.full || w.dirty_count > 0;
+        int timeout = -1;
+        if (pending) {
+            long remaining = deadline - now_ms();
+            timeout = (remaining > 0) ? (int)remaining : 0;
+        }
+        
+        struct pollfd pfds[2] = { { w.inotify_fd, POLLIN, 0 }, { exit_request_fd(), POLLIN, 0 } };
+        int ready = poll(pfds, 2, timeout);
+        if (ready == -1 && errno != EINTR) {
+            result = -1;
+            break;
+        }
+        
+        if (ready > 0 && pfds[0].revents != 0) {
+            ssize_t filled;
+            while (result == 0 && (filled = read(w.inotify_fd, buffer.bytes, sizeof(buffer))) > 0) {
+                for (ssize_t pos = 0; pos < filled && result == 0; ) {
+                    const struct inotify_event *event =
+                        (const struct inotify_event *)(buffer.bytes + pos);
+                    pos += sizeof(*event) + event->len;
+                    result = handle_event(&w, event);
+                }
+            }
+            
+            // Changes are collected for a while from the first one on
+            if (!pending && (w.full || w.dirty_count > 0)) {
+                deadline = now_ms() + delay;
+            }
+        }
+        
+        // A steady stream of events still gets flushed every delay
+        if ((w.full || w.dirty_count > 0) && now_ms() >= deadline) {
+            flush_changes(&w);
+        }
+    }
+    
+    if (w.root_gone) {
+        char error_msg[256];
+        len = string_format(error_msg, sizeof(error_msg), 
+                      "Error: Watched directory \"%s\" was removed.\n", dirname);
+        err_write(error_msg, len);
+    } else if (result == 0) {
+        // Stopped by a signal: the changes collected so far still go in
+        if (w.full || w.dirty_count > 0) {
+            flush_changes(&w);
+        }
+        string_format(log_msg, sizeof(log_msg), "Stopped watching directory \"%s\".", dirname);
+        log_operation(log_msg);
+    }
+    
+    clear_dirty(&w);
+    free(w.dirty);
+    for (size_t wd = 0; wd < w.path_capacity; wd++) {
+        free(w.paths[wd]);
+    }
+    free(w.paths);
+    close(w.inotify_fd);
+    close(lock_fd);
+    return (result == 0 && !w.root_gone) ? 0 : -1;
+}
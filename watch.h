@@ -0,0 +1,10 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// Milliseconds to collect changes before the index is rewritten
+#define WATCH_DEFAULT_DELAY 100
+
+// Keep the index of a directory tree current until interrupted
+int watch_directory(const char *dirname);
+
+#endif // WATCH_H